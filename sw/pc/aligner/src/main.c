@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L /* getopt() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "m_utils.h"
+#include "m_align.h"
+
+
+/*
+  Print IMU, pressure and GPS data of a session on one timeline, as
+  CSV.
+
+  m_aligner [-p <period ms>] [-m <channel>=<hold|linear|nearest>] [-t <ts_shift>] [-d <YYYY_MM_DD>] [<session dir>]
+
+  -m may be given many times; <channel> is a channel ("acc_x"), a
+  source ("imu") or a channel of a source ("nmea.speed").
+
+  Logs of session recorded with rotation (mularsky -I/-S) have to be
+  joined with m_joiner first.
+*/
+
+
+#define USAGE "usage: %s [-p <period ms>] [-m <channel>=<hold|linear|nearest>] [-t <ts_shift>] [-d <YYYY_MM_DD>] [<session dir>]\n"
+#define MODES_MAX 32
+
+
+
+
+static int m_aligner_parse_mode(const char * str, enum m_align_mode * mode)
+{
+	if (0 == strcmp(str, "hold")) {
+		*mode = M_ALIGN_HOLD;
+	} else if (0 == strcmp(str, "linear")) {
+		*mode = M_ALIGN_LINEAR;
+	} else if (0 == strcmp(str, "nearest")) {
+		*mode = M_ALIGN_NEAREST;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	long period_ms = 10;
+	int ts_shift = 0;
+	const char * day_arg = NULL;
+	char * modes[MODES_MAX];
+	int n_modes = 0;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "p:m:t:d:"))) {
+		switch (opt) {
+		case 'p':
+			period_ms = atol(optarg);
+			break;
+		case 'm':
+			if (n_modes == MODES_MAX) {
+				fprintf(stderr, "[EE] too many -m options\n");
+				return -1;
+			}
+			modes[n_modes++] = optarg;
+			break;
+		case 't':
+			ts_shift = atoi(optarg);
+			break;
+		case 'd':
+			day_arg = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return -1;
+		}
+	}
+	if (argc - optind > 1 || period_ms <= 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return -1;
+	}
+	const char * dir = optind < argc ? argv[optind] : ".";
+
+
+	char day[sizeof ("YYYY_MM_DD")];
+	if (day_arg) {
+		snprintf(day, sizeof (day), "%s", day_arg);
+	} else if (0 != m_get_session_day(dir, day, sizeof (day))) {
+		fprintf(stderr, "[EE] can't get day of session, use -d\n");
+		return -1;
+	}
+	struct m_nmea_clock clock;
+	if (0 != m_nmea_clock_init(&clock, day, ts_shift)) {
+		return -1;
+	}
+
+
+	/* Sources that can't be opened are skipped. */
+	struct m_align_source imu;
+	struct m_align_source pressure;
+	struct m_align_source nmea;
+	struct m_align_source * sources[3];
+	size_t n_sources = 0;
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof (path), "%s/imu.txt", dir);
+	if (0 == m_align_source_imu(&imu, path)) {
+		sources[n_sources++] = &imu;
+	}
+	snprintf(path, sizeof (path), "%s/pressure.txt", dir);
+	if (0 == m_align_source_pressure(&pressure, path)) {
+		sources[n_sources++] = &pressure;
+	}
+	snprintf(path, sizeof (path), "%s/nmea.txt", dir);
+	if (0 == m_align_source_nmea(&nmea, path, &clock)) {
+		sources[n_sources++] = &nmea;
+	}
+
+	/* From here on, sources are closed by m_align_close(), also on
+	   errors. Modes are used only by m_align_next(). */
+	struct m_align align;
+	int rv = m_align_init(&align, sources, n_sources, period_ms * 1000000LL, 0);
+	for (int i = 0; rv == 0 && i < n_modes; i++) {
+		char * eq = strchr(modes[i], '=');
+		enum m_align_mode mode;
+		if (!eq || 0 != m_aligner_parse_mode(eq + 1, &mode)) {
+			fprintf(stderr, "[EE] invalid mode '%s'\n", modes[i]);
+			rv = -1;
+			break;
+		}
+		*eq = '\0';
+		if (0 == m_align_set_mode(sources, n_sources, modes[i], mode)) {
+			fprintf(stderr, "[EE] no channel '%s'\n", modes[i]);
+			rv = -1;
+		}
+	}
+	if (rv != 0) {
+		m_align_close(&align);
+		return -1;
+	}
+
+	fprintf(stdout, "time");
+	for (size_t s = 0; s < n_sources; s++) {
+		for (size_t c = 0; c < sources[s]->n_channels; c++) {
+			fprintf(stdout, ",%s.%s", sources[s]->name, sources[s]->channels[c]);
+		}
+	}
+	fprintf(stdout, "\n");
+
+	double values[3 * M_ALIGN_CHANNELS_MAX];
+	int64_t time_ns;
+	while (1 == (rv = m_align_next(&align, &time_ns, values))) {
+		fprintf(stdout, "%lld.%03lld", (long long) (time_ns / 1000000000), (long long) (time_ns % 1000000000 / 1000000));
+		for (size_t i = 0; i < align.n_channels; i++) {
+			if (isnan(values[i])) {
+				fprintf(stdout, ",");
+			} else {
+				fprintf(stdout, ",%.7g", values[i]);
+			}
+		}
+		fprintf(stdout, "\n");
+	}
+
+	m_align_close(&align);
+
+	return rv == -1 ? -1 : 0;
+}
@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime(), getopt() */
+
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "m_input.h"
+#include "m_log.h"
+#include "m_attitude.h"
+
+
+/*
+  Benchmark and check of bulk attitude functions of libmularsky
+  against their scalar reference variants.
+
+  Usage: m_attitude_bench [-n <samples>] [<imu.txt> ...]
+
+  Without files, <samples> random orientations (default 1000000) are
+  used, plus a few special ones (identity, pitch of +/-90 degrees).
+  With files, quaternions and accelerations of imu.txt files are
+  used.
+
+  For each function the best time of a few rounds is printed, with
+  maximal difference from reference variant. If a difference exceeds
+  tolerance of the function, the benchmark fails (exit status
+  EXIT_FAILURE), so it can be used to catch regressions of bulk
+  variants.
+*/
+
+
+#define BENCH_ROUNDS 5
+#define BENCH_PI 3.14159265358979323846
+
+/* Maximal differences from reference variants. */
+#define BENCH_TOLERANCE_EULER     1e-6   /* deg */
+#define BENCH_TOLERANCE_ROTATION  1e-12
+#define BENCH_TOLERANCE_EARTH_ACC 1e-9   /* m/s^2 */
+
+
+struct m_bench_data {
+	size_t n;
+	double * q[4];      /* w, x, y, z */
+	double * a[3];      /* Acceleration in sensor frame. */
+
+	double * out[9];    /* Outputs of bulk functions. */
+	double * ref[9];    /* Outputs of reference functions. */
+};
+
+
+
+
+static double m_bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+static int m_bench_alloc(struct m_bench_data * d, size_t n)
+{
+	memset(d, 0, sizeof (struct m_bench_data));
+	d->n = n;
+
+	double ** arrays[] = { &d->q[0], &d->q[1], &d->q[2], &d->q[3], &d->a[0], &d->a[1], &d->a[2] };
+	for (size_t i = 0; i < sizeof (arrays) / sizeof (arrays[0]); i++) {
+		if (!(*arrays[i] = malloc((n ? n : 1) * sizeof (double)))) {
+			return -1;
+		}
+	}
+	for (int i = 0; i < 9; i++) {
+		if (!(d->out[i] = malloc((n ? n : 1) * sizeof (double)))
+		    || !(d->ref[i] = malloc((n ? n : 1) * sizeof (double)))) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+static void m_bench_free(struct m_bench_data * d)
+{
+	for (int i = 0; i < 4; i++) {
+		free(d->q[i]);
+	}
+	for (int i = 0; i < 3; i++) {
+		free(d->a[i]);
+	}
+	for (int i = 0; i < 9; i++) {
+		free(d->out[i]);
+		free(d->ref[i]);
+	}
+
+	return;
+}
+
+
+
+
+/* Uniformly distributed random orientations (Shoemake's method). */
+static int m_bench_random(struct m_bench_data * d, size_t n)
+{
+	const double special[][4] = {
+		{ 1.0, 0.0, 0.0, 0.0 },
+		{ sqrt(0.5), 0.0, sqrt(0.5), 0.0 },   /* Pitch +90. */
+		{ sqrt(0.5), 0.0, -sqrt(0.5), 0.0 },  /* Pitch -90. */
+		{ 0.0, 0.0, 0.0, 1.0 },               /* Yaw 180. */
+		{ 0.0, 0.0, 0.0, 0.0 },               /* No fusion data. */
+	};
+	const size_t n_special = sizeof (special) / sizeof (special[0]);
+
+	if (0 != m_bench_alloc(d, n + n_special)) {
+		return -1;
+	}
+
+	srand(1);
+	for (size_t i = 0; i < n + n_special; i++) {
+		if (i < n_special) {
+			for (int k = 0; k < 4; k++) {
+				d->q[k][i] = special[i][k];
+			}
+		} else {
+			const double u1 = rand() / (double) RAND_MAX;
+			const double u2 = 2 * BENCH_PI * rand() / (double) RAND_MAX;
+			const double u3 = 2 * BENCH_PI * rand() / (double) RAND_MAX;
+			d->q[0][i] = sqrt(1 - u1) * sin(u2);
+			d->q[1][i] = sqrt(1 - u1) * cos(u2);
+			d->q[2][i] = sqrt(u1) * sin(u3);
+			d->q[3][i] = sqrt(u1) * cos(u3);
+		}
+		for (int k = 0; k < 3; k++) {
+			d->a[k][i] = 20.0 * rand() / (double) RAND_MAX - 10.0;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+static int m_bench_file(struct m_bench_data * d, const char * path)
+{
+	struct m_input input;
+	if (-1 == m_input_open(&input, path)) {
+		return -1;
+	}
+	const char * data;
+	size_t size;
+	struct m_imu_sample * samples = NULL;
+	size_t n = 0;
+	int rv = m_input_next_block(&input, &data, &size);
+	if (rv == 1) {
+		rv = m_log_parse_imu_parallel(data, size, 0, &samples, &n, NULL);
+	} else {
+		fprintf(stderr, "[EE] can't read '%s'\n", path);
+		rv = -1;
+	}
+	m_input_close(&input);
+	if (rv == -1 || 0 != m_bench_alloc(d, n)) {
+		free(samples);
+		return -1;
+	}
+
+	m_attitude_quat_from_samples(samples, n, d->q[0], d->q[1], d->q[2], d->q[3]);
+	for (size_t i = 0; i < n; i++) {
+		for (int k = 0; k < 3; k++) {
+			d->a[k][i] = samples[i].acc[k] * M_IMU_SCALE_ACC;
+		}
+	}
+	free(samples);
+
+	return 0;
+}
+
+
+
+
+/* Maximal difference between bulk and reference outputs; @angles
+   are compared modulo 360 degrees. NaN in only one of outputs is an
+   infinite difference. */
+static double m_bench_diff(const struct m_bench_data * d, int n_outputs, int angles)
+{
+	double max = 0.0;
+	for (int k = 0; k < n_outputs; k++) {
+		for (size_t i = 0; i < d->n; i++) {
+			if (isnan(d->out[k][i]) || isnan(d->ref[k][i])) {
+				if (isnan(d->out[k][i]) != isnan(d->ref[k][i])) {
+					max = INFINITY;
+				}
+				continue;
+			}
+			double diff = fabs(d->out[k][i] - d->ref[k][i]);
+			if (angles && diff > 180.0) {
+				diff = 360.0 - diff;
+			}
+			if (diff > max) {
+				max = diff;
+			}
+		}
+	}
+	return max;
+}
+
+
+
+
+static void m_bench_euler(struct m_bench_data * d, int ref)
+{
+	if (ref) {
+		for (size_t i = 0; i < d->n; i++) {
+			m_attitude_euler_ref(d->q[0][i], d->q[1][i], d->q[2][i], d->q[3][i],
+					     &d->ref[0][i], &d->ref[1][i], &d->ref[2][i]);
+		}
+	} else {
+		m_attitude_euler(d->n, d->q[0], d->q[1], d->q[2], d->q[3], d->out[0], d->out[1], d->out[2]);
+	}
+}
+
+
+
+
+static void m_bench_rotation(struct m_bench_data * d, int ref)
+{
+	if (ref) {
+		for (size_t i = 0; i < d->n; i++) {
+			double r[9];
+			m_attitude_rotation_ref(d->q[0][i], d->q[1][i], d->q[2][i], d->q[3][i], r);
+			for (int k = 0; k < 9; k++) {
+				d->ref[k][i] = r[k];
+			}
+		}
+	} else {
+		m_attitude_rotation(d->n, d->q[0], d->q[1], d->q[2], d->q[3], d->out);
+	}
+}
+
+
+
+
+static void m_bench_earth_acc(struct m_bench_data * d, int ref)
+{
+	if (ref) {
+		for (size_t i = 0; i < d->n; i++) {
+			const double a[3] = { d->a[0][i], d->a[1][i], d->a[2][i] };
+			double e[3];
+			m_attitude_earth_acc_ref(d->q[0][i], d->q[1][i], d->q[2][i], d->q[3][i], a, M_ATTITUDE_GRAVITY, e);
+			for (int k = 0; k < 3; k++) {
+				d->ref[k][i] = e[k];
+			}
+		}
+	} else {
+		m_attitude_earth_acc(d->n, d->q[0], d->q[1], d->q[2], d->q[3], d->a[0], d->a[1], d->a[2],
+				     M_ATTITUDE_GRAVITY, d->out[0], d->out[1], d->out[2]);
+	}
+}
+
+
+
+
+static double m_bench_time(void (* fn)(struct m_bench_data *, int), struct m_bench_data * d, int ref)
+{
+	double best = INFINITY;
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		const double start = m_bench_now();
+		fn(d, ref);
+		const double elapsed = m_bench_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+	return best;
+}
+
+
+
+
+/* Returns 0 if difference from reference is within @tolerance, -1
+   otherwise. */
+static int m_bench_run(const char * label, void (* fn)(struct m_bench_data *, int),
+		       struct m_bench_data * d, int n_outputs, int angles, double tolerance, const char * unit)
+{
+	const double bulk = m_bench_time(fn, d, 0);
+	const double ref = m_bench_time(fn, d, 1);
+	const double diff = m_bench_diff(d, n_outputs, angles);
+
+	fprintf(stdout, "    %-10s bulk %8.1f Msamples/s, reference %8.1f Msamples/s (x%.1f), max diff %.3g %s\n",
+		label, d->n / bulk / 1e6, d->n / ref / 1e6, ref / bulk, diff, unit);
+	if (diff > tolerance) {
+		fprintf(stderr, "[EE] %s: max diff %.3g %s exceeds tolerance %.3g %s\n", label, diff, unit, tolerance, unit);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+static int m_bench_all(struct m_bench_data * d)
+{
+	int rv = 0;
+	rv |= m_bench_run("euler", m_bench_euler, d, 3, 1, BENCH_TOLERANCE_EULER, "deg");
+	rv |= m_bench_run("rotation", m_bench_rotation, d, 9, 0, BENCH_TOLERANCE_ROTATION, "");
+	rv |= m_bench_run("earth acc", m_bench_earth_acc, d, 3, 0, BENCH_TOLERANCE_EARTH_ACC, "m/s^2");
+	return rv;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	size_t n = 1000000;
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "n:"))) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n <samples>] [<imu.txt> ...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	int rv = 0;
+	struct m_bench_data d;
+	if (optind == argc) {
+		if (0 != m_bench_random(&d, n)) {
+			m_bench_free(&d);
+			return -1;
+		}
+		fprintf(stdout, "random orientations: %zu samples\n", d.n);
+		if (0 != m_bench_all(&d)) {
+			rv = EXIT_FAILURE;
+		}
+		m_bench_free(&d);
+	}
+
+	for (int i = optind; i < argc; i++) {
+		if (0 != m_bench_file(&d, argv[i])) {
+			m_bench_free(&d);
+			return -1;
+		}
+		fprintf(stdout, "%s: %zu samples\n", argv[i], d.n);
+		if (0 != m_bench_all(&d)) {
+			rv = EXIT_FAILURE;
+		}
+		m_bench_free(&d);
+	}
+
+	return rv;
+}
@@ -0,0 +1,324 @@
+#define _POSIX_C_SOURCE 200809L /* getopt(), clock_gettime() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "m_utils.h"
+#include "m_split.h"
+#include "m_convert.h"
+#include "m_index.h"
+#include "m_pool.h"
+
+
+/*
+  Process many sessions at once: split into routes, convert to
+  columnar files, build time indexes.
+
+  m_batch [-j <threads>] [-o <split,convert,index>] <sessions file>
+
+  Each line of sessions file describes one session:
+  <session dir> <config file> <YYYY_MM_DD>
+  Empty lines and lines starting with '#' are ignored.
+
+  All jobs of all sessions are run on a pool of <threads> threads
+  (default: number of CPUs).
+
+  Sessions recorded with rotation of logs (mularsky -I/-S) must be
+  joined with m_joiner before they are listed here.
+*/
+
+
+#define USAGE "usage: %s [-j <threads>] [-o <split,convert,index>] <sessions file>\n"
+
+#define OP_SPLIT   0x01
+#define OP_CONVERT 0x02
+#define OP_INDEX   0x04
+
+
+struct m_session {
+	char dir[PATH_MAX];
+	char config_path[PATH_MAX];
+	char day[sizeof ("YYYY_MM_DD")];
+	struct m_split_config config;
+};
+
+
+/* Argument of one job. */
+struct m_batch_task {
+	struct m_session * session;
+	const char * file;          /* File of session to index. */
+};
+
+
+
+
+static int m_batch_split(void * arg)
+{
+	struct m_batch_task * task = arg;
+	return m_split_session(task->session->dir, &task->session->config, task->session->day, 0);
+}
+
+
+
+
+static int m_batch_convert_imu(void * arg)
+{
+	struct m_batch_task * task = arg;
+	/* Parallelism comes from the pool. */
+	return m_convert_imu(task->session->dir, 1);
+}
+
+
+
+
+static int m_batch_convert_pressure(void * arg)
+{
+	struct m_batch_task * task = arg;
+	return m_convert_pressure(task->session->dir);
+}
+
+
+
+
+static int m_batch_index(void * arg)
+{
+	struct m_batch_task * task = arg;
+	const struct m_session * session = task->session;
+
+	char path[PATH_MAX];
+	char idx_path[PATH_MAX];
+	if ((int) sizeof (path) <= snprintf(path, sizeof (path), "%s/%s", session->dir, task->file)
+	    || (int) sizeof (idx_path) <= snprintf(idx_path, sizeof (idx_path), "%s.idx", path)) {
+		fprintf(stderr, "[EE] %s:%d: path too long in '%s'\n", __FUNCTION__, __LINE__, session->dir);
+		return -1;
+	}
+
+	struct m_index_timer timer;
+	struct m_nmea_clock clock;
+	if (0 == strcmp(task->file, "nmea.txt")) {
+		if (0 != m_nmea_clock_init(&clock, session->day, session->config.ts_shift)) {
+			return -1;
+		}
+		m_index_timer_nmea(&timer, &clock);
+	} else {
+		m_index_timer_sensor(&timer);
+	}
+
+	struct m_index index;
+	if (0 != m_index_build(&index, path, M_INDEX_STRIDE, &timer)) {
+		return -1;
+	}
+
+	const int rv = m_index_save(&index, idx_path);
+	m_index_free(&index);
+
+	return rv;
+}
+
+
+
+
+static int m_batch_read_sessions(const char * path, struct m_session ** sessions, size_t * n_sessions)
+{
+	FILE * file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "[EE] can't open sessions file '%s'\n", path);
+		return -1;
+	}
+
+	size_t capacity = 0;
+	*sessions = NULL;
+	*n_sessions = 0;
+
+	char line[3 * PATH_MAX];
+	int line_number = 0;
+	int rv = 0;
+	while (0 != fgets(line, sizeof (line), file)) {
+		line_number++;
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+
+		if (*n_sessions == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			struct m_session * s = realloc(*sessions, capacity * sizeof (struct m_session));
+			if (!s) {
+				rv = -1;
+				break;
+			}
+			*sessions = s;
+		}
+
+		struct m_session * session = &(*sessions)[*n_sessions];
+		char fmt[64];
+		snprintf(fmt, sizeof (fmt), "%%%ds %%%ds %%10s", PATH_MAX - 1, PATH_MAX - 1);
+		if (3 != sscanf(line, fmt, session->dir, session->config_path, session->day)) {
+			fprintf(stderr, "[EE] %s:%d: expected '<session dir> <config file> <YYYY_MM_DD>'\n", path, line_number);
+			rv = -1;
+			break;
+		}
+		if (0 != m_split_read_config(session->config_path, &session->config)) {
+			fprintf(stderr, "[EE] %s:%d: invalid config of session '%s'\n", path, line_number, session->dir);
+			rv = -1;
+			break;
+		}
+		(*n_sessions)++;
+	}
+	fclose(file);
+
+	if (rv == -1) {
+		free(*sessions);
+		*sessions = NULL;
+	}
+	return rv;
+}
+
+
+
+
+static int m_batch_parse_ops(const char * str)
+{
+	int ops = 0;
+	char buffer[64];
+	snprintf(buffer, sizeof (buffer), "%s", str);
+	for (char * op = strtok(buffer, ","); op; op = strtok(NULL, ",")) {
+		if (0 == strcmp(op, "split")) {
+			ops |= OP_SPLIT;
+		} else if (0 == strcmp(op, "convert")) {
+			ops |= OP_CONVERT;
+		} else if (0 == strcmp(op, "index")) {
+			ops |= OP_INDEX;
+		} else {
+			return -1;
+		}
+	}
+	return ops;
+}
+
+
+
+
+static double m_batch_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	int n_threads = 0;
+	int ops = OP_SPLIT | OP_CONVERT | OP_INDEX;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "j:o:"))) {
+		switch (opt) {
+		case 'j':
+			n_threads = atoi(optarg);
+			break;
+		case 'o':
+			ops = m_batch_parse_ops(optarg);
+			if (ops <= 0) {
+				fprintf(stderr, "[EE] invalid operations '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return -1;
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, USAGE, argv[0]);
+		return -1;
+	}
+
+	struct m_session * sessions;
+	size_t n_sessions;
+	if (0 != m_batch_read_sessions(argv[optind], &sessions, &n_sessions)) {
+		return -1;
+	}
+
+
+	/* Longest jobs (imu.txt is by far the largest file) are dealt
+	   first, so that they start early. */
+	const size_t jobs_per_session = 6;
+	struct m_pool_job * jobs = calloc(n_sessions * jobs_per_session + 1, sizeof (struct m_pool_job));
+	struct m_batch_task * tasks = calloc(n_sessions * jobs_per_session + 1, sizeof (struct m_batch_task));
+	if (!jobs || !tasks) {
+		free(jobs);
+		free(tasks);
+		free(sessions);
+		return -1;
+	}
+	size_t n_jobs = 0;
+	for (int pass = 0; pass < 6; pass++) {
+		for (size_t s = 0; s < n_sessions; s++) {
+			struct m_pool_job * job = &jobs[n_jobs];
+			struct m_batch_task * task = &tasks[n_jobs];
+			task->session = &sessions[s];
+			job->arg = task;
+
+			if (pass == 0 && (ops & OP_CONVERT)) {
+				job->name = "convert imu";
+				job->fn = m_batch_convert_imu;
+			} else if (pass == 1 && (ops & OP_SPLIT)) {
+				job->name = "split";
+				job->fn = m_batch_split;
+			} else if (pass == 2 && (ops & OP_INDEX)) {
+				job->name = "index imu";
+				job->fn = m_batch_index;
+				task->file = "imu.txt";
+			} else if (pass == 3 && (ops & OP_INDEX)) {
+				job->name = "index nmea";
+				job->fn = m_batch_index;
+				task->file = "nmea.txt";
+			} else if (pass == 4 && (ops & OP_CONVERT)) {
+				job->name = "convert pressure";
+				job->fn = m_batch_convert_pressure;
+			} else if (pass == 5 && (ops & OP_INDEX)) {
+				job->name = "index pressure";
+				job->fn = m_batch_index;
+				task->file = "pressure.txt";
+			} else {
+				continue;
+			}
+			n_jobs++;
+		}
+	}
+
+
+	const double start = m_batch_now();
+	const int rv = m_pool_run(jobs, n_jobs, n_threads);
+	const double elapsed = m_batch_now() - start;
+
+
+	/* Report. */
+	double total = 0;
+	int n_failed = 0;
+	for (size_t j = 0; j < n_jobs; j++) {
+		const struct m_batch_task * task = jobs[j].arg;
+		fprintf(stdout, "%-50s %-17s %-6s %8.3f s  worker %d%s\n",
+			task->session->dir, jobs[j].name, jobs[j].rv == 0 ? "ok" : "FAILED",
+			jobs[j].seconds, jobs[j].worker, jobs[j].stolen ? " (stolen)" : "");
+		total += jobs[j].seconds;
+		if (jobs[j].rv != 0) {
+			n_failed++;
+		}
+	}
+	fprintf(stdout, "%zu sessions, %zu jobs, %d failed; %.3f s of work in %.3f s\n",
+		n_sessions, n_jobs, n_failed, total, elapsed);
+
+	free(jobs);
+	free(tasks);
+	free(sessions);
+
+	return rv;
+}
@@ -0,0 +1,55 @@
+#define _POSIX_C_SOURCE 200809L /* getopt() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "m_convert.h"
+
+
+/*
+  Convert imu.txt and pressure.txt of a session into columnar files
+  imu.col and pressure.col (see m_columnar.h).
+
+  Usage: m_converter [-j <threads>] [<session dir>]
+
+  imu.txt is parsed by <threads> threads (default: number of CPUs).
+  Session with rotated logs (mularsky -I/-S) is converted after its
+  chunks are joined with m_joiner.
+*/
+
+
+
+
+int main(int argc, char ** argv)
+{
+	int n_threads = 0;
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "j:"))) {
+		switch (opt) {
+		case 'j':
+			n_threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-j <threads>] [<session dir>]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (argc - optind > 1) {
+		fprintf(stderr, "usage: %s [-j <threads>] [<session dir>]\n", argv[0]);
+		return -1;
+	}
+	const char * dir = optind < argc ? argv[optind] : ".";
+
+	int rv = 0;
+	if (0 != m_convert_imu(dir, n_threads)) {
+		fprintf(stderr, "[EE] failed to convert imu data\n");
+		rv = -1;
+	}
+	if (0 != m_convert_pressure(dir)) {
+		fprintf(stderr, "[EE] failed to convert pressure data\n");
+		rv = -1;
+	}
+
+	return rv;
+}
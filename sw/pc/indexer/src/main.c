@@ -0,0 +1,214 @@
+#define _POSIX_C_SOURCE 200809L /* getopt() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "m_utils.h"
+#include "m_input.h"
+#include "m_index.h"
+
+
+/*
+  Build time index of session files, and extract time ranges from
+  them using the index.
+
+  m_indexer [-n <stride>] [-t <ts_shift>] [-d <YYYY_MM_DD>] <file> [<file> ...]
+      Build <file>.idx for each file.
+
+  m_indexer [-n <stride>] [-t <ts_shift>] [-d <YYYY_MM_DD>] -r <start>,<stop> <file>
+      Write lines of <file> from time range [start, stop] (UNIX
+      time stamps in seconds, inclusive) to stdout. Index is built
+      first if it's missing or stale.
+
+  Day of nmea files is taken from -d or from name of session
+  directory ("00_2017_04_30_13_39_14") containing the file, and
+  -t is ts_shift from splitter's config.txt.
+
+  Offsets in index are offsets in the file, so a rotated log
+  (mularsky -I/-S) is indexed either chunk by chunk, or as one file
+  joined by m_joiner.
+*/
+
+
+#define NSECS_PER_SEC 1000000000LL
+
+
+struct m_indexer_params {
+	unsigned int stride;
+	int ts_shift;
+	const char * day;
+	int range;
+	long long start;
+	long long stop;
+};
+
+
+
+
+/* Configure timer appropriate for given file. */
+static int m_indexer_timer(const char * path, const struct m_indexer_params * params,
+			   struct m_index_timer * timer, struct m_nmea_clock * clock)
+{
+	const char * name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	if (0 != strncmp(name, "nmea", strlen("nmea"))) {
+		m_index_timer_sensor(timer);
+		return 0;
+	}
+
+	char day[sizeof ("YYYY_MM_DD")];
+	if (params->day) {
+		snprintf(day, sizeof (day), "%s", params->day);
+	} else {
+		/* Directory containing the file. */
+		char dir[PATH_MAX];
+		snprintf(dir, sizeof (dir), "%s", path);
+		char * slash = strrchr(dir, '/');
+		if (slash) {
+			*slash = '\0';
+		} else {
+			snprintf(dir, sizeof (dir), ".");
+		}
+		if (0 != m_get_session_day(dir, day, sizeof (day))) {
+			fprintf(stderr, "[EE] can't get day of '%s' from its directory, use -d\n", path);
+			return -1;
+		}
+	}
+	if (0 != m_nmea_clock_init(clock, day, params->ts_shift)) {
+		return -1;
+	}
+	m_index_timer_nmea(timer, clock);
+
+	return 0;
+}
+
+
+
+
+static int m_indexer_build(const char * path, const struct m_indexer_params * params, struct m_index * index)
+{
+	struct m_index_timer timer;
+	struct m_nmea_clock clock;
+	if (0 != m_indexer_timer(path, params, &timer, &clock)) {
+		return -1;
+	}
+
+	if (0 != m_index_build(index, path, params->stride, &timer)) {
+		fprintf(stderr, "[EE] failed to build index of '%s'\n", path);
+		return -1;
+	}
+
+	char idx_path[PATH_MAX];
+	snprintf(idx_path, sizeof (idx_path), "%s.idx", path);
+	if (0 != m_index_save(index, idx_path)) {
+		m_index_free(index);
+		return -1;
+	}
+
+	fprintf(stderr, "[II] '%s': %llu bytes, %llu index entries\n", path,
+		(unsigned long long) index->header.file_size, (unsigned long long) index->header.n_entries);
+
+	return 0;
+}
+
+
+
+
+static int m_indexer_extract(const char * path, const struct m_indexer_params * params)
+{
+	struct m_index index;
+	char idx_path[PATH_MAX];
+	snprintf(idx_path, sizeof (idx_path), "%s.idx", path);
+	if (0 != m_index_load(&index, idx_path, path)) {
+		if (0 != m_indexer_build(path, params, &index)) {
+			return -1;
+		}
+	}
+
+	struct m_index_timer timer;
+	struct m_nmea_clock clock;
+	struct m_input input;
+	if (0 != m_indexer_timer(path, params, &timer, &clock)
+	    || 0 != m_input_open(&input, path)) {
+		m_index_free(&index);
+		return -1;
+	}
+
+	int rv = -1;
+	const char * data;
+	size_t size;
+	if (!input.mapped) {
+		fprintf(stderr, "[EE] '%s' can't be memory-mapped\n", path);
+	} else if (1 == m_input_next_block(&input, &data, &size)) {
+		size_t begin;
+		size_t end;
+		if (0 == m_index_range(&index, &timer, data, size,
+				       params->start * NSECS_PER_SEC, params->stop * NSECS_PER_SEC + NSECS_PER_SEC - 1,
+				       &begin, &end)) {
+			fwrite(data + begin, 1, end - begin, stdout);
+			rv = 0;
+		}
+	}
+
+	m_input_close(&input);
+	m_index_free(&index);
+
+	return rv;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	struct m_indexer_params params = { 0 };
+	params.stride = M_INDEX_STRIDE;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "n:t:d:r:"))) {
+		switch (opt) {
+		case 'n':
+			params.stride = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			params.ts_shift = atoi(optarg);
+			break;
+		case 'd':
+			params.day = optarg;
+			break;
+		case 'r':
+			if (2 != sscanf(optarg, "%lld,%lld", &params.start, &params.stop)) {
+				fprintf(stderr, "[EE] invalid range '%s'\n", optarg);
+				return -1;
+			}
+			params.range = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n <stride>] [-t <ts_shift>] [-d <YYYY_MM_DD>] [-r <start>,<stop>] <file> [<file> ...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (optind == argc || (params.range && optind + 1 != argc)) {
+		fprintf(stderr, "usage: %s [-n <stride>] [-t <ts_shift>] [-d <YYYY_MM_DD>] [-r <start>,<stop>] <file> [<file> ...]\n", argv[0]);
+		return -1;
+	}
+
+	if (params.range) {
+		return m_indexer_extract(argv[optind], &params);
+	}
+
+	for (int i = optind; i < argc; i++) {
+		struct m_index index;
+		if (0 != m_indexer_build(argv[i], &params, &index)) {
+			return -1;
+		}
+		m_index_free(&index);
+	}
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+#define _POSIX_C_SOURCE 200809L /* getopt() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "m_chunks.h"
+
+
+/*
+  Join rotated logs of sessions recorded with mularsky -I/-S.
+
+  m_joiner [-f] <session dir> [<session dir> ...]
+
+  Chunks listed in chunks.txt of a session (imu.0000.txt,
+  imu.0001.txt, ...) are checked and joined into imu.txt etc., so
+  that the session can be processed by other tools. Existing files
+  are replaced only with -f. Sessions recorded without rotation are
+  left as they are. Returns 0 if all logs are joined.
+*/
+
+
+#define USAGE "usage: %s [-f] <session dir> [<session dir> ...]\n"
+
+
+
+
+int main(int argc, char ** argv)
+{
+	int overwrite = 0;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "f"))) {
+		switch (opt) {
+		case 'f':
+			overwrite = 1;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, USAGE, argv[0]);
+		return -1;
+	}
+
+	int rv = 0;
+	for (int i = optind; i < argc; i++) {
+		struct m_chunks chunks;
+		if (0 != m_chunks_load(&chunks, argv[i])) {
+			rv = -1;
+			continue;
+		}
+		if (chunks.n_logs == 0) {
+			fprintf(stdout, "%s: no rotated logs\n", argv[i]);
+		}
+		for (size_t l = 0; l < chunks.n_logs; l++) {
+			const struct m_chunks_log * log = &chunks.logs[l];
+			if (0 != m_chunks_join(log, argv[i], overwrite)) {
+				fprintf(stdout, "%s/%s: FAILED\n", argv[i], log->name);
+				rv = -1;
+				continue;
+			}
+			fprintf(stdout, "%s/%s: %zu chunks joined\n", argv[i], log->name, log->n_chunks);
+		}
+		m_chunks_free(&chunks);
+	}
+
+	return rv;
+}
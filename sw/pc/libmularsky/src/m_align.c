@@ -0,0 +1,636 @@
+#define _POSIX_C_SOURCE 200809L /* struct timespec */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "m_align.h"
+#include "m_input.h"
+#include "m_log.h"
+#include "m_nmea.h"
+#include "m_bme280_comp.h"
+
+
+#define NSECS_PER_SEC 1000000000LL
+#define KNOTS_TO_MPS (1852.0 / 3600.0)
+
+
+
+
+/* ---- imu.txt ---- */
+
+
+struct m_align_imu {
+	struct m_input input;
+
+	/* Samples of current second. */
+	struct m_imu_sample * samples;
+	size_t n_samples;
+	size_t capacity;
+	int64_t slot_ns;        /* Time between samples of current second. */
+
+	/* Position of emitting of samples of current second. */
+	size_t pos;
+	size_t slot;
+	int repeat_pending;     /* Repeated copy of samples[pos] is to be emitted. */
+
+	struct m_imu_sample pending;  /* First sample of next second. */
+	int have_pending;
+	int eof;
+};
+
+
+static const char * m_align_imu_channels[] = {
+	"acc_x", "acc_y", "acc_z",
+	"mag_x", "mag_y", "mag_z",
+	"gyr_x", "gyr_y", "gyr_z",
+	"eul_h", "eul_r", "eul_p",
+	"qua_w", "qua_x", "qua_y", "qua_z",
+	"lia_x", "lia_y", "lia_z",
+	"grv_x", "grv_y", "grv_z",
+	"temp"
+};
+
+
+
+
+static int m_align_imu_read(struct m_align_imu * imu, struct m_imu_sample * sample)
+{
+	const char * line;
+	size_t len;
+	int rv;
+	while (1 == (rv = m_input_next_line(&imu->input, &line, &len))) {
+		if (0 == m_log_parse_imu(line, len, sample)) {
+			return 1;
+		}
+	}
+	return rv;
+}
+
+
+
+
+/* Read all samples of next second. */
+static int m_align_imu_fill(struct m_align_imu * imu)
+{
+	imu->n_samples = 0;
+	imu->pos = 0;
+	imu->slot = 0;
+	imu->repeat_pending = 0;
+
+	if (!imu->have_pending) {
+		if (imu->eof) {
+			return 0;
+		}
+		const int rv = m_align_imu_read(imu, &imu->pending);
+		if (rv != 1) {
+			imu->eof = 1;
+			return rv;
+		}
+	}
+	imu->have_pending = 0;
+
+	size_t n_slots = 0;
+	struct m_imu_sample sample = imu->pending;
+	for (;;) {
+		if (imu->n_samples == imu->capacity) {
+			const size_t capacity = imu->capacity ? 2 * imu->capacity : 256;
+			struct m_imu_sample * samples = realloc(imu->samples, capacity * sizeof (struct m_imu_sample));
+			if (!samples) {
+				return -1;
+			}
+			imu->samples = samples;
+			imu->capacity = capacity;
+		}
+		imu->samples[imu->n_samples++] = sample;
+		n_slots += 1 + sample.repeats;
+
+		const int rv = m_align_imu_read(imu, &sample);
+		if (rv == -1) {
+			return -1;
+		} else if (rv == 0) {
+			imu->eof = 1;
+			break;
+		} else if (sample.time != imu->samples[0].time) {
+			imu->pending = sample;
+			imu->have_pending = 1;
+			break;
+		}
+	}
+
+	imu->slot_ns = NSECS_PER_SEC / (int64_t) n_slots;
+	return 1;
+}
+
+
+
+
+static int m_align_imu_next(struct m_align_source * source, int64_t * time_ns, double * values)
+{
+	struct m_align_imu * imu = source->ctx;
+
+	if (imu->pos == imu->n_samples) {
+		const int rv = m_align_imu_fill(imu);
+		if (rv != 1) {
+			return rv;
+		}
+	}
+
+	const struct m_imu_sample * s = &imu->samples[imu->pos];
+	*time_ns = s->time * NSECS_PER_SEC + (int64_t) imu->slot * imu->slot_ns;
+
+	/* Sample followed by N skipped repeats is emitted twice: at its
+	   own slot and at slot of last repeat, so that interpolation
+	   doesn't blend it with the next sample over the repeats. */
+	if (imu->repeat_pending) {
+		*time_ns += (int64_t) s->repeats * imu->slot_ns;
+		imu->repeat_pending = 0;
+		imu->slot += 1 + s->repeats;
+		imu->pos++;
+	} else if (s->repeats) {
+		imu->repeat_pending = 1;
+	} else {
+		imu->slot++;
+		imu->pos++;
+	}
+
+	double * v = values;
+	for (int i = 0; i < 3; i++) {
+		*v++ = s->acc[i] * M_IMU_SCALE_ACC;
+	}
+	for (int i = 0; i < 3; i++) {
+		*v++ = s->mag[i] * M_IMU_SCALE_MAG;
+	}
+	for (int i = 0; i < 3; i++) {
+		*v++ = s->gyr[i] * M_IMU_SCALE_GYR;
+	}
+	for (int i = 0; i < 3; i++) {
+		*v++ = s->eul[i] * M_IMU_SCALE_EUL;
+	}
+	for (int i = 0; i < 4; i++) {
+		*v++ = s->qua[i] * M_IMU_SCALE_QUA;
+	}
+	for (int i = 0; i < 3; i++) {
+		*v++ = s->lia[i] * M_IMU_SCALE_LIA;
+	}
+	for (int i = 0; i < 3; i++) {
+		*v++ = s->grv[i] * M_IMU_SCALE_GRV;
+	}
+	*v++ = s->temp * M_IMU_SCALE_TEMP;
+
+	return 1;
+}
+
+
+
+
+static void m_align_imu_close(struct m_align_source * source)
+{
+	struct m_align_imu * imu = source->ctx;
+	m_input_close(&imu->input);
+	free(imu->samples);
+	free(imu);
+	source->ctx = NULL;
+}
+
+
+
+
+/* Common part of initialization of sources. */
+static void m_align_source_setup(struct m_align_source * source, const char * name,
+				 const char * const * channels, size_t n_channels, enum m_align_mode mode)
+{
+	memset(source, 0, sizeof (struct m_align_source));
+	source->name = name;
+	source->n_channels = n_channels;
+	for (size_t i = 0; i < n_channels; i++) {
+		source->channels[i] = channels[i];
+		source->modes[i] = mode;
+	}
+}
+
+
+
+
+int m_align_source_imu(struct m_align_source * source, const char * path)
+{
+	struct m_align_imu * imu = calloc(1, sizeof (struct m_align_imu));
+	if (!imu) {
+		return -1;
+	}
+	if (-1 == m_input_open(&imu->input, path)) {
+		free(imu);
+		return -1;
+	}
+
+	m_align_source_setup(source, "imu", m_align_imu_channels,
+			     sizeof (m_align_imu_channels) / sizeof (m_align_imu_channels[0]), M_ALIGN_LINEAR);
+	source->next = m_align_imu_next;
+	source->close = m_align_imu_close;
+	source->ctx = imu;
+
+	return 0;
+}
+
+
+
+
+/* ---- pressure.txt ---- */
+
+
+struct m_align_pressure {
+	struct m_input input;
+	struct m_bme280_calib calib;
+	int have_calib;
+};
+
+
+static const char * m_align_pressure_channels[] = { "pressure", "temperature", "humidity" };
+
+
+
+
+static int m_align_pressure_next(struct m_align_source * source, int64_t * time_ns, double * values)
+{
+	struct m_align_pressure * pressure = source->ctx;
+
+	const char * line;
+	size_t len;
+	int rv;
+	while (1 == (rv = m_input_next_line(&pressure->input, &line, &len))) {
+		struct m_pressure_sample s;
+		char hex[2 * M_BME280_CALIB_SIZE + 1];
+
+		if (0 == m_log_parse_pressure_calibration(line, len, hex)) {
+			pressure->have_calib = 0 == m_bme280_calib_from_hex(&pressure->calib, hex);
+			continue;
+		}
+		if (0 != m_log_parse_pressure(line, len, &s)) {
+			continue;
+		}
+
+		*time_ns = s.time * NSECS_PER_SEC;
+		if (s.compensated) {
+			values[0] = s.pressure * M_PRESSURE_SCALE_PRESSURE;
+			values[1] = s.temperature * M_PRESSURE_SCALE_TEMPERATURE;
+			values[2] = s.humidity * M_PRESSURE_SCALE_HUMIDITY;
+		} else if (pressure->have_calib) {
+			m_bme280_compensate_double(&pressure->calib, 1,
+						   &s.raw_temperature, &s.raw_pressure, &s.raw_humidity,
+						   &values[1], &values[0], &values[2]);
+		} else {
+			values[0] = values[1] = values[2] = NAN;
+		}
+		return 1;
+	}
+
+	return rv;
+}
+
+
+
+
+static void m_align_pressure_close(struct m_align_source * source)
+{
+	struct m_align_pressure * pressure = source->ctx;
+	m_input_close(&pressure->input);
+	free(pressure);
+	source->ctx = NULL;
+}
+
+
+
+
+int m_align_source_pressure(struct m_align_source * source, const char * path)
+{
+	struct m_align_pressure * pressure = calloc(1, sizeof (struct m_align_pressure));
+	if (!pressure) {
+		return -1;
+	}
+	if (-1 == m_input_open(&pressure->input, path)) {
+		free(pressure);
+		return -1;
+	}
+
+	m_align_source_setup(source, "pressure", m_align_pressure_channels,
+			     sizeof (m_align_pressure_channels) / sizeof (m_align_pressure_channels[0]), M_ALIGN_LINEAR);
+	source->next = m_align_pressure_next;
+	source->close = m_align_pressure_close;
+	source->ctx = pressure;
+
+	return 0;
+}
+
+
+
+
+/* ---- nmea.txt ---- */
+
+
+#define M_ALIGN_NMEA_CHANNELS 6
+
+
+struct m_align_nmea {
+	struct m_input input;
+	struct m_nmea_clock clock;
+
+	/* Record being collected from sentences with the same time. */
+	int have_record;
+	int64_t time_ns;
+	double values[M_ALIGN_NMEA_CHANNELS];
+};
+
+
+static const char * m_align_nmea_channels[] = { "latitude", "longitude", "altitude", "speed", "course", "hdop" };
+
+
+
+
+/* Get time and values of one RMC or GGA sentence. Values that the
+   sentence doesn't contain, and values of sentences without a valid
+   fix, are NAN. */
+static int m_align_nmea_read(struct m_align_nmea * nmea, int64_t * time_ns, double * values)
+{
+	const char * line;
+	size_t len;
+	int rv;
+	while (1 == (rv = m_input_next_line(&nmea->input, &line, &len))) {
+		struct m_nmea_sentence sentence;
+		if (0 != m_nmea_parse(line, len, &sentence)
+		    || sentence.checksum == M_NMEA_CHECKSUM_BAD) {
+			continue;
+		}
+
+		for (int i = 0; i < M_ALIGN_NMEA_CHANNELS; i++) {
+			values[i] = NAN;
+		}
+
+		struct m_nmea_field time;
+		struct m_nmea_rmc rmc;
+		struct m_nmea_gga gga;
+		if (0 == m_nmea_get_rmc(&sentence, &rmc)) {
+			m_nmea_clock_set_date(&nmea->clock, rmc.date.data, rmc.date.len);
+			time = rmc.time;
+			if (rmc.status == 'A') {
+				values[0] = rmc.latitude;
+				values[1] = rmc.longitude;
+				values[3] = rmc.speed_knots * KNOTS_TO_MPS;
+				values[4] = rmc.course;
+			}
+		} else if (0 == m_nmea_get_gga(&sentence, &gga)) {
+			time = gga.time;
+			if (gga.quality > 0) {
+				values[0] = gga.latitude;
+				values[1] = gga.longitude;
+				values[2] = gga.altitude;
+				values[5] = gga.hdop;
+			}
+		} else {
+			continue;
+		}
+
+		struct timespec ts;
+		if (0 != m_nmea_clock_convert(&nmea->clock, time.data, time.len, &ts)) {
+			continue;
+		}
+		*time_ns = (int64_t) ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+		return 1;
+	}
+
+	return rv;
+}
+
+
+
+
+static int m_align_nmea_next(struct m_align_source * source, int64_t * time_ns, double * values)
+{
+	struct m_align_nmea * nmea = source->ctx;
+
+	int64_t t;
+	double v[M_ALIGN_NMEA_CHANNELS];
+	int rv;
+	while (1 == (rv = m_align_nmea_read(nmea, &t, v))) {
+		if (!nmea->have_record) {
+			nmea->have_record = 1;
+			nmea->time_ns = t;
+			memcpy(nmea->values, v, sizeof (v));
+		} else if (t == nmea->time_ns) {
+			for (int i = 0; i < M_ALIGN_NMEA_CHANNELS; i++) {
+				if (!isnan(v[i])) {
+					nmea->values[i] = v[i];
+				}
+			}
+		} else {
+			*time_ns = nmea->time_ns;
+			memcpy(values, nmea->values, sizeof (nmea->values));
+			nmea->time_ns = t;
+			memcpy(nmea->values, v, sizeof (v));
+			return 1;
+		}
+	}
+	if (rv == -1) {
+		return -1;
+	}
+
+	if (nmea->have_record) {
+		*time_ns = nmea->time_ns;
+		memcpy(values, nmea->values, sizeof (nmea->values));
+		nmea->have_record = 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+
+static void m_align_nmea_close(struct m_align_source * source)
+{
+	struct m_align_nmea * nmea = source->ctx;
+	m_input_close(&nmea->input);
+	free(nmea);
+	source->ctx = NULL;
+}
+
+
+
+
+int m_align_source_nmea(struct m_align_source * source, const char * path, const struct m_nmea_clock * clock)
+{
+	struct m_align_nmea * nmea = calloc(1, sizeof (struct m_align_nmea));
+	if (!nmea) {
+		return -1;
+	}
+	if (-1 == m_input_open(&nmea->input, path)) {
+		free(nmea);
+		return -1;
+	}
+	nmea->clock = *clock;
+
+	m_align_source_setup(source, "nmea", m_align_nmea_channels, M_ALIGN_NMEA_CHANNELS, M_ALIGN_HOLD);
+	source->next = m_align_nmea_next;
+	source->close = m_align_nmea_close;
+	source->ctx = nmea;
+
+	return 0;
+}
+
+
+
+
+/* ---- engine ---- */
+
+
+int m_align_set_mode(struct m_align_source * const * sources, size_t n_sources, const char * name, enum m_align_mode mode)
+{
+	int n = 0;
+	for (size_t s = 0; s < n_sources; s++) {
+		struct m_align_source * source = sources[s];
+		const size_t name_len = strlen(source->name);
+		const int whole_source = 0 == strcmp(name, source->name);
+		const char * channel = name;
+		if (0 == strncmp(name, source->name, name_len) && name[name_len] == '.') {
+			channel = name + name_len + 1;
+		}
+
+		for (size_t c = 0; c < source->n_channels; c++) {
+			if (whole_source || 0 == strcmp(channel, source->channels[c])) {
+				source->modes[c] = mode;
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+
+
+
+/* Read next record of source into "next" slot, skipping records that
+   are not later than "prev" record. */
+static int m_align_read(struct m_align_source * source)
+{
+	for (;;) {
+		const int rv = source->next(source, &source->next_time, source->next_values);
+		if (rv != 1) {
+			source->have_next = 0;
+			return rv;
+		}
+		if (!source->have_prev || source->next_time > source->prev_time) {
+			source->have_next = 1;
+			return 1;
+		}
+	}
+}
+
+
+
+
+int m_align_init(struct m_align * align, struct m_align_source ** sources, size_t n_sources, int64_t period_ns, int64_t start_ns)
+{
+	/* Sources are set first, so that m_align_close() closes them
+	   also after failure. */
+	memset(align, 0, sizeof (struct m_align));
+	align->sources = sources;
+	align->n_sources = n_sources;
+	if (period_ns <= 0) {
+		return -1;
+	}
+	align->period_ns = period_ns;
+
+	int64_t first = INT64_MAX;
+	for (size_t s = 0; s < n_sources; s++) {
+		align->n_channels += sources[s]->n_channels;
+		if (-1 == m_align_read(sources[s])) {
+			return -1;
+		}
+		if (sources[s]->have_next && sources[s]->next_time < first) {
+			first = sources[s]->next_time;
+		}
+	}
+
+	if (start_ns) {
+		align->time_ns = start_ns;
+	} else if (first != INT64_MAX) {
+		align->time_ns = first - first % period_ns;
+	}
+
+	return 0;
+}
+
+
+
+
+int m_align_next(struct m_align * align, int64_t * time_ns, double * values)
+{
+	const int64_t t = align->time_ns;
+
+	/* Move every source forward so that prev <= t < next. */
+	int more = 0;
+	for (size_t s = 0; s < align->n_sources; s++) {
+		struct m_align_source * source = align->sources[s];
+		while (source->have_next && source->next_time <= t) {
+			source->have_prev = 1;
+			source->prev_time = source->next_time;
+			memcpy(source->prev, source->next_values, source->n_channels * sizeof (double));
+			if (-1 == m_align_read(source)) {
+				return -1;
+			}
+		}
+		if (source->have_next) {
+			more = 1;
+		}
+	}
+
+	/* Last record is emitted at or after time of last record of all
+	   sources. */
+	if (!more) {
+		int64_t last = INT64_MIN;
+		for (size_t s = 0; s < align->n_sources; s++) {
+			if (align->sources[s]->have_prev && align->sources[s]->prev_time > last) {
+				last = align->sources[s]->prev_time;
+			}
+		}
+		if (t >= last + align->period_ns) {
+			return 0;
+		}
+	}
+
+	double * v = values;
+	for (size_t s = 0; s < align->n_sources; s++) {
+		const struct m_align_source * source = align->sources[s];
+		for (size_t c = 0; c < source->n_channels; c++) {
+			if (!source->have_prev) {
+				*v++ = NAN;
+			} else if (!source->have_next || source->modes[c] == M_ALIGN_HOLD) {
+				*v++ = source->prev[c];
+			} else if (source->modes[c] == M_ALIGN_LINEAR) {
+				const double k = (double) (t - source->prev_time) / (double) (source->next_time - source->prev_time);
+				*v++ = source->prev[c] + (source->next_values[c] - source->prev[c]) * k;
+			} else {
+				*v++ = (t - source->prev_time) <= (source->next_time - t) ? source->prev[c] : source->next_values[c];
+			}
+		}
+	}
+
+	*time_ns = t;
+	align->time_ns += align->period_ns;
+
+	return 1;
+}
+
+
+
+
+void m_align_close(struct m_align * align)
+{
+	for (size_t s = 0; s < align->n_sources; s++) {
+		if (align->sources[s]->close) {
+			align->sources[s]->close(align->sources[s]);
+		}
+	}
+}
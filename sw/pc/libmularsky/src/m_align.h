@@ -0,0 +1,151 @@
+#ifndef M_ALIGN_H
+#define M_ALIGN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "m_utils.h"
+
+
+/*
+  Merging of sensor streams of a session (IMU ~100 Hz, pressure 1 Hz,
+  GPS 1 Hz) onto one timeline.
+
+  Each stream is a source that produces records (time stamp + values
+  of channels) lazily, in order of time. The engine steps through a
+  common timeline with fixed period, and for each step resamples
+  every channel of every source, using one of resampling modes. Only
+  two records per source are kept in memory, regardless of length of
+  session.
+
+  Time stamps are in nanoseconds, in time base of the device
+  (global_time); NMEA times are converted with m_nmea_clock.
+
+  IMU lines of one second all have the same time stamp, so the IMU
+  source spreads samples of each second evenly over that second
+  (taking skipped repeated samples into account).
+*/
+
+
+#define M_ALIGN_CHANNELS_MAX 32
+
+
+enum m_align_mode {
+	M_ALIGN_HOLD = 0,     /* Value of last record at or before given time. */
+	M_ALIGN_LINEAR,       /* Linear interpolation between surrounding records. */
+	M_ALIGN_NEAREST       /* Value of record closest in time. */
+};
+
+
+struct m_align_source {
+	const char * name;
+	size_t n_channels;
+	const char * channels[M_ALIGN_CHANNELS_MAX];
+	enum m_align_mode modes[M_ALIGN_CHANNELS_MAX];
+
+	/* Get next record of source. Returns 1 if record is returned,
+	   0 at end of stream, -1 on errors. */
+	int (* next)(struct m_align_source * source, int64_t * time_ns, double * values);
+	void (* close)(struct m_align_source * source);
+	void * ctx;
+
+	/* State of engine: records surrounding current time. */
+	int have_prev;
+	int have_next;
+	int64_t prev_time;
+	int64_t next_time;
+	double prev[M_ALIGN_CHANNELS_MAX];
+	double next_values[M_ALIGN_CHANNELS_MAX];
+};
+
+
+struct m_align {
+	struct m_align_source ** sources;
+	size_t n_sources;
+	size_t n_channels;     /* Total number of channels of all sources. */
+	int64_t period_ns;
+	int64_t time_ns;       /* Time of next output record. */
+};
+
+
+
+/**
+   Source of data lines of imu.txt. Channels are in physical units
+   (m/s^2, uT, dps, deg, degC). Default mode is linear.
+
+   @return 0 on success, -1 on failure
+*/
+int m_align_source_imu(struct m_align_source * source, const char * path);
+
+
+
+/**
+   Source of data lines of pressure.txt: pressure [Pa], temperature
+   [degC], humidity [%rH]. Raw measurements are compensated with
+   calibration line of the file. Default mode is linear.
+
+   @return 0 on success, -1 on failure
+*/
+int m_align_source_pressure(struct m_align_source * source, const char * path);
+
+
+
+/**
+   Source of RMC and GGA sentences of nmea.txt: latitude, longitude
+   [deg], altitude [m], speed [m/s], course [deg], hdop. RMC and GGA
+   sentences with the same time make one record. Sentences without a
+   valid fix (RMC status other than 'A', GGA quality 0) give NAN
+   values. Default mode is hold.
+
+   @param clock: initialized NMEA clock; it's copied into the source
+
+   @return 0 on success, -1 on failure
+*/
+int m_align_source_nmea(struct m_align_source * source, const char * path, const struct m_nmea_clock * clock);
+
+
+
+/**
+   Set resampling mode of channel(s).
+
+   @param name: name of channel ("acc_x"), of source ("imu" - all
+   channels of source), or of channel of source ("imu.acc_x")
+
+   @return number of channels whose mode has been set
+*/
+int m_align_set_mode(struct m_align_source * const * sources, size_t n_sources, const char * name, enum m_align_mode mode);
+
+
+
+/**
+   @param sources: initialized sources
+   @param period_ns: period of output timeline
+   @param start_ns: time of first output record, 0 for time of earliest record of all sources (rounded down to @period_ns)
+
+   @return 0 on success, -1 on failure; in both cases m_align_close() closes @sources
+*/
+int m_align_init(struct m_align * align, struct m_align_source ** sources, size_t n_sources, int64_t period_ns, int64_t start_ns);
+
+
+
+/**
+   Get next record of common timeline.
+
+   @param values: buffer for align->n_channels values, in order of
+   sources and their channels; NAN for channels with no data (e.g.
+   before first record of a source)
+
+   @return 1 if record is returned, 0 after last record of all sources, -1 on errors
+*/
+int m_align_next(struct m_align * align, int64_t * time_ns, double * values);
+
+
+
+/**
+   Close all sources.
+*/
+void m_align_close(struct m_align * align);
+
+
+
+#endif /* #ifdef M_ALIGN_H */
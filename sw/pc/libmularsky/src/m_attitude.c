@@ -0,0 +1,242 @@
+#include <math.h>
+
+#include "m_attitude.h"
+
+
+#define M_ATTITUDE_PI      3.14159265358979323846
+#define M_ATTITUDE_TAN_PI_8 0.41421356237309504880  /* tan(pi / 8). */
+#define M_ATTITUDE_DEG     (180.0 / M_ATTITUDE_PI)
+
+
+/*
+  Coefficients of Taylor series of atan(t): (-1)^k / (2k + 1). For
+  |t| <= tan(pi / 8) first omitted term (t^29 / 29) is below 1e-12.
+*/
+#define M_ATTITUDE_ATAN_C(k) (((k) % 2 ? -1.0 : 1.0) / (2 * (k) + 1))
+
+
+
+
+/*
+  atan2() without branches and calls, so that loops calling it can
+  be vectorized.
+
+  Argument is reduced to [0, 1] by symmetries of atan2(), then to
+  [-tan(pi/8), tan(pi/8)] with atan(a) = pi/4 + atan((a - 1) / (a + 1)),
+  and then the series is evaluated.
+*/
+static inline double m_attitude_atan2(double y, double x)
+{
+	const double ay = fabs(y);
+	const double ax = fabs(x);
+	const int swap = ay > ax;
+	const double num = swap ? ax : ay;
+	const double den = swap ? ay : ax;
+	const double a = num / (den > 0.0 ? den : 1.0);
+
+	/* Both variants are computed: a division in only one branch of
+	   ?: is a branch that compiler doesn't turn into a select. */
+	const int shift = a > M_ATTITUDE_TAN_PI_8;
+	const double a_shifted = (a - 1.0) / (a + 1.0);
+	const double t = shift ? a_shifted : a;
+	const double t2 = t * t;
+
+	/* Horner's scheme, written out: a loop here keeps the caller's
+	   loop from being vectorized. */
+	double p = M_ATTITUDE_ATAN_C(13);
+	p = p * t2 + M_ATTITUDE_ATAN_C(12);
+	p = p * t2 + M_ATTITUDE_ATAN_C(11);
+	p = p * t2 + M_ATTITUDE_ATAN_C(10);
+	p = p * t2 + M_ATTITUDE_ATAN_C(9);
+	p = p * t2 + M_ATTITUDE_ATAN_C(8);
+	p = p * t2 + M_ATTITUDE_ATAN_C(7);
+	p = p * t2 + M_ATTITUDE_ATAN_C(6);
+	p = p * t2 + M_ATTITUDE_ATAN_C(5);
+	p = p * t2 + M_ATTITUDE_ATAN_C(4);
+	p = p * t2 + M_ATTITUDE_ATAN_C(3);
+	p = p * t2 + M_ATTITUDE_ATAN_C(2);
+	p = p * t2 + M_ATTITUDE_ATAN_C(1);
+	p = p * t2 + M_ATTITUDE_ATAN_C(0);
+	double r = t * p + (shift ? M_ATTITUDE_PI / 4 : 0.0);
+
+	r = swap ? M_ATTITUDE_PI / 2 - r : r;
+	r = x < 0.0 ? M_ATTITUDE_PI - r : r;
+
+	return copysign(r, y);
+}
+
+
+
+
+/* asin(s) = atan2(s, sqrt(1 - s^2)); @s is clamped to [-1, 1]. */
+static inline double m_attitude_asin(double s)
+{
+	s = s > 1.0 ? 1.0 : s;
+	s = s < -1.0 ? -1.0 : s;
+	return m_attitude_atan2(s, sqrt(1.0 - s * s));
+}
+
+
+
+
+void m_attitude_quat_from_samples(const struct m_imu_sample * samples, size_t n,
+				  double * restrict w, double * restrict x, double * restrict y, double * restrict z)
+{
+	for (size_t i = 0; i < n; i++) {
+		w[i] = samples[i].qua[0] * M_IMU_SCALE_QUA;
+		x[i] = samples[i].qua[1] * M_IMU_SCALE_QUA;
+		y[i] = samples[i].qua[2] * M_IMU_SCALE_QUA;
+		z[i] = samples[i].qua[3] * M_IMU_SCALE_QUA;
+	}
+
+	/* Quantization leaves the quaternions slightly off unit length. */
+	for (size_t i = 0; i < n; i++) {
+		const double norm2 = w[i] * w[i] + x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+		const double inv = (norm2 > 0.0 ? 1.0 : 0.0) / sqrt(norm2 > 0.0 ? norm2 : 1.0);
+		w[i] *= inv;
+		x[i] *= inv;
+		y[i] *= inv;
+		z[i] *= inv;
+	}
+
+	return;
+}
+
+
+
+
+void m_attitude_euler(size_t n, const double * restrict w, const double * restrict x, const double * restrict y, const double * restrict z,
+		      double * restrict yaw, double * restrict pitch, double * restrict roll)
+{
+	for (size_t i = 0; i < n; i++) {
+		yaw[i] = M_ATTITUDE_DEG * m_attitude_atan2(2.0 * (w[i] * z[i] + x[i] * y[i]),
+							   1.0 - 2.0 * (y[i] * y[i] + z[i] * z[i]));
+	}
+	for (size_t i = 0; i < n; i++) {
+		pitch[i] = M_ATTITUDE_DEG * m_attitude_asin(2.0 * (w[i] * y[i] - x[i] * z[i]));
+	}
+	for (size_t i = 0; i < n; i++) {
+		roll[i] = M_ATTITUDE_DEG * m_attitude_atan2(2.0 * (w[i] * x[i] + y[i] * z[i]),
+							    1.0 - 2.0 * (x[i] * x[i] + y[i] * y[i]));
+	}
+
+	return;
+}
+
+
+
+
+void m_attitude_euler_ref(double w, double x, double y, double z,
+			  double * yaw, double * pitch, double * roll)
+{
+	double sin_pitch = 2.0 * (w * y - x * z);
+	if (sin_pitch > 1.0) {
+		sin_pitch = 1.0;
+	} else if (sin_pitch < -1.0) {
+		sin_pitch = -1.0;
+	}
+
+	*yaw = atan2(2.0 * (w * z + x * y), 1.0 - 2.0 * (y * y + z * z)) * M_ATTITUDE_DEG;
+	*pitch = asin(sin_pitch) * M_ATTITUDE_DEG;
+	*roll = atan2(2.0 * (w * x + y * z), 1.0 - 2.0 * (x * x + y * y)) * M_ATTITUDE_DEG;
+
+	return;
+}
+
+
+
+
+void m_attitude_rotation(size_t n, const double * restrict w, const double * restrict x, const double * restrict y, const double * restrict z,
+			 double * r[9])
+{
+	double * restrict r00 = r[0];
+	double * restrict r01 = r[1];
+	double * restrict r02 = r[2];
+	double * restrict r10 = r[3];
+	double * restrict r11 = r[4];
+	double * restrict r12 = r[5];
+	double * restrict r20 = r[6];
+	double * restrict r21 = r[7];
+	double * restrict r22 = r[8];
+
+	for (size_t i = 0; i < n; i++) {
+		r00[i] = 1.0 - 2.0 * (y[i] * y[i] + z[i] * z[i]);
+		r01[i] = 2.0 * (x[i] * y[i] - w[i] * z[i]);
+		r02[i] = 2.0 * (x[i] * z[i] + w[i] * y[i]);
+	}
+	for (size_t i = 0; i < n; i++) {
+		r10[i] = 2.0 * (x[i] * y[i] + w[i] * z[i]);
+		r11[i] = 1.0 - 2.0 * (x[i] * x[i] + z[i] * z[i]);
+		r12[i] = 2.0 * (y[i] * z[i] - w[i] * x[i]);
+	}
+	for (size_t i = 0; i < n; i++) {
+		r20[i] = 2.0 * (x[i] * z[i] - w[i] * y[i]);
+		r21[i] = 2.0 * (y[i] * z[i] + w[i] * x[i]);
+		r22[i] = 1.0 - 2.0 * (x[i] * x[i] + y[i] * y[i]);
+	}
+
+	return;
+}
+
+
+
+
+void m_attitude_rotation_ref(double w, double x, double y, double z, double r[9])
+{
+	r[0] = 1.0 - 2.0 * (y * y + z * z);
+	r[1] = 2.0 * (x * y - w * z);
+	r[2] = 2.0 * (x * z + w * y);
+
+	r[3] = 2.0 * (x * y + w * z);
+	r[4] = 1.0 - 2.0 * (x * x + z * z);
+	r[5] = 2.0 * (y * z - w * x);
+
+	r[6] = 2.0 * (x * z - w * y);
+	r[7] = 2.0 * (y * z + w * x);
+	r[8] = 1.0 - 2.0 * (x * x + y * y);
+
+	return;
+}
+
+
+
+
+void m_attitude_earth_acc(size_t n, const double * restrict w, const double * restrict x, const double * restrict y, const double * restrict z,
+			  const double * restrict ax, const double * restrict ay, const double * restrict az, double g,
+			  double * restrict ex, double * restrict ey, double * restrict ez)
+{
+	for (size_t i = 0; i < n; i++) {
+		const double xx = x[i] * x[i];
+		const double yy = y[i] * y[i];
+		const double zz = z[i] * z[i];
+		const double xy = x[i] * y[i];
+		const double xz = x[i] * z[i];
+		const double yz = y[i] * z[i];
+		const double wx = w[i] * x[i];
+		const double wy = w[i] * y[i];
+		const double wz = w[i] * z[i];
+
+		ex[i] = (1.0 - 2.0 * (yy + zz)) * ax[i] + 2.0 * (xy - wz) * ay[i] + 2.0 * (xz + wy) * az[i];
+		ey[i] = 2.0 * (xy + wz) * ax[i] + (1.0 - 2.0 * (xx + zz)) * ay[i] + 2.0 * (yz - wx) * az[i];
+		ez[i] = 2.0 * (xz - wy) * ax[i] + 2.0 * (yz + wx) * ay[i] + (1.0 - 2.0 * (xx + yy)) * az[i] - g;
+	}
+
+	return;
+}
+
+
+
+
+void m_attitude_earth_acc_ref(double w, double x, double y, double z,
+			      const double a[3], double g, double e[3])
+{
+	double r[9];
+	m_attitude_rotation_ref(w, x, y, z, r);
+
+	for (int row = 0; row < 3; row++) {
+		e[row] = r[3 * row] * a[0] + r[3 * row + 1] * a[1] + r[3 * row + 2] * a[2];
+	}
+	e[2] -= g;
+
+	return;
+}
@@ -0,0 +1,93 @@
+#ifndef M_ATTITUDE_H
+#define M_ATTITUDE_H
+
+#include <stddef.h>
+
+#include "m_log.h"
+
+
+/*
+  Attitude of IMU computed from BNO055 quaternions, for whole arrays
+  of samples.
+
+  mularsky stores Euler angles truncated to whole degrees, but it
+  also stores the full quaternion (qua=w,x,y,z, 2^14 LSB per unit).
+  These functions compute Euler angles, rotation matrices and
+  earth-frame linear acceleration from the quaternions, without loss
+  of precision.
+
+  Arrays are in struct-of-arrays layout (separate w[], x[], y[], z[]
+  arrays), and the bulk functions are simple loops without calls and
+  branches, so that compiler can vectorize them. atan2() and asin()
+  of the bulk functions are computed with polynomials; their error
+  is below 1e-12 rad. Each bulk function has a scalar reference
+  variant (*_ref), written in the plainest way with libm, for
+  checking results of bulk functions.
+
+  Quaternions are expected to be of unit length (as returned by
+  m_attitude_quat_from_samples()); all-zero quaternion gives identity
+  rotation. The quaternion rotates vectors from sensor frame to earth frame
+  (x, y, z of earth frame; z points up). Euler angles are Tait-Bryan
+  angles in z-y-x order, in degrees:
+  yaw (-180, 180], pitch [-90, 90], roll (-180, 180]. Note that they
+  are not the same as heading/roll/pitch reported by BNO055 itself
+  (eul=, datasheet chapter 3.6.5.4), which use other ranges and signs.
+*/
+
+
+/* Standard gravity, m/s^2. */
+#define M_ATTITUDE_GRAVITY 9.80665
+
+
+
+/**
+   Gather quaternions of samples into arrays, in units, normalized.
+
+   Quaternions that are all zeros (no fusion data) stay zeros.
+*/
+void m_attitude_quat_from_samples(const struct m_imu_sample * samples, size_t n,
+				  double * w, double * x, double * y, double * z);
+
+
+
+/**
+   @param yaw, pitch, roll: output arrays, in degrees
+*/
+void m_attitude_euler(size_t n, const double * w, const double * x, const double * y, const double * z,
+		      double * yaw, double * pitch, double * roll);
+
+void m_attitude_euler_ref(double w, double x, double y, double z,
+			  double * yaw, double * pitch, double * roll);
+
+
+
+/**
+   @param r: nine output arrays, r[3 * row + column] is array of
+   element (row, column) of rotation matrix from sensor frame to
+   earth frame
+*/
+void m_attitude_rotation(size_t n, const double * w, const double * x, const double * y, const double * z,
+			 double * r[9]);
+
+void m_attitude_rotation_ref(double w, double x, double y, double z, double r[9]);
+
+
+
+/**
+   Rotate acceleration from sensor frame to earth frame, and remove
+   gravity from it.
+
+   @param ax, ay, az: acceleration in sensor frame (including gravity), m/s^2
+   @param g: gravity (e.g. M_ATTITUDE_GRAVITY), m/s^2
+   @param ex, ey, ez: output arrays, linear acceleration in earth frame, m/s^2
+*/
+void m_attitude_earth_acc(size_t n, const double * w, const double * x, const double * y, const double * z,
+			  const double * ax, const double * ay, const double * az, double g,
+			  double * ex, double * ey, double * ez);
+
+void m_attitude_earth_acc_ref(double w, double x, double y, double z,
+			      const double a[3], double g, double e[3]);
+
+
+
+#endif /* #ifdef M_ATTITUDE_H */
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "m_bme280_comp.h"
+
+
+/*
+  Compensation formulas come from BME280 datasheet and from Bosch's
+  BME280 driver (Copyright (C) 2015 - 2016 Bosch Sensortec GmbH; see
+  license in sw/rpi/mularsky/src/pressure/bme280.c).
+*/
+
+
+/* Number of samples processed in one pass. */
+#define M_BME280_BLOCK 256
+
+
+
+
+int m_bme280_calib_from_bytes(struct m_bme280_calib * c, const uint8_t * buffer)
+{
+	c->dig_T1 = buffer[0]  | (uint16_t) buffer[1] << 8;
+	c->dig_T2 = buffer[2]  | (uint16_t) buffer[3] << 8;
+	c->dig_T3 = buffer[4]  | (uint16_t) buffer[5] << 8;
+
+	c->dig_P1 = buffer[6]  | (uint16_t) buffer[7] << 8;
+	c->dig_P2 = buffer[8]  | (uint16_t) buffer[9] << 8;
+	c->dig_P3 = buffer[10] | (uint16_t) buffer[11] << 8;
+	c->dig_P4 = buffer[12] | (uint16_t) buffer[13] << 8;
+	c->dig_P5 = buffer[14] | (uint16_t) buffer[15] << 8;
+	c->dig_P6 = buffer[16] | (uint16_t) buffer[17] << 8;
+	c->dig_P7 = buffer[18] | (uint16_t) buffer[19] << 8;
+	c->dig_P8 = buffer[20] | (uint16_t) buffer[21] << 8;
+	c->dig_P9 = buffer[22] | (uint16_t) buffer[23] << 8;
+
+	c->dig_H1 = buffer[24];
+	c->dig_H2 = buffer[25] | (uint16_t) buffer[26] << 8;
+	c->dig_H3 = buffer[27];
+	/* Table 16: H4 and H5 are signed 12-bit values sharing register 0xE5. */
+	c->dig_H4 = (int16_t) ((int8_t) buffer[28] * 16) | (buffer[29] & 0x0f);
+	c->dig_H5 = (int16_t) ((int8_t) buffer[30] * 16) | (buffer[29] >> 4);
+	c->dig_H6 = (int8_t) buffer[31];
+
+	return 0;
+}
+
+
+
+
+int m_bme280_calib_from_hex(struct m_bme280_calib * c, const char * hex)
+{
+	uint8_t buffer[M_BME280_CALIB_SIZE];
+	for (int i = 0; i < M_BME280_CALIB_SIZE; i++) {
+		unsigned int byte;
+		if (1 != sscanf(hex + 2 * i, "%2x", &byte)) {
+			fprintf(stderr, "[EE] %s:%d: malformed calibration data at byte %d\n", __FUNCTION__, __LINE__, i);
+			return -1;
+		}
+		buffer[i] = (uint8_t) byte;
+	}
+
+	return m_bme280_calib_from_bytes(c, buffer);
+}
+
+
+
+
+/* Chapter 4.2.3: t_fine, common to all integer variants. */
+static void m_bme280_fine_int32(const struct m_bme280_calib * c, size_t n, const int32_t * restrict raw_t, int32_t * restrict fine)
+{
+	const int32_t T1 = c->dig_T1;
+	const int32_t T2 = c->dig_T2;
+	const int32_t T3 = c->dig_T3;
+
+	for (size_t i = 0; i < n; i++) {
+		const int32_t r = raw_t[i];
+		const int32_t x1 = (((r >> 3) - (T1 << 1)) * T2) >> 11;
+		const int32_t x2 = (((((r >> 4) - T1) * ((r >> 4) - T1)) >> 12) * T3) >> 14;
+		fine[i] = x1 + x2;
+	}
+}
+
+
+
+
+static void m_bme280_temperature_int32(size_t n, const int32_t * restrict fine, int32_t * restrict t)
+{
+	for (size_t i = 0; i < n; i++) {
+		t[i] = (fine[i] * 5 + 128) >> 8;
+	}
+}
+
+
+
+
+/* Chapter 8.2. */
+static void m_bme280_pressure_int32(const struct m_bme280_calib * c, size_t n, const int32_t * restrict fine, const int32_t * restrict raw_p, uint32_t * restrict p)
+{
+	for (size_t i = 0; i < n; i++) {
+		int32_t var1 = (fine[i] >> 1) - (int32_t) 64000;
+		int32_t var2 = (((var1 >> 2) * (var1 >> 2)) >> 11) * ((int32_t) c->dig_P6);
+		var2 = var2 + ((var1 * ((int32_t) c->dig_P5)) << 1);
+		var2 = (var2 >> 2) + (((int32_t) c->dig_P4) << 16);
+		var1 = (((c->dig_P3 * (((var1 >> 2) * (var1 >> 2)) >> 13)) >> 3) + ((((int32_t) c->dig_P2) * var1) >> 1)) >> 18;
+		var1 = ((32768 + var1) * ((int32_t) c->dig_P1)) >> 15;
+		if (var1 == 0) {
+			p[i] = 0; /* Avoid division by zero. */
+			continue;
+		}
+
+		uint32_t v = (((uint32_t) (((int32_t) 1048576) - raw_p[i])) - (var2 >> 12)) * 3125;
+		if (v < 0x80000000) {
+			v = (v << 1) / ((uint32_t) var1);
+		} else {
+			v = (v / (uint32_t) var1) * 2;
+		}
+		var1 = (((int32_t) c->dig_P9) * ((int32_t) (((v >> 3) * (v >> 3)) >> 13))) >> 12;
+		var2 = (((int32_t) (v >> 2)) * ((int32_t) c->dig_P8)) >> 13;
+		p[i] = (uint32_t) ((int32_t) v + ((var1 + var2 + c->dig_P7) >> 4));
+	}
+}
+
+
+
+
+/* Chapter 4.2.3. */
+static void m_bme280_pressure_int64(const struct m_bme280_calib * c, size_t n, const int32_t * restrict fine, const int32_t * restrict raw_p, uint32_t * restrict p)
+{
+	for (size_t i = 0; i < n; i++) {
+		int64_t var1 = ((int64_t) fine[i]) - 128000;
+		int64_t var2 = var1 * var1 * (int64_t) c->dig_P6;
+		var2 = var2 + ((var1 * (int64_t) c->dig_P5) << 17);
+		var2 = var2 + (((int64_t) c->dig_P4) << 35);
+		var1 = ((var1 * var1 * (int64_t) c->dig_P3) >> 8) + ((var1 * (int64_t) c->dig_P2) << 12);
+		var1 = (((((int64_t) 1) << 47) + var1)) * ((int64_t) c->dig_P1) >> 33;
+		if (var1 == 0) {
+			p[i] = 0; /* Avoid division by zero. */
+			continue;
+		}
+
+		int64_t v = 1048576 - raw_p[i];
+		v = (((v << 31) - var2) * 3125) / var1;
+		var1 = (((int64_t) c->dig_P9) * (v >> 13) * (v >> 13)) >> 25;
+		var2 = (((int64_t) c->dig_P8) * v) >> 19;
+		p[i] = (uint32_t) (((v + var1 + var2) >> 8) + (((int64_t) c->dig_P7) << 4));
+	}
+}
+
+
+
+
+/* Chapter 4.2.3. */
+static void m_bme280_humidity_int32(const struct m_bme280_calib * c, size_t n, const int32_t * restrict fine, const int32_t * restrict raw_h, uint32_t * restrict h)
+{
+	const int32_t H1 = c->dig_H1;
+	const int32_t H2 = c->dig_H2;
+	const int32_t H3 = c->dig_H3;
+	const int32_t H4 = c->dig_H4;
+	const int32_t H5 = c->dig_H5;
+	const int32_t H6 = c->dig_H6;
+
+	for (size_t i = 0; i < n; i++) {
+		int32_t v = fine[i] - ((int32_t) 76800);
+		v = (((((raw_h[i] << 14) - (H4 << 20) - (H5 * v)) + ((int32_t) 16384)) >> 15)
+		     * (((((((v * H6) >> 10) * (((v * H3) >> 11) + ((int32_t) 32768))) >> 10) + ((int32_t) 2097152)) * H2 + 8192) >> 14));
+		v = v - (((((v >> 15) * (v >> 15)) >> 7) * H1) >> 4);
+		v = v < 0 ? 0 : v;
+		v = v > 419430400 ? 419430400 : v;
+		h[i] = (uint32_t) (v >> 12);
+	}
+}
+
+
+
+
+static void m_bme280_compensate_integer(const struct m_bme280_calib * c, size_t n,
+					const int32_t * raw_t, const int32_t * raw_p, const int32_t * raw_h,
+					int32_t * t, uint32_t * p, uint32_t * h, int pressure_bits)
+{
+	int32_t fine[M_BME280_BLOCK];
+
+	for (size_t begin = 0; begin < n; begin += M_BME280_BLOCK) {
+		const size_t len = (n - begin) < M_BME280_BLOCK ? (n - begin) : M_BME280_BLOCK;
+
+		m_bme280_fine_int32(c, len, raw_t + begin, fine);
+		if (t) {
+			m_bme280_temperature_int32(len, fine, t + begin);
+		}
+		if (p) {
+			if (pressure_bits == 64) {
+				m_bme280_pressure_int64(c, len, fine, raw_p + begin, p + begin);
+			} else {
+				m_bme280_pressure_int32(c, len, fine, raw_p + begin, p + begin);
+			}
+		}
+		if (h) {
+			m_bme280_humidity_int32(c, len, fine, raw_h + begin, h + begin);
+		}
+	}
+}
+
+
+
+
+void m_bme280_compensate_int32(const struct m_bme280_calib * c, size_t n,
+			       const int32_t * raw_t, const int32_t * raw_p, const int32_t * raw_h,
+			       int32_t * t, uint32_t * p, uint32_t * h)
+{
+	m_bme280_compensate_integer(c, n, raw_t, raw_p, raw_h, t, p, h, 32);
+}
+
+
+
+
+void m_bme280_compensate_int64(const struct m_bme280_calib * c, size_t n,
+			       const int32_t * raw_t, const int32_t * raw_p, const int32_t * raw_h,
+			       int32_t * t, uint32_t * p, uint32_t * h)
+{
+	m_bme280_compensate_integer(c, n, raw_t, raw_p, raw_h, t, p, h, 64);
+}
+
+
+
+
+/* Chapter 8.1. Bosch's code truncates t_fine to integer also in
+   floating point variant, so do it here too. */
+static void m_bme280_fine_double(const struct m_bme280_calib * c, size_t n, const int32_t * restrict raw_t, double * restrict fine, double * restrict t)
+{
+	const double T1 = c->dig_T1;
+	const double T2 = c->dig_T2;
+	const double T3 = c->dig_T3;
+
+	for (size_t i = 0; i < n; i++) {
+		const double r = raw_t[i];
+		const double x1 = (r / 16384.0 - T1 / 1024.0) * T2;
+		const double x2 = ((r / 131072.0 - T1 / 8192.0) * (r / 131072.0 - T1 / 8192.0)) * T3;
+		fine[i] = (double) (int32_t) (x1 + x2);
+		t[i] = (x1 + x2) / 5120.0;
+	}
+}
+
+
+
+
+static void m_bme280_pressure_double(const struct m_bme280_calib * c, size_t n, const double * restrict fine, const int32_t * restrict raw_p, double * restrict p)
+{
+	const double P1 = c->dig_P1, P2 = c->dig_P2, P3 = c->dig_P3;
+	const double P4 = c->dig_P4, P5 = c->dig_P5, P6 = c->dig_P6;
+	const double P7 = c->dig_P7, P8 = c->dig_P8, P9 = c->dig_P9;
+
+	for (size_t i = 0; i < n; i++) {
+		double var1 = (fine[i] / 2.0) - 64000.0;
+		double var2 = var1 * var1 * P6 / 32768.0;
+		var2 = var2 + var1 * P5 * 2.0;
+		var2 = (var2 / 4.0) + (P4 * 65536.0);
+		var1 = (P3 * var1 * var1 / 524288.0 + P2 * var1) / 524288.0;
+		var1 = (1.0 + var1 / 32768.0) * P1;
+
+		/* Avoid division by zero without a branch. */
+		const int valid = var1 != 0.0;
+		const double divisor = valid ? var1 : 1.0;
+		double v = 1048576.0 - (double) raw_p[i];
+		v = (v - (var2 / 4096.0)) * 6250.0 / divisor;
+		var1 = P9 * v * v / 2147483648.0;
+		var2 = v * P8 / 32768.0;
+		v = v + (var1 + var2 + P7) / 16.0;
+		p[i] = valid ? v : 0.0;
+	}
+}
+
+
+
+
+static void m_bme280_humidity_double(const struct m_bme280_calib * c, size_t n, const double * restrict fine, const int32_t * restrict raw_h, double * restrict h)
+{
+	const double H1 = c->dig_H1, H2 = c->dig_H2, H3 = c->dig_H3;
+	const double H4 = c->dig_H4, H5 = c->dig_H5, H6 = c->dig_H6;
+
+	for (size_t i = 0; i < n; i++) {
+		const double x = fine[i] - 76800.0;
+		double v = ((double) raw_h[i] - (H4 * 64.0 + H5 / 16384.0 * x))
+			* (H2 / 65536.0 * (1.0 + H6 / 67108864.0 * x * (1.0 + H3 / 67108864.0 * x)));
+		v = v * (1.0 - H1 * v / 524288.0);
+		v = v > 100.0 ? 100.0 : v;
+		v = v < 0.0 ? 0.0 : v;
+		h[i] = x != 0.0 ? v : 0.0;
+	}
+}
+
+
+
+
+void m_bme280_compensate_double(const struct m_bme280_calib * c, size_t n,
+				const int32_t * raw_t, const int32_t * raw_p, const int32_t * raw_h,
+				double * t, double * p, double * h)
+{
+	double fine[M_BME280_BLOCK];
+	double temperature[M_BME280_BLOCK];
+
+	for (size_t begin = 0; begin < n; begin += M_BME280_BLOCK) {
+		const size_t len = (n - begin) < M_BME280_BLOCK ? (n - begin) : M_BME280_BLOCK;
+
+		m_bme280_fine_double(c, len, raw_t + begin, fine, t ? t + begin : temperature);
+		if (p) {
+			m_bme280_pressure_double(c, len, fine, raw_p + begin, p + begin);
+		}
+		if (h) {
+			m_bme280_humidity_double(c, len, fine, raw_h + begin, h + begin);
+		}
+	}
+}
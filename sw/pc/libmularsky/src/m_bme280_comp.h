@@ -0,0 +1,118 @@
+#ifndef M_BME280_COMP_H
+#define M_BME280_COMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+  Offline compensation of raw BME280 measurements.
+
+  mularsky started with -p stores only raw ADC values of pressure,
+  temperature and humidity, and stores chip's calibration data once,
+  in "pressure calibration: <hex>" line at the beginning of
+  pressure.txt. These functions turn arrays of the raw values into
+  compensated values.
+
+  Chapter numbers refer to BME280 datasheet (BST-BME280-DS001-10).
+*/
+
+
+/* Size of calibration data: 0x88-0x9F, 0xA1, 0xE1-0xE7 (chapter 4.2.2). */
+#define M_BME280_CALIB_SIZE 32
+
+
+struct m_bme280_calib {
+	uint16_t dig_T1;
+	int16_t  dig_T2;
+	int16_t  dig_T3;
+
+	uint16_t dig_P1;
+	int16_t  dig_P2;
+	int16_t  dig_P3;
+	int16_t  dig_P4;
+	int16_t  dig_P5;
+	int16_t  dig_P6;
+	int16_t  dig_P7;
+	int16_t  dig_P8;
+	int16_t  dig_P9;
+
+	uint8_t  dig_H1;
+	int16_t  dig_H2;
+	uint8_t  dig_H3;
+	int16_t  dig_H4;
+	int16_t  dig_H5;
+	int8_t   dig_H6;
+};
+
+
+
+/**
+   @param c: output calibration data
+   @param buffer: M_BME280_CALIB_SIZE bytes of calibration registers, in order in which mularsky reads them
+
+   @return 0
+*/
+int m_bme280_calib_from_bytes(struct m_bme280_calib * c, const uint8_t * buffer);
+
+
+
+/**
+   @param c: output calibration data
+   @param hex: calibration registers as 2 * M_BME280_CALIB_SIZE hex digits, as in "pressure calibration:" line of pressure.txt
+
+   @return 0 on success, -1 on malformed input
+*/
+int m_bme280_calib_from_hex(struct m_bme280_calib * c, const char * hex);
+
+
+
+/*
+  Batch compensation of @n samples.
+
+  Inputs are arrays of raw (uncompensated) ADC values. Outputs are
+  arrays of @n compensated values; any of output arrays may be NULL
+  if given quantity is not needed. Raw temperature is always needed,
+  since all compensations depend on it.
+
+  Functions process data in blocks, in separate simple passes over
+  arrays, so that compiler can vectorize the passes.
+*/
+
+/**
+   Integer variant from chapter 8.2 (32 bit) of datasheet.
+
+   @param t: temperature, in 0.01 DegC
+   @param p: pressure, in Pa
+   @param h: humidity, in %rH in Q22.10 format
+*/
+void m_bme280_compensate_int32(const struct m_bme280_calib * c, size_t n,
+			       const int32_t * raw_t, const int32_t * raw_p, const int32_t * raw_h,
+			       int32_t * t, uint32_t * p, uint32_t * h);
+
+/**
+   Integer variant from chapter 4.2.3 (64 bit pressure) of datasheet.
+   Temperature and humidity are the same as in 32 bit variant.
+
+   @param t: temperature, in 0.01 DegC
+   @param p: pressure, in Pa in Q24.8 format
+   @param h: humidity, in %rH in Q22.10 format
+*/
+void m_bme280_compensate_int64(const struct m_bme280_calib * c, size_t n,
+			       const int32_t * raw_t, const int32_t * raw_p, const int32_t * raw_h,
+			       int32_t * t, uint32_t * p, uint32_t * h);
+
+/**
+   Floating point variant from chapter 8.1 of datasheet.
+
+   @param t: temperature, in DegC
+   @param p: pressure, in Pa
+   @param h: humidity, in %rH
+*/
+void m_bme280_compensate_double(const struct m_bme280_calib * c, size_t n,
+				const int32_t * raw_t, const int32_t * raw_p, const int32_t * raw_h,
+				double * t, double * p, double * h);
+
+
+
+#endif /* #ifdef M_BME280_COMP_H */
@@ -0,0 +1,303 @@
+#define _POSIX_C_SOURCE 200809L /* getline(), fsync() */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "m_chunks.h"
+
+
+/* Size of buffer for copying of chunks. */
+#define M_CHUNKS_BUFFER_SIZE (1024 * 1024)
+
+
+
+
+/* Name of log of chunk: "imu.txt" for "imu.0003.txt". Returns 0 on
+   success, -1 if @name isn't a name of chunk. */
+static int m_chunks_log_name(const char * name, char log_name[NAME_MAX + 1])
+{
+	/* Last dot starts extension, unless the log has none. */
+	const char * ext = strrchr(name, '.');
+	if (!ext) {
+		return -1;
+	}
+	const char * digits = ext;
+	while (digits > name && digits[-1] != '.') {
+		digits--;
+	}
+	if (digits == name || !isdigit((unsigned char) *digits)) {
+		/* "<log>.<index>", without extension. */
+		digits = ext + 1;
+		ext = name + strlen(name);
+	}
+	for (const char * c = digits; c < ext; c++) {
+		if (!isdigit((unsigned char) *c)) {
+			return -1;
+		}
+	}
+	if (digits == ext) {
+		return -1;
+	}
+
+	snprintf(log_name, NAME_MAX + 1, "%.*s%s", (int) (digits - 1 - name), name, ext);
+	return 0;
+}
+
+
+
+
+static struct m_chunks_log * m_chunks_find(struct m_chunks * chunks, const char * name)
+{
+	for (size_t i = 0; i < chunks->n_logs; i++) {
+		if (0 == strcmp(chunks->logs[i].name, name)) {
+			return &chunks->logs[i];
+		}
+	}
+
+	struct m_chunks_log * logs = realloc(chunks->logs, (chunks->n_logs + 1) * sizeof (struct m_chunks_log));
+	if (!logs) {
+		return NULL;
+	}
+	chunks->logs = logs;
+	struct m_chunks_log * log = &chunks->logs[chunks->n_logs++];
+	memset(log, 0, sizeof (struct m_chunks_log));
+	snprintf(log->name, sizeof (log->name), "%s", name);
+
+	return log;
+}
+
+
+
+
+static int m_chunks_compare(const void * a, const void * b)
+{
+	const struct m_chunk * ca = a;
+	const struct m_chunk * cb = b;
+	return (ca->index > cb->index) - (ca->index < cb->index);
+}
+
+
+
+
+int m_chunks_load(struct m_chunks * chunks, const char * dir)
+{
+	memset(chunks, 0, sizeof (struct m_chunks));
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof (path), "%s/%s", dir, M_CHUNKS_MANIFEST);
+	FILE * file = fopen(path, "r");
+	if (!file) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		return -1;
+	}
+
+	int rv = 0;
+	char * line = NULL;
+	size_t size = 0;
+	int line_number = 0;
+	while (rv == 0 && -1 != getline(&line, &size, file)) {
+		line_number++;
+		if (line[0] == '\n' || line[0] == '\0') {
+			continue;
+		}
+
+		struct m_chunk chunk;
+		memset(&chunk, 0, sizeof (chunk));
+		char fmt[64];
+		char hex[M_MD5_HEX_SIZE + 1];
+		unsigned long long first, last, bytes, header;
+		char log_name[NAME_MAX + 1];
+		snprintf(fmt, sizeof (fmt), "%%%ds %%d %%llu %%llu %%llu %%llu %%%ds", NAME_MAX, M_MD5_HEX_SIZE);
+		if (7 != sscanf(line, fmt, chunk.name, &chunk.index, &first, &last, &bytes, &header, hex)
+		    || chunk.index < 0 || header > bytes
+		    || 0 != m_chunks_log_name(chunk.name, log_name)) {
+			fprintf(stderr, "[EE] %s:%d: invalid line %d of '%s'\n", __FUNCTION__, __LINE__, line_number, path);
+			rv = -1;
+			break;
+		}
+		chunk.first = first;
+		chunk.last = last;
+		chunk.size = bytes;
+		chunk.header_size = header;
+		/* "-" if the device couldn't hash the chunk. */
+		chunk.have_md5 = 0 == m_md5_from_hex(hex, chunk.md5);
+
+		struct m_chunks_log * log = m_chunks_find(chunks, log_name);
+		struct m_chunk * c = log ? realloc(log->chunks, (log->n_chunks + 1) * sizeof (struct m_chunk)) : NULL;
+		if (!c) {
+			rv = -1;
+			break;
+		}
+		log->chunks = c;
+		log->chunks[log->n_chunks++] = chunk;
+	}
+	free(line);
+	fclose(file);
+
+	if (rv == -1) {
+		m_chunks_free(chunks);
+		return -1;
+	}
+
+	/* Chunks of different logs are finished in any order. */
+	for (size_t i = 0; i < chunks->n_logs; i++) {
+		qsort(chunks->logs[i].chunks, chunks->logs[i].n_chunks, sizeof (struct m_chunk), m_chunks_compare);
+	}
+
+	return 0;
+}
+
+
+
+
+/* Append chunk without its repeated header to @out, checking its
+   size and md5. */
+static int m_chunks_copy(const struct m_chunk * chunk, const char * dir, int out, char * buffer)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof (path), "%s/%s", dir, chunk->name);
+	int in = open(path, O_RDONLY);
+	if (in == -1) {
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		return -1;
+	}
+
+	struct m_md5 md5;
+	m_md5_init(&md5);
+	uint64_t offset = 0;
+	int rv = 0;
+	for (;;) {
+		ssize_t n = read(in, buffer, M_CHUNKS_BUFFER_SIZE);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			fprintf(stderr, "[EE] %s:%d: can't read '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+			rv = -1;
+			break;
+		}
+		if (n == 0) {
+			break;
+		}
+		m_md5_update(&md5, buffer, n);
+
+		size_t skip = 0;
+		if (offset < chunk->header_size) {
+			skip = chunk->header_size - offset < (uint64_t) n ? chunk->header_size - offset : (size_t) n;
+		}
+		offset += n;
+		for (size_t done = skip; done < (size_t) n; ) {
+			ssize_t w = write(out, buffer + done, n - done);
+			if (w < 0 && errno == EINTR) {
+				continue;
+			}
+			if (w < 0) {
+				fprintf(stderr, "[EE] %s:%d: can't write joined '%s': %s\n", __FUNCTION__, __LINE__, chunk->name, strerror(errno));
+				rv = -1;
+				break;
+			}
+			done += w;
+		}
+		if (rv == -1) {
+			break;
+		}
+	}
+	close(in);
+	if (rv == -1) {
+		return -1;
+	}
+
+	uint8_t digest[M_MD5_DIGEST_SIZE];
+	m_md5_final(&md5, digest);
+	if (offset != chunk->size) {
+		fprintf(stderr, "[EE] %s:%d: '%s' has %llu bytes, %llu expected\n", __FUNCTION__, __LINE__,
+			path, (unsigned long long) offset, (unsigned long long) chunk->size);
+		return -1;
+	}
+	if (chunk->have_md5 && 0 != memcmp(digest, chunk->md5, M_MD5_DIGEST_SIZE)) {
+		fprintf(stderr, "[EE] %s:%d: checksum of '%s' doesn't match\n", __FUNCTION__, __LINE__, path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+int m_chunks_join(const struct m_chunks_log * log, const char * dir, int overwrite)
+{
+	for (size_t i = 0; i < log->n_chunks; i++) {
+		if (log->chunks[i].index != (int) i) {
+			fprintf(stderr, "[EE] %s:%d: chunk %zu of '%s' is missing in '%s'\n", __FUNCTION__, __LINE__, i, log->name, dir);
+			return -1;
+		}
+	}
+
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	if ((int) sizeof (path) <= snprintf(path, sizeof (path), "%s/%s", dir, log->name)
+	    || (int) sizeof (tmp_path) <= snprintf(tmp_path, sizeof (tmp_path), "%s.part", path)) {
+		fprintf(stderr, "[EE] %s:%d: path too long in '%s'\n", __FUNCTION__, __LINE__, dir);
+		return -1;
+	}
+	if (!overwrite && 0 == access(path, F_OK)) {
+		fprintf(stderr, "[EE] %s:%d: '%s' already exists\n", __FUNCTION__, __LINE__, path);
+		return -1;
+	}
+
+	char * buffer = malloc(M_CHUNKS_BUFFER_SIZE);
+	if (!buffer) {
+		return -1;
+	}
+	int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out == -1) {
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, tmp_path, strerror(errno));
+		free(buffer);
+		return -1;
+	}
+
+	int rv = 0;
+	for (size_t i = 0; rv == 0 && i < log->n_chunks; i++) {
+		rv = m_chunks_copy(&log->chunks[i], dir, out, buffer);
+	}
+	if (rv == 0 && 0 != fsync(out)) {
+		fprintf(stderr, "[EE] %s:%d: can't sync '%s': %s\n", __FUNCTION__, __LINE__, tmp_path, strerror(errno));
+		rv = -1;
+	}
+	close(out);
+	free(buffer);
+
+	if (rv == 0 && 0 != rename(tmp_path, path)) {
+		fprintf(stderr, "[EE] %s:%d: can't rename '%s': %s\n", __FUNCTION__, __LINE__, tmp_path, strerror(errno));
+		rv = -1;
+	}
+	if (rv == -1) {
+		unlink(tmp_path);
+	}
+
+	return rv;
+}
+
+
+
+
+void m_chunks_free(struct m_chunks * chunks)
+{
+	for (size_t i = 0; i < chunks->n_logs; i++) {
+		free(chunks->logs[i].chunks);
+	}
+	free(chunks->logs);
+	memset(chunks, 0, sizeof (struct m_chunks));
+
+	return;
+}
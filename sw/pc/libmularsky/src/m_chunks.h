@@ -0,0 +1,89 @@
+#ifndef M_CHUNKS_H
+#define M_CHUNKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "m_md5.h"
+
+
+/*
+  Joining of rotated logs.
+
+  With rotation of logs (mularsky -I/-S), a log of a session is a
+  sequence of chunks (imu.0000.txt, imu.0001.txt, ...) instead of one
+  file (imu.txt). Finished chunks are listed in session manifest
+  chunks.txt, with lines
+
+      <file> <index> <first second> <last second> <bytes> <header bytes> <md5>
+
+  Each chunk but the first starts with <header bytes> of repeated
+  header of the log (e.g. calibration of pressure sensor). Chunks
+  without their repeated headers, concatenated in order of indexes,
+  are the log as it would be written without rotation, so joined
+  logs can be read by all tools.
+*/
+
+
+#define M_CHUNKS_MANIFEST "chunks.txt"
+
+
+struct m_chunk {
+	char name[NAME_MAX + 1];        /* File of chunk, in session dir. */
+	int index;
+	uint64_t first;                 /* First and last second of chunk. */
+	uint64_t last;
+	uint64_t size;
+	uint64_t header_size;           /* Bytes of repeated header. */
+	int have_md5;                   /* Was md5 known to the device? */
+	uint8_t md5[M_MD5_DIGEST_SIZE];
+};
+
+
+struct m_chunks_log {
+	char name[NAME_MAX + 1];        /* "imu.txt" for "imu.0000.txt", ... */
+	struct m_chunk * chunks;        /* Sorted by index. */
+	size_t n_chunks;
+};
+
+
+struct m_chunks {
+	struct m_chunks_log * logs;
+	size_t n_logs;
+};
+
+
+
+/**
+   Read session manifest of chunks in @dir.
+
+   Session without the manifest (recorded without rotation) has no
+   rotated logs.
+
+   @return 0 on success, -1 on failure
+*/
+int m_chunks_load(struct m_chunks * chunks, const char * dir);
+
+
+
+/**
+   Join chunks of @log into file of its plain name in @dir.
+
+   Size and md5 of each chunk are checked against the manifest, and
+   chunks must have consecutive indexes starting at 0. Chunks are
+   joined into a temporary file, which is renamed on success.
+
+   @param overwrite: replace existing file of plain name
+
+   @return 0 on success, -1 on failure
+*/
+int m_chunks_join(const struct m_chunks_log * log, const char * dir, int overwrite);
+
+
+
+void m_chunks_free(struct m_chunks * chunks);
+
+
+
+#endif /* #ifdef M_CHUNKS_H */
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L /* posix_madvise() */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "m_columnar.h"
+
+
+/* Number of rows gathered into buffer before writing. */
+#define M_COL_BLOCK 4096
+
+
+
+
+size_t m_col_type_size(enum m_col_type type)
+{
+	switch (type) {
+	case M_COL_INT8:
+	case M_COL_UINT8:
+		return 1;
+	case M_COL_INT16:
+	case M_COL_UINT16:
+		return 2;
+	case M_COL_INT32:
+	case M_COL_UINT32:
+		return 4;
+	case M_COL_INT64:
+	case M_COL_DOUBLE:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+
+
+
+static size_t m_col_align(size_t offset)
+{
+	return (offset + M_COL_ALIGN - 1) / M_COL_ALIGN * M_COL_ALIGN;
+}
+
+
+
+
+int m_col_write(const char * path, size_t n_rows, const struct m_col_source * sources, size_t n_columns)
+{
+	struct m_col_header header = { { 0 }, M_COL_VERSION, n_columns, n_rows };
+	memcpy(header.magic, M_COL_MAGIC, sizeof (header.magic));
+
+	struct m_col_desc * descs = calloc(n_columns ? n_columns : 1, sizeof (struct m_col_desc));
+	char * buffer = malloc(M_COL_BLOCK * sizeof (uint64_t));
+	if (!descs || !buffer) {
+		free(descs);
+		free(buffer);
+		return -1;
+	}
+
+	size_t offset = m_col_align(sizeof (header) + n_columns * sizeof (struct m_col_desc));
+	for (size_t c = 0; c < n_columns; c++) {
+		snprintf(descs[c].name, sizeof (descs[c].name), "%s", sources[c].name);
+		snprintf(descs[c].unit, sizeof (descs[c].unit), "%s", sources[c].unit);
+		descs[c].type = sources[c].type;
+		descs[c].scale = sources[c].scale;
+		descs[c].offset = offset;
+		offset = m_col_align(offset + n_rows * m_col_type_size(sources[c].type));
+	}
+
+	FILE * file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		free(descs);
+		free(buffer);
+		return -1;
+	}
+
+	int rv = 0;
+	if (1 != fwrite(&header, sizeof (header), 1, file)
+	    || n_columns != fwrite(descs, sizeof (struct m_col_desc), n_columns, file)) {
+		rv = -1;
+	}
+
+	for (size_t c = 0; c < n_columns && rv == 0; c++) {
+		/* Padding up to aligned beginning of column. */
+		static const char zeros[M_COL_ALIGN] = { 0 };
+		const long pos = ftell(file);
+		if (pos < 0 || (uint64_t) pos > descs[c].offset
+		    || (descs[c].offset - pos) != fwrite(zeros, 1, descs[c].offset - pos, file)) {
+			rv = -1;
+			break;
+		}
+
+		/* Gather values of column from rows, block by block. */
+		const size_t size = m_col_type_size(sources[c].type);
+		const char * row = sources[c].base;
+		for (size_t r = 0; r < n_rows; r += M_COL_BLOCK) {
+			const size_t n = n_rows - r < M_COL_BLOCK ? n_rows - r : M_COL_BLOCK;
+			for (size_t i = 0; i < n; i++) {
+				memcpy(buffer + i * size, row, size);
+				row += sources[c].stride;
+			}
+			if (n != fwrite(buffer, size, n, file)) {
+				rv = -1;
+				break;
+			}
+		}
+	}
+
+	if (0 != fclose(file)) {
+		rv = -1;
+	}
+	if (rv == -1) {
+		fprintf(stderr, "[EE] %s:%d: failed to write '%s'\n", __FUNCTION__, __LINE__, path);
+	}
+
+	free(descs);
+	free(buffer);
+
+	return rv;
+}
+
+
+
+
+int m_col_open(struct m_col_file * file, const char * path)
+{
+	memset(file, 0, sizeof (struct m_col_file));
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (0 != fstat(fd, &st) || (size_t) st.st_size < sizeof (struct m_col_header)) {
+		fprintf(stderr, "[EE] %s:%d: '%s' is not a columnar file\n", __FUNCTION__, __LINE__, path);
+		close(fd);
+		return -1;
+	}
+
+	void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "[EE] %s:%d: can't map '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		return -1;
+	}
+
+	file->map = map;
+	file->size = st.st_size;
+	file->header = map;
+	file->columns = (const struct m_col_desc *) (file->header + 1);
+
+	/* Validate everything that is used for accessing columns. */
+	const struct m_col_header * header = file->header;
+	if (0 != memcmp(header->magic, M_COL_MAGIC, sizeof (header->magic))
+	    || header->version != M_COL_VERSION
+	    || sizeof (struct m_col_header) + header->n_columns * sizeof (struct m_col_desc) > file->size) {
+		fprintf(stderr, "[EE] %s:%d: '%s' is not a valid columnar file\n", __FUNCTION__, __LINE__, path);
+		m_col_close(file);
+		return -1;
+	}
+	for (uint32_t c = 0; c < header->n_columns; c++) {
+		const struct m_col_desc * desc = &file->columns[c];
+		const size_t size = m_col_type_size(desc->type);
+		if (size == 0
+		    || desc->offset % M_COL_ALIGN
+		    || desc->offset > file->size
+		    || header->n_rows > (file->size - desc->offset) / size) {
+			fprintf(stderr, "[EE] %s:%d: invalid column %u in '%s'\n", __FUNCTION__, __LINE__, c, path);
+			m_col_close(file);
+			return -1;
+		}
+	}
+
+	posix_madvise(map, file->size, POSIX_MADV_WILLNEED);
+
+	return 0;
+}
+
+
+
+
+void m_col_close(struct m_col_file * file)
+{
+	if (file->map) {
+		munmap(file->map, file->size);
+	}
+	memset(file, 0, sizeof (struct m_col_file));
+}
+
+
+
+
+const void * m_col_get(const struct m_col_file * file, const char * name, const struct m_col_desc ** desc)
+{
+	for (uint32_t c = 0; c < file->header->n_columns; c++) {
+		if (0 == strncmp(file->columns[c].name, name, sizeof (file->columns[c].name))) {
+			if (desc) {
+				*desc = &file->columns[c];
+			}
+			return (const char *) file->map + file->columns[c].offset;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,127 @@
+#ifndef M_COLUMNAR_H
+#define M_COLUMNAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+  Columnar binary files with data of one sensor of a session
+  (imu.col, pressure.col).
+
+  File starts with a header and descriptors of columns, followed by
+  one contiguous typed array per channel (acc_x, qua_w, pressure,
+  ...). Each array starts at offset aligned to M_COL_ALIGN bytes.
+  Descriptor gives type of values, unit, and scale factor converting
+  stored values to the unit (value_in_unit = stored_value * scale).
+
+  Files are written in native byte order of the machine.
+
+  Loader memory-maps the file, so columns can be used directly as C
+  arrays.
+*/
+
+
+#define M_COL_MAGIC "MLRSKCOL"
+#define M_COL_VERSION 1
+#define M_COL_ALIGN 64
+
+
+enum m_col_type {
+	M_COL_INT8 = 1,
+	M_COL_UINT8,
+	M_COL_INT16,
+	M_COL_UINT16,
+	M_COL_INT32,
+	M_COL_UINT32,
+	M_COL_INT64,
+	M_COL_DOUBLE
+};
+
+
+struct m_col_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_columns;
+	uint64_t n_rows;
+};
+
+
+struct m_col_desc {
+	char name[24];
+	char unit[16];
+	uint32_t type;          /* enum m_col_type. */
+	uint32_t reserved;
+	double scale;
+	uint64_t offset;        /* Offset of column's array from beginning of file. */
+};
+
+
+/*
+  Source of a column for writer: values are gathered from @base with
+  @stride bytes between rows, so columns can be written directly from
+  an array of structures.
+*/
+struct m_col_source {
+	const char * name;
+	const char * unit;
+	enum m_col_type type;
+	double scale;
+	const void * base;
+	size_t stride;
+};
+
+
+struct m_col_file {
+	void * map;
+	size_t size;
+	const struct m_col_header * header;
+	const struct m_col_desc * columns;
+};
+
+
+
+/**
+   @return size of value of given type, 0 for invalid type
+*/
+size_t m_col_type_size(enum m_col_type type);
+
+
+
+/**
+   Write columnar file.
+
+   @param n_rows: number of rows in each source
+   @param sources: descriptions of @n_columns columns
+
+   @return 0 on success, -1 on failure
+*/
+int m_col_write(const char * path, size_t n_rows, const struct m_col_source * sources, size_t n_columns);
+
+
+
+/**
+   Memory-map columnar file and validate its header and descriptors.
+
+   @return 0 on success, -1 on failure
+*/
+int m_col_open(struct m_col_file * file, const char * path);
+
+
+
+void m_col_close(struct m_col_file * file);
+
+
+
+/**
+   Find column by name.
+
+   @param desc: if not NULL, descriptor of the column is returned here
+
+   @return pointer to column's array, NULL if there is no such column
+*/
+const void * m_col_get(const struct m_col_file * file, const char * name, const struct m_col_desc ** desc);
+
+
+
+#endif /* #ifdef M_COLUMNAR_H */
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include "m_convert.h"
+#include "m_input.h"
+#include "m_log.h"
+#include "m_columnar.h"
+#include "m_bme280_comp.h"
+#include "m_attitude.h"
+
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+
+/* Growing array of samples. */
+struct m_samples {
+	void * data;
+	size_t n;
+	size_t capacity;
+	size_t size;       /* Size of one sample. */
+};
+
+
+
+
+static void * m_samples_append(struct m_samples * samples)
+{
+	if (samples->n == samples->capacity) {
+		const size_t capacity = samples->capacity ? 2 * samples->capacity : 4096;
+		void * data = realloc(samples->data, capacity * samples->size);
+		if (!data) {
+			fprintf(stderr, "[EE] can't allocate memory for %zu samples\n", capacity);
+			return NULL;
+		}
+		samples->data = data;
+		samples->capacity = capacity;
+	}
+
+	return (char *) samples->data + samples->size * samples->n++;
+}
+
+
+
+
+/* Column of array of samples of type @type, member @member. Array of
+   session without samples may be NULL, and then so is the column (no
+   arithmetic on NULL); m_col_write() doesn't read it for 0 rows. */
+#define M_COLUMN(name, unit, col_type, scale, samples, type, member) \
+	{ name, unit, col_type, scale, (samples) ? (const char *) (samples) + offsetof(type, member) : NULL, sizeof (type) }
+
+
+
+
+int m_convert_imu(const char * dir, int n_threads)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof (path), "%s/imu.txt", dir);
+
+	struct m_input input;
+	if (-1 == m_input_open(&input, path)) {
+		return -1;
+	}
+
+	struct m_samples samples = { NULL, 0, 0, sizeof (struct m_imu_sample) };
+	size_t n_other = 0;
+	const char * data;
+	size_t size;
+	int rv;
+	if (input.mapped) {
+		/* Whole file is available at once, so it can be parsed by
+		   many threads. */
+		struct m_imu_sample * parsed;
+		rv = m_input_next_block(&input, &data, &size);
+		if (rv == 1) {
+			rv = m_log_parse_imu_parallel(data, size, n_threads, &parsed, &samples.n, &n_other);
+		}
+		if (rv == 0) {
+			samples.data = parsed;
+			samples.capacity = samples.n;
+		}
+	} else {
+		while (1 == (rv = m_input_next_block(&input, &data, &size))) {
+			const char * end = data + size;
+			const char * line = data;
+			while (line < end) {
+				const char * eol = memchr(line, '\n', end - line);
+				const char * next = eol ? eol + 1 : end;
+
+				struct m_imu_sample sample;
+				if (0 == m_log_parse_imu(line, next - line, &sample)) {
+					struct m_imu_sample * s = m_samples_append(&samples);
+					if (!s) {
+						rv = -1;
+						break;
+					}
+					*s = sample;
+				} else {
+					n_other++;
+				}
+
+				line = next;
+			}
+			if (rv == -1) {
+				break;
+			}
+		}
+	}
+	m_input_close(&input);
+
+	if (rv == -1) {
+		free(samples.data);
+		return -1;
+	}
+
+	/* Attitude with full precision of quaternions, and earth-frame
+	   linear acceleration. */
+	const size_t n = samples.n ? samples.n : 1;
+	double * attitude = malloc(13 * n * sizeof (double));
+	if (!attitude) {
+		fprintf(stderr, "[EE] can't allocate memory for attitude of %zu samples\n", samples.n);
+		free(samples.data);
+		return -1;
+	}
+	double * w = attitude;
+	double * x = attitude + n;
+	double * y = attitude + 2 * n;
+	double * z = attitude + 3 * n;
+	double * yaw = attitude + 4 * n;
+	double * pitch = attitude + 5 * n;
+	double * roll = attitude + 6 * n;
+	double * acc = attitude + 7 * n;
+	double * earth_acc = attitude + 10 * n;
+
+	const struct m_imu_sample * s = samples.data;
+	m_attitude_quat_from_samples(s, samples.n, w, x, y, z);
+	m_attitude_euler(samples.n, w, x, y, z, yaw, pitch, roll);
+	for (size_t i = 0; i < samples.n; i++) {
+		acc[i] = s[i].acc[0] * M_IMU_SCALE_ACC;
+		acc[n + i] = s[i].acc[1] * M_IMU_SCALE_ACC;
+		acc[2 * n + i] = s[i].acc[2] * M_IMU_SCALE_ACC;
+	}
+	m_attitude_earth_acc(samples.n, w, x, y, z, acc, acc + n, acc + 2 * n, M_ATTITUDE_GRAVITY,
+			     earth_acc, earth_acc + n, earth_acc + 2 * n);
+
+	const struct m_col_source columns[] = {
+		M_COLUMN("time",    "s",     M_COL_INT64,  1.0,              s, struct m_imu_sample, time),
+		M_COLUMN("acc_x",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_ACC,  s, struct m_imu_sample, acc[0]),
+		M_COLUMN("acc_y",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_ACC,  s, struct m_imu_sample, acc[1]),
+		M_COLUMN("acc_z",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_ACC,  s, struct m_imu_sample, acc[2]),
+		M_COLUMN("mag_x",   "uT",    M_COL_INT16,  M_IMU_SCALE_MAG,  s, struct m_imu_sample, mag[0]),
+		M_COLUMN("mag_y",   "uT",    M_COL_INT16,  M_IMU_SCALE_MAG,  s, struct m_imu_sample, mag[1]),
+		M_COLUMN("mag_z",   "uT",    M_COL_INT16,  M_IMU_SCALE_MAG,  s, struct m_imu_sample, mag[2]),
+		M_COLUMN("gyr_x",   "dps",   M_COL_INT16,  M_IMU_SCALE_GYR,  s, struct m_imu_sample, gyr[0]),
+		M_COLUMN("gyr_y",   "dps",   M_COL_INT16,  M_IMU_SCALE_GYR,  s, struct m_imu_sample, gyr[1]),
+		M_COLUMN("gyr_z",   "dps",   M_COL_INT16,  M_IMU_SCALE_GYR,  s, struct m_imu_sample, gyr[2]),
+		M_COLUMN("eul_h",   "deg",   M_COL_INT16,  M_IMU_SCALE_EUL,  s, struct m_imu_sample, eul[0]),
+		M_COLUMN("eul_r",   "deg",   M_COL_INT16,  M_IMU_SCALE_EUL,  s, struct m_imu_sample, eul[1]),
+		M_COLUMN("eul_p",   "deg",   M_COL_INT16,  M_IMU_SCALE_EUL,  s, struct m_imu_sample, eul[2]),
+		M_COLUMN("qua_w",   "",      M_COL_INT16,  M_IMU_SCALE_QUA,  s, struct m_imu_sample, qua[0]),
+		M_COLUMN("qua_x",   "",      M_COL_INT16,  M_IMU_SCALE_QUA,  s, struct m_imu_sample, qua[1]),
+		M_COLUMN("qua_y",   "",      M_COL_INT16,  M_IMU_SCALE_QUA,  s, struct m_imu_sample, qua[2]),
+		M_COLUMN("qua_z",   "",      M_COL_INT16,  M_IMU_SCALE_QUA,  s, struct m_imu_sample, qua[3]),
+		M_COLUMN("lia_x",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_LIA,  s, struct m_imu_sample, lia[0]),
+		M_COLUMN("lia_y",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_LIA,  s, struct m_imu_sample, lia[1]),
+		M_COLUMN("lia_z",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_LIA,  s, struct m_imu_sample, lia[2]),
+		M_COLUMN("grv_x",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_GRV,  s, struct m_imu_sample, grv[0]),
+		M_COLUMN("grv_y",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_GRV,  s, struct m_imu_sample, grv[1]),
+		M_COLUMN("grv_z",   "m/s^2", M_COL_INT16,  M_IMU_SCALE_GRV,  s, struct m_imu_sample, grv[2]),
+		M_COLUMN("temp",    "degC",  M_COL_INT8,   M_IMU_SCALE_TEMP, s, struct m_imu_sample, temp),
+		M_COLUMN("calib",   "",      M_COL_UINT8,  1.0,              s, struct m_imu_sample, calib),
+		M_COLUMN("repeats", "",      M_COL_UINT32, 1.0,              s, struct m_imu_sample, repeats),
+		{ "yaw",         "deg",   M_COL_DOUBLE, 1.0, yaw,               sizeof (double) },
+		{ "pitch",       "deg",   M_COL_DOUBLE, 1.0, pitch,             sizeof (double) },
+		{ "roll",        "deg",   M_COL_DOUBLE, 1.0, roll,              sizeof (double) },
+		{ "earth_lia_x", "m/s^2", M_COL_DOUBLE, 1.0, earth_acc,         sizeof (double) },
+		{ "earth_lia_y", "m/s^2", M_COL_DOUBLE, 1.0, earth_acc + n,     sizeof (double) },
+		{ "earth_lia_z", "m/s^2", M_COL_DOUBLE, 1.0, earth_acc + 2 * n, sizeof (double) },
+	};
+
+	snprintf(path, sizeof (path), "%s/imu.col", dir);
+	rv = m_col_write(path, samples.n, columns, sizeof (columns) / sizeof (columns[0]));
+	fprintf(stderr, "[II] '%s': %zu samples, %zu other lines\n", path, samples.n, n_other);
+
+	free(attitude);
+	free(samples.data);
+	return rv;
+}
+
+
+
+
+/* Compensate raw pressure samples (all samples are raw if first one is). */
+static int m_compensate_pressure(struct m_pressure_sample * s, size_t n, const char * hex)
+{
+	struct m_bme280_calib calib;
+	if (hex[0] == '\0' || 0 != m_bme280_calib_from_hex(&calib, hex)) {
+		fprintf(stderr, "[EE] raw pressure samples without valid calibration data\n");
+		return -1;
+	}
+
+	int32_t * raw = malloc(3 * n * sizeof (int32_t));
+	int32_t * t = malloc(n * sizeof (int32_t));
+	uint32_t * p = malloc(n * sizeof (uint32_t));
+	uint32_t * h = malloc(n * sizeof (uint32_t));
+	if (!raw || !t || !p || !h) {
+		free(raw);
+		free(t);
+		free(p);
+		free(h);
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		raw[i] = s[i].raw_temperature;
+		raw[n + i] = s[i].raw_pressure;
+		raw[2 * n + i] = s[i].raw_humidity;
+	}
+	m_bme280_compensate_int32(&calib, n, raw, raw + n, raw + 2 * n, t, p, h);
+	for (size_t i = 0; i < n; i++) {
+		s[i].temperature = t[i];
+		s[i].pressure = p[i];
+		s[i].humidity = h[i];
+		s[i].compensated = 1;
+	}
+
+	free(raw);
+	free(t);
+	free(p);
+	free(h);
+
+	return 0;
+}
+
+
+
+
+int m_convert_pressure(const char * dir)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof (path), "%s/pressure.txt", dir);
+
+	struct m_input input;
+	if (-1 == m_input_open(&input, path)) {
+		return -1;
+	}
+
+	struct m_samples samples = { NULL, 0, 0, sizeof (struct m_pressure_sample) };
+	char hex[2 * M_BME280_CALIB_SIZE + 1] = { 0 };
+	unsigned long n_other = 0;
+	const char * data;
+	size_t size;
+	int rv;
+	while (1 == (rv = m_input_next_block(&input, &data, &size))) {
+		const char * end = data + size;
+		const char * line = data;
+		while (line < end) {
+			const char * eol = memchr(line, '\n', end - line);
+			const char * next = eol ? eol + 1 : end;
+
+			struct m_pressure_sample sample;
+			if (0 == m_log_parse_pressure(line, next - line, &sample)) {
+				struct m_pressure_sample * s = m_samples_append(&samples);
+				if (!s) {
+					rv = -1;
+					break;
+				}
+				*s = sample;
+			} else if (0 != m_log_parse_pressure_calibration(line, next - line, hex)) {
+				n_other++;
+			}
+
+			line = next;
+		}
+		if (rv == -1) {
+			break;
+		}
+	}
+	m_input_close(&input);
+
+	struct m_pressure_sample * s = samples.data;
+	if (rv != -1 && samples.n && !s[0].compensated) {
+		rv = m_compensate_pressure(s, samples.n, hex);
+	}
+	if (rv == -1) {
+		free(samples.data);
+		return -1;
+	}
+
+	const struct m_col_source columns[] = {
+		M_COLUMN("time",            "s",    M_COL_INT64,  1.0,                          s, struct m_pressure_sample, time),
+		M_COLUMN("raw_pressure",    "",     M_COL_INT32,  1.0,                          s, struct m_pressure_sample, raw_pressure),
+		M_COLUMN("raw_temperature", "",     M_COL_INT32,  1.0,                          s, struct m_pressure_sample, raw_temperature),
+		M_COLUMN("raw_humidity",    "",     M_COL_INT32,  1.0,                          s, struct m_pressure_sample, raw_humidity),
+		M_COLUMN("pressure",        "Pa",   M_COL_UINT32, M_PRESSURE_SCALE_PRESSURE,    s, struct m_pressure_sample, pressure),
+		M_COLUMN("temperature",     "degC", M_COL_INT32,  M_PRESSURE_SCALE_TEMPERATURE, s, struct m_pressure_sample, temperature),
+		M_COLUMN("humidity",        "%rH",  M_COL_UINT32, M_PRESSURE_SCALE_HUMIDITY,    s, struct m_pressure_sample, humidity),
+		M_COLUMN("repeats",         "",     M_COL_UINT32, 1.0,                          s, struct m_pressure_sample, repeats),
+	};
+
+	snprintf(path, sizeof (path), "%s/pressure.col", dir);
+	rv = m_col_write(path, samples.n, columns, sizeof (columns) / sizeof (columns[0]));
+	fprintf(stderr, "[II] '%s': %zu samples, %lu other lines\n", path, samples.n, n_other);
+
+	free(samples.data);
+	return rv;
+}
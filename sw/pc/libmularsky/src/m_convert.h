@@ -0,0 +1,42 @@
+#ifndef M_CONVERT_H
+#define M_CONVERT_H
+
+
+/*
+  Conversion of imu.txt and pressure.txt of a session into columnar
+  files imu.col and pressure.col (see m_columnar.h), written to the
+  session directory.
+*/
+
+
+
+/**
+   imu.txt is parsed by @n_threads threads if the file can be
+   memory-mapped.
+
+   Besides columns of values from imu.txt, imu.col gets yaw, pitch,
+   roll and earth-frame linear acceleration computed from
+   quaternions (see m_attitude.h).
+
+   @param dir: session directory
+   @param n_threads: number of threads, 0 for number of online CPUs
+
+   @return 0 on success, -1 on failure
+*/
+int m_convert_imu(const char * dir, int n_threads);
+
+
+
+/**
+   Raw pressure measurements (mularsky -p) are compensated with
+   calibration data from the beginning of pressure.txt.
+
+   @param dir: session directory
+
+   @return 0 on success, -1 on failure
+*/
+int m_convert_pressure(const char * dir);
+
+
+
+#endif /* #ifdef M_CONVERT_H */
@@ -0,0 +1,543 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "m_fusion.h"
+#include "m_attitude.h"
+
+
+#define NSECS_PER_SEC 1000000000LL
+#define N M_FUSION_STATES
+
+#define M_FUSION_PI 3.14159265358979323846
+#define M_FUSION_RAD (M_FUSION_PI / 180.0)
+
+/* WGS84 ellipsoid. */
+#define M_FUSION_WGS84_A  6378137.0
+#define M_FUSION_WGS84_E2 6.69437999014e-3
+
+/* Barometric formula of standard atmosphere:
+   p = P0 * (1 - h / H) ^ K. */
+#define M_FUSION_P0 101325.0
+#define M_FUSION_H0 44330.0
+#define M_FUSION_K  5.255
+
+/* Indexes of states. */
+#define X_POS     0   /* east, north, up */
+#define X_VEL     3
+#define X_ACC_OFF 6
+#define X_BARO    9
+
+/* Indexes of inputs. */
+#define IN_IMU      0
+#define IN_PRESSURE 1
+#define IN_NMEA     2
+
+/* Indexes of used channels of inputs. */
+#define CH_ACC_X 0    /* acc_x, acc_y, acc_z, qua_w, qua_x, qua_y, qua_z */
+#define CH_QUA_W 3
+#define CH_PRESSURE 0
+#define CH_LAT    0   /* latitude, longitude, altitude, speed, course, hdop */
+#define CH_LON    1
+#define CH_ALT    2
+#define CH_SPEED  3
+#define CH_COURSE 4
+#define CH_HDOP   5
+
+
+static const char * m_fusion_imu_channels[] = { "acc_x", "acc_y", "acc_z", "qua_w", "qua_x", "qua_y", "qua_z", NULL };
+static const char * m_fusion_pressure_channels[] = { "pressure", NULL };
+static const char * m_fusion_nmea_channels[] = { "latitude", "longitude", "altitude", "speed", "course", "hdop", NULL };
+
+
+
+
+void m_fusion_default_params(struct m_fusion_params * params)
+{
+	params->period_ns = 10 * 1000000LL;
+
+	params->acc_noise = 0.5;
+	params->acc_offset_walk = 0.01;
+	params->baro_offset_walk = 0.05;
+
+	params->gps_noise = 3.0;
+	params->gps_alt_noise = 6.0;
+	params->gps_speed_noise = 0.5;
+	params->pressure_noise = 3.0;
+	params->gate = 5.0;
+
+	params->yaw_offset = 0.0;
+	params->horizontal_imu = 1;
+
+	return;
+}
+
+
+
+
+static double m_fusion_pressure_altitude(double pressure)
+{
+	return M_FUSION_H0 * (1.0 - pow(pressure / M_FUSION_P0, 1.0 / M_FUSION_K));
+}
+
+
+
+
+static int m_fusion_input_init(struct m_fusion_input * input, struct m_align_source * source, const char * const * channels)
+{
+	memset(input, 0, sizeof (struct m_fusion_input));
+	input->source = source;
+	if (!source) {
+		return 0;
+	}
+
+	for (int i = 0; channels[i]; i++) {
+		input->channels[i] = -1;
+		for (size_t c = 0; c < source->n_channels; c++) {
+			if (0 == strcmp(channels[i], source->channels[c])) {
+				input->channels[i] = (int) c;
+			}
+		}
+		if (input->channels[i] == -1) {
+			fprintf(stderr, "[EE] %s:%d: source '%s' has no channel '%s'\n", __FUNCTION__, __LINE__, source->name, channels[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+static int m_fusion_input_read(struct m_fusion_input * input)
+{
+	input->have = 0;
+	if (!input->source) {
+		return 0;
+	}
+	const int rv = input->source->next(input->source, &input->time_ns, input->values);
+	input->have = rv == 1;
+	return rv;
+}
+
+
+
+
+static double m_fusion_value(const struct m_fusion_input * input, int channel)
+{
+	return input->values[input->channels[channel]];
+}
+
+
+
+
+int m_fusion_init(struct m_fusion * fusion, const struct m_fusion_params * params,
+		  struct m_align_source * imu, struct m_align_source * pressure, struct m_align_source * nmea)
+{
+	memset(fusion, 0, sizeof (struct m_fusion));
+	fusion->params = *params;
+	fusion->last_pressure = NAN;
+
+	if (!nmea || params->period_ns <= 0) {
+		return -1;
+	}
+	if (0 != m_fusion_input_init(&fusion->inputs[IN_IMU], imu, m_fusion_imu_channels)
+	    || 0 != m_fusion_input_init(&fusion->inputs[IN_PRESSURE], pressure, m_fusion_pressure_channels)
+	    || 0 != m_fusion_input_init(&fusion->inputs[IN_NMEA], nmea, m_fusion_nmea_channels)) {
+		return -1;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		if (-1 == m_fusion_input_read(&fusion->inputs[i])) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+/* Propagate state to time @time_ns, with current acceleration input. */
+static void m_fusion_predict(struct m_fusion * fusion, int64_t time_ns)
+{
+	const double dt = (time_ns - fusion->time_ns) / (double) NSECS_PER_SEC;
+	if (dt <= 0.0) {
+		return;
+	}
+	fusion->time_ns = time_ns;
+
+	double * x = fusion->x;
+	for (int i = 0; i < 3; i++) {
+		const double a = fusion->acc[i] - x[X_ACC_OFF + i];
+		x[X_POS + i] += x[X_VEL + i] * dt + 0.5 * a * dt * dt;
+		x[X_VEL + i] += a * dt;
+	}
+
+	/* P = F * P * F' + Q */
+	double F[N][N] = { { 0 } };
+	for (int i = 0; i < N; i++) {
+		F[i][i] = 1.0;
+	}
+	for (int i = 0; i < 3; i++) {
+		F[X_POS + i][X_VEL + i] = dt;
+		F[X_POS + i][X_ACC_OFF + i] = -0.5 * dt * dt;
+		F[X_VEL + i][X_ACC_OFF + i] = -dt;
+	}
+
+	double FP[N][N];
+	for (int i = 0; i < N; i++) {
+		for (int j = 0; j < N; j++) {
+			double sum = 0.0;
+			for (int k = 0; k < N; k++) {
+				sum += F[i][k] * fusion->P[k][j];
+			}
+			FP[i][j] = sum;
+		}
+	}
+	for (int i = 0; i < N; i++) {
+		for (int j = 0; j < N; j++) {
+			double sum = 0.0;
+			for (int k = 0; k < N; k++) {
+				sum += FP[i][k] * F[j][k];
+			}
+			fusion->P[i][j] = sum;
+		}
+	}
+
+	/* Acceleration is white noise of density acc_noise^2. */
+	const double q = fusion->params.acc_noise * fusion->params.acc_noise;
+	for (int i = 0; i < 3; i++) {
+		fusion->P[X_POS + i][X_POS + i] += q * dt * dt * dt / 3.0;
+		fusion->P[X_POS + i][X_VEL + i] += q * dt * dt / 2.0;
+		fusion->P[X_VEL + i][X_POS + i] += q * dt * dt / 2.0;
+		fusion->P[X_VEL + i][X_VEL + i] += q * dt;
+		fusion->P[X_ACC_OFF + i][X_ACC_OFF + i] += fusion->params.acc_offset_walk * fusion->params.acc_offset_walk * dt;
+	}
+	fusion->P[X_BARO][X_BARO] += fusion->params.baro_offset_walk * fusion->params.baro_offset_walk * dt;
+
+	return;
+}
+
+
+
+
+/*
+  Update with scalar measurement.
+
+  @h: row of Jacobian of measurement function
+  @innovation: measurement minus its prediction
+  @sigma: standard deviation of measurement
+
+  @return 0 if measurement is used, -1 if it's rejected by gate
+*/
+static int m_fusion_update(struct m_fusion * fusion, const double h[N], double innovation, double sigma)
+{
+	double PH[N];
+	double S = sigma * sigma;
+	for (int i = 0; i < N; i++) {
+		PH[i] = 0.0;
+		for (int j = 0; j < N; j++) {
+			PH[i] += fusion->P[i][j] * h[j];
+		}
+		S += h[i] * PH[i];
+	}
+
+	if (innovation * innovation > fusion->params.gate * fusion->params.gate * S) {
+		fusion->stats.rejected++;
+		return -1;
+	}
+
+	for (int i = 0; i < N; i++) {
+		const double K = PH[i] / S;
+		fusion->x[i] += K * innovation;
+		for (int j = 0; j < N; j++) {
+			fusion->P[i][j] -= K * PH[j];
+		}
+	}
+	/* Keep P symmetric despite rounding. */
+	for (int i = 0; i < N; i++) {
+		for (int j = i + 1; j < N; j++) {
+			const double p = 0.5 * (fusion->P[i][j] + fusion->P[j][i]);
+			fusion->P[i][j] = p;
+			fusion->P[j][i] = p;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+/* Update with measurement of state @state. */
+static void m_fusion_update_state(struct m_fusion * fusion, int state, double z, double sigma)
+{
+	double h[N] = { 0 };
+	h[state] = 1.0;
+	m_fusion_update(fusion, h, z - fusion->x[state], sigma);
+}
+
+
+
+
+static void m_fusion_start(struct m_fusion * fusion, const struct m_fusion_input * nmea)
+{
+	const struct m_fusion_params * params = &fusion->params;
+	const double lat = m_fusion_value(nmea, CH_LAT);
+	const double lon = m_fusion_value(nmea, CH_LON);
+	const double alt = m_fusion_value(nmea, CH_ALT);
+	const double speed = m_fusion_value(nmea, CH_SPEED);
+	const double course = m_fusion_value(nmea, CH_COURSE);
+
+	/* Local tangent plane at first fix. */
+	const double s = sin(lat * M_FUSION_RAD);
+	const double w = 1.0 - M_FUSION_WGS84_E2 * s * s;
+	fusion->lat0 = lat;
+	fusion->lon0 = lon;
+	fusion->m_per_deg_lat = M_FUSION_WGS84_A * (1.0 - M_FUSION_WGS84_E2) / (w * sqrt(w)) * M_FUSION_RAD;
+	fusion->m_per_deg_lon = M_FUSION_WGS84_A / sqrt(w) * cos(lat * M_FUSION_RAD) * M_FUSION_RAD;
+
+	memset(fusion->x, 0, sizeof (fusion->x));
+	memset(fusion->P, 0, sizeof (fusion->P));
+	fusion->x[X_POS + 2] = alt;
+	fusion->P[X_POS][X_POS] = params->gps_noise * params->gps_noise;
+	fusion->P[X_POS + 1][X_POS + 1] = params->gps_noise * params->gps_noise;
+	fusion->P[X_POS + 2][X_POS + 2] = params->gps_alt_noise * params->gps_alt_noise;
+	if (!isnan(speed) && !isnan(course)) {
+		fusion->x[X_VEL] = speed * sin(course * M_FUSION_RAD);
+		fusion->x[X_VEL + 1] = speed * cos(course * M_FUSION_RAD);
+	}
+	for (int i = 0; i < 3; i++) {
+		fusion->P[X_VEL + i][X_VEL + i] = 10.0 * 10.0;
+		fusion->P[X_ACC_OFF + i][X_ACC_OFF + i] = 0.1 * 0.1;
+	}
+	fusion->P[X_BARO][X_BARO] = params->gps_alt_noise * params->gps_alt_noise;
+	if (!isnan(fusion->last_pressure)) {
+		fusion->x[X_BARO] = m_fusion_pressure_altitude(fusion->last_pressure) - alt;
+		fusion->baro_initialized = 1;
+	}
+
+	fusion->initialized = 1;
+	fusion->time_ns = nmea->time_ns;
+	fusion->output_ns = (nmea->time_ns + params->period_ns - 1) / params->period_ns * params->period_ns;
+
+	return;
+}
+
+
+
+
+static void m_fusion_gps(struct m_fusion * fusion, const struct m_fusion_input * nmea)
+{
+	const struct m_fusion_params * params = &fusion->params;
+	const double lat = m_fusion_value(nmea, CH_LAT);
+	const double lon = m_fusion_value(nmea, CH_LON);
+	const double alt = m_fusion_value(nmea, CH_ALT);
+	const double speed = m_fusion_value(nmea, CH_SPEED);
+	const double course = m_fusion_value(nmea, CH_COURSE);
+	const double hdop = m_fusion_value(nmea, CH_HDOP);
+
+	if (!fusion->initialized) {
+		if (!isnan(lat) && !isnan(lon) && !isnan(alt)) {
+			m_fusion_start(fusion, nmea);
+			fusion->stats.gps++;
+		}
+		return;
+	}
+
+	m_fusion_predict(fusion, nmea->time_ns);
+	fusion->stats.gps++;
+
+	if (!isnan(lat) && !isnan(lon)) {
+		const double sigma = params->gps_noise * (hdop > 0.0 ? hdop : 1.0);
+		m_fusion_update_state(fusion, X_POS, (lon - fusion->lon0) * fusion->m_per_deg_lon, sigma);
+		m_fusion_update_state(fusion, X_POS + 1, (lat - fusion->lat0) * fusion->m_per_deg_lat, sigma);
+	}
+	if (!isnan(alt)) {
+		m_fusion_update_state(fusion, X_POS + 2, alt, params->gps_alt_noise);
+	}
+	if (!isnan(speed)) {
+		/* Course is meaningless (or missing) when standing still. */
+		if (!isnan(course) && speed > params->gps_speed_noise) {
+			m_fusion_update_state(fusion, X_VEL, speed * sin(course * M_FUSION_RAD), params->gps_speed_noise);
+			m_fusion_update_state(fusion, X_VEL + 1, speed * cos(course * M_FUSION_RAD), params->gps_speed_noise);
+		} else if (speed <= params->gps_speed_noise) {
+			m_fusion_update_state(fusion, X_VEL, 0.0, params->gps_speed_noise + speed);
+			m_fusion_update_state(fusion, X_VEL + 1, 0.0, params->gps_speed_noise + speed);
+		}
+	}
+
+	return;
+}
+
+
+
+
+static void m_fusion_pressure(struct m_fusion * fusion, const struct m_fusion_input * input)
+{
+	const double pressure = m_fusion_value(input, CH_PRESSURE);
+	if (isnan(pressure) || pressure <= 0.0) {
+		return;
+	}
+	fusion->stats.pressure++;
+
+	if (!fusion->initialized) {
+		fusion->last_pressure = pressure;
+		return;
+	}
+	m_fusion_predict(fusion, input->time_ns);
+
+	if (!fusion->baro_initialized) {
+		fusion->x[X_BARO] = m_fusion_pressure_altitude(pressure) - fusion->x[X_POS + 2];
+		fusion->baro_initialized = 1;
+		return;
+	}
+
+	/* Measurement function is barometric formula of altitude seen by
+	   barometer (true altitude + offset). */
+	const double altitude = fusion->x[X_POS + 2] + fusion->x[X_BARO];
+	const double base = 1.0 - altitude / M_FUSION_H0;
+	const double predicted = M_FUSION_P0 * pow(base, M_FUSION_K);
+	const double derivative = -M_FUSION_P0 * M_FUSION_K / M_FUSION_H0 * pow(base, M_FUSION_K - 1.0);
+
+	double h[N] = { 0 };
+	h[X_POS + 2] = derivative;
+	h[X_BARO] = derivative;
+	m_fusion_update(fusion, h, pressure - predicted, fusion->params.pressure_noise);
+
+	return;
+}
+
+
+
+
+static void m_fusion_imu(struct m_fusion * fusion, const struct m_fusion_input * input)
+{
+	fusion->stats.imu++;
+	if (fusion->initialized) {
+		/* Until now, previous acceleration was in effect. */
+		m_fusion_predict(fusion, input->time_ns);
+	}
+
+	double q[4];
+	double a[3];
+	for (int i = 0; i < 4; i++) {
+		q[i] = m_fusion_value(input, CH_QUA_W + i);
+	}
+	for (int i = 0; i < 3; i++) {
+		a[i] = m_fusion_value(input, CH_ACC_X + i);
+	}
+	const double norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	if (isnan(norm) || norm < 0.5 || isnan(a[0]) || isnan(a[1]) || isnan(a[2])) {
+		/* No fusion data of IMU (e.g. non-fusion mode). */
+		fusion->acc[0] = fusion->acc[1] = fusion->acc[2] = 0.0;
+		return;
+	}
+	for (int i = 0; i < 4; i++) {
+		q[i] /= norm;
+	}
+
+	double e[3];
+	m_attitude_earth_acc_ref(q[0], q[1], q[2], q[3], a, M_ATTITUDE_GRAVITY, e);
+
+	if (fusion->params.horizontal_imu) {
+		const double c = cos(fusion->params.yaw_offset * M_FUSION_RAD);
+		const double s = sin(fusion->params.yaw_offset * M_FUSION_RAD);
+		fusion->acc[0] = e[0] * c + e[1] * s;
+		fusion->acc[1] = -e[0] * s + e[1] * c;
+	} else {
+		fusion->acc[0] = 0.0;
+		fusion->acc[1] = 0.0;
+	}
+	fusion->acc[2] = e[2];
+
+	return;
+}
+
+
+
+
+static void m_fusion_estimate(const struct m_fusion * fusion, struct m_fusion_estimate * estimate)
+{
+	const double * x = fusion->x;
+
+	estimate->time_ns = fusion->time_ns;
+	estimate->east = x[X_POS];
+	estimate->north = x[X_POS + 1];
+	estimate->up = x[X_POS + 2];
+	estimate->latitude = fusion->lat0 + x[X_POS + 1] / fusion->m_per_deg_lat;
+	estimate->longitude = fusion->lon0 + x[X_POS] / fusion->m_per_deg_lon;
+	estimate->altitude = x[X_POS + 2];
+	estimate->v_east = x[X_VEL];
+	estimate->v_north = x[X_VEL + 1];
+	estimate->v_up = x[X_VEL + 2];
+	estimate->sigma_horizontal = sqrt(fusion->P[X_POS][X_POS] + fusion->P[X_POS + 1][X_POS + 1]);
+	estimate->sigma_altitude = sqrt(fusion->P[X_POS + 2][X_POS + 2]);
+	estimate->baro_offset = x[X_BARO];
+
+	return;
+}
+
+
+
+
+int m_fusion_next(struct m_fusion * fusion, struct m_fusion_estimate * estimate)
+{
+	for (;;) {
+		/* Earliest pending record of all inputs. */
+		int in = -1;
+		for (int i = 0; i < 3; i++) {
+			if (fusion->inputs[i].have && (in == -1 || fusion->inputs[i].time_ns < fusion->inputs[in].time_ns)) {
+				in = i;
+			}
+		}
+		if (in == -1) {
+			return 0;
+		}
+
+		struct m_fusion_input * input = &fusion->inputs[in];
+		if (fusion->initialized && input->time_ns > fusion->output_ns) {
+			m_fusion_predict(fusion, fusion->output_ns);
+			fusion->time_ns = fusion->output_ns;
+			m_fusion_estimate(fusion, estimate);
+			fusion->output_ns += fusion->params.period_ns;
+			fusion->stats.estimates++;
+			return 1;
+		}
+
+		switch (in) {
+		case IN_IMU:
+			m_fusion_imu(fusion, input);
+			break;
+		case IN_PRESSURE:
+			m_fusion_pressure(fusion, input);
+			break;
+		default:
+			m_fusion_gps(fusion, input);
+			break;
+		}
+
+		if (-1 == m_fusion_input_read(input)) {
+			return -1;
+		}
+	}
+}
+
+
+
+
+void m_fusion_close(struct m_fusion * fusion)
+{
+	for (int i = 0; i < 3; i++) {
+		struct m_align_source * source = fusion->inputs[i].source;
+		if (source && source->close) {
+			source->close(source);
+		}
+		fusion->inputs[i].source = NULL;
+	}
+
+	return;
+}
@@ -0,0 +1,150 @@
+#ifndef M_FUSION_H
+#define M_FUSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "m_align.h"
+
+
+/*
+  Reconstruction of trajectory of a session from GPS (1 Hz), IMU
+  (~100 Hz) and barometer, with an extended Kalman filter.
+
+  Records of the three sources (see m_align.h) are consumed in order
+  of time, in one streaming pass:
+
+  - every IMU sample gives earth-frame linear acceleration (from
+    quaternion and acceleration, see m_attitude.h), which drives
+    prediction of position and velocity until the next sample,
+  - GPS fixes correct position (scaled by HDOP), velocity (from speed
+    and course) and altitude (GGA),
+  - pressure corrects altitude through the barometric formula, which
+    is the non-linear part of the filter. Offset between barometric
+    and GPS altitude (weather, sensor) is a state of the filter, so
+    that barometer gives smooth altitude changes and GPS gives
+    absolute altitude.
+
+  State: position east/north/up [m] in a local tangent plane at the
+  first fix, velocity [m/s], slowly varying offset of acceleration in
+  earth frame [m/s^2], and offset of barometric altitude [m].
+
+  Estimates are returned at fixed period (e.g. 10 ms), starting at
+  the first GPS fix with altitude.
+
+  Earth frame of BNO055 quaternion is taken as x east, y north, z
+  up. Its heading is magnetic, so magnetic declination of the area
+  should be given as yaw_offset.
+*/
+
+
+#define M_FUSION_STATES 10
+
+
+struct m_fusion_params {
+	int64_t period_ns;          /* Period of output estimates. */
+
+	double acc_noise;           /* Noise density of acceleration input, m/s^2 per sqrt(Hz). */
+	double acc_offset_walk;     /* Drift of acceleration offset, m/s^2 per sqrt(s). */
+	double baro_offset_walk;    /* Drift of barometric altitude offset, m per sqrt(s). */
+
+	double gps_noise;           /* Horizontal position noise at HDOP 1, m. */
+	double gps_alt_noise;       /* m. */
+	double gps_speed_noise;     /* m/s. */
+	double pressure_noise;      /* Pa. */
+	double gate;                /* Measurements further than this many sigmas from prediction are rejected. */
+
+	double yaw_offset;          /* Rotation of IMU earth frame to true north, deg (magnetic declination). */
+	int horizontal_imu;         /* Use horizontal IMU acceleration; otherwise only vertical one. */
+};
+
+
+/* One estimate of trajectory. */
+struct m_fusion_estimate {
+	int64_t time_ns;
+	double latitude;            /* deg */
+	double longitude;           /* deg */
+	double altitude;            /* m above mean sea level */
+	double east;                /* m, from first fix */
+	double north;
+	double up;
+	double v_east;              /* m/s */
+	double v_north;
+	double v_up;
+	double sigma_horizontal;    /* Standard deviation of horizontal position, m. */
+	double sigma_altitude;      /* m */
+	double baro_offset;         /* Barometric minus true altitude, m. */
+};
+
+
+struct m_fusion_stats {
+	unsigned long imu;
+	unsigned long pressure;
+	unsigned long gps;
+	unsigned long rejected;     /* Scalar measurements rejected by gate. */
+	unsigned long estimates;
+};
+
+
+struct m_fusion_input {
+	struct m_align_source * source;
+	int have;                   /* Is record below pending? */
+	int64_t time_ns;
+	double values[M_ALIGN_CHANNELS_MAX];
+	int channels[8];            /* Indexes of used channels of source. */
+};
+
+
+struct m_fusion {
+	struct m_fusion_params params;
+	struct m_fusion_input inputs[3];     /* imu, pressure, nmea */
+
+	int initialized;
+	int baro_initialized;
+	int64_t time_ns;                     /* Time of state. */
+	int64_t output_ns;                   /* Time of next estimate. */
+	double x[M_FUSION_STATES];
+	double P[M_FUSION_STATES][M_FUSION_STATES];
+	double acc[3];                       /* Current acceleration input, earth frame. */
+	double last_pressure;                /* For initialization of baro offset. */
+
+	double lat0;                         /* Origin of local tangent plane. */
+	double lon0;
+	double m_per_deg_lat;
+	double m_per_deg_lon;
+
+	struct m_fusion_stats stats;
+};
+
+
+
+void m_fusion_default_params(struct m_fusion_params * params);
+
+
+
+/**
+   @param imu, pressure: sources of m_align, or NULL
+   @param nmea: source of m_align; required
+
+   @return 0 on success, -1 on failure
+*/
+int m_fusion_init(struct m_fusion * fusion, const struct m_fusion_params * params,
+		  struct m_align_source * imu, struct m_align_source * pressure, struct m_align_source * nmea);
+
+
+
+/**
+   @return 1 if estimate is returned, 0 after end of all sources, -1 on errors
+*/
+int m_fusion_next(struct m_fusion * fusion, struct m_fusion_estimate * estimate);
+
+
+
+/**
+   Close all sources.
+*/
+void m_fusion_close(struct m_fusion * fusion);
+
+
+
+#endif /* #ifdef M_FUSION_H */
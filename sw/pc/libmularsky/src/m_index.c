@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L /* struct timespec, fstat() */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "m_index.h"
+#include "m_input.h"
+#include "m_nmea.h"
+
+
+#define NSECS_PER_SEC 1000000000LL
+
+
+
+
+/* "imu@1493559540:..." or "pressure@1493559540: ..." */
+static int m_index_get_time_sensor(void * ctx, const char * line, size_t len, int64_t * timestamp_ns)
+{
+	(void) ctx;
+
+	size_t i = 0;
+	while (i < len && line[i] >= 'a' && line[i] <= 'z') {
+		i++;
+	}
+	if (i == 0 || i == len || line[i] != '@') {
+		return -1;
+	}
+	i++;
+
+	const size_t digits = i;
+	int64_t value = 0;
+	while (i < len && line[i] >= '0' && line[i] <= '9') {
+		value = value * 10 + (line[i] - '0');
+		i++;
+	}
+	if (i == digits || i == len || line[i] != ':') {
+		return -1;
+	}
+
+	*timestamp_ns = value * NSECS_PER_SEC;
+	return 0;
+}
+
+
+
+
+void m_index_timer_sensor(struct m_index_timer * timer)
+{
+	timer->get_time = m_index_get_time_sensor;
+	timer->sync = NULL;
+	timer->ctx = NULL;
+}
+
+
+
+
+static int m_index_get_time_nmea(void * ctx, const char * line, size_t len, int64_t * timestamp_ns)
+{
+	struct m_nmea_clock * clock = (struct m_nmea_clock *) ctx;
+
+	struct m_nmea_sentence sentence;
+	if (0 != m_nmea_parse(line, len, &sentence)
+	    || sentence.checksum == M_NMEA_CHECKSUM_BAD) {
+		return -1;
+	}
+
+	struct m_nmea_field time;
+	struct m_nmea_rmc rmc;
+	struct m_nmea_gga gga;
+	if (0 == m_nmea_get_rmc(&sentence, &rmc)) {
+		m_nmea_clock_set_date(clock, rmc.date.data, rmc.date.len);
+		time = rmc.time;
+	} else if (0 == m_nmea_get_gga(&sentence, &gga)) {
+		time = gga.time;
+	} else {
+		return -1;
+	}
+
+	struct timespec ts;
+	if (0 != m_nmea_clock_convert(clock, time.data, time.len, &ts)) {
+		return -1;
+	}
+
+	*timestamp_ns = (int64_t) ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+	return 0;
+}
+
+
+
+
+static void m_index_sync_nmea(void * ctx, int64_t timestamp_ns)
+{
+	m_nmea_clock_sync((struct m_nmea_clock *) ctx, timestamp_ns / NSECS_PER_SEC);
+}
+
+
+
+
+void m_index_timer_nmea(struct m_index_timer * timer, struct m_nmea_clock * clock)
+{
+	timer->get_time = m_index_get_time_nmea;
+	timer->sync = m_index_sync_nmea;
+	timer->ctx = clock;
+}
+
+
+
+
+static int m_index_append(struct m_index * index, int64_t timestamp_ns, uint64_t offset)
+{
+	if (index->header.n_entries == index->capacity) {
+		size_t capacity = index->capacity ? 2 * index->capacity : 1024;
+		struct m_index_entry * entries = realloc(index->entries, capacity * sizeof (struct m_index_entry));
+		if (!entries) {
+			fprintf(stderr, "[EE] %s:%d: failed to allocate index entries\n", __FUNCTION__, __LINE__);
+			return -1;
+		}
+		index->entries = entries;
+		index->capacity = capacity;
+	}
+
+	index->entries[index->header.n_entries].timestamp_ns = timestamp_ns;
+	index->entries[index->header.n_entries].offset = offset;
+	index->header.n_entries++;
+
+	return 0;
+}
+
+
+
+
+int m_index_build(struct m_index * index, const char * path, unsigned int stride, const struct m_index_timer * timer)
+{
+	memset(index, 0, sizeof (struct m_index));
+	memcpy(index->header.magic, M_INDEX_MAGIC, sizeof (index->header.magic));
+	index->header.version = M_INDEX_VERSION;
+	index->header.stride = stride ? stride : M_INDEX_STRIDE;
+
+	struct m_input input;
+	if (-1 == m_input_open(&input, path)) {
+		return -1;
+	}
+
+	struct stat st;
+	if (0 != fstat(input.fd, &st)) {
+		fprintf(stderr, "[EE] %s:%d: can't stat '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		m_input_close(&input);
+		return -1;
+	}
+	index->header.file_mtime = st.st_mtime;
+
+	uint64_t base = 0; /* Offset of current block in file. */
+	unsigned long n_lines = 0; /* Number of time-stamped lines. */
+	const char * data;
+	size_t size;
+	int rv;
+	while (1 == (rv = m_input_next_block(&input, &data, &size))) {
+		const char * end = data + size;
+		const char * line = data;
+		while (line < end) {
+			const char * eol = memchr(line, '\n', end - line);
+			const char * next = eol ? eol + 1 : end;
+
+			int64_t timestamp_ns;
+			if (0 == timer->get_time(timer->ctx, line, next - line, &timestamp_ns)) {
+				if (n_lines % index->header.stride == 0
+				    && -1 == m_index_append(index, timestamp_ns, base + (line - data))) {
+					rv = -1;
+					break;
+				}
+				n_lines++;
+			}
+
+			line = next;
+		}
+		base += size;
+		if (rv == -1) {
+			break;
+		}
+	}
+	m_input_close(&input);
+
+	if (rv == -1) {
+		m_index_free(index);
+		return -1;
+	}
+
+	index->header.file_size = base;
+
+	return 0;
+}
+
+
+
+
+int m_index_save(const struct m_index * index, const char * path)
+{
+	FILE * file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		return -1;
+	}
+
+	size_t n = index->header.n_entries;
+	if (1 != fwrite(&index->header, sizeof (index->header), 1, file)
+	    || n != fwrite(index->entries, sizeof (struct m_index_entry), n, file)) {
+		fprintf(stderr, "[EE] %s:%d: failed to write '%s'\n", __FUNCTION__, __LINE__, path);
+		fclose(file);
+		return -1;
+	}
+
+	if (0 != fclose(file)) {
+		fprintf(stderr, "[EE] %s:%d: failed to write '%s'\n", __FUNCTION__, __LINE__, path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+int m_index_load(struct m_index * index, const char * path, const char * file_path)
+{
+	memset(index, 0, sizeof (struct m_index));
+
+	FILE * file = fopen(path, "r");
+	if (!file) {
+		return -1;
+	}
+
+	if (1 != fread(&index->header, sizeof (index->header), 1, file)
+	    || 0 != memcmp(index->header.magic, M_INDEX_MAGIC, sizeof (index->header.magic))
+	    || index->header.version != M_INDEX_VERSION) {
+		fprintf(stderr, "[EE] %s:%d: '%s' is not a valid index file\n", __FUNCTION__, __LINE__, path);
+		fclose(file);
+		return -1;
+	}
+
+	struct stat st;
+	if (0 != stat(file_path, &st)
+	    || (uint64_t) st.st_size != index->header.file_size
+	    || (int64_t) st.st_mtime != index->header.file_mtime) {
+		fprintf(stderr, "[WW] %s:%d: index '%s' is stale\n", __FUNCTION__, __LINE__, path);
+		fclose(file);
+		return -1;
+	}
+
+	size_t n = index->header.n_entries;
+	index->entries = malloc((n ? n : 1) * sizeof (struct m_index_entry));
+	if (!index->entries) {
+		fclose(file);
+		return -1;
+	}
+	index->capacity = n;
+
+	if (n != fread(index->entries, sizeof (struct m_index_entry), n, file)) {
+		fprintf(stderr, "[EE] %s:%d: '%s' is truncated\n", __FUNCTION__, __LINE__, path);
+		fclose(file);
+		m_index_free(index);
+		return -1;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+
+
+
+void m_index_free(struct m_index * index)
+{
+	free(index->entries);
+	index->entries = NULL;
+	index->capacity = 0;
+	index->header.n_entries = 0;
+}
+
+
+
+
+/* Scan lines from @offset, return offset of first line with time
+   stamp >= @limit_ns (or > @limit_ns if not @inclusive), or @size. */
+static size_t m_index_scan(const struct m_index_timer * timer, const char * data, size_t size, size_t offset, int64_t limit_ns, int inclusive)
+{
+	const char * end = data + size;
+	const char * line = data + offset;
+	while (line < end) {
+		const char * eol = memchr(line, '\n', end - line);
+		const char * next = eol ? eol + 1 : end;
+
+		int64_t timestamp_ns;
+		if (0 == timer->get_time(timer->ctx, line, next - line, &timestamp_ns)
+		    && (inclusive ? timestamp_ns >= limit_ns : timestamp_ns > limit_ns)) {
+			return line - data;
+		}
+
+		line = next;
+	}
+
+	return size;
+}
+
+
+
+
+int m_index_range(const struct m_index * index, const struct m_index_timer * timer,
+		  const char * data, size_t size, int64_t start_ns, int64_t stop_ns,
+		  size_t * begin, size_t * end)
+{
+	if (size != index->header.file_size) {
+		fprintf(stderr, "[EE] %s:%d: size of data doesn't match index\n", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	/* Last entry with time stamp earlier than start of range. Lines
+	   with time stamp equal to start may precede first such entry. */
+	size_t lo = 0;
+	size_t hi = index->header.n_entries;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (index->entries[mid].timestamp_ns < start_ns) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	size_t offset = 0;
+	if (lo > 0) {
+		offset = index->entries[lo - 1].offset;
+		if (timer->sync) {
+			timer->sync(timer->ctx, index->entries[lo - 1].timestamp_ns);
+		}
+	}
+
+	*begin = m_index_scan(timer, data, size, offset, start_ns, 1);
+	if (*begin == size) {
+		*end = size;
+		return 0;
+	}
+
+	/* Scan from beginning of range: it's the part that is returned
+	   anyway. If the first line is already past @stop_ns, range is
+	   empty. */
+	*end = m_index_scan(timer, data, size, *begin, stop_ns, 0);
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef M_INDEX_H
+#define M_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "m_utils.h"
+
+
+/*
+  Sparse time index of session log files (imu.txt, pressure.txt,
+  nmea.txt).
+
+  Index maps time stamps to byte offsets of every N-th line that has
+  a time stamp. It is built in one streaming pass over a file and
+  can be stored in a sidecar file (e.g. imu.txt.idx). A range query
+  looks up the closest entry with binary search and then scans only
+  the lines between that entry and the end of the range.
+
+  Time stamps are in nanoseconds, in the time base of the device.
+  Files are expected to be (mostly) sorted by time.
+*/
+
+
+#define M_INDEX_MAGIC "MLRSKIDX"
+#define M_INDEX_VERSION 1
+
+/* Default number of time-stamped lines between index entries. */
+#define M_INDEX_STRIDE 1024
+
+
+struct m_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t stride;
+	uint64_t file_size;     /* Size of indexed file. */
+	int64_t file_mtime;     /* Modification time of indexed file, for detecting stale index. */
+	uint64_t n_entries;
+};
+
+
+struct m_index_entry {
+	int64_t timestamp_ns;
+	uint64_t offset;
+};
+
+
+struct m_index {
+	struct m_index_header header;
+	struct m_index_entry * entries;
+	size_t capacity;
+};
+
+
+/*
+  Getter of time stamps of lines of a file.
+
+  get_time() returns 0 and sets time stamp if line has a time stamp,
+  and -1 otherwise.
+
+  sync() (may be NULL) is called with time stamp of index entry
+  before lines are scanned from that entry, for getters that need
+  state from previous lines (NMEA clock).
+*/
+struct m_index_timer {
+	int (* get_time)(void * ctx, const char * line, size_t len, int64_t * timestamp_ns);
+	void (* sync)(void * ctx, int64_t timestamp_ns);
+	void * ctx;
+};
+
+
+
+/**
+   Timer for "<sensor>@<time stamp>:" lines of imu.txt and pressure.txt.
+*/
+void m_index_timer_sensor(struct m_index_timer * timer);
+
+
+
+/**
+   Timer for RMC and GGA sentences of nmea.txt.
+
+   @param clock: initialized NMEA clock, used for conversion of times
+*/
+void m_index_timer_nmea(struct m_index_timer * timer, struct m_nmea_clock * clock);
+
+
+
+/**
+   Build index of a file in one pass.
+
+   @param stride: number of time-stamped lines between index entries
+
+   @return 0 on success, -1 on failure
+*/
+int m_index_build(struct m_index * index, const char * path, unsigned int stride, const struct m_index_timer * timer);
+
+
+
+/**
+   @return 0 on success, -1 on failure
+*/
+int m_index_save(const struct m_index * index, const char * path);
+
+
+
+/**
+   Load index and check that it is up to date with indexed file.
+
+   @param path: path to index file
+   @param file_path: path to indexed file
+
+   @return 0 on success, -1 if index can't be read or is stale
+*/
+int m_index_load(struct m_index * index, const char * path, const char * file_path);
+
+
+
+void m_index_free(struct m_index * index);
+
+
+
+/**
+   Find byte range of lines belonging to time range [@start_ns, @stop_ns].
+
+   Range starts at first line with time stamp >= @start_ns, and ends
+   before first line with time stamp > @stop_ns (lines without time
+   stamps belong to preceding time-stamped line).
+
+   @param data, @size: contents of indexed file (e.g. memory-mapped)
+   @param begin, @end: resulting range; empty range if there are no matching lines
+
+   @return 0 on success, -1 if @data doesn't match index
+*/
+int m_index_range(const struct m_index * index, const struct m_index_timer * timer,
+		  const char * data, size_t size, int64_t start_ns, int64_t stop_ns,
+		  size_t * begin, size_t * end);
+
+
+
+#endif /* #ifdef M_INDEX_H */
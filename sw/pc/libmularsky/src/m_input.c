@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L /* posix_madvise() */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "m_input.h"
+#include "m_chunks.h"
+
+
+/* Initial size of buffer of streamed input. */
+#define M_INPUT_BUFFER_SIZE (1024 * 1024)
+
+
+
+
+/* Is there session manifest of chunks next to missing @path? */
+static int m_input_rotated(const char * path)
+{
+	const char * slash = strrchr(path, '/');
+	char manifest[PATH_MAX];
+	if (slash) {
+		snprintf(manifest, sizeof (manifest), "%.*s/%s", (int) (slash - path), path, M_CHUNKS_MANIFEST);
+	} else {
+		snprintf(manifest, sizeof (manifest), "%s", M_CHUNKS_MANIFEST);
+	}
+
+	return 0 == access(manifest, F_OK);
+}
+
+
+
+
+int m_input_open(struct m_input * input, const char * path)
+{
+	memset(input, 0, sizeof (struct m_input));
+
+	if (0 == strcmp(path, "-")) {
+		input->fd = STDIN_FILENO;
+	} else {
+		input->fd = open(path, O_RDONLY);
+		if (input->fd == -1) {
+			const int err = errno;
+			fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(err));
+			if (err == ENOENT && m_input_rotated(path)) {
+				fprintf(stderr, "[II] session of '%s' has rotated logs, join them with m_joiner\n", path);
+			}
+			return -1;
+		}
+	}
+
+	struct stat st;
+	if (0 == fstat(input->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+		if (data != MAP_FAILED) {
+			posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+			input->data = data;
+			input->size = st.st_size;
+			input->mapped = 1;
+			return 0;
+		}
+		/* Fall back to reading. */
+	}
+
+	input->size = M_INPUT_BUFFER_SIZE;
+	input->data = malloc(input->size);
+	if (!input->data) {
+		m_input_close(input);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+int m_input_next_block(struct m_input * input, const char ** data, size_t * size)
+{
+	if (input->mapped) {
+		if (input->eof) {
+			return 0;
+		}
+		input->eof = 1;
+		*data = input->data;
+		*size = input->size;
+		return 1;
+	}
+
+	/* Move unreturned tail of previous block to beginning of buffer. */
+	memmove(input->data, input->data + input->consumed, input->used - input->consumed);
+	input->used -= input->consumed;
+	input->consumed = 0;
+
+	for (;;) {
+		/* Look for end of last complete line in buffer. */
+		const char * last = NULL;
+		for (size_t i = input->used; i > 0; i--) {
+			if (input->data[i - 1] == '\n') {
+				last = input->data + i;
+				break;
+			}
+		}
+
+		if (last && (input->eof || input->used == input->size)) {
+			input->consumed = last - input->data;
+			*data = input->data;
+			*size = input->consumed;
+			return 1;
+		}
+		if (input->eof) {
+			if (input->used == 0) {
+				return 0;
+			}
+			/* Last line, without newline. */
+			input->consumed = input->used;
+			*data = input->data;
+			*size = input->used;
+			return 1;
+		}
+
+		if (input->used == input->size) {
+			/* Line longer than buffer. */
+			char * new_data = realloc(input->data, 2 * input->size);
+			if (!new_data) {
+				return -1;
+			}
+			input->data = new_data;
+			input->size *= 2;
+		}
+
+		ssize_t n = read(input->fd, input->data + input->used, input->size - input->used);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "[EE] %s:%d: read failed: %s\n", __FUNCTION__, __LINE__, strerror(errno));
+			return -1;
+		} else if (n == 0) {
+			input->eof = 1;
+		} else {
+			input->used += n;
+		}
+	}
+}
+
+
+
+
+int m_input_next_line(struct m_input * input, const char ** line, size_t * len)
+{
+	if (input->line_cur == input->line_end) {
+		const char * data;
+		size_t size;
+		const int rv = m_input_next_block(input, &data, &size);
+		if (rv != 1) {
+			return rv;
+		}
+		input->line_cur = data;
+		input->line_end = data + size;
+	}
+
+	const char * eol = memchr(input->line_cur, '\n', input->line_end - input->line_cur);
+	const char * next = eol ? eol + 1 : input->line_end;
+
+	*line = input->line_cur;
+	*len = next - input->line_cur;
+	input->line_cur = next;
+
+	return 1;
+}
+
+
+
+
+void m_input_close(struct m_input * input)
+{
+	if (input->mapped) {
+		munmap(input->data, input->size);
+	} else {
+		free(input->data);
+	}
+	if (input->fd > STDIN_FILENO) {
+		close(input->fd);
+	}
+	memset(input, 0, sizeof (struct m_input));
+}
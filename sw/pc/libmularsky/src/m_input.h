@@ -0,0 +1,73 @@
+#ifndef M_INPUT_H
+#define M_INPUT_H
+
+#include <stddef.h>
+
+
+/*
+  Reading of text input files in blocks of complete lines.
+
+  Regular files are memory-mapped, and the whole file is returned as
+  one block. Other inputs (pipes, files that can't be mapped) are
+  read through a buffer, and returned in blocks ending at end of a
+  line. The buffer grows if a single line doesn't fit in it, so lines
+  are never split between blocks.
+
+  Blocks point into mapping or into the buffer, and are valid until
+  next call of m_input_next_block() or m_input_close().
+*/
+
+
+struct m_input {
+	int fd;
+	int mapped;         /* Is the file memory-mapped? */
+	char * data;        /* Mapping or buffer. */
+	size_t size;        /* Size of mapping or of buffer. */
+	size_t used;        /* Number of bytes of data in buffer. */
+	size_t consumed;    /* Number of bytes of buffer returned in previous block. */
+	int eof;
+
+	const char * line_cur;  /* Position of m_input_next_line() in current block. */
+	const char * line_end;
+};
+
+
+
+/**
+   @param input: input to initialize
+   @param path: path to file; "-" means standard input
+
+   @return 0 on success, -1 on failure
+*/
+int m_input_open(struct m_input * input, const char * path);
+
+
+
+/**
+   Get next block of complete lines.
+
+   Last line of input may be returned without terminating newline.
+
+   @return 1 when a block is returned in @data/@size, 0 at end of input, -1 on failure
+*/
+int m_input_next_block(struct m_input * input, const char ** data, size_t * size);
+
+
+
+/**
+   Get next line of input, with its line ending (if present).
+
+   Line is valid until next call of m_input_next_line(). Don't mix
+   calls of this function with calls of m_input_next_block().
+
+   @return 1 when a line is returned in @line/@len, 0 at end of input, -1 on failure
+*/
+int m_input_next_line(struct m_input * input, const char ** line, size_t * len);
+
+
+
+void m_input_close(struct m_input * input);
+
+
+
+#endif /* #ifdef M_INPUT_H */
@@ -0,0 +1,443 @@
+#define _POSIX_C_SOURCE 200809L /* sysconf() */
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m_log.h"
+#include "m_bme280_comp.h"
+
+
+
+
+/* Scanner of fields of a line. */
+struct m_scan {
+	const char * p;
+	const char * end;
+};
+
+
+
+
+static int m_scan_literal(struct m_scan * s, const char * literal)
+{
+	const size_t len = strlen(literal);
+	if ((size_t) (s->end - s->p) < len || 0 != memcmp(s->p, literal, len)) {
+		return -1;
+	}
+	s->p += len;
+	return 0;
+}
+
+
+
+
+static void m_scan_spaces(struct m_scan * s)
+{
+	while (s->p < s->end && *s->p == ' ') {
+		s->p++;
+	}
+}
+
+
+
+
+static int m_scan_int(struct m_scan * s, int64_t * value)
+{
+	int negative = 0;
+	if (s->p < s->end && *s->p == '-') {
+		negative = 1;
+		s->p++;
+	}
+
+	const char * start = s->p;
+	int64_t v = 0;
+	while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+		v = v * 10 + (*s->p - '0');
+		s->p++;
+	}
+	if (s->p == start || s->p - start > 18) {
+		return -1;
+	}
+
+	*value = negative ? -v : v;
+	return 0;
+}
+
+
+
+
+static int m_scan_hex(struct m_scan * s, int64_t * value)
+{
+	if (0 != m_scan_literal(s, "0x")) {
+		return -1;
+	}
+
+	const char * start = s->p;
+	int64_t v = 0;
+	for (; s->p < s->end && s->p - start < 16; s->p++) {
+		const char c = *s->p;
+		if (c >= '0' && c <= '9') {
+			v = v * 16 + (c - '0');
+		} else if (c >= 'a' && c <= 'f') {
+			v = v * 16 + (c - 'a' + 10);
+		} else if (c >= 'A' && c <= 'F') {
+			v = v * 16 + (c - 'A' + 10);
+		} else {
+			break;
+		}
+	}
+	if (s->p == start) {
+		return -1;
+	}
+
+	*value = v;
+	return 0;
+}
+
+
+
+
+/* "<name>=a,b,c" into @n int16 values. */
+static int m_scan_vector(struct m_scan * s, const char * name, int16_t * values, int n)
+{
+	if (0 != m_scan_literal(s, name)) {
+		return -1;
+	}
+	for (int i = 0; i < n; i++) {
+		int64_t v;
+		if ((i > 0 && 0 != m_scan_literal(s, ","))
+		    || 0 != m_scan_int(s, &v)
+		    || v < INT16_MIN || v > INT16_MAX) {
+			return -1;
+		}
+		values[i] = (int16_t) v;
+	}
+	m_scan_spaces(s);
+	return 0;
+}
+
+
+
+
+/* Optional " rep=<n>" suffix and line ending. */
+static int m_scan_repeats(struct m_scan * s, uint32_t * repeats)
+{
+	m_scan_spaces(s);
+	*repeats = 0;
+	if (0 == m_scan_literal(s, "rep=")) {
+		int64_t v;
+		if (0 != m_scan_int(s, &v) || v < 0 || v > UINT32_MAX) {
+			return -1;
+		}
+		*repeats = (uint32_t) v;
+	}
+	while (s->p < s->end && (*s->p == '\r' || *s->p == '\n')) {
+		s->p++;
+	}
+	return s->p == s->end ? 0 : -1;
+}
+
+
+
+
+/* "<sensor>@<time>:" */
+static int m_scan_time(struct m_scan * s, const char * sensor, int64_t * time)
+{
+	if (0 != m_scan_literal(s, sensor)
+	    || 0 != m_scan_literal(s, "@")
+	    || 0 != m_scan_int(s, time)
+	    || 0 != m_scan_literal(s, ":")) {
+		return -1;
+	}
+	m_scan_spaces(s);
+	return 0;
+}
+
+
+
+
+int m_log_parse_imu(const char * line, size_t len, struct m_imu_sample * sample)
+{
+	struct m_scan s = { line, line + len };
+	int64_t temp;
+	int64_t calib;
+
+	if (0 != m_scan_time(&s, "imu", &sample->time)
+	    || 0 != m_scan_vector(&s, "acc=", sample->acc, 3)
+	    || 0 != m_scan_vector(&s, "mag=", sample->mag, 3)
+	    || 0 != m_scan_vector(&s, "gyr=", sample->gyr, 3)
+	    || 0 != m_scan_vector(&s, "eul=", sample->eul, 3)
+	    || 0 != m_scan_vector(&s, "qua=", sample->qua, 4)
+	    || 0 != m_scan_vector(&s, "lia=", sample->lia, 3)
+	    || 0 != m_scan_vector(&s, "grv=", sample->grv, 3)
+	    || 0 != m_scan_literal(&s, "temp=")
+	    || 0 != m_scan_int(&s, &temp)
+	    || (m_scan_spaces(&s), 0 != m_scan_literal(&s, "calib="))
+	    || 0 != m_scan_hex(&s, &calib)
+	    || 0 != m_scan_repeats(&s, &sample->repeats)) {
+		return -1;
+	}
+
+	sample->temp = (int8_t) temp;
+	sample->calib = (uint8_t) calib;
+
+	return 0;
+}
+
+
+
+
+/* Chunks are small enough for threads to share work evenly, and large
+   enough to make cost of scheduling negligible. */
+#define M_LOG_CHUNK_SIZE (4 * 1024 * 1024)
+#define M_LOG_THREADS_MAX 64
+
+
+struct m_log_chunk {
+	const char * begin;
+	const char * end;
+	struct m_imu_sample * samples;
+	size_t n_samples;
+	size_t n_other;
+	int rv;
+};
+
+
+struct m_log_job {
+	struct m_log_chunk * chunks;
+	size_t n_chunks;
+	size_t next;              /* Next chunk to parse. */
+	pthread_mutex_t lock;
+};
+
+
+
+
+static int m_log_parse_imu_chunk(struct m_log_chunk * chunk)
+{
+	/* Upper estimate of number of lines; data lines are much longer. */
+	size_t capacity = (chunk->end - chunk->begin) / 64 + 16;
+	chunk->samples = malloc(capacity * sizeof (struct m_imu_sample));
+	if (!chunk->samples) {
+		return -1;
+	}
+
+	const char * line = chunk->begin;
+	while (line < chunk->end) {
+		const char * eol = memchr(line, '\n', chunk->end - line);
+		const char * next = eol ? eol + 1 : chunk->end;
+
+		if (chunk->n_samples == capacity) {
+			capacity *= 2;
+			struct m_imu_sample * samples = realloc(chunk->samples, capacity * sizeof (struct m_imu_sample));
+			if (!samples) {
+				return -1;
+			}
+			chunk->samples = samples;
+		}
+
+		if (0 == m_log_parse_imu(line, next - line, &chunk->samples[chunk->n_samples])) {
+			chunk->n_samples++;
+		} else {
+			chunk->n_other++;
+		}
+
+		line = next;
+	}
+
+	return 0;
+}
+
+
+
+
+static void * m_log_thread_fn(void * arg)
+{
+	struct m_log_job * job = (struct m_log_job *) arg;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		const size_t i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (i >= job->n_chunks) {
+			break;
+		}
+		job->chunks[i].rv = m_log_parse_imu_chunk(&job->chunks[i]);
+	}
+
+	return NULL;
+}
+
+
+
+
+int m_log_parse_imu_parallel(const char * data, size_t size, int n_threads,
+			     struct m_imu_sample ** samples, size_t * n_samples, size_t * n_other)
+{
+	if (n_threads <= 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = n > 0 ? (int) n : 1;
+	}
+	if (n_threads > M_LOG_THREADS_MAX) {
+		n_threads = M_LOG_THREADS_MAX;
+	}
+
+	/* Split data into chunks, moving end of each chunk to end of line. */
+	struct m_log_job job = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+	job.chunks = calloc(size / M_LOG_CHUNK_SIZE + 1, sizeof (struct m_log_chunk));
+	if (!job.chunks) {
+		return -1;
+	}
+	const char * end = data + size;
+	const char * begin = data;
+	while (begin < end) {
+		const char * chunk_end = end;
+		if ((size_t) (end - begin) > M_LOG_CHUNK_SIZE) {
+			const char * eol = memchr(begin + M_LOG_CHUNK_SIZE, '\n', end - begin - M_LOG_CHUNK_SIZE);
+			chunk_end = eol ? eol + 1 : end;
+		}
+		job.chunks[job.n_chunks].begin = begin;
+		job.chunks[job.n_chunks].end = chunk_end;
+		job.n_chunks++;
+		begin = chunk_end;
+	}
+
+	if ((size_t) n_threads > job.n_chunks) {
+		n_threads = job.n_chunks ? job.n_chunks : 1;
+	}
+
+	/* Calling thread is one of workers. */
+	pthread_t threads[M_LOG_THREADS_MAX];
+	int n_started = 0;
+	for (; n_started < n_threads - 1; n_started++) {
+		if (0 != pthread_create(&threads[n_started], NULL, m_log_thread_fn, &job)) {
+			fprintf(stderr, "[WW] %s:%d: failed to create thread, continuing with %d threads\n", __FUNCTION__, __LINE__, n_started + 1);
+			break;
+		}
+	}
+	m_log_thread_fn(&job);
+	for (int i = 0; i < n_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&job.lock);
+
+	/* Merge results of chunks in order. */
+	int rv = 0;
+	size_t total = 0;
+	size_t total_other = 0;
+	for (size_t i = 0; i < job.n_chunks; i++) {
+		if (job.chunks[i].rv != 0) {
+			rv = -1;
+		}
+		total += job.chunks[i].n_samples;
+		total_other += job.chunks[i].n_other;
+	}
+
+	struct m_imu_sample * result = NULL;
+	if (rv == 0) {
+		result = malloc((total ? total : 1) * sizeof (struct m_imu_sample));
+		if (!result) {
+			rv = -1;
+		}
+	}
+	if (rv == 0) {
+		size_t pos = 0;
+		for (size_t i = 0; i < job.n_chunks; i++) {
+			memcpy(result + pos, job.chunks[i].samples, job.chunks[i].n_samples * sizeof (struct m_imu_sample));
+			pos += job.chunks[i].n_samples;
+		}
+	}
+
+	for (size_t i = 0; i < job.n_chunks; i++) {
+		free(job.chunks[i].samples);
+	}
+	free(job.chunks);
+
+	if (rv != 0) {
+		fprintf(stderr, "[EE] %s:%d: failed to allocate memory for samples\n", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	*samples = result;
+	*n_samples = total;
+	if (n_other) {
+		*n_other = total_other;
+	}
+
+	return 0;
+}
+
+
+
+
+int m_log_parse_pressure(const char * line, size_t len, struct m_pressure_sample * sample)
+{
+	struct m_scan s = { line, line + len };
+	if (0 != m_scan_time(&s, "pressure", &sample->time)) {
+		return -1;
+	}
+
+	int64_t values[6];
+	int n = 0;
+	for (; n < 6; n++) {
+		if (n > 0) {
+			if (0 != m_scan_literal(&s, ",")) {
+				break;
+			}
+			m_scan_spaces(&s);
+		}
+		if (0 != m_scan_int(&s, &values[n])) {
+			return -1;
+		}
+	}
+	if (0 != m_scan_repeats(&s, &sample->repeats)) {
+		return -1;
+	}
+
+	if (n == 6) {
+		sample->raw_pressure = (int32_t) values[0];
+		sample->pressure = (uint32_t) values[1];
+		sample->raw_temperature = (int32_t) values[2];
+		sample->temperature = (int32_t) values[3];
+		sample->raw_humidity = (int32_t) values[4];
+		sample->humidity = (uint32_t) values[5];
+		sample->compensated = 1;
+	} else if (n == 3) {
+		sample->raw_pressure = (int32_t) values[0];
+		sample->raw_temperature = (int32_t) values[1];
+		sample->raw_humidity = (int32_t) values[2];
+		sample->pressure = 0;
+		sample->temperature = 0;
+		sample->humidity = 0;
+		sample->compensated = 0;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+int m_log_parse_pressure_calibration(const char * line, size_t len, char * hex)
+{
+	struct m_scan s = { line, line + len };
+	if (0 != m_scan_literal(&s, "pressure calibration:")) {
+		return -1;
+	}
+	m_scan_spaces(&s);
+
+	const size_t n = 2 * M_BME280_CALIB_SIZE;
+	if ((size_t) (s.end - s.p) < n) {
+		return -1;
+	}
+	memcpy(hex, s.p, n);
+	hex[n] = '\0';
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef M_LOG_H
+#define M_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+  Parsing of data lines of imu.txt and pressure.txt, as written by
+  mularsky on the device.
+
+  Lines are scanned by hand, field by field, without sscanf(); they
+  don't have to be nul-terminated. Other lines of the files (chip
+  info, calibration status, recovery messages) are rejected.
+*/
+
+
+/*
+  "imu@<time>:acc=x,y,z mag=x,y,z gyr=x,y,z eul=h,r,p qua=w,x,y,z
+   lia=x,y,z grv=x,y,z temp=t calib=0xcc[ rep=n]"
+
+  Values are as read from BNO055 registers, with exception of Euler
+  angles, which are stored in whole degrees. Units are described by
+  M_IMU_SCALE_* (BNO055 datasheet, chapter 3.6.4).
+*/
+struct m_imu_sample {
+	int64_t time;       /* global_time of device, in seconds. */
+	int16_t acc[3];
+	int16_t mag[3];
+	int16_t gyr[3];
+	int16_t eul[3];     /* Heading, roll, pitch. */
+	int16_t qua[4];     /* w, x, y, z. */
+	int16_t lia[3];
+	int16_t grv[3];
+	int8_t temp;
+	uint8_t calib;
+	uint32_t repeats;   /* Number of identical samples skipped after this one. */
+};
+
+
+#define M_IMU_SCALE_ACC  (1.0 / 100.0)     /* m/s^2, Table 3-17. */
+#define M_IMU_SCALE_MAG  (1.0 / 16.0)      /* uT, Table 3-19. */
+#define M_IMU_SCALE_GYR  (1.0 / 16.0)      /* dps, Table 3-22. */
+#define M_IMU_SCALE_EUL  1.0               /* deg (already divided by 16 on device). */
+#define M_IMU_SCALE_QUA  (1.0 / 16384.0)   /* unitless, Table 3-31. */
+#define M_IMU_SCALE_LIA  (1.0 / 100.0)     /* m/s^2, Table 3-33. */
+#define M_IMU_SCALE_GRV  (1.0 / 100.0)     /* m/s^2, Table 3-35. */
+#define M_IMU_SCALE_TEMP 1.0               /* degC, Table 3-37. */
+
+
+/*
+  "pressure@<time>: raw_p, p, raw_t, t, raw_h, h[ rep=n]", or, in raw
+  mode of mularsky, "pressure@<time>: raw_p, raw_t, raw_h[ rep=n]".
+*/
+struct m_pressure_sample {
+	int64_t time;
+	int32_t raw_pressure;
+	int32_t raw_temperature;
+	int32_t raw_humidity;
+	uint32_t pressure;      /* Pa. */
+	int32_t temperature;    /* 0.01 degC. */
+	uint32_t humidity;      /* %rH in Q22.10 format. */
+	uint32_t repeats;
+	int compensated;        /* Are pressure, temperature, humidity set? */
+};
+
+
+#define M_PRESSURE_SCALE_PRESSURE    1.0              /* Pa. */
+#define M_PRESSURE_SCALE_TEMPERATURE (1.0 / 100.0)    /* degC. */
+#define M_PRESSURE_SCALE_HUMIDITY    (1.0 / 1024.0)   /* %rH. */
+
+
+
+/**
+   @param line: line of imu.txt, with or without line ending
+   @param len: length of @line
+
+   @return 0 on success, -1 if line isn't a data line
+*/
+int m_log_parse_imu(const char * line, size_t len, struct m_imu_sample * sample);
+
+
+
+/**
+   Parse all data lines of imu.txt contents in parallel.
+
+   @data is split into chunks ending at line boundaries, chunks are
+   parsed by @n_threads threads, and results are merged in order of
+   lines.
+
+   @param data, @size: contents of imu.txt (e.g. memory-mapped)
+   @param n_threads: number of threads, 0 for number of online CPUs
+   @param samples: returned array of samples, to be freed by caller
+   @param n_samples: number of returned samples
+   @param n_other: if not NULL, number of lines that aren't data lines is returned here
+
+   @return 0 on success, -1 on failure
+*/
+int m_log_parse_imu_parallel(const char * data, size_t size, int n_threads,
+			     struct m_imu_sample ** samples, size_t * n_samples, size_t * n_other);
+
+
+
+/**
+   @param line: line of pressure.txt, with or without line ending
+   @param len: length of @line
+
+   @return 0 on success, -1 if line isn't a data line
+*/
+int m_log_parse_pressure(const char * line, size_t len, struct m_pressure_sample * sample);
+
+
+
+/**
+   Get calibration data from "pressure calibration: <hex>" line.
+
+   @param hex: buffer of at least 2 * M_BME280_CALIB_SIZE + 1 bytes for nul-terminated hex string
+
+   @return 0 on success, -1 if line isn't a calibration line
+*/
+int m_log_parse_pressure_calibration(const char * line, size_t len, char * hex);
+
+
+
+#endif /* #ifdef M_LOG_H */
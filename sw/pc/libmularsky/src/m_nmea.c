@@ -0,0 +1,309 @@
+#include <string.h>
+#include <math.h>
+
+#include "m_nmea.h"
+
+
+
+
+/* Value of hexadecimal digit, -1 for other characters. */
+static int m_nmea_hex_value(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else {
+		return -1;
+	}
+}
+
+
+
+
+int m_nmea_parse(const char * line, size_t len, struct m_nmea_sentence * sentence)
+{
+	/* Strip line ending. */
+	while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+		len--;
+	}
+	if (len < strlen("$GPXXX") || line[0] != '$') {
+		return -1;
+	}
+
+	sentence->line.data = line;
+	sentence->line.len = len;
+	sentence->n_fields = 0;
+	sentence->checksum = M_NMEA_CHECKSUM_MISSING;
+
+	/* Split fields and calculate checksum (XOR of characters
+	   between '$' and '*') in one pass. */
+	const char * end = line + len;
+	const char * field = line + 1;
+	const char * p = field;
+	unsigned char sum = 0;
+	for (; p < end && *p != '*'; p++) {
+		if (*p == ',') {
+			if (sentence->n_fields == M_NMEA_FIELDS_MAX) {
+				return -1;
+			}
+			sentence->fields[sentence->n_fields].data = field;
+			sentence->fields[sentence->n_fields].len = p - field;
+			sentence->n_fields++;
+			field = p + 1;
+		}
+		sum ^= (unsigned char) *p;
+	}
+	if (sentence->n_fields == M_NMEA_FIELDS_MAX) {
+		return -1;
+	}
+	sentence->fields[sentence->n_fields].data = field;
+	sentence->fields[sentence->n_fields].len = p - field;
+	sentence->n_fields++;
+
+	if (p < end) {
+		/* "*hh" */
+		if (end - p >= 3) {
+			const int hi = m_nmea_hex_value(p[1]);
+			const int lo = m_nmea_hex_value(p[2]);
+			if (hi != -1 && lo != -1 && sum == (hi << 4 | lo)) {
+				sentence->checksum = M_NMEA_CHECKSUM_OK;
+			} else {
+				sentence->checksum = M_NMEA_CHECKSUM_BAD;
+			}
+		} else {
+			sentence->checksum = M_NMEA_CHECKSUM_BAD;
+		}
+	}
+
+	/* Address field is talker (2 characters) + sentence type (3 characters). */
+	const struct m_nmea_field * address = &sentence->fields[0];
+	sentence->type = M_NMEA_OTHER;
+	if (address->len == 5) {
+		const char * t = address->data + 2;
+		if (0 == memcmp(t, "RMC", 3)) {
+			sentence->type = M_NMEA_RMC;
+		} else if (0 == memcmp(t, "GGA", 3)) {
+			sentence->type = M_NMEA_GGA;
+		} else if (0 == memcmp(t, "VTG", 3)) {
+			sentence->type = M_NMEA_VTG;
+		} else if (0 == memcmp(t, "GSA", 3)) {
+			sentence->type = M_NMEA_GSA;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+void m_nmea_iter_init(struct m_nmea_iter * iter, const char * data, size_t size)
+{
+	iter->cur = data;
+	iter->end = data + size;
+}
+
+
+
+
+int m_nmea_next(struct m_nmea_iter * iter, struct m_nmea_sentence * sentence)
+{
+	while (iter->cur < iter->end) {
+		const char * line = iter->cur;
+		const char * eol = memchr(line, '\n', iter->end - line);
+		iter->cur = eol ? eol + 1 : iter->end;
+
+		if (0 == m_nmea_parse(line, iter->cur - line, sentence)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+double m_nmea_field_to_double(const struct m_nmea_field * field)
+{
+	const char * p = field->data;
+	const char * end = field->data + field->len;
+	if (p == end) {
+		return NAN;
+	}
+
+	int negative = 0;
+	if (*p == '-' || *p == '+') {
+		negative = *p == '-';
+		p++;
+	}
+
+	/* Integer arithmetic on digits, one division at the end. Fields
+	   of NMEA sentences are short enough to fit in 64 bits. */
+	long long mantissa = 0;
+	long long divisor = 1;
+	int n_digits = 0;
+	int fraction = 0;
+	for (; p < end; p++) {
+		if (*p >= '0' && *p <= '9') {
+			if (n_digits < 18) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (fraction) {
+					divisor *= 10;
+				}
+				n_digits++;
+			} else if (!fraction) {
+				return NAN;
+			}
+		} else if (*p == '.' && !fraction) {
+			fraction = 1;
+		} else {
+			return NAN;
+		}
+	}
+	if (n_digits == 0) {
+		return NAN;
+	}
+
+	const double value = (double) mantissa / divisor;
+	return negative ? -value : value;
+}
+
+
+
+
+/* Integer field, -1 if empty or invalid. */
+static int m_nmea_field_to_int(const struct m_nmea_field * field)
+{
+	if (field->len == 0 || field->len > 9) {
+		return -1;
+	}
+	int value = 0;
+	for (size_t i = 0; i < field->len; i++) {
+		if (field->data[i] < '0' || field->data[i] > '9') {
+			return -1;
+		}
+		value = value * 10 + (field->data[i] - '0');
+	}
+	return value;
+}
+
+
+
+
+static char m_nmea_field_to_char(const struct m_nmea_field * field)
+{
+	return field->len == 1 ? field->data[0] : '\0';
+}
+
+
+
+
+/* Convert "dddmm.mmmm" field and N/S/E/W hemisphere field to degrees. */
+static double m_nmea_fields_to_degrees(const struct m_nmea_field * value, const struct m_nmea_field * hemisphere)
+{
+	const double v = m_nmea_field_to_double(value);
+	if (isnan(v)) {
+		return v;
+	}
+
+	const double degrees = (double) (long) (v / 100.0); /* Value is never negative. */
+	const double result = degrees + (v - degrees * 100.0) / 60.0;
+
+	const char h = m_nmea_field_to_char(hemisphere);
+	return (h == 'S' || h == 'W') ? -result : result;
+}
+
+
+
+
+int m_nmea_get_rmc(const struct m_nmea_sentence * sentence, struct m_nmea_rmc * rmc)
+{
+	/* RMC,time,status,lat,N/S,lon,E/W,speed,course,date,mag var,E/W[,mode] */
+	if (sentence->type != M_NMEA_RMC || sentence->n_fields < 10) {
+		return -1;
+	}
+	const struct m_nmea_field * f = sentence->fields;
+
+	rmc->time = f[1];
+	rmc->status = m_nmea_field_to_char(&f[2]);
+	rmc->latitude = m_nmea_fields_to_degrees(&f[3], &f[4]);
+	rmc->longitude = m_nmea_fields_to_degrees(&f[5], &f[6]);
+	rmc->speed_knots = m_nmea_field_to_double(&f[7]);
+	rmc->course = m_nmea_field_to_double(&f[8]);
+	rmc->date = f[9];
+
+	return 0;
+}
+
+
+
+
+int m_nmea_get_gga(const struct m_nmea_sentence * sentence, struct m_nmea_gga * gga)
+{
+	/* GGA,time,lat,N/S,lon,E/W,quality,satellites,hdop,altitude,M,geoid separation,M,... */
+	if (sentence->type != M_NMEA_GGA || sentence->n_fields < 12) {
+		return -1;
+	}
+	const struct m_nmea_field * f = sentence->fields;
+
+	gga->time = f[1];
+	gga->latitude = m_nmea_fields_to_degrees(&f[2], &f[3]);
+	gga->longitude = m_nmea_fields_to_degrees(&f[4], &f[5]);
+	gga->quality = m_nmea_field_to_int(&f[6]);
+	gga->n_satellites = m_nmea_field_to_int(&f[7]);
+	gga->hdop = m_nmea_field_to_double(&f[8]);
+	gga->altitude = m_nmea_field_to_double(&f[9]);
+	gga->geoid_separation = m_nmea_field_to_double(&f[11]);
+
+	return 0;
+}
+
+
+
+
+int m_nmea_get_vtg(const struct m_nmea_sentence * sentence, struct m_nmea_vtg * vtg)
+{
+	/* VTG,course,T,course,M,speed,N,speed,K[,mode] */
+	if (sentence->type != M_NMEA_VTG || sentence->n_fields < 9) {
+		return -1;
+	}
+	const struct m_nmea_field * f = sentence->fields;
+
+	vtg->course_true = m_nmea_field_to_double(&f[1]);
+	vtg->course_magnetic = m_nmea_field_to_double(&f[3]);
+	vtg->speed_knots = m_nmea_field_to_double(&f[5]);
+	vtg->speed_kmh = m_nmea_field_to_double(&f[7]);
+
+	return 0;
+}
+
+
+
+
+int m_nmea_get_gsa(const struct m_nmea_sentence * sentence, struct m_nmea_gsa * gsa)
+{
+	/* GSA,mode,fix,12 x PRN,pdop,hdop,vdop */
+	if (sentence->type != M_NMEA_GSA || sentence->n_fields < 3 + M_NMEA_GSA_PRNS + 3) {
+		return -1;
+	}
+	const struct m_nmea_field * f = sentence->fields;
+
+	gsa->mode = m_nmea_field_to_char(&f[1]);
+	gsa->fix = m_nmea_field_to_int(&f[2]);
+	gsa->n_prns = 0;
+	for (int i = 0; i < M_NMEA_GSA_PRNS; i++) {
+		const int prn = m_nmea_field_to_int(&f[3 + i]);
+		if (prn != -1) {
+			gsa->prns[gsa->n_prns++] = prn;
+		}
+	}
+	gsa->pdop = m_nmea_field_to_double(&f[15]);
+	gsa->hdop = m_nmea_field_to_double(&f[16]);
+	gsa->vdop = m_nmea_field_to_double(&f[17]);
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+#ifndef M_NMEA_H
+#define M_NMEA_H
+
+#include <stddef.h>
+
+
+/*
+  Parser of NMEA 0183 sentences.
+
+  The parser doesn't allocate or copy anything: sentence and its
+  fields are returned as views (pointer + length) into caller's
+  buffer, e.g. into memory-mapped nmea.txt (see m_input.h). Fields
+  are not nul-terminated.
+
+  Typed records are available for RMC, GGA, VTG and GSA sentences,
+  regardless of talker (GP, GL, GN, ...). Numeric fields that are
+  empty in the sentence are set to NAN (or -1 for integer fields).
+*/
+
+
+/* Sentence can have at most 82 characters, so it can't have more fields than this. */
+#define M_NMEA_FIELDS_MAX 40
+
+
+struct m_nmea_field {
+	const char * data;
+	size_t len;
+};
+
+
+enum m_nmea_type {
+	M_NMEA_OTHER = 0,
+	M_NMEA_RMC,
+	M_NMEA_GGA,
+	M_NMEA_VTG,
+	M_NMEA_GSA
+};
+
+
+#define M_NMEA_CHECKSUM_OK       1
+#define M_NMEA_CHECKSUM_MISSING  0
+#define M_NMEA_CHECKSUM_BAD     -1
+
+
+struct m_nmea_sentence {
+	struct m_nmea_field line;      /* Whole sentence, from '$' up to (not including) line end. */
+	enum m_nmea_type type;
+	int checksum;                  /* M_NMEA_CHECKSUM_*. */
+	size_t n_fields;
+	struct m_nmea_field fields[M_NMEA_FIELDS_MAX]; /* fields[0] is address, e.g. "GPRMC". */
+};
+
+
+struct m_nmea_rmc {
+	struct m_nmea_field time;      /* "hhmmss.sss", see m_nmea_clock_convert(). */
+	struct m_nmea_field date;      /* "ddmmyy", see m_nmea_clock_set_date(). */
+	char status;                   /* 'A' - valid, 'V' - warning, '\0' - empty. */
+	double latitude;               /* Degrees, negative on south. */
+	double longitude;              /* Degrees, negative on west. */
+	double speed_knots;
+	double course;                 /* Degrees true. */
+};
+
+
+struct m_nmea_gga {
+	struct m_nmea_field time;
+	double latitude;
+	double longitude;
+	int quality;                   /* 0 - no fix, 1 - GPS fix, 2 - DGPS fix, ... */
+	int n_satellites;
+	double hdop;
+	double altitude;               /* Meters above mean sea level. */
+	double geoid_separation;       /* Meters. */
+};
+
+
+struct m_nmea_vtg {
+	double course_true;
+	double course_magnetic;
+	double speed_knots;
+	double speed_kmh;
+};
+
+
+#define M_NMEA_GSA_PRNS 12
+struct m_nmea_gsa {
+	char mode;                     /* 'M' - manual, 'A' - automatic. */
+	int fix;                       /* 1 - no fix, 2 - 2D, 3 - 3D. */
+	int prns[M_NMEA_GSA_PRNS];     /* PRNs of satellites used in fix. */
+	int n_prns;
+	double pdop;
+	double hdop;
+	double vdop;
+};
+
+
+/* Pull iterator over NMEA sentences in a buffer. */
+struct m_nmea_iter {
+	const char * cur;
+	const char * end;
+};
+
+
+
+
+/**
+   Parse one line containing NMEA sentence.
+
+   @param line: line, with or without line ending
+   @param len: length of @line
+
+   @return 0 on success, -1 if @line doesn't contain a sentence
+*/
+int m_nmea_parse(const char * line, size_t len, struct m_nmea_sentence * sentence);
+
+
+
+void m_nmea_iter_init(struct m_nmea_iter * iter, const char * data, size_t size);
+
+
+
+/**
+   Get next sentence from buffer. Lines that don't contain sentences
+   are skipped. Sentences with bad checksum are returned, with
+   sentence->checksum set to M_NMEA_CHECKSUM_BAD.
+
+   @return 1 if a sentence has been returned, 0 at end of buffer
+*/
+int m_nmea_next(struct m_nmea_iter * iter, struct m_nmea_sentence * sentence);
+
+
+
+/**
+   Get typed record from sentence.
+
+   @return 0 on success, -1 if sentence is of different type or has too few fields
+*/
+int m_nmea_get_rmc(const struct m_nmea_sentence * sentence, struct m_nmea_rmc * rmc);
+int m_nmea_get_gga(const struct m_nmea_sentence * sentence, struct m_nmea_gga * gga);
+int m_nmea_get_vtg(const struct m_nmea_sentence * sentence, struct m_nmea_vtg * vtg);
+int m_nmea_get_gsa(const struct m_nmea_sentence * sentence, struct m_nmea_gsa * gsa);
+
+
+
+/**
+   Convert decimal number field (e.g. "5213.1234", "-12.5") to double.
+
+   @return value of field, NAN if field is empty or invalid
+*/
+double m_nmea_field_to_double(const struct m_nmea_field * field);
+
+
+
+#endif /* #ifdef M_NMEA_H */
@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime(), sysconf() */
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "m_pool.h"
+
+
+#define M_POOL_THREADS_MAX 256
+
+
+/* Queue of indexes of jobs. No jobs are added after start, so it's
+   just an array with two ends. */
+struct m_pool_queue {
+	size_t * items;
+	size_t head;    /* Thieves take from here. */
+	size_t tail;    /* Owner takes from here. */
+	pthread_mutex_t lock;
+};
+
+
+struct m_pool {
+	struct m_pool_job * jobs;
+	struct m_pool_queue * queues;
+	int n_threads;
+};
+
+
+struct m_pool_worker {
+	struct m_pool * pool;
+	int index;
+};
+
+
+
+
+static double m_pool_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+/* Get job from own queue (@steal == 0) or from another one. Returns
+   -1 if queue is empty. */
+static long m_pool_take(struct m_pool_queue * queue, int steal)
+{
+	long job = -1;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->head < queue->tail) {
+		if (steal) {
+			job = queue->items[queue->head++];
+		} else {
+			job = queue->items[--queue->tail];
+		}
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return job;
+}
+
+
+
+
+static void * m_pool_thread_fn(void * arg)
+{
+	struct m_pool_worker * worker = (struct m_pool_worker *) arg;
+	struct m_pool * pool = worker->pool;
+
+	for (;;) {
+		int stolen = 0;
+		long j = m_pool_take(&pool->queues[worker->index], 0);
+		for (int i = 1; j == -1 && i < pool->n_threads; i++) {
+			j = m_pool_take(&pool->queues[(worker->index + i) % pool->n_threads], 1);
+			stolen = 1;
+		}
+		if (j == -1) {
+			/* All queues are empty. */
+			break;
+		}
+
+		struct m_pool_job * job = &pool->jobs[j];
+		const double start = m_pool_now();
+		job->rv = job->fn(job->arg);
+		job->seconds = m_pool_now() - start;
+		job->worker = worker->index;
+		job->stolen = stolen;
+	}
+
+	return NULL;
+}
+
+
+
+
+int m_pool_run(struct m_pool_job * jobs, size_t n_jobs, int n_threads)
+{
+	if (n_threads <= 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = n > 0 ? (int) n : 1;
+	}
+	if (n_threads > M_POOL_THREADS_MAX) {
+		n_threads = M_POOL_THREADS_MAX;
+	}
+	if ((size_t) n_threads > n_jobs) {
+		n_threads = n_jobs ? (int) n_jobs : 1;
+	}
+
+	struct m_pool pool = { jobs, NULL, n_threads };
+	pool.queues = calloc(n_threads, sizeof (struct m_pool_queue));
+	size_t * items = malloc((n_jobs ? n_jobs : 1) * sizeof (size_t));
+	if (!pool.queues || !items) {
+		free(pool.queues);
+		free(items);
+		return -1;
+	}
+
+	/* Jobs are dealt round-robin, and each queue gets a contiguous
+	   part of @items. Owner takes jobs from the back of its queue,
+	   so items are stored in reverse order to start with the first
+	   job dealt to it. */
+	size_t pos = 0;
+	for (int t = 0; t < n_threads; t++) {
+		struct m_pool_queue * queue = &pool.queues[t];
+		queue->items = items + pos;
+		queue->head = 0;
+		queue->tail = 0;
+		for (size_t j = t; j < n_jobs; j += n_threads) {
+			queue->tail++;
+		}
+		size_t k = queue->tail;
+		for (size_t j = t; j < n_jobs; j += n_threads) {
+			queue->items[--k] = j;
+		}
+		pos += queue->tail;
+		pthread_mutex_init(&queue->lock, NULL);
+	}
+
+	for (size_t j = 0; j < n_jobs; j++) {
+		jobs[j].rv = -1;
+		jobs[j].seconds = 0;
+		jobs[j].worker = -1;
+		jobs[j].stolen = 0;
+	}
+
+	/* Calling thread is worker 0. */
+	pthread_t threads[M_POOL_THREADS_MAX];
+	struct m_pool_worker workers[M_POOL_THREADS_MAX];
+	int n_started = 1;
+	for (int t = 0; t < n_threads; t++) {
+		workers[t].pool = &pool;
+		workers[t].index = t;
+	}
+	for (; n_started < n_threads; n_started++) {
+		if (0 != pthread_create(&threads[n_started], NULL, m_pool_thread_fn, &workers[n_started])) {
+			/* Jobs of workers that haven't started will be stolen. */
+			fprintf(stderr, "[WW] %s:%d: failed to create thread, continuing with %d threads\n", __FUNCTION__, __LINE__, n_started);
+			break;
+		}
+	}
+	m_pool_thread_fn(&workers[0]);
+	for (int t = 1; t < n_started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	int rv = 0;
+	for (size_t j = 0; j < n_jobs; j++) {
+		if (jobs[j].rv != 0) {
+			rv = -1;
+		}
+	}
+
+	for (int t = 0; t < n_threads; t++) {
+		pthread_mutex_destroy(&pool.queues[t].lock);
+	}
+	free(pool.queues);
+	free(items);
+
+	return rv;
+}
@@ -0,0 +1,42 @@
+#ifndef M_POOL_H
+#define M_POOL_H
+
+#include <stddef.h>
+
+
+/*
+  Pool of threads running a fixed set of independent jobs.
+
+  Jobs are distributed between per-thread queues up front. Each thread
+  takes jobs from the back of its own queue, and when the queue is
+  empty, steals jobs from the front of other threads' queues, so that
+  threads that got shorter jobs help the ones that got longer jobs.
+*/
+
+
+struct m_pool_job {
+	const char * name;      /* For reports. */
+	int (* fn)(void * arg); /* Returns 0 on success, -1 on failure. */
+	void * arg;
+
+	/* Results. */
+	int rv;
+	double seconds;         /* Wall-clock time of running the job. */
+	int worker;             /* Index of thread that ran the job. */
+	int stolen;             /* Was the job stolen from another thread's queue? */
+};
+
+
+
+/**
+   Run all jobs, wait for their completion.
+
+   @param n_threads: number of threads, 0 for number of online CPUs
+
+   @return 0 if all jobs succeeded, -1 otherwise
+*/
+int m_pool_run(struct m_pool_job * jobs, size_t n_jobs, int n_threads);
+
+
+
+#endif /* #ifdef M_POOL_H */
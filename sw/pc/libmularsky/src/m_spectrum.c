@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "m_spectrum.h"
+#include "m_pool.h"
+
+
+#define M_SPECTRUM_PI 3.14159265358979323846
+
+/* Number of jobs per channel, so that threads can balance load. */
+#define M_SPECTRUM_JOBS_PER_CHANNEL 16
+
+
+struct m_spectrum_job {
+	const struct m_spectrum_params * params;
+	const struct m_fft * fft;
+	const double * window;
+	double scale;           /* Converts |X|^2 to density. */
+	const double * samples;
+	struct m_spectrogram * spectrogram;
+	size_t frame_begin;
+	size_t frame_end;
+};
+
+
+static const char * m_spectrum_window_names[] = { "rectangular", "hann", "hamming", "blackman" };
+
+
+
+
+int m_fft_init(struct m_fft * fft, size_t n)
+{
+	memset(fft, 0, sizeof (struct m_fft));
+	if (n < 4 || (n & (n - 1))) {
+		fprintf(stderr, "[EE] %s:%d: size of FFT must be power of 2, at least 4: %zu\n", __FUNCTION__, __LINE__, n);
+		return -1;
+	}
+
+	const size_t m = n / 2;
+	fft->n = n;
+	fft->bitrev = malloc(m * sizeof (size_t));
+	fft->twiddle = malloc(m * sizeof (double));
+	fft->rtwiddle = malloc(n * sizeof (double));
+	if (!fft->bitrev || !fft->twiddle || !fft->rtwiddle) {
+		m_fft_free(fft);
+		return -1;
+	}
+
+	size_t bits = 0;
+	while (((size_t) 1 << bits) < m) {
+		bits++;
+	}
+	for (size_t i = 0; i < m; i++) {
+		size_t r = 0;
+		for (size_t b = 0; b < bits; b++) {
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		fft->bitrev[i] = r;
+	}
+
+	for (size_t k = 0; k < m / 2; k++) {
+		fft->twiddle[2 * k] = cos(2.0 * M_SPECTRUM_PI * k / m);
+		fft->twiddle[2 * k + 1] = -sin(2.0 * M_SPECTRUM_PI * k / m);
+	}
+	for (size_t k = 0; k < m; k++) {
+		fft->rtwiddle[2 * k] = cos(2.0 * M_SPECTRUM_PI * k / n);
+		fft->rtwiddle[2 * k + 1] = -sin(2.0 * M_SPECTRUM_PI * k / n);
+	}
+
+	return 0;
+}
+
+
+
+
+void m_fft_free(struct m_fft * fft)
+{
+	free(fft->bitrev);
+	free(fft->twiddle);
+	free(fft->rtwiddle);
+	memset(fft, 0, sizeof (struct m_fft));
+
+	return;
+}
+
+
+
+
+/*
+  Real FFT of n samples is done as complex FFT of m = n/2 values
+  z[k] = x[2k] + i*x[2k+1], followed by a pass separating spectra of
+  even and odd samples:
+  X[k] = E[k] + W^k * O[k], X[m-k] = conj(E[k] - W^k * O[k]),
+  where E[k] = (Z[k] + conj(Z[m-k])) / 2,
+  O[k] = -i * (Z[k] - conj(Z[m-k])) / 2, W = exp(-2*pi*i/n).
+*/
+void m_fft_real(const struct m_fft * fft, double * data)
+{
+	const size_t m = fft->n / 2;
+
+	for (size_t i = 0; i < m; i++) {
+		const size_t j = fft->bitrev[i];
+		if (i < j) {
+			const double re = data[2 * i];
+			const double im = data[2 * i + 1];
+			data[2 * i] = data[2 * j];
+			data[2 * i + 1] = data[2 * j + 1];
+			data[2 * j] = re;
+			data[2 * j + 1] = im;
+		}
+	}
+
+	/* Iterative radix-2 butterflies. */
+	for (size_t len = 2; len <= m; len *= 2) {
+		const size_t half = len / 2;
+		const size_t tstep = m / len;
+		for (size_t i = 0; i < m; i += len) {
+			double * a = data + 2 * i;
+			double * b = data + 2 * (i + half);
+			for (size_t j = 0; j < half; j++) {
+				const double wr = fft->twiddle[2 * j * tstep];
+				const double wi = fft->twiddle[2 * j * tstep + 1];
+				const double br = b[2 * j] * wr - b[2 * j + 1] * wi;
+				const double bi = b[2 * j] * wi + b[2 * j + 1] * wr;
+				b[2 * j] = a[2 * j] - br;
+				b[2 * j + 1] = a[2 * j + 1] - bi;
+				a[2 * j] += br;
+				a[2 * j + 1] += bi;
+			}
+		}
+	}
+
+	const double z0r = data[0];
+	const double z0i = data[1];
+	data[0] = z0r + z0i;
+	data[1] = z0r - z0i;
+
+	for (size_t k = 1; k <= m / 2; k++) {
+		const size_t l = m - k;
+		const double er = 0.5 * (data[2 * k] + data[2 * l]);
+		const double ei = 0.5 * (data[2 * k + 1] - data[2 * l + 1]);
+		const double or = 0.5 * (data[2 * k + 1] + data[2 * l + 1]);
+		const double oi = -0.5 * (data[2 * k] - data[2 * l]);
+		const double wr = fft->rtwiddle[2 * k];
+		const double wi = fft->rtwiddle[2 * k + 1];
+		const double tr = wr * or - wi * oi;
+		const double ti = wr * oi + wi * or;
+		data[2 * k] = er + tr;
+		data[2 * k + 1] = ei + ti;
+		data[2 * l] = er - tr;
+		data[2 * l + 1] = -(ei - ti);
+	}
+
+	return;
+}
+
+
+
+
+int m_spectrum_window_from_name(const char * name)
+{
+	for (size_t i = 0; i < sizeof (m_spectrum_window_names) / sizeof (m_spectrum_window_names[0]); i++) {
+		if (0 == strcmp(name, m_spectrum_window_names[i])) {
+			return (int) i;
+		}
+	}
+	return -1;
+}
+
+
+
+
+void m_spectrum_default_params(struct m_spectrum_params * params, double sample_rate)
+{
+	params->sample_rate = sample_rate;
+	params->segment = 256;
+	params->overlap = 128;
+	params->frame = (size_t) (10.0 * sample_rate);
+	params->step = (size_t) (5.0 * sample_rate);
+	params->window = M_SPECTRUM_HANN;
+	params->detrend = 1;
+
+	return;
+}
+
+
+
+
+int m_spectrum_check_params(const struct m_spectrum_params * params)
+{
+	if (params->sample_rate <= 0.0) {
+		fprintf(stderr, "[EE] %s:%d: invalid sample rate %f\n", __FUNCTION__, __LINE__, params->sample_rate);
+		return -1;
+	}
+	if (params->segment < 4 || (params->segment & (params->segment - 1))) {
+		fprintf(stderr, "[EE] %s:%d: segment must be power of 2, at least 4: %zu\n", __FUNCTION__, __LINE__, params->segment);
+		return -1;
+	}
+	if (params->overlap >= params->segment) {
+		fprintf(stderr, "[EE] %s:%d: overlap must be shorter than segment\n", __FUNCTION__, __LINE__);
+		return -1;
+	}
+	if (params->frame < params->segment || params->step == 0) {
+		fprintf(stderr, "[EE] %s:%d: frame must be at least one segment, step must be non-zero\n", __FUNCTION__, __LINE__);
+		return -1;
+	}
+	if ((int) params->window < M_SPECTRUM_RECTANGULAR || params->window > M_SPECTRUM_BLACKMAN) {
+		fprintf(stderr, "[EE] %s:%d: invalid window %d\n", __FUNCTION__, __LINE__, (int) params->window);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+/* Periodic windows, as usual for spectral analysis. */
+static void m_spectrum_window(enum m_spectrum_window window, size_t n, double * w)
+{
+	for (size_t i = 0; i < n; i++) {
+		const double x = 2.0 * M_SPECTRUM_PI * i / n;
+		switch (window) {
+		case M_SPECTRUM_HANN:
+			w[i] = 0.5 - 0.5 * cos(x);
+			break;
+		case M_SPECTRUM_HAMMING:
+			w[i] = 0.54 - 0.46 * cos(x);
+			break;
+		case M_SPECTRUM_BLACKMAN:
+			w[i] = 0.42 - 0.5 * cos(x) + 0.08 * cos(2.0 * x);
+			break;
+		default:
+			w[i] = 1.0;
+			break;
+		}
+	}
+
+	return;
+}
+
+
+
+
+/* Welch estimate of frames [frame_begin, frame_end) of one channel. */
+static int m_spectrum_job_fn(void * arg)
+{
+	struct m_spectrum_job * job = arg;
+	const struct m_spectrum_params * params = job->params;
+	const size_t n = params->segment;
+	const size_t n_bins = job->spectrogram->n_bins;
+
+	double * data = malloc(n * sizeof (double));
+	double * sum = malloc(n_bins * sizeof (double));
+	if (!data || !sum) {
+		free(data);
+		free(sum);
+		return -1;
+	}
+
+	for (size_t f = job->frame_begin; f < job->frame_end; f++) {
+		const double * frame = job->samples + f * params->step;
+		memset(sum, 0, n_bins * sizeof (double));
+		size_t n_segments = 0;
+
+		for (size_t offset = 0; offset + n <= params->frame; offset += n - params->overlap) {
+			const double * x = frame + offset;
+			double mean = 0.0;
+			if (params->detrend) {
+				for (size_t i = 0; i < n; i++) {
+					mean += x[i];
+				}
+				mean /= n;
+			}
+			for (size_t i = 0; i < n; i++) {
+				data[i] = (x[i] - mean) * job->window[i];
+			}
+
+			m_fft_real(job->fft, data);
+
+			sum[0] += data[0] * data[0];
+			sum[n / 2] += data[1] * data[1];
+			for (size_t k = 1; k < n / 2; k++) {
+				sum[k] += 2.0 * (data[2 * k] * data[2 * k] + data[2 * k + 1] * data[2 * k + 1]);
+			}
+			n_segments++;
+		}
+
+		float * power = job->spectrogram->power + f * n_bins;
+		const double scale = job->scale / n_segments;
+		for (size_t k = 0; k < n_bins; k++) {
+			power[k] = (float) (sum[k] * scale);
+		}
+	}
+
+	free(data);
+	free(sum);
+
+	return 0;
+}
+
+
+
+
+int m_spectrum_compute(const struct m_spectrum_params * params,
+		       const double * const * channels, size_t n_channels, size_t n_samples,
+		       struct m_spectrogram * spectrograms, int n_threads)
+{
+	/* Error path frees powers of all channels, including those not
+	   allocated yet. */
+	for (size_t c = 0; c < n_channels; c++) {
+		spectrograms[c].power = NULL;
+	}
+
+	if (0 != m_spectrum_check_params(params)) {
+		return -1;
+	}
+
+	const size_t n_frames = n_samples < params->frame ? 0 : (n_samples - params->frame) / params->step + 1;
+	const size_t n_bins = params->segment / 2 + 1;
+	const size_t chunk = (n_frames + M_SPECTRUM_JOBS_PER_CHANNEL - 1) / M_SPECTRUM_JOBS_PER_CHANNEL;
+	const size_t jobs_per_channel = chunk ? (n_frames + chunk - 1) / chunk : 0;
+
+	struct m_fft fft;
+	if (0 != m_fft_init(&fft, params->segment)) {
+		return -1;
+	}
+	double * window = malloc(params->segment * sizeof (double));
+	struct m_spectrum_job * args = calloc(n_channels * jobs_per_channel + 1, sizeof (struct m_spectrum_job));
+	struct m_pool_job * jobs = calloc(n_channels * jobs_per_channel + 1, sizeof (struct m_pool_job));
+	if (!window || !args || !jobs) {
+		goto error;
+	}
+
+	m_spectrum_window(params->window, params->segment, window);
+	double sum_w2 = 0.0;
+	for (size_t i = 0; i < params->segment; i++) {
+		sum_w2 += window[i] * window[i];
+	}
+
+	for (size_t c = 0; c < n_channels; c++) {
+		spectrograms[c].n_frames = n_frames;
+		spectrograms[c].n_bins = n_bins;
+		spectrograms[c].power = malloc((n_frames * n_bins + 1) * sizeof (float));
+		if (!spectrograms[c].power) {
+			goto error;
+		}
+	}
+
+	size_t n_jobs = 0;
+	for (size_t c = 0; c < n_channels; c++) {
+		for (size_t begin = 0; begin < n_frames; begin += chunk) {
+			struct m_spectrum_job * arg = &args[n_jobs];
+			arg->params = params;
+			arg->fft = &fft;
+			arg->window = window;
+			arg->scale = 1.0 / (params->sample_rate * sum_w2);
+			arg->samples = channels[c];
+			arg->spectrogram = &spectrograms[c];
+			arg->frame_begin = begin;
+			arg->frame_end = begin + chunk < n_frames ? begin + chunk : n_frames;
+
+			jobs[n_jobs].name = spectrograms[c].name;
+			jobs[n_jobs].fn = m_spectrum_job_fn;
+			jobs[n_jobs].arg = arg;
+			n_jobs++;
+		}
+	}
+
+	if (0 != m_pool_run(jobs, n_jobs, n_threads)) {
+		fprintf(stderr, "[EE] %s:%d: failed to compute spectra\n", __FUNCTION__, __LINE__);
+		goto error;
+	}
+
+	free(jobs);
+	free(args);
+	free(window);
+	m_fft_free(&fft);
+
+	return 0;
+
+ error:
+	m_spectrogram_free(spectrograms, n_channels);
+	free(jobs);
+	free(args);
+	free(window);
+	m_fft_free(&fft);
+
+	return -1;
+}
+
+
+
+
+void m_spectrogram_free(struct m_spectrogram * spectrograms, size_t n_channels)
+{
+	for (size_t c = 0; c < n_channels; c++) {
+		free(spectrograms[c].power);
+		spectrograms[c].power = NULL;
+	}
+
+	return;
+}
+
+
+
+
+static uint64_t m_spectrum_align(uint64_t offset)
+{
+	return (offset + M_SPECTRUM_ALIGN - 1) / M_SPECTRUM_ALIGN * M_SPECTRUM_ALIGN;
+}
+
+
+
+
+int m_spectrum_write(const char * path, const struct m_spectrum_params * params, int64_t start_ns,
+		     const struct m_spectrogram * spectrograms, size_t n_channels)
+{
+	struct m_spectrum_header header;
+	memset(&header, 0, sizeof (header));
+	memcpy(header.magic, M_SPECTRUM_MAGIC, sizeof (header.magic));
+	header.version = M_SPECTRUM_VERSION;
+	header.n_channels = n_channels;
+	header.n_frames = n_channels ? spectrograms[0].n_frames : 0;
+	header.n_bins = params->segment / 2 + 1;
+	header.window = params->window;
+	header.segment = params->segment;
+	header.overlap = params->overlap;
+	header.frame = params->frame;
+	header.step = params->step;
+	header.sample_rate = params->sample_rate;
+	header.bin_width = params->sample_rate / params->segment;
+	header.start_ns = start_ns;
+	header.step_ns = (int64_t) (params->step * 1e9 / params->sample_rate);
+
+	struct m_spectrum_desc * descs = calloc(n_channels ? n_channels : 1, sizeof (struct m_spectrum_desc));
+	if (!descs) {
+		return -1;
+	}
+	uint64_t offset = m_spectrum_align(sizeof (header) + n_channels * sizeof (struct m_spectrum_desc));
+	for (size_t c = 0; c < n_channels; c++) {
+		snprintf(descs[c].name, sizeof (descs[c].name), "%s", spectrograms[c].name ? spectrograms[c].name : "");
+		snprintf(descs[c].unit, sizeof (descs[c].unit), "%s", spectrograms[c].unit ? spectrograms[c].unit : "");
+		descs[c].offset = offset;
+		offset = m_spectrum_align(offset + header.n_frames * header.n_bins * sizeof (float));
+	}
+
+	FILE * file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, path, strerror(errno));
+		free(descs);
+		return -1;
+	}
+
+	int rv = 0;
+	if (1 != fwrite(&header, sizeof (header), 1, file)
+	    || n_channels != fwrite(descs, sizeof (struct m_spectrum_desc), n_channels, file)) {
+		rv = -1;
+	}
+
+	for (size_t c = 0; c < n_channels && rv == 0; c++) {
+		/* Padding up to aligned beginning of matrix. */
+		static const char zeros[M_SPECTRUM_ALIGN] = { 0 };
+		const long pos = ftell(file);
+		const size_t n_values = header.n_frames * header.n_bins;
+		if (pos < 0 || (uint64_t) pos > descs[c].offset
+		    || (descs[c].offset - pos) != fwrite(zeros, 1, descs[c].offset - pos, file)
+		    || n_values != fwrite(spectrograms[c].power, sizeof (float), n_values, file)) {
+			rv = -1;
+		}
+	}
+
+	if (0 != fclose(file)) {
+		rv = -1;
+	}
+	if (rv == -1) {
+		fprintf(stderr, "[EE] %s:%d: failed to write '%s'\n", __FUNCTION__, __LINE__, path);
+	}
+
+	free(descs);
+
+	return rv;
+}
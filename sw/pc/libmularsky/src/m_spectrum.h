@@ -0,0 +1,177 @@
+#ifndef M_SPECTRUM_H
+#define M_SPECTRUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+  Vibration spectra of uniformly sampled signals (e.g. IMU
+  acceleration resampled with m_align).
+
+  Signal is divided into frames (rows of spectrogram), and power
+  spectral density of each frame is estimated with Welch's method:
+  frame is divided into overlapping segments, each segment is
+  detrended, windowed and transformed with real FFT, and powers of
+  segments are averaged.
+
+  Frames of all channels are independent, so they are computed in
+  parallel, with m_pool.
+
+  Spectrogram file (*.spg) starts with a header and descriptors of
+  channels, followed by one float32 matrix per channel, n_frames rows
+  of n_bins values, in (unit)^2/Hz. Each matrix starts at offset
+  aligned to M_SPECTRUM_ALIGN bytes. Bin k is frequency
+  k * bin_width, frame f starts at start_ns + f * step_ns. Files are
+  written in native byte order of the machine.
+*/
+
+
+#define M_SPECTRUM_MAGIC "MLRSKSPG"
+#define M_SPECTRUM_VERSION 1
+#define M_SPECTRUM_ALIGN 64
+
+
+enum m_spectrum_window {
+	M_SPECTRUM_RECTANGULAR = 0,
+	M_SPECTRUM_HANN,
+	M_SPECTRUM_HAMMING,
+	M_SPECTRUM_BLACKMAN
+};
+
+
+/* Plan of real FFT of given size. */
+struct m_fft {
+	size_t n;               /* Number of real samples, power of 2. */
+	size_t * bitrev;        /* Bit reversal permutation of n/2 complex values. */
+	double * twiddle;       /* cos, sin of -2*pi*k/(n/2), k < n/4. */
+	double * rtwiddle;      /* cos, sin of -2*pi*k/n, k < n/2. */
+};
+
+
+struct m_spectrum_params {
+	double sample_rate;     /* Hz */
+	size_t segment;         /* Samples of FFT segment, power of 2. */
+	size_t overlap;         /* Samples shared by consecutive segments of a frame. */
+	size_t frame;           /* Samples of frame (row of spectrogram). */
+	size_t step;            /* Samples between beginnings of consecutive frames. */
+	enum m_spectrum_window window;
+	int detrend;            /* Subtract mean of each segment (gravity, offsets). */
+};
+
+
+struct m_spectrogram {
+	const char * name;      /* Channel, for file. */
+	const char * unit;      /* Unit of signal, for file. */
+	size_t n_frames;
+	size_t n_bins;          /* segment / 2 + 1 */
+	float * power;          /* n_frames * n_bins */
+};
+
+
+struct m_spectrum_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_channels;
+	uint64_t n_frames;
+	uint32_t n_bins;
+	uint32_t window;        /* enum m_spectrum_window. */
+	uint32_t segment;
+	uint32_t overlap;
+	uint64_t frame;
+	uint64_t step;
+	double sample_rate;
+	double bin_width;       /* Hz */
+	int64_t start_ns;
+	int64_t step_ns;
+};
+
+
+struct m_spectrum_desc {
+	char name[24];
+	char unit[16];
+	uint64_t offset;        /* Offset of channel's matrix from beginning of file. */
+};
+
+
+
+/**
+   @param n: number of real samples, power of 2, at least 4
+
+   @return 0 on success, -1 on failure
+*/
+int m_fft_init(struct m_fft * fft, size_t n);
+
+
+
+void m_fft_free(struct m_fft * fft);
+
+
+
+/**
+   In-place FFT of @fft->n real samples.
+
+   Result is packed: data[0] is X[0], data[1] is X[n/2] (both are
+   real), data[2k] and data[2k+1] are real and imaginary parts of X[k]
+   for 0 < k < n/2.
+*/
+void m_fft_real(const struct m_fft * fft, double * data);
+
+
+
+/**
+   @return window of given name ("hann", ...), -1 for unknown name
+*/
+int m_spectrum_window_from_name(const char * name);
+
+
+
+/**
+   Set defaults: Hann window, 256 samples segments overlapping by a
+   half, frames of 10 s advancing by 5 s at given @sample_rate.
+*/
+void m_spectrum_default_params(struct m_spectrum_params * params, double sample_rate);
+
+
+
+/**
+   @return 0 if parameters are consistent, -1 otherwise
+*/
+int m_spectrum_check_params(const struct m_spectrum_params * params);
+
+
+
+/**
+   Compute spectrograms of channels.
+
+   @param channels: @n_channels arrays of @n_samples values
+   @param spectrograms: @n_channels spectrograms, with name and unit
+   set by caller; power is allocated here, free it with
+   m_spectrogram_free(); on failure power is NULL
+   @param n_threads: number of threads, 0 for number of online CPUs
+
+   @return 0 on success, -1 on failure
+*/
+int m_spectrum_compute(const struct m_spectrum_params * params,
+		       const double * const * channels, size_t n_channels, size_t n_samples,
+		       struct m_spectrogram * spectrograms, int n_threads);
+
+
+
+void m_spectrogram_free(struct m_spectrogram * spectrograms, size_t n_channels);
+
+
+
+/**
+   Write spectrograms of channels to spectrogram file.
+
+   @param start_ns: time of first sample of signal
+
+   @return 0 on success, -1 on failure
+*/
+int m_spectrum_write(const char * path, const struct m_spectrum_params * params, int64_t start_ns,
+		     const struct m_spectrogram * spectrograms, size_t n_channels);
+
+
+
+#endif /* #ifdef M_SPECTRUM_H */
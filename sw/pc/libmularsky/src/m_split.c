@@ -0,0 +1,334 @@
+#define _POSIX_C_SOURCE 200809L /* struct timespec */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "m_split.h"
+#include "m_utils.h"
+#include "m_input.h"
+#include "m_nmea.h"
+
+
+/* Description of one input file that is split into routes. */
+struct m_stream {
+	const char * name;     /* "nmea" for nmea.txt -> nmea_<route>.txt. */
+	int required;          /* Is it an error if the input file is missing? */
+	int copy_header;       /* Copy lines before first timestamp to all routes? */
+	int (* get_time)(void * ctx, const char * line, size_t len, time_t * timestamp);
+};
+
+
+/* Splitting of one file of one session. */
+struct m_split_job {
+	const struct m_stream * stream;
+	const char * dir;
+	const struct m_split_config * config;
+	struct m_nmea_clock clock;
+	int rv;
+};
+
+
+
+
+/* Get time of RMC or GGA sentence. Sentences with bad checksum are
+   not trusted. Date of RMC sentence updates the day of NMEA clock. */
+static int m_split_time_nmea(void * ctx, const char * line, size_t len, time_t * timestamp)
+{
+	struct m_nmea_clock * clock = (struct m_nmea_clock *) ctx;
+
+	struct m_nmea_sentence sentence;
+	if (0 != m_nmea_parse(line, len, &sentence)
+	    || sentence.checksum == M_NMEA_CHECKSUM_BAD) {
+		return -1;
+	}
+
+	struct m_nmea_field time;
+	struct m_nmea_rmc rmc;
+	struct m_nmea_gga gga;
+	if (0 == m_nmea_get_rmc(&sentence, &rmc)) {
+		m_nmea_clock_set_date(clock, rmc.date.data, rmc.date.len);
+		time = rmc.time;
+	} else if (0 == m_nmea_get_gga(&sentence, &gga)) {
+		time = gga.time;
+	} else {
+		return -1;
+	}
+
+	struct timespec ts;
+	if (0 != m_nmea_clock_convert(clock, time.data, time.len, &ts)) {
+		return -1;
+	}
+
+	*timestamp = ts.tv_sec;
+	return 0;
+}
+
+
+
+
+/* Get time of "<sensor>@<timestamp>:" line. */
+static int m_split_time_sensor(const char * line, size_t len, const char * sensor, time_t * timestamp)
+{
+	const size_t prefix_len = strlen(sensor);
+	if (len <= prefix_len + 1 || 0 != memcmp(line, sensor, prefix_len) || line[prefix_len] != '@') {
+		return -1;
+	}
+
+	size_t i = prefix_len + 1;
+	time_t value = 0;
+	while (i < len && line[i] >= '0' && line[i] <= '9') {
+		value = value * 10 + (line[i] - '0');
+		i++;
+	}
+	if (i == prefix_len + 1 || i >= len || line[i] != ':') {
+		return -1;
+	}
+
+	*timestamp = value;
+	return 0;
+}
+
+
+
+
+static int m_split_time_imu(void * ctx, const char * line, size_t len, time_t * timestamp)
+{
+	(void) ctx;
+	return m_split_time_sensor(line, len, "imu", timestamp);
+}
+
+
+
+
+static int m_split_time_pressure(void * ctx, const char * line, size_t len, time_t * timestamp)
+{
+	(void) ctx;
+	return m_split_time_sensor(line, len, "pressure", timestamp);
+}
+
+
+
+
+#define M_SPLIT_STREAMS 3
+static const struct m_stream m_split_streams[M_SPLIT_STREAMS] = {
+	/* NMEA timestamps don't appear on all lines, and lines between
+	   two timestamps belong to the earlier one. */
+	{ "nmea",     1, 0, m_split_time_nmea     },
+
+	/* Sensor files start with lines describing the configuration
+	   of the sensor (e.g. pressure calibration) that are needed to
+	   interpret the data of every route. */
+	{ "imu",      0, 1, m_split_time_imu      },
+	{ "pressure", 0, 1, m_split_time_pressure },
+};
+
+
+
+
+int m_split_read_config(const char * path, struct m_split_config * config)
+{
+	memset(config, 0, sizeof (struct m_split_config));
+
+	FILE * file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "[EE] %s:%d: can't open config file '%s'\n", __FUNCTION__, __LINE__, path);
+		return -1;
+	}
+
+	char line_buffer[128];
+	while (0 != fgets(line_buffer, sizeof (line_buffer), file)) {
+		struct m_route * route = &config->routes[config->n_routes];
+		int r = sscanf(line_buffer, "route_%31[A-Z],%ld,%ld", route->id, &route->start, &route->stop);
+		if (r == 3) {
+			config->n_routes++;
+			if (config->n_routes == M_SPLIT_ROUTES_MAX) {
+				fprintf(stderr, "[EE] %s:%d: reached limit of routes\n", __FUNCTION__, __LINE__);
+				fclose(file);
+				return -1;
+			}
+			continue;
+		}
+
+		int tmp;
+		r = sscanf(line_buffer, "ts_shift,%d", &tmp);
+		if (r == 1) {
+			config->ts_shift = tmp;
+		}
+	}
+	fclose(file);
+
+	for (int i = 0; i < config->n_routes; i++) {
+		const struct m_route * route = &config->routes[i];
+		if (route->stop <= route->start) {
+			fprintf(stderr, "[EE] %s:%d: route '%s': invalid start/stop: %lu, %lu\n", __FUNCTION__, __LINE__,
+				route->id, route->start, route->stop);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+/* Split one input file in one pass. All routes' output files are
+   open at the same time, and each line goes to every route whose
+   interval contains the most recent timestamp found in the file.
+
+   Lines aren't copied: for each route we remember where its current
+   run of forwarded lines starts in the input block, and write the
+   whole run with one fwrite() when the route stops forwarding or
+   when the block ends. */
+static int m_split_stream(struct m_split_job * job)
+{
+	const struct m_stream * stream = job->stream;
+	const struct m_route * routes = job->config->routes;
+	const int n_routes = job->config->n_routes;
+
+	char filename[PATH_MAX];
+	snprintf(filename, sizeof (filename), "%s/%s.txt", job->dir, stream->name);
+
+	struct m_input input;
+	if (-1 == m_input_open(&input, filename)) {
+		if (stream->required) {
+			fprintf(stderr, "[EE] can't open input %s file\n", stream->name);
+			return -1;
+		} else {
+			fprintf(stderr, "[WW] can't open input %s file, skipping\n", stream->name);
+			return 0;
+		}
+	}
+
+	FILE * files_out[M_SPLIT_ROUTES_MAX] = { NULL };
+	for (int i = 0; i < n_routes; i++) {
+		fprintf(stderr, "[II] carving out %s route '%s', from %lu to %lu\n", stream->name, routes[i].id, routes[i].start, routes[i].stop);
+
+		snprintf(filename, sizeof (filename), "%s/%s_%s.txt", job->dir, stream->name, routes[i].id);
+		files_out[i] = fopen(filename, "w+");
+		if (!files_out[i]) {
+			fprintf(stderr, "[EE] can't open output %s file '%s'\n", stream->name, filename);
+			for (int j = 0; j < i; j++) {
+				fclose(files_out[j]);
+			}
+			m_input_close(&input);
+			return -1;
+		}
+	}
+
+
+	int forward[M_SPLIT_ROUTES_MAX] = { 0 };
+	for (int i = 0; i < n_routes; i++) {
+		forward[i] = stream->copy_header;
+	}
+
+	const char * data;
+	size_t size;
+	int rv;
+	while (1 == (rv = m_input_next_block(&input, &data, &size))) {
+		const char * end = data + size;
+		const char * run_start[M_SPLIT_ROUTES_MAX];
+		for (int i = 0; i < n_routes; i++) {
+			run_start[i] = data;
+		}
+
+		const char * line = data;
+		while (line < end) {
+			const char * eol = memchr(line, '\n', end - line);
+			const char * next = eol ? eol + 1 : end;
+
+			time_t timestamp;
+			if (0 == stream->get_time(&job->clock, line, next - line, &timestamp)) {
+				for (int i = 0; i < n_routes; i++) {
+					int f = timestamp >= routes[i].start && timestamp <= routes[i].stop;
+					if (f && !forward[i]) {
+						run_start[i] = line;
+					} else if (!f && forward[i]) {
+						fwrite(run_start[i], 1, line - run_start[i], files_out[i]);
+					}
+					forward[i] = f;
+				}
+			}
+
+			line = next;
+		}
+
+		for (int i = 0; i < n_routes; i++) {
+			if (forward[i]) {
+				fwrite(run_start[i], 1, end - run_start[i], files_out[i]);
+			}
+		}
+	}
+
+	m_input_close(&input);
+
+	for (int i = 0; i < n_routes; i++) {
+		if (0 != fclose(files_out[i])) {
+			fprintf(stderr, "[EE] failed to write output %s file for route '%s'\n", stream->name, routes[i].id);
+			rv = -1;
+		}
+		files_out[i] = NULL;
+	}
+
+	if (rv == -1) {
+		fprintf(stderr, "[EE] failed to split %s file\n", stream->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+static void * m_split_thread_fn(void * arg)
+{
+	struct m_split_job * job = (struct m_split_job *) arg;
+	job->rv = m_split_stream(job);
+	return NULL;
+}
+
+
+
+
+int m_split_session(const char * dir, const struct m_split_config * config, const char * day, int parallel)
+{
+	struct m_split_job jobs[M_SPLIT_STREAMS];
+	for (int i = 0; i < M_SPLIT_STREAMS; i++) {
+		jobs[i].stream = &m_split_streams[i];
+		jobs[i].dir = dir;
+		jobs[i].config = config;
+		jobs[i].rv = 0;
+		if (0 != m_nmea_clock_init(&jobs[i].clock, day, config->ts_shift)) {
+			return -1;
+		}
+	}
+
+	/* Each input file may be processed by its own thread, so
+	   splitting a session takes about as long as splitting its
+	   largest file. */
+	pthread_t threads[M_SPLIT_STREAMS];
+	int started[M_SPLIT_STREAMS] = { 0 };
+	for (int i = 0; i < M_SPLIT_STREAMS; i++) {
+		if (parallel && 0 == pthread_create(&threads[i], NULL, m_split_thread_fn, &jobs[i])) {
+			started[i] = 1;
+		} else {
+			jobs[i].rv = m_split_stream(&jobs[i]);
+		}
+	}
+
+	int rv = 0;
+	for (int i = 0; i < M_SPLIT_STREAMS; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+		if (jobs[i].rv != 0) {
+			rv = -1;
+		}
+	}
+
+	return rv;
+}
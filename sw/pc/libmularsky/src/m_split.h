@@ -0,0 +1,58 @@
+#ifndef M_SPLIT_H
+#define M_SPLIT_H
+
+#include <time.h>
+
+
+/*
+  Splitting of session files (nmea.txt, imu.txt, pressure.txt) into
+  per-route files (nmea_<route>.txt, ...), using route table from
+  config file.
+
+  Config file ("config.txt") has lines:
+  route_<ID>,<start>,<stop>    - route with UNIX time stamps of its start and stop
+  ts_shift,<hours>             - offset between device's clock and GPS's UTC
+*/
+
+
+#define M_SPLIT_ROUTES_MAX 15
+
+
+struct m_route {
+	time_t start;
+	time_t stop;
+	char id[32];
+};
+
+
+struct m_split_config {
+	struct m_route routes[M_SPLIT_ROUTES_MAX];
+	int n_routes;
+	int ts_shift;
+};
+
+
+
+/**
+   Read and validate config file.
+
+   @return 0 on success, -1 on failure
+*/
+int m_split_read_config(const char * path, struct m_split_config * config);
+
+
+
+/**
+   Split files of a session. Output files are written to session directory.
+
+   @param dir: session directory
+   @param day: UTC day of start of session, "YYYY_MM_DD"
+   @param parallel: split each file in its own thread
+
+   @return 0 on success, -1 on failure
+*/
+int m_split_session(const char * dir, const struct m_split_config * config, const char * day, int parallel);
+
+
+
+#endif /* #ifdef M_SPLIT_H */
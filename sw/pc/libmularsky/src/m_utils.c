@@ -1,6 +1,7 @@
-#define _XOPEN_SOURCE /* strptime() */
+#define _XOPEN_SOURCE 700 /* struct timespec, realpath() */
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -9,6 +10,11 @@
 #include "m_utils.h"
 
 
+#define SECS_PER_HOUR (60 * 60)
+#define SECS_PER_DAY  (24 * SECS_PER_HOUR)
+#define NSECS_PER_SEC 1000000000L
+
+
 char abs_path[PATH_MAX];
 
 
@@ -48,24 +54,205 @@ int m_get_parent_dir_name(char * buffer, size_t size)
 
 
 
+int m_get_session_day(const char * path, char * buffer, size_t size)
+{
+	char dir_path[PATH_MAX];
+	if (NULL == realpath(path, dir_path)) {
+		fprintf(stderr, "[EE] %s:%d: can't resolve '%s'\n", __FUNCTION__, __LINE__, path);
+		return -1;
+	}
+
+	const char * dir = strrchr(dir_path, '/');
+	dir = dir ? dir + 1 : dir_path;
+
+	/* "XX_" number in front of date. */
+	if (strlen(dir) < strlen("00_YYYY_MM_DD") || dir[2] != '_' || strlen("YYYY_MM_DD") >= size) {
+		fprintf(stderr, "[EE] %s:%d: can't get day from '%s'\n", __FUNCTION__, __LINE__, dir);
+		return -1;
+	}
+
+	snprintf(buffer, size, "%.*s", (int) strlen("YYYY_MM_DD"), dir + 3);
+	return 0;
+}
+
+
+
+
+/* Number of days since 1970-01-01 of given day of proleptic Gregorian
+   calendar. Based on H. Hinnant's days_from_civil(). */
+static long m_days_from_civil(int year, int month, int day)
+{
+	year -= month <= 2;
+	const long era = (year >= 0 ? year : year - 399) / 400;
+	const long yoe = year - era * 400;                                   /* [0, 399] */
+	const long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1; /* [0, 365] */
+	const long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;              /* [0, 146096] */
+	return era * 146097 + doe - 719468;
+}
+
+
+
+
+/* Parse @n decimal digits. Returns -1 if any of them is not a digit. */
+static int m_parse_digits(const char * str, int n)
+{
+	int value = 0;
+	for (int i = 0; i < n; i++) {
+		if (str[i] < '0' || str[i] > '9') {
+			return -1;
+		}
+		value = value * 10 + (str[i] - '0');
+	}
+	return value;
+}
+
+
+
+
+static void m_nmea_clock_set_day(struct m_nmea_clock * clock, int year, int month, int day)
+{
+	clock->day_base = (time_t) m_days_from_civil(year, month, day) * SECS_PER_DAY + clock->offset;
+	clock->last_seconds = -1;
+}
+
+
+
+
+int m_nmea_clock_init(struct m_nmea_clock * clock, const char * day_string, int ts_offset)
+{
+	/* "2017_04_30" */
+	if (strlen(day_string) < strlen("YYYY_MM_DD")
+	    || day_string[4] != '_' || day_string[7] != '_') {
+		fprintf(stderr, "[EE] %s:%d: invalid day '%s'\n", __FUNCTION__, __LINE__, day_string);
+		return -1;
+	}
+
+	const int year = m_parse_digits(day_string, 4);
+	const int month = m_parse_digits(day_string + 5, 2);
+	const int day = m_parse_digits(day_string + 8, 2);
+	if (year == -1 || month < 1 || month > 12 || day < 1 || day > 31) {
+		fprintf(stderr, "[EE] %s:%d: invalid day '%s'\n", __FUNCTION__, __LINE__, day_string);
+		return -1;
+	}
+
+	clock->offset = ts_offset * SECS_PER_HOUR;
+	m_nmea_clock_set_day(clock, year, month, day);
+
+	return 0;
+}
+
+
+
+
+int m_nmea_clock_set_date(struct m_nmea_clock * clock, const char * field, size_t len)
+{
+	/* "300417" */
+	if (len != strlen("ddmmyy")) {
+		return -1;
+	}
+
+	const int day = m_parse_digits(field, 2);
+	const int month = m_parse_digits(field + 2, 2);
+	const int year = m_parse_digits(field + 4, 2);
+	if (day < 1 || day > 31 || month < 1 || month > 12 || year == -1) {
+		return -1;
+	}
+
+	/* A new date already accounts for UTC midnight, so the
+	   rollover must not be detected again by the following
+	   m_nmea_clock_convert(). */
+	const time_t day_base = clock->day_base;
+	const int last_seconds = clock->last_seconds;
+	m_nmea_clock_set_day(clock, 2000 + year, month, day);
+	if (clock->day_base == day_base) {
+		clock->last_seconds = last_seconds;
+	}
+
+	return 0;
+}
+
+
+
+
+void m_nmea_clock_sync(struct m_nmea_clock * clock, time_t timestamp)
+{
+	time_t utc = timestamp - clock->offset;
+	time_t seconds_of_day = utc % SECS_PER_DAY;
+	if (seconds_of_day < 0) {
+		seconds_of_day += SECS_PER_DAY;
+	}
+
+	clock->day_base = utc - seconds_of_day + clock->offset;
+	clock->last_seconds = (int) seconds_of_day;
+}
+
+
+
+
+int m_nmea_clock_convert(struct m_nmea_clock * clock, const char * field, size_t len, struct timespec * ts)
+{
+	/* "133940" or "133940.000" */
+	if (len < strlen("hhmmss") || (len > strlen("hhmmss") && field[6] != '.')) {
+		return -1;
+	}
+
+	const int hours = m_parse_digits(field, 2);
+	const int minutes = m_parse_digits(field + 2, 2);
+	const int seconds = m_parse_digits(field + 4, 2);
+	if (hours == -1 || hours > 23 || minutes == -1 || minutes > 59 || seconds == -1 || seconds > 60) {
+		return -1;
+	}
+
+	long nsec = 0;
+	long scale = NSECS_PER_SEC;
+	for (size_t i = 7; i < len; i++) {
+		if (field[i] < '0' || field[i] > '9') {
+			return -1;
+		}
+		if (scale > 1) {
+			scale /= 10;
+			nsec += (field[i] - '0') * scale;
+		}
+	}
+
+	const int seconds_of_day = hours * SECS_PER_HOUR + minutes * 60 + seconds;
+
+	/* Time of day going back by more than half a day means that
+	   a new UTC day has started. Smaller steps back are left
+	   alone (e.g. sentences out of order). */
+	if (clock->last_seconds != -1 && seconds_of_day + SECS_PER_DAY / 2 < clock->last_seconds) {
+		clock->day_base += SECS_PER_DAY;
+	}
+	clock->last_seconds = seconds_of_day;
+
+	ts->tv_sec = clock->day_base + seconds_of_day;
+	ts->tv_nsec = nsec;
+
+	return 0;
+}
+
+
+
+
 time_t m_nmea_gps_time_to_timestamp(const char * day_string, int nmea_ts, int ts_offset)
 {
-	/* "2017-04-30 133940" */
-	nmea_ts += (ts_offset * 10000); /* Plus N hours for conversion from GPS's UTC to local time zone. */
-	static char buffer[sizeof ("2017-04-30 133940") + 1] = { 0 };
-	sprintf(buffer, "%s %d", day_string, nmea_ts);
-
-	struct tm tm = { 0 };
-	if (NULL == strptime(buffer, "%Y_%m_%d %H%M%S", &tm)) {
-		fprintf(stderr, "[EE][%s] failed at strptime (%s)\n", __FUNCTION__, buffer);
+	struct m_nmea_clock clock;
+	if (0 != m_nmea_clock_init(&clock, day_string, ts_offset)) {
+		return (time_t) -1;
+	}
+
+	char field[sizeof ("133940")];
+	if (nmea_ts < 0 || nmea_ts > 235960) {
+		fprintf(stderr, "[EE] %s:%d: invalid NMEA time %d\n", __FUNCTION__, __LINE__, nmea_ts);
 		return (time_t) -1;
 	}
+	snprintf(field, sizeof (field), "%06d", nmea_ts);
 
-	time_t time = mktime(&tm);
-	if (time == -1) {
-		fprintf(stderr, "[EE][%s] failed at mktime\n", __FUNCTION__);
+	struct timespec ts;
+	if (0 != m_nmea_clock_convert(&clock, field, strlen(field), &ts)) {
+		fprintf(stderr, "[EE] %s:%d: invalid NMEA time %d\n", __FUNCTION__, __LINE__, nmea_ts);
 		return (time_t) -1;
 	}
 
-	return time;
+	return ts.tv_sec;
 }
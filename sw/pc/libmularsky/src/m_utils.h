@@ -1,19 +1,102 @@
 #ifndef M_UTILS_H
 #define M_UTILS_H
 
+#include <stddef.h>
 #include <time.h>
 
 
+struct timespec;
+
+
 int m_get_parent_dir_name(char * buffer, size_t size);
 
 
 
+/**
+   Get "YYYY_MM_DD" day of session from name of session directory
+   ("00_2017_04_30_13_39_14").
+
+   @param path: path to session directory
+
+   @return 0 on success, -1 if name of directory doesn't contain a day
+*/
+int m_get_session_day(const char * path, char * buffer, size_t size);
+
+
+
+/*
+  Conversion of NMEA UTC times to time stamps of recording device.
+
+  NMEA sentences contain only time of day (and RMC contains the date),
+  so the clock keeps time stamp of beginning of current UTC day, and
+  time of day is added to it with integer arithmetic. The day is
+  advanced when time of day goes back (UTC midnight), and is set
+  directly from date field of RMC sentences when these are available.
+
+  Conversion doesn't depend on time zone of the machine that does it.
+*/
+struct m_nmea_clock {
+	time_t day_base;   /* Time stamp of 00:00:00 UTC of current day, plus offset. */
+	int offset;        /* Seconds by which device's clock is ahead of UTC. */
+	int last_seconds;  /* Seconds since midnight of previous converted time, or -1. */
+};
+
+
+
+/**
+   @param clock: clock to initialize
+   @param day_string: UTC day at which a session starts, as "YYYY_MM_DD" (may be followed by other characters)
+   @param ts_offset: offset of hours between device's clock and GPS's UTC
+
+   @return 0 on success, -1 if @day_string is invalid
+*/
+int m_nmea_clock_init(struct m_nmea_clock * clock, const char * day_string, int ts_offset);
+
+
+
+/**
+   Set current day from date field of RMC sentence.
+
+   @param field: "ddmmyy" field, not necessarily nul-terminated
+   @param len: length of @field
+
+   @return 0 on success, -1 if @field is invalid
+*/
+int m_nmea_clock_set_date(struct m_nmea_clock * clock, const char * field, size_t len);
+
+
+
+/**
+   Set current day from a known time stamp (e.g. one stored in index
+   of nmea.txt), so that times of following sentences are converted
+   correctly when conversion doesn't start at beginning of a file.
+*/
+void m_nmea_clock_sync(struct m_nmea_clock * clock, time_t timestamp);
+
+
+
+/**
+   Convert time field of NMEA sentence to time stamp.
+
+   @param field: "hhmmss" or "hhmmss.sss" field, not necessarily nul-terminated
+   @param len: length of @field
+   @param ts: resulting time stamp, with fractional seconds
+
+   @return 0 on success, -1 if @field is invalid
+*/
+int m_nmea_clock_convert(struct m_nmea_clock * clock, const char * field, size_t len, struct timespec * ts);
+
+
+
 /**
    @param day_string: "day" part of timestamp. NMEA timestamp only contains HHMMSS, and to build a full UNIX timestamp we need YYMMDD as well.
    @param nmea_ts - NMEA time stamp to convert
-   @param ts_offset - offset of hours between local time zone and GPS's UTC
+   @param ts_offset - offset of hours between device's clock and GPS's UTC
+
+   Convenience wrapper around m_nmea_clock_*() for converting a
+   single time stamp. Midnight rollover is not detected.
 
-   @return time stamp in local time zone
+   @return time stamp, (time_t) -1 on errors
 */
 time_t m_nmea_gps_time_to_timestamp(const char * day_string, int nmea_ts, int ts_offset);
 
@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L /* getline(), posix_madvise() */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "m_verify.h"
+#include "m_pool.h"
+
+
+/* Argument of job checking a file or a segment of a file. */
+struct m_verify_task {
+	struct m_verify_file * file;
+	struct m_verify_segment * segment;  /* NULL for whole file. */
+};
+
+
+
+
+/* Split "<md5>  <rest>" line (md5sum format, also with '*' marking
+   binary mode). Returns pointer to <rest>, with newline removed. */
+static char * m_verify_parse_line(char * line, uint8_t digest[M_MD5_DIGEST_SIZE])
+{
+	line[strcspn(line, "\r\n")] = '\0';
+
+	if (strlen(line) < 2 * M_MD5_DIGEST_SIZE + 2
+	    || line[2 * M_MD5_DIGEST_SIZE] != ' '
+	    || 0 != m_md5_from_hex(line, digest)) {
+		return NULL;
+	}
+
+	char * rest = line + 2 * M_MD5_DIGEST_SIZE + 1;
+	if (*rest == ' ' || *rest == '*') {
+		rest++;
+	}
+	return *rest ? rest : NULL;
+}
+
+
+
+
+static struct m_verify_file * m_verify_find(struct m_verify * verify, const char * name)
+{
+	for (size_t i = 0; i < verify->n_files; i++) {
+		if (0 == strcmp(verify->files[i].name, name)) {
+			return &verify->files[i];
+		}
+	}
+	return NULL;
+}
+
+
+
+
+static int m_verify_load_segments(struct m_verify * verify, const char * path)
+{
+	FILE * file = fopen(path, "r");
+	if (!file) {
+		/* Manifest of segments is optional. */
+		return 0;
+	}
+
+	int rv = 0;
+	char * line = NULL;
+	size_t size = 0;
+	int line_number = 0;
+	while (-1 != getline(&line, &size, file)) {
+		line_number++;
+		if (line[0] == '\n' || line[0] == '\0') {
+			continue;
+		}
+
+		struct m_verify_segment segment = { 0 };
+		char * rest = m_verify_parse_line(line, segment.expected);
+		unsigned long long offset, length;
+		int n = 0;
+		if (!rest || 2 != sscanf(rest, "%llu %llu %n", &offset, &length, &n) || n == 0) {
+			fprintf(stderr, "[EE] %s:%d: invalid line %d of '%s'\n", __FUNCTION__, __LINE__, line_number, path);
+			rv = -1;
+			break;
+		}
+		segment.offset = offset;
+		segment.length = length;
+
+		struct m_verify_file * f = m_verify_find(verify, rest + n);
+		if (!f) {
+			fprintf(stderr, "[WW] %s:%d: '%s' from '%s' is not in manifest\n", __FUNCTION__, __LINE__, rest + n, path);
+			continue;
+		}
+		struct m_verify_segment * segments = realloc(f->segments, (f->n_segments + 1) * sizeof (struct m_verify_segment));
+		if (!segments) {
+			rv = -1;
+			break;
+		}
+		f->segments = segments;
+		f->segments[f->n_segments++] = segment;
+	}
+
+	free(line);
+	fclose(file);
+
+	return rv;
+}
+
+
+
+
+int m_verify_load(struct m_verify * verify, const char * manifest_path)
+{
+	memset(verify, 0, sizeof (struct m_verify));
+
+	FILE * file = fopen(manifest_path, "r");
+	if (!file) {
+		fprintf(stderr, "[EE] %s:%d: can't open '%s': %s\n", __FUNCTION__, __LINE__, manifest_path, strerror(errno));
+		return -1;
+	}
+
+	/* Paths in manifest are relative to its directory. */
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof (dir), "%s", manifest_path);
+	char * slash = strrchr(dir, '/');
+	if (slash) {
+		*slash = '\0';
+	} else {
+		snprintf(dir, sizeof (dir), ".");
+	}
+
+	int rv = 0;
+	size_t capacity = 0;
+	char * line = NULL;
+	size_t size = 0;
+	int line_number = 0;
+	while (-1 != getline(&line, &size, file)) {
+		line_number++;
+		if (line[0] == '\n' || line[0] == '\0') {
+			continue;
+		}
+
+		if (verify->n_files == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			struct m_verify_file * files = realloc(verify->files, capacity * sizeof (struct m_verify_file));
+			if (!files) {
+				rv = -1;
+				break;
+			}
+			verify->files = files;
+		}
+
+		struct m_verify_file * f = &verify->files[verify->n_files];
+		memset(f, 0, sizeof (struct m_verify_file));
+		const char * name = m_verify_parse_line(line, f->expected);
+		if (!name) {
+			fprintf(stderr, "[EE] %s:%d: invalid line %d of '%s'\n", __FUNCTION__, __LINE__, line_number, manifest_path);
+			rv = -1;
+			break;
+		}
+		if ((int) sizeof (f->name) <= snprintf(f->name, sizeof (f->name), "%s", name)
+		    || (int) sizeof (f->path) <= snprintf(f->path, sizeof (f->path), "%s/%s", name[0] == '/' ? "" : dir, name)) {
+			fprintf(stderr, "[EE] %s:%d: path too long in line %d of '%s'\n", __FUNCTION__, __LINE__, line_number, manifest_path);
+			rv = -1;
+			break;
+		}
+		verify->n_files++;
+	}
+	free(line);
+	fclose(file);
+
+	if (rv == 0) {
+		/* checksums.txt -> checksums_segments.txt */
+		char segments_path[PATH_MAX];
+		const size_t len = strlen(manifest_path);
+		const int has_ext = len > 4 && 0 == strcmp(manifest_path + len - 4, ".txt");
+		snprintf(segments_path, sizeof (segments_path), "%.*s_segments.txt", (int) (has_ext ? len - 4 : len), manifest_path);
+		rv = m_verify_load_segments(verify, segments_path);
+	}
+
+	if (rv == -1) {
+		m_verify_free(verify);
+	}
+
+	return rv;
+}
+
+
+
+
+/* Hash @length bytes of file starting at @offset (0 and whole file
+   for @length == UINT64_MAX). */
+static int m_verify_hash(const char * path, uint64_t offset, uint64_t length, uint8_t digest[M_MD5_DIGEST_SIZE])
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+	struct stat st;
+	if (0 != fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (length == UINT64_MAX) {
+		length = st.st_size;
+	}
+	if (offset + length > (uint64_t) st.st_size) {
+		/* File is truncated. */
+		close(fd);
+		return -1;
+	}
+
+	struct m_md5 md5;
+	m_md5_init(&md5);
+
+	if (length > 0) {
+		/* Offset of mapping must be a multiple of page size. */
+		const uint64_t skip = offset % (uint64_t) sysconf(_SC_PAGESIZE);
+		void * data = mmap(NULL, length + skip, PROT_READ, MAP_PRIVATE, fd, offset - skip);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		posix_madvise(data, length + skip, POSIX_MADV_SEQUENTIAL);
+		m_md5_update(&md5, (const char *) data + skip, length);
+		munmap(data, length + skip);
+	}
+	close(fd);
+
+	m_md5_final(&md5, digest);
+
+	return 0;
+}
+
+
+
+
+static int m_verify_job(void * arg)
+{
+	struct m_verify_task * task = (struct m_verify_task *) arg;
+	struct m_verify_file * file = task->file;
+	struct m_verify_segment * segment = task->segment;
+
+	if (segment) {
+		uint8_t digest[M_MD5_DIGEST_SIZE];
+		if (0 != m_verify_hash(file->path, segment->offset, segment->length, digest)) {
+			segment->status = M_VERIFY_MISSING;
+		} else if (0 != memcmp(digest, segment->expected, M_MD5_DIGEST_SIZE)) {
+			segment->status = M_VERIFY_BAD;
+		} else {
+			segment->status = M_VERIFY_OK;
+		}
+		return segment->status == M_VERIFY_OK ? 0 : -1;
+	}
+
+	if (0 != m_verify_hash(file->path, 0, UINT64_MAX, file->actual)) {
+		file->status = M_VERIFY_MISSING;
+	} else if (0 != memcmp(file->actual, file->expected, M_MD5_DIGEST_SIZE)) {
+		file->status = M_VERIFY_BAD;
+	} else {
+		file->status = M_VERIFY_OK;
+	}
+	return file->status == M_VERIFY_OK ? 0 : -1;
+}
+
+
+
+
+size_t m_verify_run(struct m_verify * verify, int n_threads)
+{
+	/* Enough for files, and for segments of files. */
+	size_t n_tasks = verify->n_files;
+	for (size_t i = 0; i < verify->n_files; i++) {
+		n_tasks += verify->files[i].n_segments;
+	}
+	struct m_verify_task * tasks = calloc(n_tasks + 1, sizeof (struct m_verify_task));
+	struct m_pool_job * jobs = calloc(n_tasks + 1, sizeof (struct m_pool_job));
+	if (!tasks || !jobs) {
+		free(tasks);
+		free(jobs);
+		for (size_t i = 0; i < verify->n_files; i++) {
+			verify->files[i].status = M_VERIFY_MISSING;
+		}
+		return verify->n_files;
+	}
+
+	/* Whole files first. */
+	size_t n_jobs = 0;
+	for (size_t i = 0; i < verify->n_files; i++) {
+		tasks[n_jobs].file = &verify->files[i];
+		jobs[n_jobs].name = verify->files[i].name;
+		jobs[n_jobs].fn = m_verify_job;
+		jobs[n_jobs].arg = &tasks[n_jobs];
+		n_jobs++;
+	}
+	m_pool_run(jobs, n_jobs, n_threads);
+
+	/* Segments of damaged files. */
+	size_t n_failed = 0;
+	n_jobs = 0;
+	for (size_t i = 0; i < verify->n_files; i++) {
+		struct m_verify_file * file = &verify->files[i];
+		if (file->status == M_VERIFY_OK) {
+			continue;
+		}
+		n_failed++;
+		for (size_t s = 0; s < file->n_segments; s++) {
+			tasks[n_jobs].file = file;
+			tasks[n_jobs].segment = &file->segments[s];
+			jobs[n_jobs].name = file->name;
+			jobs[n_jobs].fn = m_verify_job;
+			jobs[n_jobs].arg = &tasks[n_jobs];
+			n_jobs++;
+		}
+	}
+	if (n_jobs) {
+		m_pool_run(jobs, n_jobs, n_threads);
+	}
+
+	free(tasks);
+	free(jobs);
+
+	return n_failed;
+}
+
+
+
+
+void m_verify_free(struct m_verify * verify)
+{
+	for (size_t i = 0; i < verify->n_files; i++) {
+		free(verify->files[i].segments);
+	}
+	free(verify->files);
+	verify->files = NULL;
+	verify->n_files = 0;
+
+	return;
+}
@@ -0,0 +1,82 @@
+#ifndef M_VERIFY_H
+#define M_VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "m_md5.h"
+
+
+/*
+  Verification of integrity manifests of session files.
+
+  Manifest has format of output of md5sum (and of
+  measurements/raw_data_checksums.txt): "<md5>  <path>" lines,
+  optionally separated by empty lines. Paths are relative to
+  directory of the manifest.
+
+  Manifest may be accompanied by a manifest of segments (for
+  checksums.txt it's checksums_segments.txt), with lines
+  "<md5>  <offset> <length> <path>", describing consecutive parts of
+  files. The device writes both while it writes session files.
+
+  Files are memory-mapped and hashed in parallel. Segments of a file
+  are checked (also in parallel) only if the file doesn't match, to
+  tell which parts of it are damaged.
+*/
+
+
+#define M_VERIFY_OK       0
+#define M_VERIFY_BAD      1  /* Checksum doesn't match. */
+#define M_VERIFY_MISSING  2  /* File can't be read. */
+
+
+struct m_verify_segment {
+	uint64_t offset;
+	uint64_t length;
+	uint8_t expected[M_MD5_DIGEST_SIZE];
+	int status;
+};
+
+
+struct m_verify_file {
+	char name[PATH_MAX];            /* Path as given in manifest. */
+	char path[PATH_MAX];            /* Path to file. */
+	uint8_t expected[M_MD5_DIGEST_SIZE];
+	uint8_t actual[M_MD5_DIGEST_SIZE];
+	int status;
+
+	struct m_verify_segment * segments;
+	size_t n_segments;
+};
+
+
+struct m_verify {
+	struct m_verify_file * files;
+	size_t n_files;
+};
+
+
+
+/**
+   Read manifest (and its manifest of segments, if present)
+
+   @return 0 on success, -1 on failure
+*/
+int m_verify_load(struct m_verify * verify, const char * manifest_path);
+
+/**
+   Check files listed in manifest, set their status
+
+   @param n_threads: number of threads, 0 for number of online CPUs
+
+   @return number of files that failed verification
+*/
+size_t m_verify_run(struct m_verify * verify, int n_threads);
+
+void m_verify_free(struct m_verify * verify);
+
+
+
+#endif /* #ifdef M_VERIFY_H */
@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime() */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "m_input.h"
+#include "m_nmea.h"
+#include "m_utils.h"
+
+
+/*
+  Throughput benchmark of NMEA parser.
+
+  Usage: m_nmea_bench <nmea file> [<nmea file> ...]
+
+  Each file is read into memory (memory-mapped when possible), and
+  then parsed several times: with m_nmea_next() alone, with
+  m_nmea_next() and conversion to typed records, and with sscanf()
+  of time field, the way the splitter used to do it.
+
+  Before that, conversion of times across UTC midnight is checked,
+  since a benchmark of wrong results is of no use.
+*/
+
+
+#define BENCH_ROUNDS 5
+
+
+struct m_bench_counts {
+	unsigned long sentences;
+	unsigned long types[M_NMEA_GSA + 1];
+	unsigned long bad_checksums;
+	unsigned long missing_checksums;
+	double sum; /* Keeps compiler from optimizing out conversions. */
+};
+
+
+
+
+static double m_bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+static void m_bench_iterate(const char * data, size_t size, struct m_bench_counts * counts)
+{
+	struct m_nmea_iter iter;
+	struct m_nmea_sentence sentence;
+
+	m_nmea_iter_init(&iter, data, size);
+	while (m_nmea_next(&iter, &sentence)) {
+		counts->sentences++;
+		counts->types[sentence.type]++;
+		if (sentence.checksum == M_NMEA_CHECKSUM_BAD) {
+			counts->bad_checksums++;
+		} else if (sentence.checksum == M_NMEA_CHECKSUM_MISSING) {
+			counts->missing_checksums++;
+		}
+	}
+}
+
+
+
+
+static void m_bench_records(const char * data, size_t size, struct m_bench_counts * counts)
+{
+	struct m_nmea_iter iter;
+	struct m_nmea_sentence sentence;
+
+	m_nmea_iter_init(&iter, data, size);
+	while (m_nmea_next(&iter, &sentence)) {
+		counts->sentences++;
+
+		struct m_nmea_rmc rmc;
+		struct m_nmea_gga gga;
+		struct m_nmea_vtg vtg;
+		struct m_nmea_gsa gsa;
+		if (0 == m_nmea_get_rmc(&sentence, &rmc)) {
+			counts->sum += rmc.latitude + rmc.longitude + rmc.speed_knots;
+		} else if (0 == m_nmea_get_gga(&sentence, &gga)) {
+			counts->sum += gga.altitude + gga.n_satellites;
+		} else if (0 == m_nmea_get_vtg(&sentence, &vtg)) {
+			counts->sum += vtg.speed_kmh;
+		} else if (0 == m_nmea_get_gsa(&sentence, &gsa)) {
+			counts->sum += gsa.pdop;
+		}
+	}
+}
+
+
+
+
+static void m_bench_sscanf(const char * data, size_t size, struct m_bench_counts * counts)
+{
+	const char * line = data;
+	const char * end = data + size;
+	char line_buffer[128];
+
+	while (line < end) {
+		const char * eol = memchr(line, '\n', end - line);
+		const char * next = eol ? eol + 1 : end;
+
+		size_t len = next - line;
+		if (len >= sizeof (line_buffer)) {
+			len = sizeof (line_buffer) - 1;
+		}
+		memcpy(line_buffer, line, len);
+		line_buffer[len] = '\0';
+
+		int nmea_timestamp;
+		int tmp;
+		if (2 == sscanf(line_buffer, "$GPRMC,%d.%d", &nmea_timestamp, &tmp)
+		    || 2 == sscanf(line_buffer, "$GPGGA,%d.%d", &nmea_timestamp, &tmp)) {
+			counts->sentences++;
+			counts->sum += nmea_timestamp;
+		}
+
+		line = next;
+	}
+}
+
+
+
+
+/*
+  Convert times of RMC/GGA sentences around UTC midnight the way
+  m_split and m_align do (date of RMC is set before its time is
+  converted).
+
+  Returns 0 if all times are as expected, -1 otherwise.
+*/
+static int m_bench_check_clock(void)
+{
+	const struct {
+		const char * date;    /* RMC, or NULL for GGA. */
+		const char * time;
+		time_t expected;
+	} sentences[] = {
+		{ "300417", "235958", 1493596798 },
+		{ NULL,     "235959", 1493596799 },
+		{ "010517", "000000", 1493596800 },  /* Day set by date, not by rollover. */
+		{ NULL,     "000001", 1493596801 },
+		{ NULL,     "235959", 1493683199 },
+		{ NULL,     "000000", 1493683200 },  /* Day set by rollover... */
+		{ "020517", "000001", 1493683201 },  /* ...and confirmed by date. */
+	};
+
+	struct m_nmea_clock clock;
+	m_nmea_clock_init(&clock, "2017_04_30", 0);
+	int rv = 0;
+	for (size_t i = 0; i < sizeof (sentences) / sizeof (sentences[0]); i++) {
+		if (sentences[i].date) {
+			m_nmea_clock_set_date(&clock, sentences[i].date, strlen(sentences[i].date));
+		}
+		struct timespec ts = { 0 };
+		if (0 != m_nmea_clock_convert(&clock, sentences[i].time, strlen(sentences[i].time), &ts)
+		    || ts.tv_sec != sentences[i].expected) {
+			fprintf(stderr, "[EE] NMEA clock: %s %s converted to %ld, expected %ld\n",
+				sentences[i].date ? sentences[i].date : "------", sentences[i].time,
+				(long) ts.tv_sec, (long) sentences[i].expected);
+			rv = -1;
+		}
+	}
+
+	return rv;
+}
+
+
+
+
+static void m_bench_run(const char * label, void (* fn)(const char *, size_t, struct m_bench_counts *),
+			const char * data, size_t size, struct m_bench_counts * counts)
+{
+	double best = INFINITY;
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		memset(counts, 0, sizeof (struct m_bench_counts));
+		const double start = m_bench_now();
+		fn(data, size, counts);
+		const double elapsed = m_bench_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	fprintf(stdout, "    %-10s %9.1f MB/s  %12.0f sentences/s  (%lu sentences, %.6f s)\n",
+		label, size / best / 1e6, counts->sentences / best, counts->sentences, best);
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <nmea file> [<nmea file> ...]\n", argv[0]);
+		return -1;
+	}
+
+	if (-1 == m_bench_check_clock()) {
+		return -1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		struct m_input input;
+		if (-1 == m_input_open(&input, argv[i])) {
+			return -1;
+		}
+
+		/* Benchmark is run on the first block, which for regular
+		   files is the whole memory-mapped file. */
+		const char * data;
+		size_t size;
+		if (1 != m_input_next_block(&input, &data, &size)) {
+			fprintf(stderr, "[EE] can't read '%s'\n", argv[i]);
+			m_input_close(&input);
+			return -1;
+		}
+
+		fprintf(stdout, "%s: %zu bytes\n", argv[i], size);
+
+		struct m_bench_counts counts;
+		m_bench_run("iterate", m_bench_iterate, data, size, &counts);
+		fprintf(stdout, "        RMC %lu, GGA %lu, VTG %lu, GSA %lu, other %lu, bad checksum %lu, no checksum %lu\n",
+			counts.types[M_NMEA_RMC], counts.types[M_NMEA_GGA], counts.types[M_NMEA_VTG],
+			counts.types[M_NMEA_GSA], counts.types[M_NMEA_OTHER], counts.bad_checksums, counts.missing_checksums);
+
+		m_bench_run("records", m_bench_records, data, size, &counts);
+		m_bench_run("sscanf", m_bench_sscanf, data, size, &counts);
+
+		m_input_close(&input);
+	}
+
+	return 0;
+}
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime(), getopt(), sysconf() */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "m_spectrum.h"
+
+
+/*
+  Benchmark and check of spectrograms of libmularsky.
+
+  Usage: m_spectrum_bench [-s <seconds>]
+
+  Before benchmarking, m_spectrum_compute() is checked: spectrogram
+  of a sine must peak at its frequency, and failure of the function
+  (forced with a signal too long to allocate its spectrogram) must
+  leave powers of all channels NULL, whatever the caller left in
+  them.
+
+  Then spectrograms of three channels of <seconds> (default 3600) of
+  random signal at 100 Hz are computed with default parameters and
+  increasing number of threads, and the best time of a few rounds is
+  printed.
+*/
+
+
+#define BENCH_ROUNDS 5
+#define BENCH_CHANNELS 3
+#define BENCH_RATE 100.0
+#define BENCH_PI 3.14159265358979323846
+
+
+
+
+static double m_bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+/* Returns 0 if peak of each frame is in bin of sine's frequency,
+   -1 otherwise. */
+static int m_bench_check_peak(void)
+{
+	struct m_spectrum_params params;
+	m_spectrum_default_params(&params, BENCH_RATE);
+
+	const size_t n = (size_t) (60 * BENCH_RATE);
+	const size_t bin = 32;
+	const double frequency = bin * BENCH_RATE / params.segment;
+	double * signal = malloc(n * sizeof (double));
+	if (!signal) {
+		return -1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		signal[i] = 9.81 + sin(2 * BENCH_PI * frequency * i / BENCH_RATE);
+	}
+
+	const double * channels[1] = { signal };
+	struct m_spectrogram spectrogram = { .name = "sine", .unit = "" };
+	int rv = m_spectrum_compute(&params, channels, 1, n, &spectrogram, 0);
+	for (size_t f = 0; rv == 0 && f < spectrogram.n_frames; f++) {
+		const float * power = spectrogram.power + f * spectrogram.n_bins;
+		size_t peak = 0;
+		for (size_t k = 1; k < spectrogram.n_bins; k++) {
+			if (power[k] > power[peak]) {
+				peak = k;
+			}
+		}
+		if (peak != bin) {
+			fprintf(stderr, "[EE] spectrum: peak of frame %zu in bin %zu, expected %zu\n", f, peak, bin);
+			rv = -1;
+		}
+	}
+	if (rv == 0 && spectrogram.n_frames == 0) {
+		fprintf(stderr, "[EE] spectrum: no frames\n");
+		rv = -1;
+	}
+
+	m_spectrogram_free(&spectrogram, 1);
+	free(signal);
+
+	return rv;
+}
+
+
+
+
+/* Returns 0 if failed computation leaves no dangling powers, -1
+   otherwise. A crash in free() is a failure as well. */
+static int m_bench_check_failure(void)
+{
+	struct m_spectrum_params params;
+	m_spectrum_default_params(&params, BENCH_RATE);
+
+	/* Spectrogram of such a signal takes petabytes, so allocation
+	   of the first power fails before any sample is read. */
+	const size_t n = SIZE_MAX >> 10;
+	const double sample = 0.0;
+	const double * channels[BENCH_CHANNELS] = { &sample, &sample, &sample };
+
+	/* Garbage, like in uninitialized array of caller. */
+	float garbage;
+	struct m_spectrogram spectrograms[BENCH_CHANNELS];
+	for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+		spectrograms[c].name = "failure";
+		spectrograms[c].unit = "";
+		spectrograms[c].power = &garbage;
+	}
+
+	if (-1 != m_spectrum_compute(&params, channels, BENCH_CHANNELS, n, spectrograms, 0)) {
+		fprintf(stderr, "[EE] spectrum: computation of %zu samples didn't fail\n", n);
+		m_spectrogram_free(spectrograms, BENCH_CHANNELS);
+		return -1;
+	}
+	for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+		if (spectrograms[c].power) {
+			fprintf(stderr, "[EE] spectrum: power of channel %zu not NULL after failure\n", c);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	double seconds = 3600.0;
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "s:"))) {
+		switch (opt) {
+		case 's':
+			seconds = strtod(optarg, NULL);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s <seconds>]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (seconds <= 0.0 || optind != argc) {
+		fprintf(stderr, "usage: %s [-s <seconds>]\n", argv[0]);
+		return -1;
+	}
+
+	if (-1 == m_bench_check_peak() || -1 == m_bench_check_failure()) {
+		return -1;
+	}
+
+	const size_t n = (size_t) (seconds * BENCH_RATE);
+	double * signals[BENCH_CHANNELS] = { NULL };
+	const double * channels[BENCH_CHANNELS];
+	srand(1);
+	for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+		if (!(signals[c] = malloc((n ? n : 1) * sizeof (double)))) {
+			for (size_t k = 0; k < c; k++) {
+				free(signals[k]);
+			}
+			return -1;
+		}
+		for (size_t i = 0; i < n; i++) {
+			signals[c][i] = 20.0 * rand() / (double) RAND_MAX - 10.0;
+		}
+		channels[c] = signals[c];
+	}
+
+	struct m_spectrum_params params;
+	m_spectrum_default_params(&params, BENCH_RATE);
+	fprintf(stdout, "random signal: %d channels of %zu samples\n", BENCH_CHANNELS, n);
+
+	const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int rv = 0;
+	for (int n_threads = 1; rv == 0 && n_threads <= (n_cpus > 0 ? n_cpus : 1); n_threads *= 2) {
+		double best = INFINITY;
+		size_t n_frames = 0;
+		for (int r = 0; rv == 0 && r < BENCH_ROUNDS; r++) {
+			struct m_spectrogram spectrograms[BENCH_CHANNELS];
+			for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+				spectrograms[c].name = "random";
+				spectrograms[c].unit = "";
+			}
+			const double start = m_bench_now();
+			rv = m_spectrum_compute(&params, channels, BENCH_CHANNELS, n, spectrograms, n_threads);
+			const double elapsed = m_bench_now() - start;
+			if (elapsed < best) {
+				best = elapsed;
+			}
+			n_frames = spectrograms[0].n_frames;
+			m_spectrogram_free(spectrograms, BENCH_CHANNELS);
+		}
+		if (rv == 0) {
+			fprintf(stdout, "    %2d threads %10.0f frames/s  (%zu frames, %.6f s)\n",
+				n_threads, BENCH_CHANNELS * n_frames / best, BENCH_CHANNELS * n_frames, best);
+		}
+	}
+
+	for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+		free(signals[c]);
+	}
+
+	return rv;
+}
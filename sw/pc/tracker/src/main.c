@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L /* getopt(), clock_gettime() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+#include "m_utils.h"
+#include "m_align.h"
+#include "m_fusion.h"
+
+
+/*
+  Reconstruct trajectory of a session from GPS, IMU and barometer
+  (see m_fusion.h), print it as CSV.
+
+  m_tracker [-p <period ms>] [-t <ts_shift>] [-d <YYYY_MM_DD>] [-y <yaw offset deg>] [-H] [<session dir>]
+
+  -H: don't use horizontal acceleration of IMU (e.g. when IMU is not
+  fixed to the vehicle), only the vertical one.
+
+  Rotated logs (mularsky -I/-S) are read after joining with m_joiner.
+*/
+
+
+#define USAGE "usage: %s [-p <period ms>] [-t <ts_shift>] [-d <YYYY_MM_DD>] [-y <yaw offset deg>] [-H] [<session dir>]\n"
+
+
+
+
+int main(int argc, char ** argv)
+{
+	struct m_fusion_params params;
+	m_fusion_default_params(&params);
+	long period_ms = params.period_ns / 1000000;
+	int ts_shift = 0;
+	const char * day_arg = NULL;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "p:t:d:y:H"))) {
+		switch (opt) {
+		case 'p':
+			period_ms = atol(optarg);
+			break;
+		case 't':
+			ts_shift = atoi(optarg);
+			break;
+		case 'd':
+			day_arg = optarg;
+			break;
+		case 'y':
+			params.yaw_offset = atof(optarg);
+			break;
+		case 'H':
+			params.horizontal_imu = 0;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return -1;
+		}
+	}
+	if (argc - optind > 1 || period_ms <= 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return -1;
+	}
+	params.period_ns = period_ms * 1000000LL;
+	const char * dir = optind < argc ? argv[optind] : ".";
+
+
+	char day[sizeof ("YYYY_MM_DD")];
+	if (day_arg) {
+		snprintf(day, sizeof (day), "%s", day_arg);
+	} else if (0 != m_get_session_day(dir, day, sizeof (day))) {
+		fprintf(stderr, "[EE] can't get day of session, use -d\n");
+		return -1;
+	}
+	struct m_nmea_clock clock;
+	if (0 != m_nmea_clock_init(&clock, day, ts_shift)) {
+		return -1;
+	}
+
+
+	/* Only GPS is required, IMU and barometer improve the track. */
+	struct m_align_source imu;
+	struct m_align_source pressure;
+	struct m_align_source nmea;
+	struct m_align_source * imu_source = NULL;
+	struct m_align_source * pressure_source = NULL;
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof (path), "%s/imu.txt", dir);
+	if (0 == m_align_source_imu(&imu, path)) {
+		imu_source = &imu;
+	} else {
+		fprintf(stderr, "[WW] no IMU data\n");
+	}
+	snprintf(path, sizeof (path), "%s/pressure.txt", dir);
+	if (0 == m_align_source_pressure(&pressure, path)) {
+		pressure_source = &pressure;
+	} else {
+		fprintf(stderr, "[WW] no pressure data\n");
+	}
+	snprintf(path, sizeof (path), "%s/nmea.txt", dir);
+	if (0 != m_align_source_nmea(&nmea, path, &clock)) {
+		fprintf(stderr, "[EE] no GPS data\n");
+		return -1;
+	}
+
+
+	struct m_fusion fusion;
+	if (0 != m_fusion_init(&fusion, &params, imu_source, pressure_source, &nmea)) {
+		m_fusion_close(&fusion);
+		return -1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	fprintf(stdout, "time,latitude,longitude,altitude,east,north,up,v_east,v_north,v_up,sigma_horizontal,sigma_altitude,baro_offset\n");
+
+	struct m_fusion_estimate e;
+	int64_t first_ns = 0;
+	int64_t last_ns = 0;
+	int rv;
+	while (1 == (rv = m_fusion_next(&fusion, &e))) {
+		if (fusion.stats.estimates == 1) {
+			first_ns = e.time_ns;
+		}
+		last_ns = e.time_ns;
+		fprintf(stdout, "%lld.%03lld,%.8f,%.8f,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f\n",
+			(long long) (e.time_ns / 1000000000), (long long) (e.time_ns % 1000000000 / 1000000),
+			e.latitude, e.longitude, e.altitude,
+			e.east, e.north, e.up,
+			e.v_east, e.v_north, e.v_up,
+			e.sigma_horizontal, e.sigma_altitude, e.baro_offset);
+	}
+
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	const double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+	const double session = (last_ns - first_ns) / 1e9;
+
+	fprintf(stderr, "[II] records: imu %lu, pressure %lu, gps %lu; rejected measurements %lu\n",
+		fusion.stats.imu, fusion.stats.pressure, fusion.stats.gps, fusion.stats.rejected);
+	fprintf(stderr, "[II] %lu estimates, %.1f s of session in %.3f s (%.0fx real time)\n",
+		fusion.stats.estimates, session, seconds, seconds > 0 ? session / seconds : 0.0);
+
+	m_fusion_close(&fusion);
+
+	return rv == -1 ? -1 : 0;
+}
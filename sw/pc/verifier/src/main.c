@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809L /* getopt() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "m_md5.h"
+#include "m_verify.h"
+
+
+/*
+  Verify integrity manifests of session files, e.g. checksums.txt
+  written by the device or measurements/raw_data_checksums.txt.
+
+  m_verifier [-j <threads>] [-q] <manifest> [<manifest> ...]
+
+  Output is similar to output of "md5sum -c". For damaged files that
+  have a manifest of segments, damaged segments are listed too.
+  Returns 0 if all files are OK.
+*/
+
+
+#define USAGE "usage: %s [-j <threads>] [-q] <manifest> [<manifest> ...]\n"
+
+
+
+
+static void m_verifier_report(const struct m_verify * verify, int quiet)
+{
+	for (size_t i = 0; i < verify->n_files; i++) {
+		const struct m_verify_file * file = &verify->files[i];
+		if (file->status == M_VERIFY_OK) {
+			if (!quiet) {
+				fprintf(stdout, "%s: OK\n", file->path);
+			}
+			continue;
+		}
+		if (file->status == M_VERIFY_MISSING) {
+			fprintf(stdout, "%s: FAILED open or read\n", file->path);
+			continue;
+		}
+
+		fprintf(stdout, "%s: FAILED\n", file->path);
+		for (size_t s = 0; s < file->n_segments; s++) {
+			const struct m_verify_segment * segment = &file->segments[s];
+			if (segment->status != M_VERIFY_OK) {
+				fprintf(stdout, "    bytes %" PRIu64 "-%" PRIu64 ": %s\n",
+					segment->offset, segment->offset + segment->length,
+					segment->status == M_VERIFY_BAD ? "FAILED" : "MISSING");
+			}
+		}
+	}
+
+	return;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	int n_threads = 0;
+	int quiet = 0;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "j:q"))) {
+		switch (opt) {
+		case 'j':
+			n_threads = atoi(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, USAGE, argv[0]);
+		return -1;
+	}
+
+	size_t n_files = 0;
+	size_t n_failed = 0;
+	int rv = 0;
+	for (int i = optind; i < argc; i++) {
+		struct m_verify verify;
+		if (0 != m_verify_load(&verify, argv[i])) {
+			rv = -1;
+			continue;
+		}
+		n_failed += m_verify_run(&verify, n_threads);
+		n_files += verify.n_files;
+		m_verifier_report(&verify, quiet);
+		m_verify_free(&verify);
+	}
+
+	if (n_failed) {
+		fprintf(stderr, "[WW] %zu of %zu files failed verification\n", n_failed, n_files);
+		rv = -1;
+	}
+
+	return rv;
+}
@@ -0,0 +1,313 @@
+#define _POSIX_C_SOURCE 200809L /* getopt(), clock_gettime() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+#include "m_align.h"
+#include "m_split.h"
+#include "m_spectrum.h"
+
+
+/*
+  Compute vibration spectrograms of IMU channels of a session (or of
+  its route), write them to spectrogram file (see m_spectrum.h).
+
+  m_vibration [-c <channel>[,<channel>...]] [-r <rate Hz>] [-n <segment>] [-v <overlap>] [-f <frame s>] [-s <step s>] [-w <window>] [-R <route>] [-j <threads>] [-o <output>] [<session dir>]
+
+  Channels are IMU channels of aligner ("acc_x", "lia_z", ...),
+  resampled linearly at given rate. Route is taken from config.txt
+  of session. Window is one of "rectangular", "hann", "hamming",
+  "blackman".
+
+  imu.txt of session recorded with rotation (mularsky -I/-S) is
+  joined from its chunks with m_joiner first.
+*/
+
+
+#define USAGE "usage: %s [-c <channel>[,<channel>...]] [-r <rate Hz>] [-n <segment>] [-v <overlap>] [-f <frame s>] [-s <step s>] [-w <window>] [-R <route>] [-j <threads>] [-o <output>] [<session dir>]\n"
+#define CHANNELS_MAX 16
+
+
+
+
+/* Growable array of samples of one channel. */
+struct samples {
+	double * values;
+	size_t n;
+	size_t size;
+};
+
+
+
+
+static int samples_append(struct samples * samples, double value)
+{
+	if (samples->n == samples->size) {
+		const size_t size = samples->size ? 2 * samples->size : 65536;
+		double * values = realloc(samples->values, size * sizeof (double));
+		if (!values) {
+			return -1;
+		}
+		samples->values = values;
+		samples->size = size;
+	}
+	samples->values[samples->n++] = value;
+	return 0;
+}
+
+
+
+
+static int find_route(const char * dir, const char * id, struct m_route * route)
+{
+	char path[PATH_MAX];
+	struct m_split_config config;
+	snprintf(path, sizeof (path), "%s/config.txt", dir);
+	if (0 != m_split_read_config(path, &config)) {
+		return -1;
+	}
+	for (int i = 0; i < config.n_routes; i++) {
+		if (0 == strcmp(config.routes[i].id, id)) {
+			*route = config.routes[i];
+			return 0;
+		}
+	}
+	fprintf(stderr, "[EE] no route '%s' in '%s'\n", id, path);
+	return -1;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	double rate = 100.0;
+	char channels_arg[256] = "acc_x,acc_y,acc_z";
+	long segment = -1;
+	long overlap = -1;
+	double frame_s = 10.0;
+	double step_s = 5.0;
+	int window = M_SPECTRUM_HANN;
+	const char * route_id = NULL;
+	int n_threads = 0;
+	const char * output = NULL;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "c:r:n:v:f:s:w:R:j:o:"))) {
+		switch (opt) {
+		case 'c':
+			snprintf(channels_arg, sizeof (channels_arg), "%s", optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'n':
+			segment = atol(optarg);
+			break;
+		case 'v':
+			overlap = atol(optarg);
+			break;
+		case 'f':
+			frame_s = atof(optarg);
+			break;
+		case 's':
+			step_s = atof(optarg);
+			break;
+		case 'w':
+			if (-1 == (window = m_spectrum_window_from_name(optarg))) {
+				fprintf(stderr, "[EE] unknown window '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 'R':
+			route_id = optarg;
+			break;
+		case 'j':
+			n_threads = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return -1;
+		}
+	}
+	if (argc - optind > 1 || rate <= 0.0 || frame_s <= 0.0 || step_s <= 0.0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return -1;
+	}
+	const char * dir = optind < argc ? argv[optind] : ".";
+
+	struct m_spectrum_params params;
+	m_spectrum_default_params(&params, rate);
+	params.frame = (size_t) (frame_s * rate + 0.5);
+	params.step = (size_t) (step_s * rate + 0.5);
+	params.window = window;
+	if (segment > 0) {
+		params.segment = segment;
+		params.overlap = segment / 2;
+	}
+	if (overlap >= 0) {
+		params.overlap = overlap;
+	}
+	if (0 != m_spectrum_check_params(&params)) {
+		return -1;
+	}
+
+	struct m_route route = { 0, 0, "" };
+	if (route_id && 0 != find_route(dir, route_id, &route)) {
+		return -1;
+	}
+
+
+	struct m_align_source imu;
+	struct m_align_source * sources[1] = { &imu };
+	char path[PATH_MAX];
+	snprintf(path, sizeof (path), "%s/imu.txt", dir);
+	if (0 != m_align_source_imu(&imu, path)) {
+		return -1;
+	}
+
+	/* Indexes of requested channels in records of aligner. */
+	const char * names[CHANNELS_MAX];
+	size_t index[CHANNELS_MAX];
+	size_t n_channels = 0;
+	for (char * name = strtok(channels_arg, ","); name; name = strtok(NULL, ",")) {
+		size_t c = 0;
+		while (c < imu.n_channels && 0 != strcmp(name, imu.channels[c])) {
+			c++;
+		}
+		if (c == imu.n_channels || n_channels == CHANNELS_MAX) {
+			fprintf(stderr, "[EE] invalid channel '%s'\n", name);
+			imu.close(&imu);
+			return -1;
+		}
+		names[n_channels] = imu.channels[c];
+		index[n_channels++] = c;
+	}
+	if (n_channels == 0) {
+		fprintf(stderr, "[EE] no channels given\n");
+		imu.close(&imu);
+		return -1;
+	}
+
+	struct m_align align;
+	const int64_t period_ns = (int64_t) (1e9 / rate + 0.5);
+	if (0 != m_align_init(&align, sources, 1, period_ns, route.start * 1000000000LL)) {
+		m_align_close(&align);
+		return -1;
+	}
+
+
+	/* Read resampled channels. Records before first sample are
+	   skipped, gaps are bridged by aligner. */
+	struct samples samples[CHANNELS_MAX];
+	memset(samples, 0, sizeof (samples));
+	double values[M_ALIGN_CHANNELS_MAX];
+	int64_t time_ns;
+	int64_t start_ns = -1;
+	int rv;
+	while (1 == (rv = m_align_next(&align, &time_ns, values))) {
+		if (route_id && time_ns > route.stop * 1000000000LL) {
+			break;
+		}
+		if (start_ns == -1) {
+			if (isnan(values[index[0]])) {
+				continue;
+			}
+			start_ns = time_ns;
+		}
+		for (size_t c = 0; c < n_channels; c++) {
+			double v = values[index[c]];
+			if (isnan(v)) {
+				v = samples[c].n ? samples[c].values[samples[c].n - 1] : 0.0;
+			}
+			if (0 != samples_append(&samples[c], v)) {
+				rv = -1;
+				break;
+			}
+		}
+		if (rv == -1) {
+			break;
+		}
+	}
+	m_align_close(&align);
+	if (rv == -1) {
+		for (size_t c = 0; c < n_channels; c++) {
+			free(samples[c].values);
+		}
+		return -1;
+	}
+
+	const size_t n_samples = samples[0].n;
+	fprintf(stderr, "[II] %zu samples per channel at %.1f Hz (%.1f s)\n", n_samples, rate, n_samples / rate);
+
+
+	struct timespec begin;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	const double * channels[CHANNELS_MAX];
+	struct m_spectrogram spectrograms[CHANNELS_MAX];
+	for (size_t c = 0; c < n_channels; c++) {
+		channels[c] = samples[c].values;
+		spectrograms[c].name = names[c];
+		spectrograms[c].unit = 0 == strncmp(names[c], "acc_", 4) || 0 == strncmp(names[c], "lia_", 4) || 0 == strncmp(names[c], "grv_", 4) ? "m/s^2" : "";
+	}
+	rv = m_spectrum_compute(&params, channels, n_channels, n_samples, spectrograms, n_threads);
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (rv == 0) {
+		fprintf(stderr, "[II] %zu frames x %zu bins (%.3f Hz) per channel in %.3f s\n",
+			spectrograms[0].n_frames, spectrograms[0].n_bins, rate / params.segment,
+			(end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9);
+
+		/* Dominant frequency of whole signal, without DC. */
+		for (size_t c = 0; c < n_channels; c++) {
+			const struct m_spectrogram * s = &spectrograms[c];
+			size_t peak = 1;
+			double peak_power = -1.0;
+			for (size_t k = 1; k < s->n_bins; k++) {
+				double p = 0.0;
+				for (size_t f = 0; f < s->n_frames; f++) {
+					p += s->power[f * s->n_bins + k];
+				}
+				if (p > peak_power) {
+					peak_power = p;
+					peak = k;
+				}
+			}
+			if (s->n_frames) {
+				fprintf(stderr, "[II] %s: dominant frequency %.2f Hz\n", s->name, peak * rate / params.segment);
+			}
+		}
+
+		char default_output[PATH_MAX];
+		if (!output) {
+			if (route_id) {
+				snprintf(default_output, sizeof (default_output), "%s/vibration_%s.spg", dir, route_id);
+			} else {
+				snprintf(default_output, sizeof (default_output), "%s/vibration.spg", dir);
+			}
+			output = default_output;
+		}
+		rv = m_spectrum_write(output, &params, start_ns, spectrograms, n_channels);
+		if (rv == 0) {
+			fprintf(stderr, "[II] written '%s'\n", output);
+		}
+		m_spectrogram_free(spectrograms, n_channels);
+	}
+
+	for (size_t c = 0; c < n_channels; c++) {
+		free(samples[c].values);
+	}
+
+	return rv;
+}
@@ -0,0 +1,524 @@
+#define _GNU_SOURCE /* posix_openpt(), cfmakeraw() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include "m_misc.h"
+
+
+
+
+/*
+  Emulator of BNO055 on UART, for testing of UART transport
+  (m_bno055_uart.c) and of mularsky -u without the chip.
+
+  mularsky_bno055_emu [-e <error rate [%]>] [-l <link>]
+
+  Creates a pseudo-terminal and prints path of its slave side (and
+  creates symlink @link to it), e.g.:
+
+      $ ./mularsky_bno055_emu -e 5 -l /tmp/bno055
+      bno055_emu: /dev/pts/7
+      $ ./mularsky -u /tmp/bno055 <output dir>
+
+  Commands of chapter 4.7 of datasheet (BST-BNO055-DS000-14) are
+  answered from emulated register map (pages 0 and 1):
+
+  - reads return register values (0xBB response),
+  - writes are acknowledged with status 0x01, and have effects on
+    PAGE_ID, OPR_MODE (SYS_STATUS follows it) and SYS_TRIGGER (reset
+    and self test),
+  - invalid commands get status responses of table 4-10: wrong start
+    byte, min./max. length, invalid address, write to read-only
+    register, and receive character timeout for incomplete commands.
+
+  After reset (SYS_TRIGGER bit 5) the chip doesn't answer for
+  EMU_RESET_MS, and the write of reset isn't acknowledged, like the
+  real chip may do. With -e, the given percentage of commands is
+  answered with BUS_OVER_RUN_ERROR, which the transport must retry.
+
+  Data registers change at output rate of current mode (100 Hz in
+  fusion modes, ODR of accelerometer in non-fusion modes), so reads
+  made faster than that return repeated samples, as on the chip.
+
+  Ctrl-C prints statistics of commands.
+*/
+
+
+
+
+#define EMU_START                  0xAA
+#define EMU_CMD_WRITE              0x00
+#define EMU_CMD_READ               0x01
+#define EMU_RESP_READ              0xBB
+#define EMU_RESP_STATUS            0xEE
+#define EMU_MAX_LEN                128
+
+/* Table 4-10. */
+#define EMU_WRITE_SUCCESS          0x01
+#define EMU_REGMAP_INVALID_ADDRESS 0x05
+#define EMU_REGMAP_WRITE_DISABLED  0x06
+#define EMU_WRONG_START_BYTE       0x07
+#define EMU_BUS_OVER_RUN_ERROR     0x08
+#define EMU_MAX_LENGTH_ERROR       0x09
+#define EMU_MIN_LENGTH_ERROR       0x0A
+#define EMU_RECEIVE_CHAR_TIMEOUT   0x0B
+
+#define EMU_REG_PAGE_ID            0x07
+#define EMU_REG_DATA_START         0x08
+#define EMU_REG_CALIB_STAT         0x35
+#define EMU_REG_ST_RESULT          0x36
+#define EMU_REG_SYS_STATUS         0x39
+#define EMU_REG_SYS_ERR            0x3A
+#define EMU_REG_OPR_MODE           0x3D
+#define EMU_REG_SYS_TRIGGER        0x3F
+#define EMU_REG_ACC_CONFIG         0x08   /* Page 1. */
+
+#define EMU_PAGE_SIZE              0x80
+#define EMU_CHAR_TIMEOUT_MS        20     /* Max. gap between bytes of one command. */
+#define EMU_RESET_MS               650    /* Table 1-2: POR time. */
+#define EMU_FUSION_HZ              100
+
+
+
+
+static uint8_t emu_pages[2][EMU_PAGE_SIZE];
+static struct timespec emu_start;          /* Start of current operation mode. */
+static struct timespec emu_busy_until;     /* End of reset. */
+static double emu_error_rate;              /* [%] */
+static volatile sig_atomic_t emu_stop;
+
+static unsigned long emu_n_reads;
+static unsigned long emu_n_writes;
+static unsigned long emu_n_errors;
+static unsigned long emu_n_injected;
+static unsigned long emu_n_resets;
+
+
+
+
+static void emu_sighandler(int sig)
+{
+	emu_stop = 1;
+}
+
+
+
+
+static int64_t emu_elapsed_ns(const struct timespec * since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) (now.tv_sec - since->tv_sec) * NSECS_PER_SEC + (now.tv_nsec - since->tv_nsec);
+}
+
+
+
+
+/* Table 4-2: register map after power-on reset. */
+static void emu_power_on(void)
+{
+	memset(emu_pages, 0, sizeof (emu_pages));
+
+	uint8_t * p0 = emu_pages[0];
+	p0[0x00] = 0xA0;                /* CHIP_ID */
+	p0[0x01] = 0xFB;                /* ACC_ID */
+	p0[0x02] = 0x32;                /* MAG_ID */
+	p0[0x03] = 0x0F;                /* GYR_ID */
+	p0[0x04] = 0x11;                /* SW_REV_ID_LSB */
+	p0[0x05] = 0x03;                /* SW_REV_ID_MSB */
+	p0[0x06] = 0x15;                /* BL_REV_ID */
+	p0[EMU_REG_ST_RESULT] = 0x0F;   /* POST passed. */
+	p0[0x3B] = 0x80;                /* UNIT_SEL */
+	p0[0x41] = 0x24;                /* AXIS_MAP_CONFIG */
+
+	uint8_t * p1 = emu_pages[1];
+	p1[EMU_REG_ACC_CONFIG] = 0x0D;  /* 4G, 62.5 Hz, normal. */
+	p1[0x09] = 0x6D;                /* MAG_Config */
+	p1[0x0A] = 0x38;                /* GYR_Config_0 */
+
+	clock_gettime(CLOCK_MONOTONIC, &emu_start);
+
+	return;
+}
+
+
+
+
+static void emu_put16(uint8_t * reg, int value)
+{
+	reg[0] = (uint8_t) (value & 0xFF);
+	reg[1] = (uint8_t) ((value >> 8) & 0xFF);
+
+	return;
+}
+
+
+
+
+/* Triangle wave of amplitude @amp and period of @period samples. */
+static int emu_wave(unsigned long n, unsigned long period, int amp)
+{
+	const long phase = (long) (n % period);
+	const long half = (long) period / 2;
+	const long v = phase < half ? phase : (long) period - phase;
+
+	return (int) (amp * (2 * v - half) / (half ? half : 1));
+}
+
+
+
+
+/*
+  Update data registers to the sample current at this moment. Values
+  are made up, but change with each sample.
+*/
+static void emu_update_data(void)
+{
+	uint8_t * p0 = emu_pages[0];
+	const uint8_t mode = p0[EMU_REG_OPR_MODE] & 0x0F;
+	if (mode == 0x00) {
+		return; /* CONFIGMODE: no measurements. */
+	}
+
+	/* Table 3-8: ACC bandwidth 7.81 Hz * 2^n, ODR is twice that. */
+	const bool fusion = mode >= 0x08;
+	const double acc_odr = 15.63 * (1 << ((emu_pages[1][EMU_REG_ACC_CONFIG] >> 2) & 0x07));
+	const double rate = fusion ? EMU_FUSION_HZ : acc_odr;
+	const unsigned long n = (unsigned long) (emu_elapsed_ns(&emu_start) * rate / NSECS_PER_SEC);
+
+	emu_put16(p0 + 0x08, emu_wave(n, 200, 40));          /* ACC_DATA [mg] */
+	emu_put16(p0 + 0x0A, emu_wave(n, 140, 30));
+	emu_put16(p0 + 0x0C, 980 + (int) (n % 7));
+	if (mode == 0x01) {
+		return; /* ACCONLY */
+	}
+	emu_put16(p0 + 0x0E, 200 + emu_wave(n, 300, 10));    /* MAG_DATA */
+	emu_put16(p0 + 0x10, -150 + emu_wave(n, 310, 10));
+	emu_put16(p0 + 0x12, 400);
+	emu_put16(p0 + 0x14, emu_wave(n, 90, 16));           /* GYR_DATA */
+	emu_put16(p0 + 0x16, emu_wave(n, 110, 16));
+	emu_put16(p0 + 0x18, (int) (n % 3) - 1);
+	if (!fusion) {
+		return;
+	}
+	emu_put16(p0 + 0x1A, (int) ((n / 10) % 5760));       /* EUL_DATA, 1/16 deg */
+	emu_put16(p0 + 0x1C, emu_wave(n, 400, 32));
+	emu_put16(p0 + 0x1E, emu_wave(n, 500, 32));
+	emu_put16(p0 + 0x20, 16384 - (int) (n % 11));        /* QUA_DATA */
+	emu_put16(p0 + 0x22, emu_wave(n, 400, 100));
+	emu_put16(p0 + 0x24, emu_wave(n, 500, 100));
+	emu_put16(p0 + 0x26, (int) (n % 13));
+	emu_put16(p0 + 0x28, emu_wave(n, 200, 40));          /* LIA_DATA */
+	emu_put16(p0 + 0x2A, emu_wave(n, 140, 30));
+	emu_put16(p0 + 0x2C, (int) (n % 7) - 3);
+	emu_put16(p0 + 0x2E, 0);                              /* GRV_DATA */
+	emu_put16(p0 + 0x30, 0);
+	emu_put16(p0 + 0x32, 981);
+	p0[0x34] = 25;                                        /* TEMP */
+	p0[EMU_REG_CALIB_STAT] = 0xFF;
+
+	return;
+}
+
+
+
+
+static void emu_respond(int fd, const uint8_t * data, size_t size)
+{
+	if (write(fd, data, size) != (ssize_t) size) {
+		fprintf(stderr, "%s:%d: write failed: %s\n", __FILE__, __LINE__, strerror(errno));
+	}
+
+	return;
+}
+
+
+
+
+static void emu_status(int fd, uint8_t status)
+{
+	const uint8_t response[2] = { EMU_RESP_STATUS, status };
+	emu_respond(fd, response, sizeof (response));
+	if (status != EMU_WRITE_SUCCESS) {
+		emu_n_errors++;
+	}
+
+	return;
+}
+
+
+
+
+/* Table 4-2: read only registers of page 0. */
+static bool emu_is_writable(int page, uint8_t reg)
+{
+	if (page == 0) {
+		return reg == EMU_REG_PAGE_ID || reg > EMU_REG_SYS_ERR;
+	}
+	return reg >= EMU_REG_PAGE_ID && reg < 0x50; /* 0x50-0x5F: UNIQUE_ID. */
+}
+
+
+
+
+/*
+  Write one register, with its side effects.
+
+  Returns true if the chip goes into reset.
+*/
+static bool emu_write_register(uint8_t reg, uint8_t value)
+{
+	const int page = emu_pages[0][EMU_REG_PAGE_ID] ? 1 : 0;
+	uint8_t * p0 = emu_pages[0];
+
+	if (reg == EMU_REG_PAGE_ID) {
+		emu_pages[0][EMU_REG_PAGE_ID] = value & 0x01;
+		emu_pages[1][EMU_REG_PAGE_ID] = value & 0x01;
+		return false;
+	}
+	if (page == 1) {
+		/* Sensor configuration is taken only in non-fusion modes. */
+		if (reg == EMU_REG_ACC_CONFIG && (p0[EMU_REG_OPR_MODE] & 0x0F) >= 0x08) {
+			return false;
+		}
+		emu_pages[1][reg] = value;
+		return false;
+	}
+
+	if (reg == EMU_REG_OPR_MODE) {
+		const uint8_t mode = value & 0x0F;
+		p0[EMU_REG_OPR_MODE] = mode;
+		/* 5: fusion algorithm running, 6: running without fusion. */
+		p0[EMU_REG_SYS_STATUS] = mode == 0x00 ? 0x00 : (mode >= 0x08 ? 0x05 : 0x06);
+		clock_gettime(CLOCK_MONOTONIC, &emu_start);
+		return false;
+	}
+	if (reg == EMU_REG_SYS_TRIGGER) {
+		if (value & 0x20) {
+			emu_power_on();
+			emu_n_resets++;
+			return true;
+		}
+		if ((value & 0x01) && (p0[EMU_REG_OPR_MODE] & 0x0F) == 0x00) {
+			p0[EMU_REG_ST_RESULT] = 0x0F; /* BIST passed. */
+		}
+		return false; /* Trigger bits are self-clearing. */
+	}
+	p0[reg] = value;
+
+	return false;
+}
+
+
+
+
+/*
+  Execute complete command in @cmd.
+*/
+static void emu_execute(int fd, const uint8_t * cmd)
+{
+	const int page = emu_pages[0][EMU_REG_PAGE_ID] ? 1 : 0;
+	const uint8_t reg = cmd[2];
+	const uint8_t len = cmd[3];
+
+	if (emu_error_rate > 0.0 && rand() < emu_error_rate / 100.0 * RAND_MAX) {
+		emu_n_injected++;
+		emu_status(fd, EMU_BUS_OVER_RUN_ERROR);
+		return;
+	}
+	if (reg + len > EMU_PAGE_SIZE) {
+		emu_status(fd, EMU_REGMAP_INVALID_ADDRESS);
+		return;
+	}
+
+	if (cmd[1] == EMU_CMD_READ) {
+		emu_n_reads++;
+		emu_update_data();
+		uint8_t response[2 + EMU_MAX_LEN] = { EMU_RESP_READ, len };
+		memcpy(response + 2, emu_pages[page] + reg, len);
+		emu_respond(fd, response, 2 + len);
+		return;
+	}
+
+	emu_n_writes++;
+	for (int i = 0; i < len; i++) {
+		if (!emu_is_writable(page, reg + i)) {
+			emu_status(fd, EMU_REGMAP_WRITE_DISABLED);
+			return;
+		}
+	}
+	for (int i = 0; i < len; i++) {
+		if (emu_write_register(reg + i, cmd[4 + i])) {
+			/* No acknowledge, chip is in reset. */
+			clock_gettime(CLOCK_MONOTONIC, &emu_busy_until);
+			emu_busy_until.tv_nsec += EMU_RESET_MS * USECS_PER_MSEC * NSECS_PER_USEC;
+			emu_busy_until.tv_sec += emu_busy_until.tv_nsec / NSECS_PER_SEC;
+			emu_busy_until.tv_nsec %= NSECS_PER_SEC;
+			return;
+		}
+	}
+	emu_status(fd, EMU_WRITE_SUCCESS);
+
+	return;
+}
+
+
+
+
+/*
+  Open master side of pseudo-terminal. Slave side is kept open too,
+  so that the master doesn't get EIO between sessions of clients.
+*/
+static int emu_open_pty(int * slave_fd, char * path, size_t size)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd == -1 || 0 != grantpt(fd) || 0 != unlockpt(fd) || !ptsname(fd)) {
+		fprintf(stderr, "%s:%d: failed to create pty: %s\n", __FILE__, __LINE__, strerror(errno));
+		return -1;
+	}
+	snprintf(path, size, "%s", ptsname(fd));
+
+	*slave_fd = open(path, O_RDWR | O_NOCTTY);
+	struct termios tio;
+	if (*slave_fd == -1 || 0 != tcgetattr(*slave_fd, &tio)) {
+		fprintf(stderr, "%s:%d: failed to open %s: %s\n", __FILE__, __LINE__, path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(*slave_fd, TCSANOW, &tio);
+
+	return fd;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	char const * link_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "e:l:")) != -1) {
+		switch (opt) {
+		case 'e':
+			emu_error_rate = atof(optarg);
+			break;
+		case 'l':
+			link_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-e <error rate [%%]>] [-l <link>]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc || emu_error_rate < 0.0 || emu_error_rate > 100.0) {
+		fprintf(stderr, "usage: %s [-e <error rate [%%]>] [-l <link>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	int slave_fd;
+	char path[64];
+	int fd = emu_open_pty(&slave_fd, path, sizeof (path));
+	if (fd == -1) {
+		exit(EXIT_FAILURE);
+	}
+	if (link_path) {
+		unlink(link_path);
+		if (0 != symlink(path, link_path)) {
+			fprintf(stderr, "%s:%d: failed to create link %s: %s\n", __FILE__, __LINE__, link_path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	printf("bno055_emu: %s\n", path);
+	fflush(stdout);
+
+	signal(SIGINT, emu_sighandler);
+	signal(SIGTERM, emu_sighandler);
+	emu_power_on();
+	clock_gettime(CLOCK_MONOTONIC, &emu_busy_until);
+
+	uint8_t cmd[4 + 255];
+	size_t have = 0;
+	while (!emu_stop) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int rv = poll(&pfd, 1, EMU_CHAR_TIMEOUT_MS);
+		if (rv == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "%s:%d: poll failed: %s\n", __FILE__, __LINE__, strerror(errno));
+			break;
+		}
+		if (rv == 0) {
+			/* Incomplete command. */
+			if (have > 0) {
+				have = 0;
+				emu_status(fd, EMU_RECEIVE_CHAR_TIMEOUT);
+			}
+			continue;
+		}
+
+		uint8_t buffer[256];
+		ssize_t n = read(fd, buffer, sizeof (buffer));
+		if (n <= 0) {
+			continue;
+		}
+		if (emu_elapsed_ns(&emu_busy_until) < 0) {
+			continue; /* In reset, input is lost. */
+		}
+
+		for (ssize_t i = 0; i < n; i++) {
+			cmd[have++] = buffer[i];
+			if (cmd[0] != EMU_START) {
+				have = 0;
+				emu_status(fd, EMU_WRONG_START_BYTE);
+				break; /* Rest of the input is garbage too. */
+			}
+			if (have == 2 && cmd[1] != EMU_CMD_READ && cmd[1] != EMU_CMD_WRITE) {
+				have = 0;
+				emu_status(fd, EMU_WRONG_START_BYTE);
+				break;
+			}
+			if (have < 4) {
+				continue;
+			}
+			if (have == 4 && cmd[3] == 0) {
+				have = 0;
+				emu_status(fd, EMU_MIN_LENGTH_ERROR);
+				break;
+			}
+			if (have == 4 && cmd[3] > EMU_MAX_LEN) {
+				have = 0;
+				emu_status(fd, EMU_MAX_LENGTH_ERROR);
+				break;
+			}
+			if (cmd[1] == EMU_CMD_READ || have == 4 + (size_t) cmd[3]) {
+				emu_execute(fd, cmd);
+				have = 0;
+			}
+		}
+	}
+
+	fprintf(stderr, "bno055_emu: reads %lu, writes %lu, error responses %lu (injected %lu), resets %lu\n",
+		emu_n_reads, emu_n_writes, emu_n_errors, emu_n_injected, emu_n_resets);
+	if (link_path) {
+		unlink(link_path);
+	}
+	close(slave_fd);
+	close(fd);
+
+	return 0;
+}
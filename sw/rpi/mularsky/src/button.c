@@ -9,9 +9,11 @@
 #include <wiringPi.h>
 
 #include "m_misc.h"
+#include "m_bus.h"
 
 
 #define PRESS_LIMIT 15
+#define BUS_STALE_S 10   /* Status of collector is published every few seconds. */
 
 
 int main(int argc, char ** argv)
@@ -21,8 +23,30 @@ int main(int argc, char ** argv)
         pinMode(G_GPIO_LED, OUTPUT);
 
 
+	/* View of collector's state; attached when collector is running. */
+	const struct m_bus * bus = NULL;
+
 	int n_button_pressed = 0;
 	for (;;) {
+		if (!bus) {
+			bus = m_bus_attach();
+		}
+		struct m_bus_status status;
+		if (bus && 0 == m_bus_read_latest(bus, M_BUS_STATUS, &status, sizeof (status), NULL)) {
+			if (time(NULL) - (time_t) (status.timestamp_ns / NSECS_PER_SEC) > BUS_STALE_S) {
+				/* Collector has stopped (and maybe
+				   started again with a new segment). */
+				m_bus_detach(bus);
+				bus = NULL;
+			} else {
+				fprintf(stderr, "button: collector %d: imu %s (%llu samples), pressure %s (%llu samples), gps %s\n",
+					(int) status.pid,
+					status.imu_ok ? "ok" : "nok", (unsigned long long) m_bus_head(bus, M_BUS_IMU),
+					status.pressure_ok ? "ok" : "nok", (unsigned long long) m_bus_head(bus, M_BUS_PRESSURE),
+					status.gps_ok ? "ok" : "nok");
+			}
+		}
+
 		int button_state = digitalRead(G_GPIO_BUTTON);
 		if (button_state == LOW) {
 			n_button_pressed++;
@@ -1,13 +1,20 @@
-#define _BSD_SOURCE /* usleep() */
+#define _BSD_SOURCE /* usleep(), clock_gettime() */
 
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
 
 #include "m_bme280.h"
 #include "m_i2c.h"
 #include "m_misc.h"
+#include "m_time.h"
+#include "m_manifest.h"
+#include "m_rotate.h"
+#include "m_bus.h"
+#include "m_trace.h"
 #include "bme280.h"
 
 
@@ -33,6 +40,8 @@ extern time_t global_time;
 extern int pressure_led_time_ms;
 
 static FILE * pressure_out_fd;
+static struct m_rotate_log * pressure_out_log;
+static bool pressure_raw; /* Store only raw values, without compensation. */
 static struct m_bme280_compensation bme280_comp;
 static const int pressure_ms = 1000; /* [milliseconds] */
 static const char * data_filename = "pressure.txt";
@@ -40,11 +49,28 @@ static const char * data_filename = "pressure.txt";
 
 
 #define BME280_I2C_ADDR 0x77
+#define BME280_I2C_DEV  1   /* Hardware I2C bus. */
+
+/* Recovery from failed reads of data. */
+#define PRESSURE_READ_RETRIES         5      /* Re-reads before re-initialization of chip. */
+#define PRESSURE_RETRY_BACKOFF_US     1000   /* Initial delay between re-reads, doubled with each re-read. */
+#define PRESSURE_REINIT_BACKOFF_MAX_S 8      /* Max. delay between attempts of re-initialization. */
 
 /* BME280 configuration registers and their contents (chip configuration). */
 
 #define BME280_REG_CHIP_ID         0xD0   /* Read only. */
 
+#define BME280_COMPENSATION_SIZE   (24 + 1 + 7) /* 0x88-0x9F, 0xA1, 0xE1-0xE7. */
+
+#define BME280_REG_STATUS          0xF3
+#define BME280_STATUS_MEASURING    0x08   /* xxxx 1xxx = conversion is running (chapter 5.4.4). */
+#define BME280_MEASUREMENT_MAX_MS  115    /* Max. measurement time for 16x oversampling of all three values (chapter 9.1). */
+
+#define BME280_REG_DATA            0xF7   /* Beginning of data for burst read (press_msb). */
+
+#define BME280_REG_RESET           0xE0
+#define BME280_SETTING_RESET       0xB6   /* Chapter 5.4.2: "soft reset" value. */
+
 #define BME280_REG_CTRL_CONFIG     0xF5
 #define BME280_SETTING_STBY        0xe0   /* 111x xxxx = 250 ms (table 27). */
 #define BME280_SETTING_FILTER      0x10   /* xxx1 00xx = filter coeff 16. */
@@ -64,8 +90,12 @@ static void m_bme280_convert_and_store_compensation(const uint8_t * buffer, stru
 static uint8_t m_bme280_read_chip_id(int fd);
 static int m_bme280_configure(int fd);
 static int m_bme280_get_compensation_data(int fd, struct m_bme280_compensation * c);
-static void m_bme280_convert_and_store_data(const uint8_t * buffer, struct m_bme280_compensation * c);
+static void m_bme280_convert_and_store_data(const uint8_t * buffer, struct m_bme280_compensation * c, unsigned int repeats);
+static int m_bme280_wait_for_conversion(int fd);
 static int m_bme280_read_loop(int fd, int ms, struct m_bme280_compensation * c);
+static int m_bme280_init(int fd, struct m_bme280_compensation * c);
+static int m_bme280_reset(int fd);
+static int m_bme280_recover(int * fd, struct m_bme280_compensation * c);
 
 
 
@@ -152,7 +182,7 @@ int m_bme280_configure(int fd)
 int m_bme280_get_compensation_data(int fd, struct m_bme280_compensation * c)
 {
 	uint8_t block_start = 0;
-	uint8_t buffer[24 + 1 + 7] = { 0 };
+	uint8_t buffer[BME280_COMPENSATION_SIZE] = { 0 };
 	int rv = 0;
 
 	block_start = 0x88;
@@ -201,10 +231,22 @@ void m_bme280_convert_and_store_compensation(const uint8_t * buffer, struct m_bm
 	   structure for later use by compensation functions. */
 
 	fprintf(pressure_out_fd, "\n");
-	for (int i = 0; i < 33; i++) {
+	for (int i = 0; i < BME280_COMPENSATION_SIZE; i++) {
 		fprintf(pressure_out_fd, "compensation data byte %02d: 0x%02x\n", i, *(buffer + i));
 	}
 
+	/* The same data in one line, for offline compensation of raw
+	   values (see m_bme280_calib_from_hex() in libmularsky). */
+	char line[32 + 2 * BME280_COMPENSATION_SIZE];
+	int len = snprintf(line, sizeof (line), "pressure calibration: ");
+	for (int i = 0; i < BME280_COMPENSATION_SIZE; i++) {
+		len += snprintf(line + len, sizeof (line) - len, "%02x", buffer[i]);
+	}
+	len += snprintf(line + len, sizeof (line) - len, "\n");
+	fputs(line, pressure_out_fd);
+	/* Each chunk of rotated log can be compensated on its own. */
+	m_rotate_set_header(pressure_out_log, line, len);
+
 	c->dig_T1 = buffer[0]  | (uint16_t) buffer[1] << 8;
 	c->dig_T2 = buffer[2]  | (uint16_t) buffer[3] << 8;
 	c->dig_T3 = buffer[4]  | (uint16_t) buffer[5] << 8;
@@ -222,9 +264,10 @@ void m_bme280_convert_and_store_compensation(const uint8_t * buffer, struct m_bm
 	c->dig_H1 = buffer[24];
 	c->dig_H2 = buffer[25] | (uint16_t) buffer[26] << 8;
 	c->dig_H3 = buffer[27];
-	c->dig_H4 = ((uint16_t) buffer[28] << 4) | (0x0f & buffer[29]); /* This is probably messed up. */
-	c->dig_H5 = ((0xf0 & buffer[29]) >> 4) | ((uint16_t) buffer[30] << 4); /* This may be messed up as well. */
-	c->dig_H6 = buffer[31];
+	/* Table 16: H4 and H5 are signed 12-bit values sharing register 0xE5. */
+	c->dig_H4 = (int16_t) ((int8_t) buffer[28] * 16) | (buffer[29] & 0x0f);
+	c->dig_H5 = (int16_t) ((int8_t) buffer[30] * 16) | (buffer[29] >> 4);
+	c->dig_H6 = (int8_t) buffer[31];
 
 
 	fprintf(pressure_out_fd, "\n");
@@ -262,8 +305,11 @@ void m_bme280_convert_and_store_compensation(const uint8_t * buffer, struct m_bm
 /*
   Measurement data is stored in @buffer of size 8 bytes.
   The data has been read in burst read of 8 bytes starting from 0xF7.
+
+  @repeats is a count of reads, made since the previous sample, that
+  returned the same data as the previous sample and were skipped.
 */
-void m_bme280_convert_and_store_data(const uint8_t * buffer, struct m_bme280_compensation * c)
+void m_bme280_convert_and_store_data(const uint8_t * buffer, struct m_bme280_compensation * c, unsigned int repeats)
 {
 	/* Chapter 4 Data readout.
 	   "The data are read out in an unsigned 20-bit format both
@@ -291,24 +337,45 @@ void m_bme280_convert_and_store_data(const uint8_t * buffer, struct m_bme280_com
 	   So calculate compensated temperature first. Then pressure
 	   and humidity. */
 
-#if 1
-	int32_t c_temperature = bme280_compensate_temperature_int32(raw_temperature, c);
-	uint32_t c_pressure = bme280_compensate_pressure_int32(raw_pressure, c);
-	uint32_t c_humidity = bme280_compensate_pressure_int32(raw_humidity, c);
-
-	fprintf(pressure_out_fd, "pressure@%lu: %u, %u, %u, %d, %u, %u\n",
-		global_time,
-		raw_pressure, c_pressure,
-		raw_temperature, c_temperature,
-		raw_humidity, c_humidity);
-#endif
+	struct m_bus_pressure_sample sample;
+	memset(&sample, 0, sizeof (sample));
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	sample.timestamp_ns = (uint64_t) ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+	sample.raw_pressure = raw_pressure;
+	sample.raw_temperature = raw_temperature;
+	sample.raw_humidity = raw_humidity;
+	sample.repeats = repeats > UINT16_MAX ? UINT16_MAX : repeats;
+
+	if (!pressure_raw) {
+		int32_t c_temperature = bme280_compensate_temperature_int32(raw_temperature, c);
+		uint32_t c_pressure = bme280_compensate_pressure_int32(raw_pressure, c);
+		uint32_t c_humidity = bme280_compensate_humidity_int32(raw_humidity, c);
+
+		sample.pressure = c_pressure;
+		sample.temperature = c_temperature;
+		sample.humidity = c_humidity;
+		sample.compensated = 1;
+
+		fprintf(pressure_out_fd, "pressure@%lu: %u, %u, %u, %d, %u, %u",
+			global_time,
+			raw_pressure, c_pressure,
+			raw_temperature, c_temperature,
+			raw_humidity, c_humidity);
+	} else {
+		/* Compensation will be done offline, with calibration
+		   data stored at the beginning of the file. */
+		fprintf(pressure_out_fd, "pressure@%lu: %u, %u, %u",
+			global_time,
+			raw_pressure, raw_temperature, raw_humidity);
+	}
 
+	if (repeats) {
+		fprintf(pressure_out_fd, " rep=%u", repeats);
+	}
+	fprintf(pressure_out_fd, "\n");
 
-#if 0
-        fprintf(pressure_out_fd, "pressure@%lu: %u, %u, %u\n",
-                global_time,
-                raw_pressure, raw_temperature, raw_humidity);
-#endif
+	m_bus_publish(M_BUS_PRESSURE, &sample, sizeof (sample));
 
 	return;
 }
@@ -316,6 +383,35 @@ void m_bme280_convert_and_store_data(const uint8_t * buffer, struct m_bme280_com
 
 
 
+/*
+  Wait until conversion that is currently running is finished.
+
+  Chapter 5.4.4 Register 0xF3 "status": bit 3 "measuring" is set
+  while conversion is running, and the results are transferred to
+  data registers when it's finished.
+
+  Returns 0 when conversion is finished, -1 on errors.
+*/
+int m_bme280_wait_for_conversion(int fd)
+{
+	const int step_ms = 5;
+	for (int waited_ms = 0; waited_ms <= BME280_MEASUREMENT_MAX_MS; waited_ms += step_ms) {
+		uint8_t status = 0;
+		if (-1 == m_i2c_read(fd, BME280_REG_STATUS, &status, 1)) {
+			return -1;
+		}
+		if (!(status & BME280_STATUS_MEASURING)) {
+			return 0;
+		}
+		usleep(step_ms * USECS_PER_MSEC);
+	}
+
+	return -1;
+}
+
+
+
+
 /*
   Read measurements in loop @count times every @ms milliseconds.
   Apply compensation data @c to the measurements.
@@ -335,25 +431,60 @@ int m_bme280_read_loop(int fd, int ms, struct m_bme280_compensation * c)
 	  What does "without the need of further write accesses" mean? I have to give register address, right?
 	*/
 
-	const uint8_t block_start = 0xF7;  /* Beginning of data for burst read. */
+	const uint8_t block_start = BME280_REG_DATA;  /* Beginning of data for burst read. */
 	const size_t block_size = 8;       /* 0xF7 to 0xFE: pressure, temperature, humidity. */
 
 	uint8_t buffer[block_size];
+	uint8_t previous[block_size];
+	bool have_previous = false;
+	unsigned int repeats = 0; /* Repeated reads since last stored sample. */
 
 	while (!cancel_treads) {
 		global_time = time(NULL);
+		m_trace_begin(M_TRACE_PRESSURE_PERIOD, 0);
 
 		buffer[0] = block_start;
 		int rv = m_i2c_read(fd, block_start, buffer, block_size);
 		if (rv == -1) {
 			fprintf(pressure_out_fd, "%s:%d: read data failed\n", __FILE__, __LINE__);
-			return -1;
+			if (-1 == m_bme280_recover(&fd, c)) {
+				m_trace_end(M_TRACE_PRESSURE_PERIOD, 0);
+				break;
+			}
+			m_trace_end(M_TRACE_PRESSURE_PERIOD, 0);
+			continue;
 		}
 		//fprintf(pressure_out_fd, "%02x %02x %02x %02x %02x %02x %02x %02x\n", buffer[0], buffer[1], buffer[2], buffer[3], buffer[4], buffer[5], buffer[6], buffer[7]);
 
-		m_bme280_convert_and_store_data(buffer, c);
+		if (have_previous && 0 == memcmp(buffer, previous, block_size)) {
+			/* No new conversion since previous read. If the
+			   chip is converting right now, don't skip the
+			   sample but get the result of the conversion. */
+			const bool updated = 0 == m_bme280_wait_for_conversion(fd)
+				&& 0 == m_i2c_read(fd, block_start, buffer, block_size)
+				&& 0 != memcmp(buffer, previous, block_size);
+			if (!updated) {
+				repeats++;
+				m_trace_end(M_TRACE_PRESSURE_PERIOD, 0);
+				m_trace_begin(M_TRACE_PRESSURE_SLEEP, 0);
+				usleep(USECS_PER_MSEC * ms);
+				m_trace_end(M_TRACE_PRESSURE_SLEEP, 0);
+				continue;
+			}
+		}
+
+		m_trace_begin(M_TRACE_PRESSURE_DECODE, 0);
+		m_bme280_convert_and_store_data(buffer, c, repeats);
+		m_trace_end(M_TRACE_PRESSURE_DECODE, 0);
+		memcpy(previous, buffer, block_size);
+		have_previous = true;
+		repeats = 0;
+		m_rotate_check(pressure_out_log, &pressure_out_fd);
 
+		m_trace_end(M_TRACE_PRESSURE_PERIOD, 0);
+		m_trace_begin(M_TRACE_PRESSURE_SLEEP, 0);
 		usleep(USECS_PER_MSEC * ms);
+		m_trace_end(M_TRACE_PRESSURE_SLEEP, 0);
 
 	}
 
@@ -365,35 +496,141 @@ int m_bme280_read_loop(int fd, int ms, struct m_bme280_compensation * c)
 
 
 
-int pressure_prepare(char const * dirpath)
+/*
+  Chapter 5.4.2 Register 0xE0 "reset".
+  Chapter 1, table 1: start-up time is 2 ms.
+*/
+int m_bme280_reset(int fd)
 {
-	if (dirpath == NULL) {
-		pressure_out_fd = stderr;
-	} else {
-		char buffer[64] = { 0 };
-		snprintf(buffer, sizeof (buffer), "%s/%s", dirpath, data_filename);
-		pressure_out_fd = fopen(buffer, "w");
-		//setvbuf(pressure_out_fd, NULL, _IONBF, 0);
-	}
-
-	int fd = m_i2c_open_slave(1, BME280_I2C_ADDR);
-	if (fd == -1) {
+	const uint8_t value = BME280_SETTING_RESET;
+	if (-1 == m_i2c_write(fd, BME280_REG_RESET, &value, 1)) {
+		fprintf(pressure_out_fd, "%s:%d: reset failed\n", __FILE__, __LINE__);
 		return -1;
 	}
+	usleep(2 * USECS_PER_MSEC);
 
+	return 0;
+}
+
+
+
+
+/*
+  Check chip, get its compensation data and configure it. Used at
+  startup and during recovery.
+*/
+int m_bme280_init(int fd, struct m_bme280_compensation * c)
+{
 	uint8_t cid = m_bme280_read_chip_id(fd);
 	if (cid == 0) {
-		close(fd);
 		return -1;
 	}
 	fprintf(pressure_out_fd, "%s:%d: pressure chip id = 0x%02x\n", __FILE__, __LINE__, cid);
 
-	if (-1 == m_bme280_get_compensation_data(fd, &bme280_comp)) {
-		close(fd);
+	if (-1 == m_bme280_get_compensation_data(fd, c)) {
 		return -1;
 	}
 
 	if (-1 == m_bme280_configure(fd)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+/*
+  Recover from failed read of data from device @fd.
+
+  Most of failures are single glitches on the bus, so first the read
+  is retried a few times, with growing delays. If this doesn't help,
+  the device is re-opened, the chip is reset and goes through the
+  same initialization sequence as at startup. This is repeated until
+  it succeeds or until the thread is cancelled.
+
+  global_time is driven by this thread, so it's kept up to date
+  during recovery.
+
+  On success *@fd is a descriptor of working device, and the function
+  returns 0. Returns -1 if the thread has been cancelled before
+  recovery.
+*/
+int m_bme280_recover(int * fd, struct m_bme280_compensation * c)
+{
+	uint8_t buffer[8];
+	const time_t gap_start = global_time;
+	struct timespec begin;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	int backoff_us = PRESSURE_RETRY_BACKOFF_US;
+	for (int i = 1; i <= PRESSURE_READ_RETRIES && !cancel_treads; i++) {
+		usleep(backoff_us);
+		backoff_us *= 2;
+		global_time = time(NULL);
+		if (0 == m_i2c_read(*fd, BME280_REG_DATA, buffer, sizeof (buffer))) {
+			fprintf(pressure_out_fd, "pressure@%lu: gap since %lu, recovered after %d re-reads in %ld ms\n",
+				global_time, gap_start, i, m_timespec_elapsed_ms(&begin));
+			return 0;
+		}
+	}
+
+	pressure_led_time_ms = BLINK_NOK;
+
+	int backoff_s = 1;
+	for (int attempt = 1; !cancel_treads; attempt++) {
+		global_time = time(NULL);
+		fprintf(pressure_out_fd, "pressure@%lu: re-initializing chip, attempt %d\n", global_time, attempt);
+
+		if (*fd != -1) {
+			close(*fd);
+		}
+		*fd = m_i2c_open_slave(BME280_I2C_DEV, BME280_I2C_ADDR);
+		pressure_sensor_fd = (*fd == -1) ? 0 : *fd;
+
+		if (*fd != -1 && 0 == m_bme280_reset(*fd) && 0 == m_bme280_init(*fd, c)) {
+			global_time = time(NULL);
+			fprintf(pressure_out_fd, "pressure@%lu: gap since %lu, recovered after %d re-initializations in %ld ms\n",
+				global_time, gap_start, attempt, m_timespec_elapsed_ms(&begin));
+			pressure_led_time_ms = BLINK_OK;
+			return 0;
+		}
+
+		sleep(backoff_s);
+		if (backoff_s < PRESSURE_REINIT_BACKOFF_MAX_S) {
+			backoff_s *= 2;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+/*
+  dirpath - directory for output file, NULL for stderr
+  params  - parameters of pressure sensor
+*/
+int pressure_prepare(char const * dirpath, const struct m_pressure_params * params)
+{
+	if (dirpath == NULL) {
+		pressure_out_fd = stderr;
+	} else {
+		pressure_out_log = m_rotate_open(dirpath, data_filename, &pressure_out_fd);
+		//setvbuf(pressure_out_fd, NULL, _IONBF, 0);
+	}
+
+	pressure_raw = params->raw;
+	fprintf(pressure_out_fd, "pressure: storing %s values\n", pressure_raw ? "raw" : "raw and compensated");
+
+	int fd = m_i2c_open_slave(BME280_I2C_DEV, BME280_I2C_ADDR);
+	if (fd == -1) {
+		return -1;
+	}
+
+	if (-1 == m_bme280_init(fd, &bme280_comp)) {
 		close(fd);
 		return -1;
 	}
@@ -406,8 +643,62 @@ int pressure_prepare(char const * dirpath)
 
 
 
+/*
+  Replay of a recorded session (replay.c): samples don't come from
+  the chip, but go through the same compensation, storing and
+  publishing as samples read by pressure_thread_fn().
+
+  @calibration: M_PRESSURE_CALIBRATION_SIZE bytes of compensation
+  registers, as read from the chip; NULL if they are unknown, then
+  only raw values are stored.
+  @buffer: M_PRESSURE_REPLAY_DATA_SIZE bytes of data registers.
+*/
+int pressure_replay_prepare(char const * dirpath, const struct m_pressure_params * params, const uint8_t * calibration)
+{
+	pressure_out_log = m_rotate_open(dirpath, data_filename, &pressure_out_fd);
+	if (!pressure_out_log) {
+		return -1;
+	}
+
+	pressure_raw = params->raw || !calibration;
+	fprintf(pressure_out_fd, "pressure: replaying recorded session, storing %s values\n", pressure_raw ? "raw" : "raw and compensated");
+	if (calibration) {
+		m_bme280_convert_and_store_compensation(calibration, &bme280_comp);
+	}
+
+	return 0;
+}
+
+
+
+
+void pressure_replay_sample(const uint8_t * buffer, unsigned int repeats)
+{
+	m_trace_begin(M_TRACE_PRESSURE_DECODE, 0);
+	m_bme280_convert_and_store_data(buffer, &bme280_comp, repeats);
+	m_trace_end(M_TRACE_PRESSURE_DECODE, 0);
+	m_rotate_check(pressure_out_log, &pressure_out_fd);
+
+	return;
+}
+
+
+
+
+void pressure_replay_finish(void)
+{
+	m_rotate_close(pressure_out_log, &pressure_out_fd);
+	pressure_out_log = NULL;
+
+	return;
+}
+
+
+
+
 void * pressure_thread_fn(void * dummy)
 {
+	m_trace_thread_name("pressure");
         fprintf(pressure_out_fd, "pressure thread function begin\n");
 
 	pressure_led_time_ms = BLINK_OK;
@@ -416,9 +707,9 @@ void * pressure_thread_fn(void * dummy)
 
         fprintf(pressure_out_fd, "pressure thread function end\n");
 
-	if (pressure_out_fd && pressure_out_fd != stderr) {
-		fclose(pressure_out_fd);
-		pressure_out_fd = NULL;
+	if (pressure_out_log) {
+		m_rotate_close(pressure_out_log, &pressure_out_fd);
+		pressure_out_log = NULL;
 	}
 
         return NULL;
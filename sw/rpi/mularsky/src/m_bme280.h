@@ -5,6 +5,7 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
 
 
 
@@ -37,10 +38,28 @@ struct m_bme280_compensation {
 
 
 
-int pressure_prepare(char const * dirpath);
+struct m_pressure_params {
+	bool raw;  /* Store only raw values, to be compensated offline. */
+};
+
+
+
+
+int pressure_prepare(char const * dirpath, const struct m_pressure_params * params);
 void * pressure_thread_fn(void * dummy);
 
 
 
 
+/* Replay of recorded session, without chip (see replay.c). */
+#define M_PRESSURE_CALIBRATION_SIZE  32  /* 0x88-0x9F, 0xA1, 0xE1-0xE7. */
+#define M_PRESSURE_REPLAY_DATA_SIZE  8   /* 0xF7 to 0xFE. */
+
+int pressure_replay_prepare(char const * dirpath, const struct m_pressure_params * params, const uint8_t * calibration);
+void pressure_replay_sample(const uint8_t * buffer, unsigned int repeats);
+void pressure_replay_finish(void);
+
+
+
+
 #endif /* #ifndef H_M_BME280 */
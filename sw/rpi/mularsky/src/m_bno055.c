@@ -1,15 +1,22 @@
-#define _BSD_SOURCE /* usleep() */
+#define _BSD_SOURCE /* usleep(), clock_nanosleep() */
 
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "m_bno055.h"
 #include "m_i2c.h"
+#include "m_bno055_uart.h"
 #include "m_misc.h"
+#include "m_time.h"
+#include "m_manifest.h"
+#include "m_rotate.h"
+#include "m_bus.h"
+#include "m_trace.h"
 
 
 
@@ -21,12 +28,19 @@ extern int imu_led_time_ms;
 
 
 static FILE * imu_out_fd;
-static const int imu_ms = 10; /* [milliseconds] */
+static FILE * imu_raw_fd; /* Binary log of raw samples, used in non-fusion modes. */
+static struct m_rotate_log * imu_out_log;
+static struct m_rotate_log * imu_raw_log;
+static const int imu_fusion_us = 10 * USECS_PER_MSEC; /* Output rate of fusion modes is 100 Hz. */
+static int imu_period_us;
 static const char * data_filename = "imu.txt";
+static const char * raw_data_filename = "imu_raw.bin";
+static char const * imu_uart_path; /* Kept for re-opening the device during recovery. */
 
 
 
 #define BNO055_I2C_ADDR 0x28
+#define BNO055_I2C_DEV  3   /* Bit-banged bus, BNO055 uses clock stretching. */
 
 /* BNO055 configuration registers and their contents (chip configuration). */
 
@@ -42,21 +56,58 @@ static const char * data_filename = "imu.txt";
 
 #define BNO055_REG_CALIB_STAT      0x35
 #define BNO055_REG_OPR_MODE        0x3D
+#define BNO055_REG_PAGE_ID         0x07
+
+#define BNO055_REG_ACC_CONFIG      0x08   /* Page 1. Writable only in non-fusion modes. */
 
 #define BNO055_REG_AXIS_MAP_CONFIG 0x41   /* Axis remapping. */
 #define BNO055_REG_AXIS_MAP_SIGN   0x42   /* Axis sign. */
 
 
 #define BNO055_OPR_MODE_CONFIGMODE 0x00
+#define BNO055_OPR_MODE_ACCONLY    0x01
+#define BNO055_OPR_MODE_AMG        0x07
 #define BNO055_OPR_MODE_FUS_IMU    0x08
 #define BNO055_OPR_MODE_FUS_NDOF0  0x0B   /* NDOF_FMC_OFF */
 #define BNO055_OPR_MODE_FUS_NDOF1  0x0C   /* NDOF */
-#define BNO055_OPR_MODE_WORK_MODE  BNO055_OPR_MODE_FUS_NDOF1
+#define BNO055_OPR_MODE_WORK_MODE  BNO055_OPR_MODE_FUS_NDOF1  /* Default. */
+
+#define BNO055_IS_RAW_MODE(mode)   ((mode) == BNO055_OPR_MODE_ACCONLY || (mode) == BNO055_OPR_MODE_AMG)
+
+#define BNO055_DATA_START          0x08   /* Beginning of Data area. */
+#define BNO055_DATA_SIZE_ACC       6      /* ACC_DATA. */
+#define BNO055_DATA_SIZE_AMG       18     /* ACC_DATA, MAG_DATA, GYR_DATA. */
+#define BNO055_DATA_SIZE_FUSION    46     /* ACC_DATA to CALIB_STAT. */
+#define BNO055_DATA_SIZE_FUSION_CMP 44    /* ACC_DATA to GRV_DATA: part of fusion data used to detect repeated samples. */
+
+
+static uint8_t imu_work_mode = BNO055_OPR_MODE_WORK_MODE;
+static uint8_t imu_acc_config = 0x0D;   /* Power-on value: 4G, 62.5 Hz, normal. */
+static size_t imu_data_size = BNO055_DATA_SIZE_FUSION;
+
+
+/* Recovery from failed reads of data. */
+#define IMU_READ_RETRIES         5        /* Re-reads before re-initialization of chip. */
+#define IMU_RETRY_BACKOFF_US     1000     /* Initial delay between re-reads, doubled with each re-read. */
+#define IMU_REINIT_BACKOFF_MAX_S 8        /* Max. delay between attempts of re-initialization. */
 
 
 #define BNO055_MANUAL_CALIBRATION 0
 #define M_BNO055_RUN_BIST 0
 
+/* Access to chip's registers, either through I2C or UART. */
+struct m_bno055_transport {
+	const char * name;
+	int (* read)(int fd, uint8_t reg, uint8_t * buffer, size_t size);
+	int (* write)(int fd, uint8_t reg, const uint8_t * data, size_t size);
+};
+
+static const struct m_bno055_transport transport_i2c = { "i2c", m_i2c_read, m_i2c_write };
+static const struct m_bno055_transport transport_uart = { "uart", m_bno055_uart_read, m_bno055_uart_write };
+static const struct m_bno055_transport * transport = &transport_i2c;
+
+static int m_bno055_read(int fd, uint8_t reg, uint8_t * buffer, size_t size);
+static int m_bno055_write(int fd, uint8_t reg, const uint8_t * data, size_t size);
 static int m_bno055_read_initial(int fd);
 #if M_BNO055_MANUAL_CALIBRATION
 static int m_bno055_calibrate_manually(int fd);
@@ -69,8 +120,30 @@ static int m_bno055_read_calibration(int fd);
 static int m_bno055_run_bist(int fd);
 #endif
 static int m_bno055_configure(int fd);
-static void m_bno055_convert_and_store_data(const uint8_t * buffer);
-static int m_bno055_read_loop(int fd, int ms);
+static int m_bno055_set_params(const struct m_imu_params * params);
+static void m_bno055_convert_and_store_data(const uint8_t * buffer, unsigned int repeats);
+static void m_bno055_store_raw_data(const uint8_t * buffer, size_t size, uint64_t sequence);
+static void m_bno055_publish(const uint8_t * buffer, size_t size, unsigned int repeats);
+static int m_bno055_read_loop(int fd, int period_us);
+static int m_bno055_open(void);
+static int m_bno055_init(int fd);
+static int m_bno055_recover(int * fd);
+
+
+
+
+int m_bno055_read(int fd, uint8_t reg, uint8_t * buffer, size_t size)
+{
+	return transport->read(fd, reg, buffer, size);
+}
+
+
+
+
+int m_bno055_write(int fd, uint8_t reg, const uint8_t * data, size_t size)
+{
+	return transport->write(fd, reg, data, size);
+}
 
 
 
@@ -78,9 +151,14 @@ static int m_bno055_read_loop(int fd, int ms);
 int m_bno055_reset(int fd)
 {
 	uint8_t buffer[2] = { BNO055_REG_SYS_TRIGGER, 0x20 };
-	if (write(fd, buffer, 2) != 2) {
-		fprintf(imu_out_fd, "imu: reset failed\n");
-		return -1;
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, 1)) {
+		if (transport != &transport_uart) {
+			fprintf(imu_out_fd, "imu: reset failed\n");
+			return -1;
+		}
+		/* Over UART the chip may go into reset before
+		   acknowledging the write. Next reads will tell us
+		   whether the reset really failed. */
 	}
 
 	sleep(1);
@@ -101,28 +179,28 @@ int m_bno055_reset(int fd)
 int m_bno055_read_initial(int fd)
 {
 	uint8_t buffer[2] = { 0 };
-	if (-1 == m_i2c_read(fd, BNO055_REG_CHIP_ID, buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_CHIP_ID, buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu chip id\n");
 		return -1;
 	}
 	fprintf(imu_out_fd, "imu chip id: %02X\n", buffer[0]);
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_ACC_ID, buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_ACC_ID, buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu acc id\n");
 		return -1;
 	}
 	fprintf(imu_out_fd, "imu acc id:  %02X\n", buffer[0]);
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_MAG_ID, buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_MAG_ID, buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu mag id\n");
 		return -1;
 	}
 	fprintf(imu_out_fd, "imu mag id:  %02X\n", buffer[0]);
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_GYR_ID, buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_GYR_ID, buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu gyr id\n");
 		return -1;
 	}
@@ -140,21 +218,21 @@ int m_bno055_get_overall_status(int fd)
 	uint8_t buffer = { 0 };
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_ST_RESULT, &buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_ST_RESULT, &buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu POST results\n");
 		return -1;
 	}
 	fprintf(imu_out_fd, "imu POST result: %02X\n", buffer);
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_SYS_STATUS, &buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_SYS_STATUS, &buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu SYS status before BIST\n");
 		return -1;
 	}
 	fprintf(imu_out_fd, "imu SYS status:  %02X\n", buffer);
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_SYS_ERR, &buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_SYS_ERR, &buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu SYS err before BIST\n");
 		return -1;
 	}
@@ -175,20 +253,20 @@ int m_bno055_run_bist(int fd)
 	uint8_t buffer[2] = { 0 };
 	buffer[0] = BNO055_REG_SYS_TRIGGER;
 	buffer[1] = 0x01;
-	if (write(fd, buffer, 2) != 2) {
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, 1)) {
 		fprintf(imu_out_fd, "imu BIST trigger failed\n");
 		return -1;
 	}
 	do {
 		sleep(1);
-		if (-1 == m_i2c_read(fd, BNO055_REG_SYS_STATUS, buffer, 1)) {
+		if (-1 == m_bno055_read(fd, BNO055_REG_SYS_STATUS, buffer, 1)) {
 			fprintf(imu_out_fd, "failed to read imu SYS status during BIST\n");
 			return -1;
 		}
 		fprintf(imu_out_fd, "imu SYS status during BIST: %02X\n", buffer[0]);
 	} while (buffer[0] == 0x04); /* 0x04 - executing selftest (4.3.58 SYS_STATUS 0x39) */
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_ST_RESULT, buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_ST_RESULT, buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu ST result after BIST\n");
 		return -1;
 	}
@@ -196,7 +274,7 @@ int m_bno055_run_bist(int fd)
 
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_SYS_STATUS, buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_SYS_STATUS, buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu SYS status after BIST\n");
 		return -1;
 	}
@@ -204,7 +282,7 @@ int m_bno055_run_bist(int fd)
 
 
 
-	if (-1 == m_i2c_read(fd, BNO055_REG_SYS_ERR, buffer, 1)) {
+	if (-1 == m_bno055_read(fd, BNO055_REG_SYS_ERR, buffer, 1)) {
 		fprintf(imu_out_fd, "failed to read imu SYS err after BIST\n");
 		return -1;
 	}
@@ -224,8 +302,8 @@ int m_bno055_calibrate_manually(int fd)
 {
 #if 1
 	usleep(30);
-	uint8_t buf[2] = { BNO055_REG_OPR_MODE, BNO055_OPR_MODE_WORK_MODE };
-	if (write(fd, buf, 2) != 2) {
+	uint8_t buf[2] = { BNO055_REG_OPR_MODE, imu_work_mode };
+	if (-1 == m_bno055_write(fd, buf[0], buf + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to set oper mode\n");
 		return -1;
 	}
@@ -236,7 +314,7 @@ int m_bno055_calibrate_manually(int fd)
 	uint8_t buffer = 0;
 
 	while (i != 5) {
-		if (-1 == m_i2c_read(fd, BNO055_REG_CALIB_STAT, &buffer, 1)) {
+		if (-1 == m_bno055_read(fd, BNO055_REG_CALIB_STAT, &buffer, 1)) {
 			fprintf(imu_out_fd, "imu: failed to read imu calibration status\n");
 			return -1;
 		}
@@ -269,7 +347,7 @@ int m_bno055_calibrate_from_data(int fd)
 
 	usleep(30);
 	uint8_t buf[2] = { BNO055_REG_OPR_MODE, BNO055_OPR_MODE_CONFIGMODE };
-	if (write(fd, buf, 2) != 2) {
+	if (-1 == m_bno055_write(fd, buf[0], buf + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to set oper mode\n");
 		return -1;
 	}
@@ -277,15 +355,15 @@ int m_bno055_calibrate_from_data(int fd)
 
 
 	uint8_t buffer[] = { 0x55,        0xF1, 0xFF, 0x0A, 0x00, 0x08, 0x00, 0xE4, 0xFD, 0xC6, 0xFF, 0x77, 0xFF, 0xFF, 0xFF, 0xFC, 0xFF, 0xFF, 0xFF, 0xE8, 0x03, 0x73, 0x02, };
-	if (write(fd, buffer, sizeof (buffer)) != sizeof (buffer)) {
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, sizeof (buffer) - 1)) {
 		fprintf(imu_out_fd, "imu: failed to write calibration data\n");
 		return -1;
 	}
 
 	usleep(30);
 	buf[0] = BNO055_REG_OPR_MODE;
-	buf[1] = BNO055_OPR_MODE_WORK_MODE;
-	if (write(fd, buf, 2) != 2) {
+	buf[1] = imu_work_mode;
+	if (-1 == m_bno055_write(fd, buf[0], buf + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to set oper mode\n");
 		return -1;
 	}
@@ -310,14 +388,14 @@ int m_bno055_read_calibration(int fd)
 	usleep(30);
 	buffer[0] = BNO055_REG_OPR_MODE;
 	buffer[1] = BNO055_OPR_MODE_CONFIGMODE;
-	if (write(fd, buffer, 2) != 2) {
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to set oper mode before reading calibration\n");
 		return -1;
 	}
 	usleep(30); /* Operating mode switching time. */
 #endif
 
-	if (-1 == m_i2c_read(fd, 0x55, buffer, sizeof (buffer))) {
+	if (-1 == m_bno055_read(fd, 0x55, buffer, sizeof (buffer))) {
 		fprintf(imu_out_fd, "imu: failed to read imu calibration data\n");
 		return -1;
 	}
@@ -354,8 +432,8 @@ int m_bno055_read_calibration(int fd)
 
 	usleep(30);
 	buffer[0] = BNO055_REG_OPR_MODE;
-	buffer[1] = BNO055_OPR_MODE_WORK_MODE;
-	if (write(fd, buffer, 2) != 2) {
+	buffer[1] = imu_work_mode;
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to set oper mode after reading calibration\n");
 		return -1;
 	}
@@ -377,7 +455,7 @@ int m_bno055_configure(int fd)
 	usleep(30);
 	buffer[0] = BNO055_REG_OPR_MODE;
 	buffer[1] = BNO055_OPR_MODE_CONFIGMODE ;
-	if (write(fd, buffer, 2) != 2) {
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to set oper mode\n");
 		return -1;
 	}
@@ -392,17 +470,33 @@ int m_bno055_configure(int fd)
 	//buffer[1] = (0x01 << 4) | (0x00 << 2) | (0x02 << 0);
 	//buffer[1] = (0x00 << 4) | (0x01 << 2) | (0x02 << 0);
 
-	if (write(fd, buffer, 2) != 2) {
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to remap axis\n");
 		return -1;
 	}
 #endif
 
 
+	if (BNO055_IS_RAW_MODE(imu_work_mode)) {
+		/* 3.5.2 Accelerometer configuration: in fusion modes
+		   ACC_Config is set by the fusion algorithm, in
+		   non-fusion modes it's up to us. */
+		const uint8_t page1 = 1;
+		const uint8_t page0 = 0;
+		if (-1 == m_bno055_write(fd, BNO055_REG_PAGE_ID, &page1, 1)
+		    || -1 == m_bno055_write(fd, BNO055_REG_ACC_CONFIG, &imu_acc_config, 1)
+		    || -1 == m_bno055_write(fd, BNO055_REG_PAGE_ID, &page0, 1)) {
+			fprintf(imu_out_fd, "imu: failed to configure accelerometer\n");
+			return -1;
+		}
+		fprintf(imu_out_fd, "imu: acc config = 0x%02x\n", imu_acc_config);
+	}
+
+
 	usleep(30);
 	buffer[0] = BNO055_REG_OPR_MODE;
-	buffer[1] = BNO055_OPR_MODE_WORK_MODE;
-	if (write(fd, buffer, 2) != 2) {
+	buffer[1] = imu_work_mode;
+	if (-1 == m_bno055_write(fd, buffer[0], buffer + 1, 1)) {
 		fprintf(imu_out_fd, "imu: failed to set oper mode after configuration\n");
 		return -1;
 	}
@@ -419,8 +513,12 @@ int m_bno055_configure(int fd)
 /*
   Measurement data is stored in @buffer of size 46 bytes.
   The data has been read in burst read of 46 bytes starting from 0x08.
+
+  @repeats is a count of reads, made since the previous sample, that
+  returned the same data as the previous sample and were skipped
+  (see m_bno055_read_loop()).
 */
-void m_bno055_convert_and_store_data(const uint8_t * buffer)
+void m_bno055_convert_and_store_data(const uint8_t * buffer, unsigned int repeats)
 {
 	fprintf(imu_out_fd, "imu@%lu:" \
 
@@ -432,9 +530,7 @@ void m_bno055_convert_and_store_data(const uint8_t * buffer)
 		"lia=%d,%d,%d " \
 		"grv=%d,%d,%d " \
 		"temp=%d " \
-		"calib=0x%x"  \
-
-		"\n",
+		"calib=0x%x",
 
 		global_time,
 
@@ -497,6 +593,73 @@ void m_bno055_convert_and_store_data(const uint8_t * buffer)
 
 		);
 
+	if (repeats) {
+		fprintf(imu_out_fd, " rep=%u", repeats);
+	}
+	fprintf(imu_out_fd, "\n");
+
+	return;
+}
+
+
+
+
+/*
+  Publish sample on live sample bus. @buffer holds @size bytes of data
+  registers starting at ACC_DATA_X_LSB: whole fusion data, or only
+  part of it in non-fusion modes.
+*/
+void m_bno055_publish(const uint8_t * buffer, size_t size, unsigned int repeats)
+{
+	struct m_bus_imu_sample sample;
+	memset(&sample, 0, sizeof (sample));
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	sample.timestamp_ns = (uint64_t) ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+	sample.repeats = repeats > UINT16_MAX ? UINT16_MAX : repeats;
+
+	/* Registers of all vectors are consecutive little-endian
+	   int16 values, in order of fields of the sample. */
+	int16_t * values[] = { sample.acc, sample.mag, sample.gyr, sample.eul, sample.qua, sample.lia, sample.grv };
+	const size_t counts[] = { 3, 3, 3, 3, 4, 3, 3 };
+	size_t offset = 0;
+	for (size_t v = 0; v < sizeof (counts) / sizeof (counts[0]); v++) {
+		for (size_t i = 0; i < counts[v] && offset + 1 < size; i++) {
+			values[v][i] = (int16_t) ((buffer[offset + 1] << 8) | buffer[offset]);
+			offset += 2;
+		}
+	}
+	if (size >= BNO055_DATA_SIZE_FUSION) {
+		sample.temp = (int8_t) buffer[44];
+		sample.calib = buffer[45];
+	}
+
+	m_bus_publish(M_BUS_IMU, &sample, sizeof (sample));
+
+	return;
+}
+
+
+
+
+/*
+  Store raw register block of @size bytes, read in non-fusion mode,
+  in binary log. Each record is a struct m_imu_raw_record followed by
+  the block.
+*/
+void m_bno055_store_raw_data(const uint8_t * buffer, size_t size, uint64_t sequence)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	struct m_imu_raw_record record;
+	record.timestamp_ns = (uint64_t) ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+	record.sequence = sequence;
+
+	fwrite(&record, sizeof (record), 1, imu_raw_fd);
+	fwrite(buffer, size, 1, imu_raw_fd);
+
 	return;
 }
 
@@ -504,27 +667,106 @@ void m_bno055_convert_and_store_data(const uint8_t * buffer)
 
 
 /*
-  Read measurements in loop every @ms milliseconds.
+  Read measurements in loop every @period_us microseconds.
   Store measurement data.
+
+  The loop is driven by absolute deadlines, so time spent on reading
+  and storing data doesn't add up to the period. If a deadline is
+  missed, the loop doesn't try to catch up: it resynchronizes and
+  counts the miss.
+
+  The loop isn't synchronized with the chip, so some reads return
+  the same sample as the previous read. The chip has no sample
+  counter or data-ready flag for this, so in fusion modes such reads
+  are detected by comparing data blocks, are not stored, and their
+  count is stored with the next new sample. The count may thus
+  include genuine samples identical to the previous one, which is
+  unlikely with orientation and noise of all sensors in the block.
+
+  In raw modes the block is small (6 bytes in ACC mode), and a still
+  sensor often gives identical consecutive samples, so every read is
+  stored; repeated reads can be told apart offline by timestamps and
+  sequence numbers of records.
 */
-int m_bno055_read_loop(int fd, int ms)
+int m_bno055_read_loop(int fd, int period_us)
 {
-	uint8_t buffer[46] = { 0 };
-	const uint8_t start = 0x08; /* Beginning of Data area. */
+	uint8_t buffer[BNO055_DATA_SIZE_FUSION] = { 0 };
+	uint8_t previous[BNO055_DATA_SIZE_FUSION] = { 0 };
+	const bool raw = BNO055_IS_RAW_MODE(imu_work_mode);
+	const size_t cmp_size = BNO055_DATA_SIZE_FUSION_CMP;
+	bool have_previous = false;
+	unsigned int repeats = 0;       /* Repeated reads since last stored sample. */
+	unsigned long n_reads = 0;
+	unsigned long n_samples = 0;
+	unsigned long n_repeated = 0;
+	unsigned long n_late = 0;
+	time_t last_report = time(NULL);
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
 
 	while (!cancel_treads) {
-		buffer[0] = start;
-		if (-1 == m_i2c_read(fd, start, buffer, sizeof (buffer))) {
-			fprintf(imu_out_fd, "imu: failed to read data\n");
-			return -1;
+		m_trace_begin(M_TRACE_IMU_PERIOD, n_reads);
+		if (-1 == m_bno055_read(fd, BNO055_DATA_START, buffer, imu_data_size)) {
+			fprintf(imu_out_fd, "imu@%lu: failed to read data\n", global_time);
+			if (-1 == m_bno055_recover(&fd)) {
+				m_trace_end(M_TRACE_IMU_PERIOD, n_reads);
+				break;
+			}
+			m_trace_end(M_TRACE_IMU_PERIOD, n_reads);
+			continue;
+		}
+		n_reads++;
+
+		if (!raw && have_previous && 0 == memcmp(buffer, previous, cmp_size)) {
+			repeats++;
+			n_repeated++;
+		} else {
+			n_samples++;
+			if (raw) {
+				m_trace_begin(M_TRACE_IMU_STORE_RAW, 0);
+				m_bno055_store_raw_data(buffer, imu_data_size, n_reads);
+				m_trace_end(M_TRACE_IMU_STORE_RAW, 0);
+			} else {
+				m_trace_begin(M_TRACE_IMU_DECODE, 0);
+				m_bno055_convert_and_store_data(buffer, repeats);
+				m_trace_end(M_TRACE_IMU_DECODE, 0);
+			}
+			m_trace_begin(M_TRACE_IMU_PUBLISH, 0);
+			m_bno055_publish(buffer, imu_data_size, repeats);
+			m_trace_end(M_TRACE_IMU_PUBLISH, 0);
+			memcpy(previous, buffer, cmp_size);
+			have_previous = true;
+			repeats = 0;
+			m_rotate_check(imu_out_log, &imu_out_fd);
+			m_rotate_check(imu_raw_log, &imu_raw_fd);
 		}
 
-		m_bno055_convert_and_store_data(buffer);
+		if (raw) {
+			time_t now = time(NULL);
+			if (now - last_report >= 60) {
+				fprintf(imu_out_fd, "imu@%lu: raw samples = %lu, late = %lu\n", now, n_samples, n_late);
+				last_report = now;
+			}
+		}
+
+		m_trace_end(M_TRACE_IMU_PERIOD, n_reads - 1);
 
-		usleep(USECS_PER_MSEC * ms);
+		m_timespec_add_us(&deadline, period_us);
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (m_timespec_cmp(&now, &deadline) > 0) {
+			n_late++;
+			m_trace_instant(M_TRACE_IMU_LATE, (now.tv_sec - deadline.tv_sec) * 1000000 + (now.tv_nsec - deadline.tv_nsec) / NSECS_PER_USEC);
+			deadline = now;
+		} else {
+			m_trace_begin(M_TRACE_IMU_SLEEP, 0);
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+			m_trace_end(M_TRACE_IMU_SLEEP, 0);
+		}
 	}
 
-	fprintf(imu_out_fd, "imu read loop returning\n");
+	fprintf(imu_out_fd, "imu read loop returning, samples = %lu, repeated = %lu, late = %lu\n", n_samples, n_repeated, n_late);
 
 	return 0;
 }
@@ -532,64 +774,234 @@ int m_bno055_read_loop(int fd, int ms)
 
 
 
-int imu_prepare(char const * dirpath)
+/*
+  Recover from failed read of data from device @fd.
+
+  Most of failures are single glitches on the bus, so first the read
+  is retried a few times, with growing delays. If this doesn't help,
+  the device is re-opened and the chip goes through the same
+  initialization sequence as at startup (reset, restoring of
+  calibration, configuration). This is repeated until it succeeds or
+  until the thread is cancelled.
+
+  On success *@fd is a descriptor of working device, and the function
+  returns 0. Returns -1 if the thread has been cancelled before
+  recovery.
+*/
+int m_bno055_recover(int * fd)
 {
-	if (dirpath == NULL) {
-		imu_out_fd = stderr;
+	uint8_t buffer[BNO055_DATA_SIZE_FUSION];
+	const time_t gap_start = global_time;
+	struct timespec begin;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	int backoff_us = IMU_RETRY_BACKOFF_US;
+	for (int i = 1; i <= IMU_READ_RETRIES && !cancel_treads; i++) {
+		usleep(backoff_us);
+		backoff_us *= 2;
+		if (0 == m_bno055_read(*fd, BNO055_DATA_START, buffer, imu_data_size)) {
+			fprintf(imu_out_fd, "imu@%lu: gap since %lu, recovered after %d re-reads in %ld ms\n",
+				global_time, gap_start, i, m_timespec_elapsed_ms(&begin));
+			return 0;
+		}
+	}
+
+	imu_led_time_ms = BLINK_NOK;
+
+	int backoff_s = 1;
+	for (int attempt = 1; !cancel_treads; attempt++) {
+		fprintf(imu_out_fd, "imu@%lu: re-initializing chip, attempt %d\n", global_time, attempt);
+
+		if (*fd != -1) {
+			close(*fd);
+		}
+		*fd = m_bno055_open();
+		imu_sensor_fd = (*fd == -1) ? 0 : *fd;
+
+		if (*fd != -1 && 0 == m_bno055_init(*fd)) {
+			fprintf(imu_out_fd, "imu@%lu: gap since %lu, recovered after %d re-initializations in %ld ms\n",
+				global_time, gap_start, attempt, m_timespec_elapsed_ms(&begin));
+			imu_led_time_ms = BLINK_OK;
+			return 0;
+		}
+
+		sleep(backoff_s);
+		if (backoff_s < IMU_REINIT_BACKOFF_MAX_S) {
+			backoff_s *= 2;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+/*
+  Translate user's parameters of IMU into values of registers.
+*/
+int m_bno055_set_params(const struct m_imu_params * params)
+{
+	/* Table 3-8: Accelerometer configurations. */
+	static const int ranges[] = { 2, 4, 8, 16 };                        /* [g]. */
+	static const int bandwidths[] = { 8, 16, 31, 62, 125, 250, 500, 1000 }; /* [Hz], rounded. */
+
+	if (params->mode == NULL || 0 == strcmp(params->mode, "ndof")) {
+		imu_work_mode = BNO055_OPR_MODE_WORK_MODE;
+		imu_data_size = BNO055_DATA_SIZE_FUSION;
+		imu_period_us = imu_fusion_us;
+		return 0;
+	} else if (0 == strcmp(params->mode, "acc")) {
+		imu_work_mode = BNO055_OPR_MODE_ACCONLY;
+		imu_data_size = BNO055_DATA_SIZE_ACC;
+	} else if (0 == strcmp(params->mode, "amg")) {
+		imu_work_mode = BNO055_OPR_MODE_AMG;
+		imu_data_size = BNO055_DATA_SIZE_AMG;
 	} else {
-		char buffer[64] = { 0 };
-		snprintf(buffer, sizeof (buffer), "%s/%s", dirpath, data_filename);
-		imu_out_fd = fopen(buffer, "w");
-		//setvbuf(imu_out_fd, NULL, _IONBF, 0);
+		fprintf(imu_out_fd, "imu: unknown mode '%s'\n", params->mode);
+		return -1;
 	}
 
-	int fd = m_i2c_open_slave(3, BNO055_I2C_ADDR);
-	if (fd == -1) {
+	int r = 0;
+	while (r < (int) (sizeof (ranges) / sizeof (ranges[0])) && ranges[r] != params->acc_range) {
+		r++;
+	}
+	int b = 0;
+	while (b < (int) (sizeof (bandwidths) / sizeof (bandwidths[0])) && bandwidths[b] != params->acc_bandwidth) {
+		b++;
+	}
+	if (r == sizeof (ranges) / sizeof (ranges[0]) || b == sizeof (bandwidths) / sizeof (bandwidths[0])) {
+		fprintf(imu_out_fd, "imu: invalid acc range/bandwidth: %d/%d\n", params->acc_range, params->acc_bandwidth);
 		return -1;
 	}
 
+	/* 4.4.1 ACC_Config: xxx = normal power mode, bbb = bandwidth, rr = range. */
+	imu_acc_config = (uint8_t) ((b << 2) | r);
+
+	/* Output data rate of accelerometer is twice its bandwidth.
+	   Use bandwidth before rounding (7.81 * 2^b). */
+	imu_period_us = (int) (1000000.0 / (2 * 7.8125 * (1 << b)));
+
+	return 0;
+}
+
+
+
+
+/*
+  Open device through which the chip is accessible.
+*/
+int m_bno055_open(void)
+{
+	if (imu_uart_path) {
+		transport = &transport_uart;
+		return m_bno055_uart_open(imu_uart_path);
+	} else {
+		transport = &transport_i2c;
+		return m_i2c_open_slave(BNO055_I2C_DEV, BNO055_I2C_ADDR);
+	}
+}
+
 
+
+
+/*
+  Bring the chip from unknown state to state in which it performs
+  measurements. Used at startup and during recovery.
+*/
+int m_bno055_init(int fd)
+{
 	if (-1 == m_bno055_reset(fd)) {
-		close(fd);
 		return -1;
 	}
 
-
 	if (-1 == m_bno055_read_initial(fd)) {
-		close(fd);
 		return -1;
 	}
 
 #if M_BNO055_MANUAL_CALIBRATION
 	if (-1 == m_bno055_calibrate_manually(fd)) {
-		close(fd);
 		return -1;
 	}
 #else
 	if (-1 == m_bno055_calibrate_from_data(fd)) {
-		close(fd);
 		return -1;
 	}
 #endif
 
 	if (-1 == m_bno055_read_calibration(fd)) {
-		close(fd);
 		return -1;
 	}
 
 	if (-1 == m_bno055_configure(fd)) {
-		close(fd);
 		return -1;
 	}
 
-
 #if M_BNO055_RUN_BIST
 	if (-1 == m_bno055_run_bist(fd)) {
-		close(fd);
 		return -1;
 	}
 #endif
 
+	return 0;
+}
+
+
+
+
+/*
+  dirpath - directory for output files, NULL for stderr
+  params  - parameters of IMU
+*/
+int imu_prepare(char const * dirpath, const struct m_imu_params * params)
+{
+	if (dirpath == NULL) {
+		imu_out_fd = stderr;
+	} else {
+		imu_out_log = m_rotate_open(dirpath, data_filename, &imu_out_fd);
+		//setvbuf(imu_out_fd, NULL, _IONBF, 0);
+	}
+
+	if (-1 == m_bno055_set_params(params)) {
+		return -1;
+	}
+
+	if (BNO055_IS_RAW_MODE(imu_work_mode)) {
+		if (dirpath == NULL) {
+			fprintf(imu_out_fd, "imu: output dir is required in raw mode\n");
+			return -1;
+		}
+		imu_raw_log = m_rotate_open(dirpath, raw_data_filename, &imu_raw_fd);
+		if (!imu_raw_log) {
+			fprintf(imu_out_fd, "imu: failed to open %s/%s\n", dirpath, raw_data_filename);
+			return -1;
+		}
+
+		struct m_imu_raw_header header = { .magic = M_IMU_RAW_MAGIC };
+		header.opr_mode = imu_work_mode;
+		header.acc_config = imu_acc_config;
+		header.sample_size = imu_data_size;
+		header.period_us = imu_period_us;
+		fwrite(&header, sizeof (header), 1, imu_raw_fd);
+		m_rotate_set_header(imu_raw_log, &header, sizeof (header));
+	}
+	char line[64];
+	const int len = snprintf(line, sizeof (line), "imu: mode = 0x%02x, period = %d us\n", imu_work_mode, imu_period_us);
+	fputs(line, imu_out_fd);
+	/* Each chunk of rotated log says how it was recorded. */
+	m_rotate_set_header(imu_out_log, line, len);
+
+	imu_uart_path = params->uart_path;
+	int fd = m_bno055_open();
+	if (fd == -1) {
+		return -1;
+	}
+	fprintf(imu_out_fd, "imu: using %s transport\n", transport->name);
+
+	if (-1 == m_bno055_init(fd)) {
+		close(fd);
+		return -1;
+	}
 
 	imu_sensor_fd = fd;
 
@@ -599,8 +1011,59 @@ int imu_prepare(char const * dirpath)
 
 
 
+/*
+  Replay of a recorded session (replay.c): samples don't come from
+  the chip, but go through the same conversion, storing and
+  publishing as samples read by imu_thread_fn().
+
+  @buffer holds M_IMU_REPLAY_DATA_SIZE bytes of fusion data registers.
+*/
+int imu_replay_prepare(char const * dirpath)
+{
+	imu_out_log = m_rotate_open(dirpath, data_filename, &imu_out_fd);
+	if (!imu_out_log) {
+		return -1;
+	}
+	const char * header = "imu: replaying recorded session\n";
+	fputs(header, imu_out_fd);
+	m_rotate_set_header(imu_out_log, header, strlen(header));
+
+	return 0;
+}
+
+
+
+
+void imu_replay_sample(const uint8_t * buffer, unsigned int repeats)
+{
+	m_trace_begin(M_TRACE_IMU_DECODE, 0);
+	m_bno055_convert_and_store_data(buffer, repeats);
+	m_trace_end(M_TRACE_IMU_DECODE, 0);
+	m_trace_begin(M_TRACE_IMU_PUBLISH, 0);
+	m_bno055_publish(buffer, BNO055_DATA_SIZE_FUSION, repeats);
+	m_trace_end(M_TRACE_IMU_PUBLISH, 0);
+	m_rotate_check(imu_out_log, &imu_out_fd);
+
+	return;
+}
+
+
+
+
+void imu_replay_finish(void)
+{
+	m_rotate_close(imu_out_log, &imu_out_fd);
+	imu_out_log = NULL;
+
+	return;
+}
+
+
+
+
 void * imu_thread_fn(void * dummy)
 {
+	m_trace_thread_name("imu");
 	fprintf(imu_out_fd, "imu thread function begin\n");
 
 	if (-1 == m_bno055_get_overall_status(imu_sensor_fd)) {
@@ -612,13 +1075,16 @@ void * imu_thread_fn(void * dummy)
 
 	imu_led_time_ms = BLINK_OK;
 
-	m_bno055_read_loop(imu_sensor_fd, imu_ms);
+	m_bno055_read_loop(imu_sensor_fd, imu_period_us);
 
 	fprintf(imu_out_fd, "imu thread function end\n");
 
-	if (imu_out_fd && imu_out_fd != stderr) {
-		fclose(imu_out_fd);
-		imu_out_fd = NULL;
+	m_rotate_close(imu_raw_log, &imu_raw_fd);
+	imu_raw_log = NULL;
+
+	if (imu_out_log) {
+		m_rotate_close(imu_out_log, &imu_out_fd);
+		imu_out_log = NULL;
 	}
 
 	return NULL;
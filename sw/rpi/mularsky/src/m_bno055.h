@@ -4,10 +4,61 @@
 
 
 
-int imu_prepare(char const * dirpath);
+#include <stdint.h>
+
+
+
+
+struct m_imu_params {
+	char const * uart_path;  /* tty to which the chip is connected; NULL: chip is connected through I2C. */
+	char const * mode;       /* "ndof" (fusion, default), "acc" (ACCONLY) or "amg" (AMG). */
+	int acc_range;           /* [g]: 2, 4, 8 or 16. Used only in non-fusion modes. */
+	int acc_bandwidth;       /* [Hz]: 8, 16, 31, 62, 125, 250, 500 or 1000. Used only in non-fusion modes. */
+};
+
+
+
+
+/*
+  Binary log of raw samples (imu_raw.bin), written in non-fusion modes.
+
+  The file starts with a header, followed by records. Each record is
+  a struct m_imu_raw_record followed by @sample_size bytes of data
+  registers, starting at ACC_DATA_X_LSB (0x08), exactly as read from
+  the chip. All fields are in host byte order.
+*/
+#define M_IMU_RAW_MAGIC "MLRSKIMU"
+
+struct m_imu_raw_header {
+	char magic[8];         /* M_IMU_RAW_MAGIC, without terminating NUL. */
+	uint8_t opr_mode;      /* Value of OPR_MODE register. */
+	uint8_t acc_config;    /* Value of ACC_Config register. */
+	uint16_t sample_size;  /* Size of data block in each record. */
+	uint32_t period_us;    /* Nominal period of sampling. */
+};
+
+struct m_imu_raw_record {
+	uint64_t timestamp_ns; /* CLOCK_REALTIME at the time of reading the sample. */
+	uint64_t sequence;     /* Number of read of the sample, counted from start of reading. */
+};
+
+
+
+
+int imu_prepare(char const * dirpath, const struct m_imu_params * params);
 void * imu_thread_fn(void * dummy);
 
 
 
 
+/* Replay of recorded session, without chip (see replay.c). */
+#define M_IMU_REPLAY_DATA_SIZE 46  /* Fusion data registers, ACC_DATA to CALIB_STAT. */
+
+int imu_replay_prepare(char const * dirpath);
+void imu_replay_sample(const uint8_t * buffer, unsigned int repeats);
+void imu_replay_finish(void);
+
+
+
+
 #endif /* #ifndef H_M_BNO055 */
@@ -0,0 +1,243 @@
+#define _DEFAULT_SOURCE /* cfmakeraw(), usleep() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include "m_bno055_uart.h"
+#include "m_trace.h"
+
+
+
+
+/*
+  UART transport for BNO055.
+
+  Unless otherwise noted, references to chapters or tables refer to
+  BNO055 datasheet from Bosch (BST-BNO055-DS000-14), chapter 4.7
+  "UART Protocol".
+
+  The chip must be strapped for UART (PS1 = 1, PS0 = 0). Since the
+  transport only needs a file descriptor of a tty, it can also be
+  pointed at a pseudo-terminal with a chip emulator on the other end
+  (mularsky_bno055_emu, see bno055_emu.c).
+*/
+
+
+
+
+#define BNO055_UART_BAUDRATE    B115200
+#define BNO055_UART_TIMEOUT_MS  100  /* Max. time of waiting for response from chip. */
+#define BNO055_UART_RETRIES     5    /* Number of re-sends of a command that failed with recoverable error. */
+#define BNO055_UART_MAX_LEN     128  /* Table 4-9: max. length of data in single read/write. */
+
+#define BNO055_UART_START       0xAA
+#define BNO055_UART_CMD_WRITE   0x00
+#define BNO055_UART_CMD_READ    0x01
+#define BNO055_UART_RESP_READ   0xBB
+#define BNO055_UART_RESP_STATUS 0xEE
+
+/* Table 4-10: status codes in responses. */
+#define BNO055_UART_WRITE_SUCCESS         0x01
+#define BNO055_UART_WRONG_START_BYTE      0x07
+#define BNO055_UART_BUS_OVER_RUN_ERROR    0x08
+#define BNO055_UART_RECEIVE_CHAR_TIMEOUT  0x0B
+
+
+
+
+static int m_bno055_uart_read_exact(int fd, uint8_t * buffer, size_t size);
+static int m_bno055_uart_transfer(int fd, const uint8_t * command, size_t command_size, uint8_t * response, size_t response_size);
+
+
+
+
+/*
+  path - path to tty device, e.g. /dev/ttyUSB0 or /dev/pts/N
+*/
+int m_bno055_uart_open(const char * path)
+{
+	int fd = open(path, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		fprintf(stderr, "%s:%d: failed to open %s (%s)\n", __FILE__, __LINE__, path, strerror(errno));
+		return -1;
+	}
+
+	struct termios tio;
+	if (tcgetattr(fd, &tio) != 0) {
+		fprintf(stderr, "%s:%d: failed to get attributes of %s\n", __FILE__, __LINE__, path);
+		close(fd);
+		return -1;
+	}
+
+	/* 4.7 UART Protocol: 115200 bps, 8N1, no flow control. */
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, BNO055_UART_BAUDRATE);
+	cfsetospeed(&tio, BNO055_UART_BAUDRATE);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		fprintf(stderr, "%s:%d: failed to set attributes of %s\n", __FILE__, __LINE__, path);
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIOFLUSH);
+
+	return fd;
+}
+
+
+
+
+/*
+  Read exactly @size bytes, waiting no longer than
+  BNO055_UART_TIMEOUT_MS for each chunk of data.
+*/
+int m_bno055_uart_read_exact(int fd, uint8_t * buffer, size_t size)
+{
+	size_t n = 0;
+	while (n < size) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int rv = poll(&pfd, 1, BNO055_UART_TIMEOUT_MS);
+		if (rv == -1 && errno == EINTR) {
+			continue;
+		}
+		if (rv <= 0) {
+			return -1; /* Error or timeout. */
+		}
+
+		ssize_t r = read(fd, buffer + n, size - n);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		n += r;
+	}
+
+	return 0;
+}
+
+
+
+
+/*
+  Send @command, receive header of response and (for successful
+  reads) @response_size bytes of data into @response.
+
+  Returns 0 on success, -1 on failure.
+*/
+int m_bno055_uart_transfer(int fd, const uint8_t * command, size_t command_size, uint8_t * response, size_t response_size)
+{
+	for (int attempt = 0; attempt < BNO055_UART_RETRIES; attempt++) {
+
+		/* Drop whatever is left from previous, failed, transfer
+		   (or from chip's reset). */
+		tcflush(fd, TCIFLUSH);
+
+		if (write(fd, command, command_size) != command_size) {
+			fprintf(stderr, "%s:%d: uart write failed (%s)\n", __FILE__, __LINE__, strerror(errno));
+			return -1;
+		}
+
+		uint8_t header[2] = { 0 };
+		if (-1 == m_bno055_uart_read_exact(fd, header, sizeof (header))) {
+			fprintf(stderr, "%s:%d: uart response timeout\n", __FILE__, __LINE__);
+			continue;
+		}
+
+		if (header[0] == BNO055_UART_RESP_READ) {
+			if (command[1] != BNO055_UART_CMD_READ || header[1] != response_size) {
+				fprintf(stderr, "%s:%d: unexpected uart read response (len = %u)\n", __FILE__, __LINE__, header[1]);
+				continue;
+			}
+			if (-1 == m_bno055_uart_read_exact(fd, response, response_size)) {
+				fprintf(stderr, "%s:%d: uart data timeout\n", __FILE__, __LINE__);
+				continue;
+			}
+			return 0;
+
+		} else if (header[0] == BNO055_UART_RESP_STATUS) {
+			if (header[1] == BNO055_UART_WRITE_SUCCESS && command[1] == BNO055_UART_CMD_WRITE) {
+				return 0;
+			}
+			if (header[1] == BNO055_UART_BUS_OVER_RUN_ERROR
+			    || header[1] == BNO055_UART_RECEIVE_CHAR_TIMEOUT
+			    || header[1] == BNO055_UART_WRONG_START_BYTE) {
+				/* Chip was busy, or command was garbled
+				   on the line: re-send it. */
+				usleep(1000);
+				continue;
+			}
+			fprintf(stderr, "%s:%d: uart command failed with status 0x%02x\n", __FILE__, __LINE__, header[1]);
+			return -1;
+
+		} else {
+			fprintf(stderr, "%s:%d: unexpected uart response byte 0x%02x\n", __FILE__, __LINE__, header[0]);
+			continue;
+		}
+	}
+
+	fprintf(stderr, "%s:%d: uart command 0x%02x for reg 0x%02x failed after %d attempts\n",
+		__FILE__, __LINE__, command[1], command[2], BNO055_UART_RETRIES);
+	return -1;
+}
+
+
+
+
+/*
+  fd     - tty file descriptor
+  reg    - number of register to read
+  buffer - output for read data
+  size   - number of bytes to read
+*/
+int m_bno055_uart_read(int fd, uint8_t reg, uint8_t * buffer, size_t size)
+{
+	if (size == 0 || size > BNO055_UART_MAX_LEN) {
+		return -1;
+	}
+
+	/* Table 4-9: Start byte, Read, Reg addr, Length. */
+	const uint8_t command[4] = { BNO055_UART_START, BNO055_UART_CMD_READ, reg, (uint8_t) size };
+	m_trace_begin(M_TRACE_UART_READ, reg | size << 8);
+	int rv = m_bno055_uart_transfer(fd, command, sizeof (command), buffer, size);
+	m_trace_end(M_TRACE_UART_READ, reg | size << 8);
+	return rv;
+}
+
+
+
+
+/*
+  fd     - tty file descriptor
+  reg    - number of first register to write
+  data   - data to be written to @reg and following registers
+  size   - number of bytes to write
+*/
+int m_bno055_uart_write(int fd, uint8_t reg, const uint8_t * data, size_t size)
+{
+	if (size == 0 || size > BNO055_UART_MAX_LEN) {
+		return -1;
+	}
+
+	/* Table 4-9: Start byte, Write, Reg addr, Length, Data. */
+	uint8_t command[4 + BNO055_UART_MAX_LEN];
+	command[0] = BNO055_UART_START;
+	command[1] = BNO055_UART_CMD_WRITE;
+	command[2] = reg;
+	command[3] = (uint8_t) size;
+	memcpy(command + 4, data, size);
+
+	return m_bno055_uart_transfer(fd, command, 4 + size, NULL, 0);
+}
@@ -0,0 +1,20 @@
+#ifndef H_M_BNO055_UART
+#define H_M_BNO055_UART
+
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+
+int m_bno055_uart_open(const char * path);
+int m_bno055_uart_read(int fd, uint8_t reg, uint8_t * buffer, size_t size);
+int m_bno055_uart_write(int fd, uint8_t reg, const uint8_t * data, size_t size);
+
+
+
+
+#endif /* #ifndef H_M_BNO055_UART */
@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L /* shm_open(), ftruncate() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "m_bus.h"
+
+
+
+
+/* Samples of all streams must fit in a slot. */
+typedef char m_bus_check_imu[sizeof (struct m_bus_imu_sample) <= M_BUS_SAMPLE_SIZE ? 1 : -1];
+typedef char m_bus_check_pressure[sizeof (struct m_bus_pressure_sample) <= M_BUS_SAMPLE_SIZE ? 1 : -1];
+typedef char m_bus_check_status[sizeof (struct m_bus_status) <= M_BUS_SAMPLE_SIZE ? 1 : -1];
+
+
+/* Reader gives up after so many torn reads of a slot, which can
+   only happen if it's preempted for a whole round of the ring. */
+#define M_BUS_READ_TRIES 16
+
+
+
+
+/* Writer's mapping; NULL if the bus hasn't been created. */
+static struct m_bus * bus_writer;
+
+
+
+
+int m_bus_create(void)
+{
+	int fd = shm_open(M_BUS_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "%s:%d: failed to open shared memory %s: %s\n", __FILE__, __LINE__, M_BUS_NAME, strerror(errno));
+		return -1;
+	}
+	if (-1 == ftruncate(fd, sizeof (struct m_bus))) {
+		fprintf(stderr, "%s:%d: failed to resize shared memory: %s\n", __FILE__, __LINE__, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	struct m_bus * bus = mmap(NULL, sizeof (struct m_bus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bus == MAP_FAILED) {
+		fprintf(stderr, "%s:%d: failed to map shared memory: %s\n", __FILE__, __LINE__, strerror(errno));
+		return -1;
+	}
+
+	/* Segment may be left by previous run; readers attached to it
+	   see the magic disappear until it's initialized again. */
+	memset(bus->magic, 0, sizeof (bus->magic));
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memset((char *) bus + sizeof (bus->magic), 0, sizeof (struct m_bus) - sizeof (bus->magic));
+	bus->version = M_BUS_VERSION;
+	bus->size = sizeof (struct m_bus);
+	bus->pid = getpid();
+	for (int i = 0; i < M_BUS_STREAMS; i++) {
+		bus->rings[i].n_slots = M_BUS_SLOTS;
+	}
+	bus->rings[M_BUS_IMU].sample_size = sizeof (struct m_bus_imu_sample);
+	bus->rings[M_BUS_PRESSURE].sample_size = sizeof (struct m_bus_pressure_sample);
+	bus->rings[M_BUS_STATUS].sample_size = sizeof (struct m_bus_status);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(bus->magic, M_BUS_MAGIC, sizeof (bus->magic));
+
+	bus_writer = bus;
+
+	return 0;
+}
+
+
+
+
+void m_bus_destroy(void)
+{
+	if (!bus_writer) {
+		return;
+	}
+	munmap(bus_writer, sizeof (struct m_bus));
+	bus_writer = NULL;
+	shm_unlink(M_BUS_NAME);
+
+	return;
+}
+
+
+
+
+/*
+  Called only by the thread owning @stream.
+*/
+void m_bus_publish(enum m_bus_stream stream, const void * sample, uint32_t size)
+{
+	if (!bus_writer) {
+		return;
+	}
+
+	struct m_bus_ring * ring = &bus_writer->rings[stream];
+	const uint64_t number = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	struct m_bus_slot * slot = &ring->slots[number & (M_BUS_SLOTS - 1)];
+	const uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->number = number;
+	memcpy(slot->data, sample, size < M_BUS_SAMPLE_SIZE ? size : M_BUS_SAMPLE_SIZE);
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, number + 1, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+const struct m_bus * m_bus_attach(void)
+{
+	int fd = shm_open(M_BUS_NAME, O_RDONLY, 0);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat st;
+	if (-1 == fstat(fd, &st) || (size_t) st.st_size < sizeof (struct m_bus)) {
+		close(fd);
+		return NULL;
+	}
+	const struct m_bus * bus = mmap(NULL, sizeof (struct m_bus), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bus == MAP_FAILED) {
+		return NULL;
+	}
+
+	if (0 != memcmp(bus->magic, M_BUS_MAGIC, sizeof (bus->magic))
+	    || bus->version != M_BUS_VERSION || bus->size != sizeof (struct m_bus)) {
+		munmap((void *) bus, sizeof (struct m_bus));
+		return NULL;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return bus;
+}
+
+
+
+
+void m_bus_detach(const struct m_bus * bus)
+{
+	if (bus) {
+		munmap((void *) bus, sizeof (struct m_bus));
+	}
+
+	return;
+}
+
+
+
+
+uint64_t m_bus_head(const struct m_bus * bus, enum m_bus_stream stream)
+{
+	return __atomic_load_n(&bus->rings[stream].head, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+int m_bus_read(const struct m_bus * bus, enum m_bus_stream stream, uint64_t number, void * sample, uint32_t size)
+{
+	const struct m_bus_ring * ring = &bus->rings[stream];
+	const struct m_bus_slot * slot = &ring->slots[number & (M_BUS_SLOTS - 1)];
+	if (size > M_BUS_SAMPLE_SIZE) {
+		size = M_BUS_SAMPLE_SIZE;
+	}
+
+	for (int i = 0; i < M_BUS_READ_TRIES; i++) {
+		if (number >= __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+			return 1;
+		}
+
+		const uint32_t seq1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq1 & 1) {
+			continue; /* Being written right now. */
+		}
+		const uint64_t slot_number = slot->number;
+		memcpy(sample, slot->data, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		const uint32_t seq2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+		if (seq1 != seq2) {
+			continue;
+		}
+		return slot_number == number ? 0 : -1;
+	}
+
+	return -1;
+}
+
+
+
+
+int m_bus_read_latest(const struct m_bus * bus, enum m_bus_stream stream, void * sample, uint32_t size, uint64_t * number)
+{
+	for (int i = 0; i < M_BUS_READ_TRIES; i++) {
+		const uint64_t head = m_bus_head(bus, stream);
+		if (head == 0) {
+			return 1;
+		}
+		if (0 == m_bus_read(bus, stream, head - 1, sample, size)) {
+			if (number) {
+				*number = head - 1;
+			}
+			return 0;
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,153 @@
+#ifndef H_M_BUS
+#define H_M_BUS
+
+
+
+
+#include <stdint.h>
+
+
+
+
+/*
+  Live sample bus: latest samples and status of mularsky, published
+  in POSIX shared memory segment M_BUS_NAME for local readers
+  (display, health checker, button service).
+
+  Each stream (IMU, pressure, status) is a ring of M_BUS_SLOTS slots
+  with one writer: the thread producing the stream. Each slot is
+  protected by its own sequence counter (seqlock): the counter is odd
+  while the slot is being written. Readers copy a slot and check that
+  the counter was even and didn't change during the copy, so they
+  never block the writer, and they use no syscalls or locks. A reader
+  that is too slow loses samples overwritten in the meantime, and is
+  told about it.
+
+  Publishing costs the writer a copy of the sample and a few stores,
+  and nothing at all if the bus hasn't been created.
+*/
+
+
+
+
+#define M_BUS_NAME         "/mularsky"
+#define M_BUS_MAGIC        "MLRSKBUS"
+#define M_BUS_VERSION      1
+#define M_BUS_SLOTS        256    /* Power of 2; 2.5 s of IMU samples at 100 Hz. */
+#define M_BUS_SAMPLE_SIZE  64     /* Max. size of sample of any stream. */
+
+
+
+
+enum m_bus_stream {
+	M_BUS_IMU = 0,
+	M_BUS_PRESSURE,
+	M_BUS_STATUS,
+	M_BUS_STREAMS
+};
+
+
+
+
+/* Sample of IMU, in units of registers of BNO055 (see imu.txt). In
+   non-fusion modes only acc (and mag, gyr in AMG mode) are valid. */
+struct m_bus_imu_sample {
+	uint64_t timestamp_ns;   /* CLOCK_REALTIME. */
+	int16_t acc[3];
+	int16_t mag[3];
+	int16_t gyr[3];
+	int16_t eul[3];
+	int16_t qua[4];
+	int16_t lia[3];
+	int16_t grv[3];
+	int8_t temp;
+	uint8_t calib;
+	uint16_t repeats;        /* Skipped repeated reads before this sample. */
+};
+
+
+/* Sample of BME280. Compensated values are valid if @compensated. */
+struct m_bus_pressure_sample {
+	uint64_t timestamp_ns;   /* CLOCK_REALTIME. */
+	uint32_t raw_pressure;
+	uint32_t raw_temperature;
+	uint32_t raw_humidity;
+	uint32_t pressure;       /* Pa. */
+	int32_t temperature;     /* 0.01 degC. */
+	uint32_t humidity;       /* 1/1024 %rH. */
+	uint16_t repeats;
+	uint8_t compensated;
+	uint8_t reserved;
+};
+
+
+/* Status of collector, published periodically by main thread. */
+struct m_bus_status {
+	uint64_t timestamp_ns;   /* CLOCK_REALTIME. */
+	int64_t global_time;     /* Time of sensor threads. */
+	int32_t pid;
+	uint8_t imu_ok;
+	uint8_t pressure_ok;
+	uint8_t gps_ok;
+	uint8_t button;          /* State of button. */
+	char dir[40];            /* Output dir, "" for stderr. */
+};
+
+
+struct m_bus_slot {
+	uint32_t seq;            /* Odd while the slot is being written. */
+	uint32_t reserved;
+	uint64_t number;         /* Number of sample in stream, from 0. */
+	unsigned char data[M_BUS_SAMPLE_SIZE];
+};
+
+
+struct m_bus_ring {
+	uint64_t head;           /* Number of samples published so far. */
+	uint32_t sample_size;
+	uint32_t n_slots;
+	unsigned char pad[48];   /* Keep head on its own cache line. */
+	struct m_bus_slot slots[M_BUS_SLOTS];
+};
+
+
+struct m_bus {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;           /* sizeof (struct m_bus). */
+	int32_t pid;             /* Writer. */
+	unsigned char pad[44];
+	struct m_bus_ring rings[M_BUS_STREAMS];
+};
+
+
+
+
+/* Writer (mularsky). */
+int m_bus_create(void);
+void m_bus_destroy(void);
+void m_bus_publish(enum m_bus_stream stream, const void * sample, uint32_t size);
+
+
+/*
+  Reader. m_bus_attach() maps the segment read-only and returns NULL
+  if it doesn't exist or isn't compatible.
+
+  m_bus_read() copies sample number @number of @stream to @sample.
+  Returns 0 on success, 1 if the sample hasn't been published yet, -1
+  if it has been overwritten.
+
+  m_bus_read_latest() copies the latest sample, and puts its number
+  in @number (if not NULL). Returns 0 on success, 1 if nothing has
+  been published yet.
+*/
+const struct m_bus * m_bus_attach(void);
+void m_bus_detach(const struct m_bus * bus);
+uint64_t m_bus_head(const struct m_bus * bus, enum m_bus_stream stream);
+int m_bus_read(const struct m_bus * bus, enum m_bus_stream stream, uint64_t number, void * sample, uint32_t size);
+int m_bus_read_latest(const struct m_bus * bus, enum m_bus_stream stream, void * sample, uint32_t size, uint64_t * number);
+
+
+
+
+#endif /* #ifndef H_M_BUS */
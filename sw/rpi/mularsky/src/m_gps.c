@@ -0,0 +1,114 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "m_gps.h"
+#include "m_rotate.h"
+#include "m_trace.h"
+
+
+
+
+#define GPS_POLL_TIMEOUT_MS  500   /* Max. delay of noticing cancel_treads. */
+#define GPS_BUFFER_SIZE      1024  /* Longer than any NMEA sentence (82 chars). */
+
+
+
+
+extern bool cancel_treads;
+
+static int gps_fd = -1;
+static FILE * gps_out_fd;
+static struct m_rotate_log * gps_out_log;
+static const char * data_filename = "nmea.txt";
+
+
+
+
+/*
+  dirpath  - directory for output file, NULL for stderr
+  tty_path - tty of GPS receiver
+*/
+int gps_prepare(char const * dirpath, char const * tty_path)
+{
+	if (dirpath == NULL) {
+		gps_out_fd = stderr;
+	} else {
+		gps_out_log = m_rotate_open(dirpath, data_filename, &gps_out_fd);
+		if (!gps_out_log) {
+			return -1;
+		}
+	}
+
+	gps_fd = open(tty_path, O_RDONLY | O_NOCTTY);
+	if (gps_fd == -1) {
+		fprintf(stderr, "%s:%d: failed to open gps tty %s: %s\n", __FILE__, __LINE__, tty_path, strerror(errno));
+		m_rotate_close(gps_out_log, &gps_out_fd);
+		gps_out_log = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+void * gps_thread_fn(void * dummy)
+{
+	m_trace_thread_name("gps");
+
+	char buffer[GPS_BUFFER_SIZE];
+	size_t used = 0;
+	while (!cancel_treads) {
+		struct pollfd pfd = { .fd = gps_fd, .events = POLLIN };
+		int rv = poll(&pfd, 1, GPS_POLL_TIMEOUT_MS);
+		if (rv == -1 && errno == EINTR) {
+			continue;
+		}
+		if (rv == 0) {
+			continue;
+		}
+		ssize_t n = rv == -1 ? -1 : read(gps_fd, buffer + used, sizeof (buffer) - used);
+		if (n <= 0) {
+			fprintf(stderr, "%s:%d: gps: failed to read tty: %s\n", __FILE__, __LINE__, n == 0 ? "end of file" : strerror(errno));
+			break;
+		}
+		used += n;
+
+		/* Only complete lines go to the log, so that chunks of
+		   rotated log start with a complete sentence. */
+		size_t complete = used;
+		while (complete > 0 && buffer[complete - 1] != '\n') {
+			complete--;
+		}
+		if (complete == 0 && used == sizeof (buffer)) {
+			complete = used; /* Garbage on the line, keep it anyway. */
+		}
+		if (complete > 0) {
+			fwrite(buffer, 1, complete, gps_out_fd);
+			memmove(buffer, buffer + complete, used - complete);
+			used -= complete;
+			m_rotate_check(gps_out_log, &gps_out_fd);
+		}
+	}
+
+	if (used > 0) {
+		fwrite(buffer, 1, used, gps_out_fd);
+	}
+	close(gps_fd);
+	gps_fd = -1;
+
+	if (gps_out_log) {
+		m_rotate_close(gps_out_log, &gps_out_fd);
+		gps_out_log = NULL;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef H_M_GPS
+#define H_M_GPS
+
+
+
+
+/*
+  Logging of NMEA sentences from GPS receiver into nmea.txt.
+
+  The tty is expected to be configured already (see
+  sw/rpi/unit/start.sh). Data is stored as received, one complete
+  line at a time, so that the log can be rotated with other logs
+  (see m_rotate.h).
+*/
+
+
+
+
+int gps_prepare(char const * dirpath, char const * tty_path);
+void * gps_thread_fn(void * dummy);
+
+
+
+
+#endif /* #ifndef H_M_GPS */
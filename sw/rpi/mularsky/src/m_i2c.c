@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime() */
+
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -5,22 +7,242 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "m_i2c.h"
+#include "m_misc.h"
+#include "m_trace.h"
 
 
 /*
   I2C routines for mularsky project.
 
   See https://www.kernel.org/doc/Documentation/i2c/dev-interface for more information.
+
+  Every transaction is timed. Durations are accumulated in
+  log-linear histograms per bus, device, direction and register, and
+  the time during which transactions held each bus gives utilisation
+  of the bus. See m_i2c_report().
 */
 
 
 
 
 #define I2C_FILENAME_PATTERN "/dev/i2c-%d"
+#define I2C_WRITE_MAX 32 /* Max. number of data bytes in single write. */
+
+#define I2C_FDS_MAX       64    /* Transactions on fds above this aren't accounted. */
+#define I2C_DEVICES_MAX   8
+#define I2C_BUSES_MAX     4
+
+/* Log-linear histogram of durations [us]: values below
+   I2C_HIST_SUB have buckets of 1 us, every following power of 2 is
+   split into I2C_HIST_SUB buckets, so a bucket is at most 1/8 of its
+   value wide. Last bucket covers everything from 2^24 us (16 s) up. */
+#define I2C_HIST_SUB      8
+#define I2C_HIST_BITS     24
+#define I2C_HIST_BUCKETS  ((I2C_HIST_BITS - 2) * I2C_HIST_SUB)
+
+enum { I2C_READ = 0, I2C_WRITE, I2C_DIRECTIONS };
+
+
+
+
+/*
+  Each histogram has one writer: the thread using the device. The
+  reporter reads counters while they are updated, so all counters
+  are accessed with relaxed atomics (64-bit counters would tear on
+  32-bit ARM otherwise).
+*/
+struct m_i2c_histogram {
+	uint32_t buckets[I2C_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t sum_us;
+	uint32_t max_us;
+
+	uint64_t reported;       /* @count at last report, used by reporter only. */
+};
+
+
+struct m_i2c_bus {
+	int number;
+	uint64_t busy_ns;        /* Sum of durations of transactions. */
+	uint64_t transactions;
+	uint64_t bytes;
+
+	uint64_t reported_busy_ns;  /* @busy_ns at last report, used by reporter only. */
+};
+
+
+struct m_i2c_device {
+	int bus;
+	uint8_t address;
+	struct m_i2c_bus * bus_stats;
+	struct m_i2c_histogram * registers[I2C_DIRECTIONS][256];  /* Allocated on first transaction. */
+};
+
+
+
+
+static pthread_mutex_t i2c_lock = PTHREAD_MUTEX_INITIALIZER;  /* For registration of devices and buses. */
+static struct m_i2c_device i2c_devices[I2C_DEVICES_MAX];
+static int i2c_n_devices;
+static struct m_i2c_bus i2c_buses[I2C_BUSES_MAX];
+static int i2c_n_buses;
+static struct m_i2c_device * i2c_fd_devices[I2C_FDS_MAX];
+
+static struct timespec i2c_start;         /* First opening of a device. */
+static struct timespec i2c_last_report;
+
+
+
+
+/*
+  Register device @address on @bus as accessed through @fd.
+*/
+static void m_i2c_register(int fd, int bus, uint8_t address)
+{
+	if (fd >= I2C_FDS_MAX) {
+		fprintf(stderr, "%s:%d: fd %d of i2c device won't be accounted\n", __FILE__, __LINE__, fd);
+		return;
+	}
+
+	pthread_mutex_lock(&i2c_lock);
+
+	if (i2c_n_devices == 0 && i2c_n_buses == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &i2c_start);
+		i2c_last_report = i2c_start;
+	}
+
+	int b = 0;
+	while (b < i2c_n_buses && i2c_buses[b].number != bus) {
+		b++;
+	}
+	if (b == I2C_BUSES_MAX) {
+		pthread_mutex_unlock(&i2c_lock);
+		fprintf(stderr, "%s:%d: too many i2c buses, bus %d won't be accounted\n", __FILE__, __LINE__, bus);
+		return;
+	}
+	if (b == i2c_n_buses) {
+		i2c_buses[b].number = bus;
+		i2c_n_buses++;
+	}
+
+	/* Re-opened device (recovery) keeps its statistics. */
+	struct m_i2c_device * device = NULL;
+	for (int i = 0; i < i2c_n_devices; i++) {
+		if (i2c_devices[i].bus == bus && i2c_devices[i].address == address) {
+			device = &i2c_devices[i];
+		}
+	}
+	if (!device && i2c_n_devices < I2C_DEVICES_MAX) {
+		device = &i2c_devices[i2c_n_devices];
+		device->bus = bus;
+		device->address = address;
+		device->bus_stats = &i2c_buses[b];
+		i2c_n_devices++;
+	}
+	__atomic_store_n(&i2c_fd_devices[fd], device, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&i2c_lock);
+
+	return;
+}
+
+
+
+
+static int m_i2c_hist_bucket(uint64_t us)
+{
+	if (us < I2C_HIST_SUB) {
+		return (int) us;
+	}
+	int e = 63 - __builtin_clzll(us);  /* Position of highest bit, >= 3. */
+	if (e >= I2C_HIST_BITS) {
+		return I2C_HIST_BUCKETS - 1;
+	}
+	return (e - 2) * I2C_HIST_SUB + (int) ((us >> (e - 3)) & (I2C_HIST_SUB - 1));
+}
+
+
+
+
+/* Smallest value [us] falling into @bucket. */
+static uint64_t m_i2c_hist_lower(int bucket)
+{
+	if (bucket < I2C_HIST_SUB) {
+		return bucket;
+	}
+	const int e = bucket / I2C_HIST_SUB + 2;
+	return (uint64_t) (I2C_HIST_SUB + bucket % I2C_HIST_SUB) << (e - 3);
+}
+
+
+
+
+/*
+  Account transaction on @fd that began at @begin.
+*/
+static void m_i2c_account(int fd, int direction, uint8_t reg, size_t size, const struct timespec * begin, bool ok)
+{
+	if (fd < 0 || fd >= I2C_FDS_MAX) {
+		return;
+	}
+	struct m_i2c_device * device = __atomic_load_n(&i2c_fd_devices[fd], __ATOMIC_ACQUIRE);
+	if (!device) {
+		return;
+	}
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const uint64_t ns = (uint64_t) ((end.tv_sec - begin->tv_sec) * NSECS_PER_SEC + (end.tv_nsec - begin->tv_nsec));
+	const uint64_t us = ns / NSECS_PER_USEC;
+
+	/* Failed transactions also held the bus. Devices on one
+	   bus may be used by different threads. */
+	struct m_i2c_bus * bus = device->bus_stats;
+	__atomic_fetch_add(&bus->busy_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&bus->transactions, 1, __ATOMIC_RELAXED);
+	if (ok) {
+		__atomic_fetch_add(&bus->bytes, size, __ATOMIC_RELAXED);
+	}
+
+	struct m_i2c_histogram * h = __atomic_load_n(&device->registers[direction][reg], __ATOMIC_ACQUIRE);
+	if (!h) {
+		h = calloc(1, sizeof (struct m_i2c_histogram));
+		if (!h) {
+			return;
+		}
+		struct m_i2c_histogram * expected = NULL;
+		if (!__atomic_compare_exchange_n(&device->registers[direction][reg], &expected, h, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(h);
+			h = expected;
+		}
+	}
+
+	if (!ok) {
+		__atomic_fetch_add(&h->errors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	__atomic_fetch_add(&h->buckets[m_i2c_hist_bucket(us)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->bytes, size, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+	if (us > __atomic_load_n(&h->max_us, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&h->max_us, (uint32_t) (us > UINT32_MAX ? UINT32_MAX : us), __ATOMIC_RELAXED);
+	}
+	/* Count last: reporter never sees more counted than bucketed. */
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELEASE);
+
+	return;
+}
+
 
 
 
@@ -41,6 +263,7 @@ int m_i2c_open_slave(int dev, uint8_t address)
 		close(fd);
 		return -1;
 	}
+	m_i2c_register(fd, dev, address);
 
 	return fd;
 }
@@ -57,16 +280,185 @@ int m_i2c_open_slave(int dev, uint8_t address)
 int m_i2c_read(int fd, uint8_t reg, uint8_t * buffer, size_t size)
 {
 	int e = 0;
+	struct timespec begin;
+	m_trace_begin(M_TRACE_I2C_READ, reg | size << 8);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 	errno = 0;
 	buffer[0] = reg;
 	if (write(fd, buffer, 1) != 1) {
 		e = errno;
+		m_i2c_account(fd, I2C_READ, reg, size, &begin, false);
+		m_trace_end(M_TRACE_I2C_READ, reg | size << 8);
 		fprintf(stderr, "%s:%d: write@read failed (%d, %s)\n", __FILE__, __LINE__, fd, strerror(e));
 		return -1;
 	}
 	if (read(fd, buffer, size) != size) {
+		m_i2c_account(fd, I2C_READ, reg, size, &begin, false);
+		m_trace_end(M_TRACE_I2C_READ, reg | size << 8);
 		fprintf(stderr, "%s:%d: read failed\n", __FILE__, __LINE__);
 		return -1;
 	}
+	m_i2c_account(fd, I2C_READ, reg, size, &begin, true);
+	m_trace_end(M_TRACE_I2C_READ, reg | size << 8);
+	return 0;
+}
+
+
+
+
+/*
+  fd     - device file descriptor
+  reg    - number of first register to write
+  data   - data to be written to @reg and following registers
+  size   - number of bytes to write
+*/
+int m_i2c_write(int fd, uint8_t reg, const uint8_t * data, size_t size)
+{
+	uint8_t buffer[1 + I2C_WRITE_MAX];
+	if (size > I2C_WRITE_MAX) {
+		fprintf(stderr, "%s:%d: write too large (%zu)\n", __FILE__, __LINE__, size);
+		return -1;
+	}
+
+	buffer[0] = reg;
+	memcpy(buffer + 1, data, size);
+
+	struct timespec begin;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	errno = 0;
+	if (write(fd, buffer, 1 + size) != 1 + size) {
+		m_i2c_account(fd, I2C_WRITE, reg, size, &begin, false);
+		fprintf(stderr, "%s:%d: write failed (%d, %s)\n", __FILE__, __LINE__, fd, strerror(errno));
+		return -1;
+	}
+	m_i2c_account(fd, I2C_WRITE, reg, size, &begin, true);
 	return 0;
 }
+
+
+
+
+/* Upper bound [us] of bucket holding given fraction of transactions. */
+static uint64_t m_i2c_hist_percentile(const uint32_t * buckets, uint64_t count, double fraction)
+{
+	const uint64_t rank = (uint64_t) (fraction * count + 0.5);
+	uint64_t cumulative = 0;
+	for (int i = 0; i < I2C_HIST_BUCKETS - 1; i++) {
+		cumulative += buckets[i];
+		if (cumulative >= rank && cumulative > 0) {
+			return m_i2c_hist_lower(i + 1);
+		}
+	}
+	return m_i2c_hist_lower(I2C_HIST_BUCKETS - 1);
+}
+
+
+
+
+/*
+  Write statistics of I2C transactions to @out.
+
+  For each bus: number of transactions, bytes transferred and
+  utilisation (share of wall time during which mularsky's
+  transactions held the bus), since last report and since start.
+  Durations are measured around syscalls, so they include some
+  kernel overhead, and utilisation is a slight overestimate of the
+  bus's real occupancy.
+
+  For each device and register: count, bytes, errors, mean,
+  percentiles (upper bounds of histogram buckets) and max of
+  durations since start. Periodic reports list only registers
+  accessed since last report; @final report lists all of them, with
+  non-empty buckets of histograms ("<lower bound [us]>:<count>").
+
+  Called from one thread only.
+*/
+void m_i2c_report(FILE * out, bool final)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&i2c_lock);
+	const int n_buses = i2c_n_buses;
+	const int n_devices = i2c_n_devices;
+	pthread_mutex_unlock(&i2c_lock);
+	if (n_buses == 0) {
+		return;
+	}
+
+	const double total_s = (now.tv_sec - i2c_start.tv_sec) + (now.tv_nsec - i2c_start.tv_nsec) / 1e9;
+	const double interval_s = (now.tv_sec - i2c_last_report.tv_sec) + (now.tv_nsec - i2c_last_report.tv_nsec) / 1e9;
+	i2c_last_report = now;
+
+	fprintf(out, "i2c: %s after %.0f s\n", final ? "final report" : "report", total_s);
+
+	for (int b = 0; b < n_buses; b++) {
+		struct m_i2c_bus * bus = &i2c_buses[b];
+		const uint64_t busy_ns = __atomic_load_n(&bus->busy_ns, __ATOMIC_RELAXED);
+		const uint64_t interval_ns = busy_ns - bus->reported_busy_ns;
+		bus->reported_busy_ns = busy_ns;
+		fprintf(out, "i2c: bus %d: %llu transactions, %llu bytes, utilisation %.2f %% (last %.0f s), %.2f %% (total)\n",
+			bus->number,
+			(unsigned long long) __atomic_load_n(&bus->transactions, __ATOMIC_RELAXED),
+			(unsigned long long) __atomic_load_n(&bus->bytes, __ATOMIC_RELAXED),
+			interval_s > 0 ? 100.0 * interval_ns / 1e9 / interval_s : 0.0,
+			interval_s,
+			total_s > 0 ? 100.0 * busy_ns / 1e9 / total_s : 0.0);
+	}
+
+	static const char * const directions[I2C_DIRECTIONS] = { "read", "write" };
+	for (int d = 0; d < n_devices; d++) {
+		const struct m_i2c_device * device = &i2c_devices[d];
+		for (int dir = 0; dir < I2C_DIRECTIONS; dir++) {
+			for (int reg = 0; reg < 256; reg++) {
+				struct m_i2c_histogram * h = __atomic_load_n(&device->registers[dir][reg], __ATOMIC_ACQUIRE);
+				if (!h) {
+					continue;
+				}
+
+				/* Snapshot; writer may go on meanwhile. */
+				const uint64_t count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+				uint32_t buckets[I2C_HIST_BUCKETS];
+				for (int i = 0; i < I2C_HIST_BUCKETS; i++) {
+					buckets[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+				}
+				const uint64_t errors = __atomic_load_n(&h->errors, __ATOMIC_RELAXED);
+				const uint64_t sum_us = __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED);
+				const uint64_t bytes = __atomic_load_n(&h->bytes, __ATOMIC_RELAXED);
+				const uint32_t max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+
+				const uint64_t new = count - h->reported;
+				h->reported = count;
+				if (!final && new == 0) {
+					continue;
+				}
+
+				fprintf(out, "i2c: bus %d dev 0x%02x %s 0x%02x: %llu (+%llu), %llu bytes, %llu errors",
+					device->bus, device->address, directions[dir], reg,
+					(unsigned long long) count, (unsigned long long) new,
+					(unsigned long long) bytes, (unsigned long long) errors);
+				if (count) {
+					fprintf(out, ", mean %.0f us, p50 %llu us, p90 %llu us, p99 %llu us, max %u us",
+						(double) sum_us / count,
+						(unsigned long long) m_i2c_hist_percentile(buckets, count, 0.50),
+						(unsigned long long) m_i2c_hist_percentile(buckets, count, 0.90),
+						(unsigned long long) m_i2c_hist_percentile(buckets, count, 0.99),
+						max_us);
+				}
+				fprintf(out, "\n");
+
+				if (final && count) {
+					fprintf(out, "i2c: bus %d dev 0x%02x %s 0x%02x: histogram:", device->bus, device->address, directions[dir], reg);
+					for (int i = 0; i < I2C_HIST_BUCKETS; i++) {
+						if (buckets[i]) {
+							fprintf(out, " %llu:%u", (unsigned long long) m_i2c_hist_lower(i), buckets[i]);
+						}
+					}
+					fprintf(out, "\n");
+				}
+			}
+		}
+	}
+
+	return;
+}
@@ -5,12 +5,22 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+
+
+
+#define M_I2C_REPORT_PERIOD_S 60   /* Period of reports of statistics of transactions. */
 
 
 
 
 int m_i2c_open_slave(int dev, uint8_t address);
 int m_i2c_read(int fd, uint8_t reg, uint8_t * buffer, size_t size);
+int m_i2c_write(int fd, uint8_t reg, const uint8_t * data, size_t size);
+
+void m_i2c_report(FILE * out, bool final);
 
 
 
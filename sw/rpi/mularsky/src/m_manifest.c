@@ -0,0 +1,318 @@
+#define _GNU_SOURCE /* fopencookie() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "m_manifest.h"
+#include "m_md5.h"
+#include "m_trace.h"
+
+
+
+
+#define M_MANIFEST_FILES_GROWTH 16  /* Rotated logs add files during whole run. */
+
+
+
+
+struct m_manifest_file {
+	char name[32];
+	int fd;
+	bool closed;
+
+	uint64_t size;
+	struct m_md5 file_md5;
+	struct m_md5 segment_md5;  /* Hash of current, incomplete segment. */
+
+	uint8_t digest[M_MD5_DIGEST_SIZE];  /* Hash of whole file, valid when closed. */
+	uint8_t (* segments)[M_MD5_DIGEST_SIZE];
+	size_t n_segments;
+};
+
+
+
+
+/* Writes of imu and pressure threads, and m_manifest_write() called
+   at exit, all go through this lock. Writes come from stdio buffers,
+   so it's taken once per few kB of data. Files are allocated one by
+   one: cookies of open streams point to them. */
+static pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct m_manifest_file ** manifest_files;
+static int manifest_n_files;
+static int manifest_capacity;
+
+/* Rotation rewrites manifest from several threads; temporary files
+   of m_manifest_write() must not be shared. */
+static pthread_mutex_t manifest_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+static void m_manifest_finish_segment(struct m_manifest_file * file)
+{
+	uint8_t (* segments)[M_MD5_DIGEST_SIZE] = realloc(file->segments, (file->n_segments + 1) * sizeof (file->segments[0]));
+	if (!segments) {
+		fprintf(stderr, "%s:%d: failed to allocate segment hash of %s\n", __FILE__, __LINE__, file->name);
+		return;
+	}
+	file->segments = segments;
+	m_md5_final(&file->segment_md5, file->segments[file->n_segments]);
+	file->n_segments++;
+	m_md5_init(&file->segment_md5);
+
+	return;
+}
+
+
+
+
+static ssize_t m_manifest_cookie_write(void * cookie, const char * buffer, size_t size)
+{
+	struct m_manifest_file * file = (struct m_manifest_file *) cookie;
+	m_trace_begin(M_TRACE_FILE_WRITE, size);
+
+	size_t written = 0;
+	while (written < size) {
+		ssize_t n = write(file->fd, buffer + written, size - written);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		written += n;
+	}
+
+	/* Hash only what has really been written. */
+	pthread_mutex_lock(&manifest_lock);
+	m_md5_update(&file->file_md5, buffer, written);
+	size_t done = 0;
+	while (done < written) {
+		size_t n = M_MANIFEST_SEGMENT_SIZE - file->size % M_MANIFEST_SEGMENT_SIZE;
+		if (n > written - done) {
+			n = written - done;
+		}
+		m_md5_update(&file->segment_md5, buffer + done, n);
+		file->size += n;
+		done += n;
+		if (file->size % M_MANIFEST_SEGMENT_SIZE == 0) {
+			m_manifest_finish_segment(file);
+		}
+	}
+	pthread_mutex_unlock(&manifest_lock);
+	m_trace_end(M_TRACE_FILE_WRITE, written);
+
+	return written ? (ssize_t) written : -1;
+}
+
+
+
+
+static int m_manifest_cookie_close(void * cookie)
+{
+	struct m_manifest_file * file = (struct m_manifest_file *) cookie;
+
+	/* Closed file is complete and durable: it may be taken
+	   away while the session goes on (see m_rotate.h). */
+	fsync(file->fd);
+	int rv = close(file->fd);
+
+	pthread_mutex_lock(&manifest_lock);
+	m_md5_final(&file->file_md5, file->digest);
+	if (file->size % M_MANIFEST_SEGMENT_SIZE) {
+		m_manifest_finish_segment(file);
+	}
+	file->closed = true;
+	pthread_mutex_unlock(&manifest_lock);
+
+	return rv;
+}
+
+
+
+
+/*
+  Open file for writing, and register it in manifest.
+
+  dirpath  - output directory
+  filename - name of file in output directory
+*/
+FILE * m_manifest_fopen(char const * dirpath, char const * filename)
+{
+	char buffer[64] = { 0 };
+	snprintf(buffer, sizeof (buffer), "%s/%s", dirpath, filename);
+
+	pthread_mutex_lock(&manifest_lock);
+	if (manifest_n_files == manifest_capacity) {
+		struct m_manifest_file ** files = realloc(manifest_files, (manifest_capacity + M_MANIFEST_FILES_GROWTH) * sizeof (files[0]));
+		if (files) {
+			manifest_files = files;
+			manifest_capacity += M_MANIFEST_FILES_GROWTH;
+		}
+	}
+	struct m_manifest_file * file = NULL;
+	if (manifest_n_files < manifest_capacity) {
+		file = calloc(1, sizeof (struct m_manifest_file));
+	}
+	if (!file) {
+		pthread_mutex_unlock(&manifest_lock);
+		fprintf(stderr, "%s:%d: failed to allocate manifest entry, %s will not be hashed\n", __FILE__, __LINE__, buffer);
+		return fopen(buffer, "w");
+	}
+
+	FILE * stream = NULL;
+	snprintf(file->name, sizeof (file->name), "%s", filename);
+	m_md5_init(&file->file_md5);
+	m_md5_init(&file->segment_md5);
+
+	file->fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (file->fd != -1) {
+		cookie_io_functions_t functions = { .read = NULL, .write = m_manifest_cookie_write, .seek = NULL, .close = m_manifest_cookie_close };
+		stream = fopencookie(file, "w", functions);
+		if (stream) {
+			manifest_files[manifest_n_files++] = file;
+		} else {
+			close(file->fd);
+		}
+	}
+	pthread_mutex_unlock(&manifest_lock);
+	if (!stream) {
+		free(file);
+	}
+
+	return stream;
+}
+
+
+
+
+/*
+  Write manifest of files opened with m_manifest_fopen(). Files
+  that are still open are included with data written so far (data
+  still in stdio buffers is not included).
+*/
+int m_manifest_write(char const * dirpath)
+{
+	char path[64] = { 0 };
+	char tmp_path[64] = { 0 };
+	char segments_path[64] = { 0 };
+	char segments_tmp_path[64] = { 0 };
+	snprintf(path, sizeof (path), "%s/%s", dirpath, M_MANIFEST_FILENAME);
+	snprintf(tmp_path, sizeof (tmp_path), "%s/%s.tmp", dirpath, M_MANIFEST_FILENAME);
+	snprintf(segments_path, sizeof (segments_path), "%s/%s", dirpath, M_MANIFEST_SEGMENTS_FILENAME);
+	snprintf(segments_tmp_path, sizeof (segments_tmp_path), "%s/%s.tmp", dirpath, M_MANIFEST_SEGMENTS_FILENAME);
+
+	pthread_mutex_lock(&manifest_write_lock);
+	FILE * out = fopen(tmp_path, "w");
+	FILE * segments_out = fopen(segments_tmp_path, "w");
+	if (!out || !segments_out) {
+		fprintf(stderr, "%s:%d: failed to open manifest in %s\n", __FILE__, __LINE__, dirpath);
+		if (out) {
+			fclose(out);
+		}
+		if (segments_out) {
+			fclose(segments_out);
+		}
+		pthread_mutex_unlock(&manifest_write_lock);
+		return -1;
+	}
+
+	pthread_mutex_lock(&manifest_lock);
+	for (int i = 0; i < manifest_n_files; i++) {
+		struct m_manifest_file * file = manifest_files[i];
+
+		uint8_t digest[M_MD5_DIGEST_SIZE];
+		uint8_t last_segment[M_MD5_DIGEST_SIZE] = { 0 };
+		size_t n_segments = file->n_segments;
+		if (file->closed) {
+			memcpy(digest, file->digest, sizeof (digest));
+		} else {
+			struct m_md5 md5 = file->file_md5;
+			m_md5_final(&md5, digest);
+			md5 = file->segment_md5;
+			m_md5_final(&md5, last_segment);
+		}
+
+		char hex[M_MD5_HEX_SIZE];
+		m_md5_to_hex(digest, hex);
+		fprintf(out, "%s  %s\n", hex, file->name);
+
+		for (size_t s = 0; s < n_segments; s++) {
+			const uint64_t offset = (uint64_t) s * M_MANIFEST_SEGMENT_SIZE;
+			const uint64_t length = file->size - offset < M_MANIFEST_SEGMENT_SIZE ? file->size - offset : M_MANIFEST_SEGMENT_SIZE;
+			m_md5_to_hex(file->segments[s], hex);
+			fprintf(segments_out, "%s  %llu %llu %s\n", hex, (unsigned long long) offset, (unsigned long long) length, file->name);
+		}
+		if (!file->closed && file->size % M_MANIFEST_SEGMENT_SIZE) {
+			const uint64_t offset = (uint64_t) n_segments * M_MANIFEST_SEGMENT_SIZE;
+			m_md5_to_hex(last_segment, hex);
+			fprintf(segments_out, "%s  %llu %llu %s\n", hex, (unsigned long long) offset, (unsigned long long) (file->size - offset), file->name);
+		}
+	}
+	pthread_mutex_unlock(&manifest_lock);
+
+	/* Manifest is replaced atomically, so a crash never leaves a
+	   truncated one. */
+	int rv = 0;
+	FILE * files[2] = { out, segments_out };
+	for (int i = 0; i < 2; i++) {
+		if (0 != fflush(files[i]) || 0 != fsync(fileno(files[i]))) {
+			rv = -1;
+		}
+		fclose(files[i]);
+	}
+	if (rv == 0 && (0 != rename(tmp_path, path) || 0 != rename(segments_tmp_path, segments_path))) {
+		rv = -1;
+	}
+	pthread_mutex_unlock(&manifest_write_lock);
+	if (rv == -1) {
+		fprintf(stderr, "%s:%d: failed to write manifest in %s: %s\n", __FILE__, __LINE__, dirpath, strerror(errno));
+	}
+
+	return rv;
+}
+
+
+
+
+/*
+  Number of bytes of @filename written to disk so far (data still in
+  stdio buffer of its stream is not included) and, if the file has
+  been closed and @hex is not NULL, its MD5 as hex string.
+
+  Returns 0 if the file is in manifest, -1 otherwise.
+*/
+int m_manifest_file_info(char const * filename, uint64_t * size, char * hex)
+{
+	int rv = -1;
+
+	pthread_mutex_lock(&manifest_lock);
+	for (int i = manifest_n_files - 1; i >= 0; i--) {
+		const struct m_manifest_file * file = manifest_files[i];
+		if (0 != strcmp(file->name, filename)) {
+			continue;
+		}
+		*size = file->size;
+		if (hex) {
+			if (file->closed) {
+				m_md5_to_hex(file->digest, hex);
+			} else {
+				hex[0] = '\0';
+			}
+		}
+		rv = 0;
+		break;
+	}
+	pthread_mutex_unlock(&manifest_lock);
+
+	return rv;
+}
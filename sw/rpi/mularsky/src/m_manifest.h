@@ -0,0 +1,43 @@
+#ifndef H_M_MANIFEST
+#define H_M_MANIFEST
+
+
+
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+
+
+/*
+  Integrity manifest of output files.
+
+  Files opened with m_manifest_fopen() are hashed while they are
+  written: MD5 of whole file, and MD5 of each consecutive segment of
+  M_MANIFEST_SEGMENT_SIZE bytes. m_manifest_write() stores the hashes
+  in output dir, in M_MANIFEST_FILENAME (format of md5sum, same as
+  measurements/raw_data_checksums.txt) and in
+  M_MANIFEST_SEGMENTS_FILENAME ("<md5>  <offset> <length> <file>"
+  lines), so that the session can be verified on PC (m_verifier)
+  without hashing it on the device after the fact.
+*/
+
+
+
+
+#define M_MANIFEST_FILENAME           "checksums.txt"
+#define M_MANIFEST_SEGMENTS_FILENAME  "checksums_segments.txt"
+#define M_MANIFEST_SEGMENT_SIZE       (4 * 1024 * 1024)
+
+
+
+
+FILE * m_manifest_fopen(char const * dirpath, char const * filename);
+int m_manifest_write(char const * dirpath);
+int m_manifest_file_info(char const * filename, uint64_t * size, char * hex);
+
+
+
+
+#endif /* #ifndef H_M_MANIFEST */
@@ -0,0 +1,196 @@
+#include <string.h>
+
+#include "m_md5.h"
+
+
+/* Per-round shift amounts. */
+static const uint8_t m_md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+
+/* floor(abs(sin(i + 1)) * 2^32). */
+static const uint32_t m_md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+
+
+
+static void m_md5_block(uint32_t state[4], const uint8_t * block)
+{
+	uint32_t w[16];
+	for (int i = 0; i < 16; i++) {
+		w[i] = (uint32_t) block[4 * i]
+			| ((uint32_t) block[4 * i + 1] << 8)
+			| ((uint32_t) block[4 * i + 2] << 16)
+			| ((uint32_t) block[4 * i + 3] << 24);
+	}
+
+	uint32_t a = state[0];
+	uint32_t b = state[1];
+	uint32_t c = state[2];
+	uint32_t d = state[3];
+
+	for (int i = 0; i < 64; i++) {
+		uint32_t f;
+		int g;
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+
+		const uint32_t t = d;
+		d = c;
+		c = b;
+		const uint32_t x = a + f + m_md5_k[i] + w[g];
+		b = b + ((x << m_md5_r[i]) | (x >> (32 - m_md5_r[i])));
+		a = t;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+
+	return;
+}
+
+
+
+
+void m_md5_init(struct m_md5 * md5)
+{
+	md5->state[0] = 0x67452301;
+	md5->state[1] = 0xefcdab89;
+	md5->state[2] = 0x98badcfe;
+	md5->state[3] = 0x10325476;
+	md5->length = 0;
+
+	return;
+}
+
+
+
+
+void m_md5_update(struct m_md5 * md5, const void * data, size_t size)
+{
+	const uint8_t * p = data;
+	size_t used = md5->length % 64;
+	md5->length += size;
+
+	if (used) {
+		size_t n = 64 - used;
+		if (n > size) {
+			n = size;
+		}
+		memcpy(md5->buffer + used, p, n);
+		p += n;
+		size -= n;
+		if (used + n < 64) {
+			return;
+		}
+		m_md5_block(md5->state, md5->buffer);
+	}
+
+	for (; size >= 64; size -= 64, p += 64) {
+		m_md5_block(md5->state, p);
+	}
+	memcpy(md5->buffer, p, size);
+
+	return;
+}
+
+
+
+
+void m_md5_final(struct m_md5 * md5, uint8_t digest[M_MD5_DIGEST_SIZE])
+{
+	const uint64_t bits = md5->length * 8;
+
+	static const uint8_t padding[64] = { 0x80 };
+	const size_t used = md5->length % 64;
+	m_md5_update(md5, padding, used < 56 ? 56 - used : 120 - used);
+
+	uint8_t length[8];
+	for (int i = 0; i < 8; i++) {
+		length[i] = (uint8_t) (bits >> (8 * i));
+	}
+	m_md5_update(md5, length, sizeof (length));
+
+	for (int i = 0; i < 4; i++) {
+		digest[4 * i]     = (uint8_t) md5->state[i];
+		digest[4 * i + 1] = (uint8_t) (md5->state[i] >> 8);
+		digest[4 * i + 2] = (uint8_t) (md5->state[i] >> 16);
+		digest[4 * i + 3] = (uint8_t) (md5->state[i] >> 24);
+	}
+
+	return;
+}
+
+
+
+
+void m_md5_to_hex(const uint8_t digest[M_MD5_DIGEST_SIZE], char hex[M_MD5_HEX_SIZE])
+{
+	static const char digits[] = "0123456789abcdef";
+	for (int i = 0; i < M_MD5_DIGEST_SIZE; i++) {
+		hex[2 * i]     = digits[digest[i] >> 4];
+		hex[2 * i + 1] = digits[digest[i] & 0x0f];
+	}
+	hex[2 * M_MD5_DIGEST_SIZE] = '\0';
+
+	return;
+}
+
+
+
+
+static int m_md5_hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	} else {
+		return -1;
+	}
+}
+
+
+
+
+int m_md5_from_hex(const char * hex, uint8_t digest[M_MD5_DIGEST_SIZE])
+{
+	for (int i = 0; i < M_MD5_DIGEST_SIZE; i++) {
+		const int hi = m_md5_hex_digit(hex[2 * i]);
+		const int lo = hi == -1 ? -1 : m_md5_hex_digit(hex[2 * i + 1]);
+		if (hi == -1 || lo == -1) {
+			return -1;
+		}
+		digest[i] = (uint8_t) ((hi << 4) | lo);
+	}
+
+	return 0;
+}
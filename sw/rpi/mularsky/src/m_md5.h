@@ -0,0 +1,43 @@
+#ifndef H_M_MD5
+#define H_M_MD5
+
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+  MD5 message digest (RFC 1321), computed incrementally.
+
+  Same code as in libmularsky; used for manifest of files written
+  by mularsky (see m_manifest.h).
+*/
+
+
+#define M_MD5_DIGEST_SIZE 16
+#define M_MD5_HEX_SIZE    (2 * M_MD5_DIGEST_SIZE + 1)
+
+
+struct m_md5 {
+	uint32_t state[4];
+	uint64_t length;        /* Total number of bytes hashed. */
+	uint8_t buffer[64];     /* Incomplete block. */
+};
+
+
+
+void m_md5_init(struct m_md5 * md5);
+void m_md5_update(struct m_md5 * md5, const void * data, size_t size);
+void m_md5_final(struct m_md5 * md5, uint8_t digest[M_MD5_DIGEST_SIZE]);
+
+/* Lowercase hex representation, as printed by md5sum. */
+void m_md5_to_hex(const uint8_t digest[M_MD5_DIGEST_SIZE], char hex[M_MD5_HEX_SIZE]);
+
+/* @return 0 on success, -1 if @hex isn't 32 hex digits */
+int m_md5_from_hex(const char * hex, uint8_t digest[M_MD5_DIGEST_SIZE]);
+
+
+
+#endif /* #ifndef H_M_MD5 */
@@ -11,6 +11,8 @@
 
 
 #define USECS_PER_MSEC 1000
+#define NSECS_PER_USEC 1000
+#define NSECS_PER_SEC  1000000000L
 
 
 #endif /* #ifndef _M_MISC_H_ */
@@ -0,0 +1,434 @@
+#define _POSIX_C_SOURCE 200809L /* fsync() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "m_rotate.h"
+#include "m_manifest.h"
+#include "m_md5.h"
+#include "m_trace.h"
+
+
+
+
+#define M_ROTATE_QUEUE    8    /* Finished chunks waiting for closing. */
+#define M_ROTATE_RETRY_S  10   /* Delay of next attempt after failed opening of chunk. */
+
+
+
+
+extern time_t global_time;
+
+
+
+
+struct m_rotate_log {
+	char dir[64];
+	char base[24];           /* "imu" of "imu.txt". */
+	char ext[8];             /* ".txt" of "imu.txt". */
+	char name[32];           /* Name of current chunk. */
+	int index;
+	bool rotating;
+
+	time_t opened;           /* First second of current chunk, 0 if not known yet. */
+	time_t next_check;
+
+	unsigned char header[M_ROTATE_HEADER_MAX];
+	size_t header_size;
+	size_t chunk_header_size; /* Header written at beginning of current chunk. */
+};
+
+
+struct m_rotate_chunk {
+	FILE * stream;
+	char dir[64];
+	char name[32];
+	int index;
+	time_t first;
+	time_t last;
+	size_t header_size;
+};
+
+
+
+
+static struct m_rotate_params rotate_params;
+
+/* Queue of finished chunks, closed by rotate_thread. */
+static pthread_mutex_t rotate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rotate_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rotate_space_cond = PTHREAD_COND_INITIALIZER;
+static struct m_rotate_chunk rotate_queue[M_ROTATE_QUEUE];
+static int rotate_queue_head;
+static int rotate_queue_count;
+static bool rotate_thread_running;
+static bool rotate_stop;
+static pthread_t rotate_thread;
+
+static pthread_mutex_t rotate_manifest_lock = PTHREAD_MUTEX_INITIALIZER;  /* For appends to session manifest. */
+
+
+
+
+/* Current second: time of the machine, or simulated time of replay. */
+static time_t m_rotate_now(void)
+{
+	return rotate_params.simulated_time ? global_time : time(NULL);
+}
+
+
+
+
+/*
+  Parse value of command line option of rotation: 'I' (interval
+  [s]) or 'S' (size [MB]).
+
+  Returns 0 on success, -1 if @value is not a positive number.
+*/
+int m_rotate_parse_option(int opt, const char * value, struct m_rotate_params * params)
+{
+	char * end = NULL;
+	errno = 0;
+	const long long n = strtoll(value, &end, 10);
+	if (errno != 0 || end == value || *end != '\0' || n <= 0) {
+		return -1;
+	}
+
+	if (opt == 'I') {
+		params->interval_s = n;
+	} else if (opt == 'S' && n <= INT64_MAX / (1024 * 1024)) {
+		params->max_bytes = (int64_t) n * 1024 * 1024;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+/*
+  Set rotation of logs opened after this call.
+*/
+void m_rotate_configure(const struct m_rotate_params * params)
+{
+	rotate_params = *params;
+
+	return;
+}
+
+
+
+
+static void m_rotate_chunk_name(const struct m_rotate_log * log, int index, char * name, size_t size)
+{
+	if (log->rotating) {
+		snprintf(name, size, "%s.%04d%s", log->base, index, log->ext);
+	} else {
+		snprintf(name, size, "%s%s", log->base, log->ext);
+	}
+
+	return;
+}
+
+
+
+
+/*
+  Close finished chunk, record it in session manifest and refresh
+  checksums of session.
+*/
+static void m_rotate_finish_chunk(const struct m_rotate_chunk * chunk)
+{
+	/* Flushes stdio buffer; manifest syncs and hashes the file. */
+	fclose(chunk->stream);
+
+	uint64_t size = 0;
+	char hex[M_MD5_HEX_SIZE] = "-";
+	if (-1 == m_manifest_file_info(chunk->name, &size, hex) || hex[0] == '\0') {
+		snprintf(hex, sizeof (hex), "-");
+	}
+
+	char path[96];
+	char line[160];
+	snprintf(path, sizeof (path), "%s/%s", chunk->dir, M_ROTATE_MANIFEST_FILENAME);
+	const int len = snprintf(line, sizeof (line), "%s %d %lu %lu %llu %llu %s\n",
+				 chunk->name, chunk->index, (unsigned long) chunk->first, (unsigned long) chunk->last,
+				 (unsigned long long) size, (unsigned long long) chunk->header_size, hex);
+
+	/* One write per line, so readers never see a partial line
+	   of a complete chunk. */
+	pthread_mutex_lock(&rotate_manifest_lock);
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (fd == -1 || write(fd, line, len) != len || 0 != fsync(fd)) {
+		fprintf(stderr, "%s:%d: failed to record %s in %s: %s\n", __FILE__, __LINE__, chunk->name, path, strerror(errno));
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	pthread_mutex_unlock(&rotate_manifest_lock);
+
+	m_manifest_write(chunk->dir);
+
+	return;
+}
+
+
+
+
+static void * m_rotate_thread_fn(void * dummy)
+{
+	m_trace_thread_name("rotate");
+
+	pthread_mutex_lock(&rotate_lock);
+	for (;;) {
+		while (rotate_queue_count == 0 && !rotate_stop) {
+			pthread_cond_wait(&rotate_cond, &rotate_lock);
+		}
+		if (rotate_queue_count == 0) {
+			break;
+		}
+		struct m_rotate_chunk chunk = rotate_queue[rotate_queue_head];
+		rotate_queue_head = (rotate_queue_head + 1) % M_ROTATE_QUEUE;
+		rotate_queue_count--;
+		pthread_cond_signal(&rotate_space_cond);
+
+		pthread_mutex_unlock(&rotate_lock);
+		m_rotate_finish_chunk(&chunk);
+		pthread_mutex_lock(&rotate_lock);
+	}
+	pthread_mutex_unlock(&rotate_lock);
+
+	return NULL;
+}
+
+
+
+
+/*
+  Hand finished chunk over to closing thread. Chunks are finished
+  (and recorded in session manifest) in order of this call, so if
+  the queue is full, the caller waits. If there is no closing thread
+  the chunk is finished right here.
+*/
+static void m_rotate_enqueue(const struct m_rotate_chunk * chunk)
+{
+	pthread_mutex_lock(&rotate_lock);
+	if (!rotate_thread_running && !rotate_stop) {
+		int rv = pthread_create(&rotate_thread, NULL, m_rotate_thread_fn, NULL);
+		if (rv == 0) {
+			rotate_thread_running = true;
+		} else {
+			fprintf(stderr, "%s:%d: failed to create rotation thread: %s\n", __FILE__, __LINE__, strerror(rv));
+		}
+	}
+	while (rotate_thread_running && rotate_queue_count == M_ROTATE_QUEUE) {
+		pthread_cond_wait(&rotate_space_cond, &rotate_lock);
+	}
+	if (rotate_thread_running) {
+		rotate_queue[(rotate_queue_head + rotate_queue_count) % M_ROTATE_QUEUE] = *chunk;
+		rotate_queue_count++;
+		pthread_cond_signal(&rotate_cond);
+		pthread_mutex_unlock(&rotate_lock);
+		return;
+	}
+	pthread_mutex_unlock(&rotate_lock);
+
+	m_rotate_finish_chunk(chunk);
+
+	return;
+}
+
+
+
+
+/*
+  Open log @filename in @dirpath: its first chunk, or the whole file
+  if rotation isn't configured. The stream is returned in *@stream.
+
+  Returns NULL on errors.
+*/
+struct m_rotate_log * m_rotate_open(char const * dirpath, char const * filename, FILE ** stream)
+{
+	*stream = NULL;
+
+	struct m_rotate_log * log = calloc(1, sizeof (struct m_rotate_log));
+	if (!log) {
+		return NULL;
+	}
+	const char * dot = strrchr(filename, '.');
+	const size_t base_len = dot ? (size_t) (dot - filename) : strlen(filename);
+	if (strlen(dirpath) >= sizeof (log->dir) || base_len >= sizeof (log->base) || (dot && strlen(dot) >= sizeof (log->ext))) {
+		fprintf(stderr, "%s:%d: path of log is too long: %s/%s\n", __FILE__, __LINE__, dirpath, filename);
+		free(log);
+		return NULL;
+	}
+	snprintf(log->dir, sizeof (log->dir), "%s", dirpath);
+	memcpy(log->base, filename, base_len);
+	snprintf(log->ext, sizeof (log->ext), "%s", dot ? dot : "");
+	log->rotating = rotate_params.interval_s > 0 || rotate_params.max_bytes > 0;
+	m_rotate_chunk_name(log, 0, log->name, sizeof (log->name));
+
+	*stream = m_manifest_fopen(log->dir, log->name);
+	if (!*stream) {
+		fprintf(stderr, "%s:%d: failed to open %s/%s\n", __FILE__, __LINE__, log->dir, log->name);
+		free(log);
+		return NULL;
+	}
+	log->opened = m_rotate_now();
+
+	return log;
+}
+
+
+
+
+/*
+  Data written at the beginning of every following chunk, so that
+  each chunk can be processed on its own (e.g. calibration of
+  pressure sensor).
+*/
+void m_rotate_set_header(struct m_rotate_log * log, const void * header, size_t size)
+{
+	if (!log) {
+		return;
+	}
+	if (size > sizeof (log->header)) {
+		fprintf(stderr, "%s:%d: header of %s is too long (%zu)\n", __FILE__, __LINE__, log->name, size);
+		size = sizeof (log->header);
+	}
+	memcpy(log->header, header, size);
+	log->header_size = size;
+
+	return;
+}
+
+
+
+
+/*
+  Called by writer of the log after each sample. If rotation is due,
+  *@stream is replaced with stream of next chunk.
+*/
+void m_rotate_check(struct m_rotate_log * log, FILE ** stream)
+{
+	if (!log || !log->rotating) {
+		return;
+	}
+	const time_t now = m_rotate_now();
+	if (now == 0 || now < log->next_check) {
+		return;
+	}
+	log->next_check = now + 1;
+	if (log->opened == 0) {
+		log->opened = now;
+	}
+
+	bool due = rotate_params.interval_s > 0 && now - log->opened >= rotate_params.interval_s;
+	if (!due && rotate_params.max_bytes > 0) {
+		uint64_t size;
+		due = 0 == m_manifest_file_info(log->name, &size, NULL) && size >= (uint64_t) rotate_params.max_bytes;
+	}
+	if (!due) {
+		return;
+	}
+
+	char name[sizeof (log->name)];
+	m_rotate_chunk_name(log, log->index + 1, name, sizeof (name));
+	FILE * next = m_manifest_fopen(log->dir, name);
+	if (!next) {
+		/* Keep writing to current chunk rather than lose data. */
+		fprintf(stderr, "%s:%d: failed to open %s/%s, rotation delayed\n", __FILE__, __LINE__, log->dir, name);
+		log->next_check = now + M_ROTATE_RETRY_S;
+		return;
+	}
+	if (log->header_size) {
+		fwrite(log->header, 1, log->header_size, next);
+	}
+
+	struct m_rotate_chunk chunk;
+	chunk.stream = *stream;
+	memcpy(chunk.dir, log->dir, sizeof (chunk.dir));
+	memcpy(chunk.name, log->name, sizeof (chunk.name));
+	chunk.index = log->index;
+	chunk.first = log->opened;
+	chunk.last = now;
+	chunk.header_size = log->chunk_header_size;
+
+	*stream = next;
+	memcpy(log->name, name, sizeof (log->name));
+	log->index++;
+	log->opened = now;
+	log->chunk_header_size = log->header_size;
+
+	m_rotate_enqueue(&chunk);
+
+	return;
+}
+
+
+
+
+/*
+  Close last chunk of the log (or the only file) and free the log.
+  *@stream is set to NULL. The last chunk is finished in background
+  after earlier ones; m_rotate_finish() waits for it.
+*/
+void m_rotate_close(struct m_rotate_log * log, FILE ** stream)
+{
+	if (!log) {
+		return;
+	}
+
+	if (log->rotating) {
+		struct m_rotate_chunk chunk;
+		chunk.stream = *stream;
+		memcpy(chunk.dir, log->dir, sizeof (chunk.dir));
+		memcpy(chunk.name, log->name, sizeof (chunk.name));
+		chunk.index = log->index;
+		chunk.first = log->opened;
+		chunk.last = m_rotate_now();
+		chunk.header_size = log->chunk_header_size;
+		m_rotate_enqueue(&chunk);
+	} else {
+		fclose(*stream);
+	}
+	*stream = NULL;
+	free(log);
+
+	return;
+}
+
+
+
+
+/*
+  Wait until all finished chunks are closed and recorded. Called
+  before final manifest is written.
+*/
+void m_rotate_finish(void)
+{
+	pthread_mutex_lock(&rotate_lock);
+	rotate_stop = true;
+	const bool running = rotate_thread_running;
+	pthread_cond_signal(&rotate_cond);
+	pthread_mutex_unlock(&rotate_lock);
+
+	if (running) {
+		pthread_join(rotate_thread, NULL);
+		rotate_thread_running = false;
+	}
+
+	return;
+}
@@ -0,0 +1,83 @@
+#ifndef H_M_ROTATE
+#define H_M_ROTATE
+
+
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+/*
+  Rotation of output logs for long deployments.
+
+  Without rotation (default) a log is one file, e.g. imu.txt. With
+  rotation by elapsed time and/or by size, the log is a sequence of
+  chunks with sequential names: imu.0000.txt, imu.0001.txt, ...
+  Concatenation of chunks is the same as one file would be; each
+  chunk also starts with the header of the log (see
+  m_rotate_set_header()), so it can be processed on its own.
+
+  Writers call m_rotate_check() after each complete sample, so chunks
+  end on sample boundaries. When rotation is due the next chunk is
+  opened and the writer continues in it right away; the finished
+  chunk is flushed, synced, closed and hashed by a background thread,
+  in order of rotation. Elapsed time is measured with time of the
+  machine (global_time set by pressure thread may stop), or with
+  simulated global_time of replay. Size is checked once per second,
+  so chunks may exceed the limit by a second's worth of data.
+
+  Every finished chunk is appended to session manifest
+  M_ROTATE_MANIFEST_FILENAME in output dir:
+
+      <file> <index> <first second> <last second> <bytes> <header bytes> <md5>
+
+  and checksums of all files (see m_manifest.h) are rewritten. A
+  chunk listed in session manifest is complete and may be copied or
+  processed while logging goes on. <header bytes> is the size of the
+  repeated header at the beginning of the chunk (0 for the first
+  chunk, whose header is a part of the log).
+
+  Tools in sw/pc (and mularsky_replay) read logs by their plain
+  names. m_joiner (sw/pc/joiner) joins chunks listed in session
+  manifest into imu.txt etc., skipping the repeated headers.
+*/
+
+
+
+
+#define M_ROTATE_MANIFEST_FILENAME  "chunks.txt"
+#define M_ROTATE_HEADER_MAX         256
+
+
+
+
+struct m_rotate_params {
+	int64_t interval_s;      /* Rotate after this many seconds; 0 = never. */
+	int64_t max_bytes;       /* Rotate after this many bytes; 0 = never. */
+	bool simulated_time;     /* Measure time with global_time of replay. */
+};
+
+
+struct m_rotate_log;
+
+
+
+
+int m_rotate_parse_option(int opt, const char * value, struct m_rotate_params * params);
+void m_rotate_configure(const struct m_rotate_params * params);
+
+struct m_rotate_log * m_rotate_open(char const * dirpath, char const * filename, FILE ** stream);
+void m_rotate_set_header(struct m_rotate_log * log, const void * header, size_t size);
+void m_rotate_check(struct m_rotate_log * log, FILE ** stream);
+void m_rotate_close(struct m_rotate_log * log, FILE ** stream);
+void m_rotate_finish(void);
+
+
+
+
+#endif /* #ifndef H_M_ROTATE */
@@ -0,0 +1,316 @@
+#define _GNU_SOURCE /* sendmmsg(), SCHED_IDLE */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "m_telemetry.h"
+#include "m_bus.h"
+#include "m_misc.h"
+#include "m_time.h"
+#include "m_trace.h"
+
+
+
+
+#define M_TELEMETRY_BATCH 32   /* Max. frames per sendmmsg(). */
+
+
+
+
+static int telemetry_fd = -1;
+static struct sockaddr_storage telemetry_address;
+static pthread_t telemetry_thread;
+static volatile bool telemetry_cancel;
+static const struct m_bus * telemetry_bus;
+
+/* State of sender thread. */
+static uint64_t telemetry_next[M_BUS_STREAMS];  /* Number of next sample to send, per stream. */
+static uint32_t telemetry_sequence;
+static unsigned char telemetry_frames[M_TELEMETRY_BATCH][M_TELEMETRY_FRAME_MAX];
+static struct mmsghdr telemetry_msgs[M_TELEMETRY_BATCH];
+static struct iovec telemetry_iovs[M_TELEMETRY_BATCH];
+static int telemetry_n_frames;
+
+static unsigned long telemetry_sent;
+static unsigned long telemetry_dropped;
+static unsigned long telemetry_lost;  /* Samples overwritten on bus before being sent. */
+
+
+
+
+int m_telemetry_address(char const * target, struct sockaddr_storage * address, socklen_t * length)
+{
+	memset(address, 0, sizeof (struct sockaddr_storage));
+
+	if (0 == strncmp(target, "unix:", 5)) {
+		struct sockaddr_un * un = (struct sockaddr_un *) address;
+		un->sun_family = AF_UNIX;
+		if (strlen(target + 5) >= sizeof (un->sun_path)) {
+			fprintf(stderr, "%s:%d: path of socket is too long: %s\n", __FILE__, __LINE__, target + 5);
+			return -1;
+		}
+		strcpy(un->sun_path, target + 5);
+		*length = sizeof (struct sockaddr_un);
+		return 0;
+	}
+
+	if (0 == strncmp(target, "udp:", 4)) {
+		char host[128];
+		const char * port = strrchr(target + 4, ':');
+		if (!port || (size_t) (port - (target + 4)) >= sizeof (host)) {
+			fprintf(stderr, "%s:%d: invalid target %s\n", __FILE__, __LINE__, target);
+			return -1;
+		}
+		memcpy(host, target + 4, port - (target + 4));
+		host[port - (target + 4)] = '\0';
+
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof (hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = host[0] ? 0 : AI_PASSIVE;
+		struct addrinfo * info = NULL;
+		int rv = getaddrinfo(host[0] ? host : NULL, port + 1, &hints, &info);
+		if (rv != 0) {
+			fprintf(stderr, "%s:%d: can't resolve %s: %s\n", __FILE__, __LINE__, target, gai_strerror(rv));
+			return -1;
+		}
+		memcpy(address, info->ai_addr, info->ai_addrlen);
+		*length = info->ai_addrlen;
+		freeaddrinfo(info);
+		return 0;
+	}
+
+	fprintf(stderr, "%s:%d: invalid target %s, expected udp:<host>:<port> or unix:<path>\n", __FILE__, __LINE__, target);
+	return -1;
+}
+
+
+
+
+/*
+  Send all frames of the batch with one syscall. Frames that don't
+  go through right away are dropped.
+*/
+static void m_telemetry_flush(void)
+{
+	m_trace_begin(M_TRACE_TELEMETRY_FLUSH, telemetry_n_frames);
+	int done = 0;
+	while (done < telemetry_n_frames) {
+		int rv = sendmmsg(telemetry_fd, telemetry_msgs + done, telemetry_n_frames - done, MSG_DONTWAIT);
+		if (rv <= 0) {
+			/* EAGAIN: socket buffer is full; ECONNREFUSED,
+			   ENOENT: nobody is listening. Either way the
+			   frame at the head of the batch is lost. */
+			telemetry_dropped++;
+			done++;
+			continue;
+		}
+		telemetry_sent += rv;
+		done += rv;
+	}
+	m_trace_end(M_TRACE_TELEMETRY_FLUSH, telemetry_n_frames);
+	telemetry_n_frames = 0;
+
+	return;
+}
+
+
+
+
+/*
+  Append samples of @stream, published since last call, to frames of
+  the batch.
+*/
+static void m_telemetry_collect(enum m_bus_stream stream)
+{
+	const uint32_t sample_size = telemetry_bus->rings[stream].sample_size;
+	const size_t per_frame = (M_TELEMETRY_FRAME_MAX - sizeof (struct m_telemetry_header)) / sample_size;
+	const uint64_t head = m_bus_head(telemetry_bus, stream);
+
+	struct m_telemetry_header * header = NULL;
+	while (telemetry_next[stream] < head) {
+		if (!header || header->n_samples == per_frame) {
+			if (telemetry_n_frames == M_TELEMETRY_BATCH) {
+				m_telemetry_flush();
+			}
+			header = (struct m_telemetry_header *) telemetry_frames[telemetry_n_frames];
+			memcpy(header->magic, M_TELEMETRY_MAGIC, sizeof (header->magic));
+			header->version = M_TELEMETRY_VERSION;
+			header->stream = stream;
+			header->n_samples = 0;
+			header->sample_size = sample_size;
+			header->reserved = 0;
+			header->sequence = telemetry_sequence++;
+			header->first_number = telemetry_next[stream];
+			telemetry_iovs[telemetry_n_frames].iov_len = sizeof (struct m_telemetry_header);
+			telemetry_n_frames++;
+		}
+
+		unsigned char * data = (unsigned char *) (header + 1) + header->n_samples * sample_size;
+		int rv = m_bus_read(telemetry_bus, stream, telemetry_next[stream], data, sample_size);
+		if (rv == -1) {
+			/* Overwritten; continue from the oldest sample
+			   that is surely still there, in a new frame. */
+			const uint64_t oldest = head > M_BUS_SLOTS / 2 ? head - M_BUS_SLOTS / 2 : 0;
+			const uint64_t next = oldest > telemetry_next[stream] ? oldest : telemetry_next[stream] + 1;
+			telemetry_lost += next - telemetry_next[stream];
+			telemetry_next[stream] = next;
+			if (header->n_samples == 0) {
+				header->first_number = next;
+			} else {
+				header = NULL;
+			}
+			continue;
+		}
+		header->n_samples++;
+		telemetry_iovs[telemetry_n_frames - 1].iov_len += sample_size; /* Current frame is always the last one. */
+		telemetry_next[stream]++;
+	}
+
+	/* Frame left without samples after skipping lost ones. */
+	if (header && header->n_samples == 0) {
+		telemetry_n_frames--;
+		telemetry_sequence--;
+	}
+
+	return;
+}
+
+
+
+
+static void * m_telemetry_thread_fn(void * dummy)
+{
+	/* Run only when CPUs have nothing better to do, so that
+	   acquisition threads are never delayed by telemetry. */
+	struct sched_param param = { .sched_priority = 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+	m_trace_thread_name("telemetry");
+
+	for (int i = 0; i < M_BUS_STREAMS; i++) {
+		telemetry_next[i] = m_bus_head(telemetry_bus, i);
+	}
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	while (!telemetry_cancel) {
+		for (int i = 0; i < M_BUS_STREAMS; i++) {
+			m_telemetry_collect(i);
+		}
+		if (telemetry_n_frames) {
+			m_telemetry_flush();
+		}
+
+		m_timespec_add_us(&deadline, M_TELEMETRY_PERIOD_MS * USECS_PER_MSEC);
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (m_timespec_cmp(&now, &deadline) > 0) {
+			deadline = now;
+		} else {
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+		}
+	}
+
+	/* Samples published since last period. */
+	for (int i = 0; i < M_BUS_STREAMS; i++) {
+		m_telemetry_collect(i);
+	}
+	if (telemetry_n_frames) {
+		m_telemetry_flush();
+	}
+
+	return NULL;
+}
+
+
+
+
+/*
+  Start sending samples of live sample bus to @target. The bus must
+  have been created with m_bus_create().
+*/
+int m_telemetry_start(char const * target)
+{
+	struct sockaddr_storage address;
+	socklen_t length;
+	if (-1 == m_telemetry_address(target, &address, &length)) {
+		return -1;
+	}
+
+	telemetry_bus = m_bus_attach();
+	if (!telemetry_bus) {
+		fprintf(stderr, "%s:%d: live sample bus is not available\n", __FILE__, __LINE__);
+		return -1;
+	}
+
+	telemetry_fd = socket(address.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (telemetry_fd == -1) {
+		fprintf(stderr, "%s:%d: failed to create socket: %s\n", __FILE__, __LINE__, strerror(errno));
+		m_bus_detach(telemetry_bus);
+		telemetry_bus = NULL;
+		return -1;
+	}
+
+	/* All frames go to one address; set it once for all messages. */
+	telemetry_address = address;
+	for (int i = 0; i < M_TELEMETRY_BATCH; i++) {
+		memset(&telemetry_msgs[i], 0, sizeof (telemetry_msgs[i]));
+		telemetry_iovs[i].iov_base = telemetry_frames[i];
+		telemetry_msgs[i].msg_hdr.msg_iov = &telemetry_iovs[i];
+		telemetry_msgs[i].msg_hdr.msg_iovlen = 1;
+		telemetry_msgs[i].msg_hdr.msg_name = &telemetry_address;
+		telemetry_msgs[i].msg_hdr.msg_namelen = length;
+	}
+
+	telemetry_cancel = false;
+	int rv = pthread_create(&telemetry_thread, NULL, m_telemetry_thread_fn, NULL);
+	if (rv != 0) {
+		fprintf(stderr, "%s:%d: failed to create telemetry thread: %s\n", __FILE__, __LINE__, strerror(rv));
+		close(telemetry_fd);
+		telemetry_fd = -1;
+		m_bus_detach(telemetry_bus);
+		telemetry_bus = NULL;
+		return -1;
+	}
+	fprintf(stderr, "telemetry: sending to %s\n", target);
+
+	return 0;
+}
+
+
+
+
+void m_telemetry_stop(void)
+{
+	if (telemetry_fd == -1) {
+		return;
+	}
+
+	telemetry_cancel = true;
+	pthread_join(telemetry_thread, NULL);
+
+	fprintf(stderr, "telemetry: frames sent = %lu, dropped = %lu, samples lost = %lu\n",
+		telemetry_sent, telemetry_dropped, telemetry_lost);
+
+	close(telemetry_fd);
+	telemetry_fd = -1;
+	m_bus_detach(telemetry_bus);
+	telemetry_bus = NULL;
+
+	return;
+}
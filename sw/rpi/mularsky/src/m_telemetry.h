@@ -0,0 +1,70 @@
+#ifndef H_M_TELEMETRY
+#define H_M_TELEMETRY
+
+
+
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "m_bus.h"
+
+
+
+
+/*
+  Live telemetry: samples of live sample bus (see m_bus.h) sent as
+  binary datagrams to a local consumer, over UDP or a Unix datagram
+  socket.
+
+  Samples are taken from the bus by a separate, low priority thread,
+  so acquisition threads never wait for the network: telemetry can't
+  change their timing. Every M_TELEMETRY_PERIOD_MS the thread packs
+  new samples of each stream into frames and sends all frames with
+  one sendmmsg() call. Socket is non-blocking: frames that can't be
+  sent right now (no receiver, full socket buffer) are dropped and
+  counted, never queued.
+
+  Frame is struct m_telemetry_header followed by @n_samples samples
+  of @sample_size bytes (struct m_bus_imu_sample etc.), with
+  consecutive numbers starting at @first_number. All fields are in
+  host byte order.
+
+  Target is "udp:<host>:<port>" or "unix:<path>".
+*/
+
+
+
+
+#define M_TELEMETRY_MAGIC      "MLTM"
+#define M_TELEMETRY_VERSION    1
+#define M_TELEMETRY_FRAME_MAX  1400  /* Fits in Ethernet MTU. */
+#define M_TELEMETRY_PERIOD_MS  20
+
+
+
+
+struct m_telemetry_header {
+	char magic[4];           /* M_TELEMETRY_MAGIC, without terminating NUL. */
+	uint8_t version;
+	uint8_t stream;          /* enum m_bus_stream. */
+	uint16_t n_samples;
+	uint16_t sample_size;
+	uint16_t reserved;
+	uint32_t sequence;       /* Number of frame, for detection of drops. */
+	uint64_t first_number;   /* Number of first sample in its stream. */
+};
+
+
+
+
+int m_telemetry_start(char const * target);
+void m_telemetry_stop(void);
+
+/* Address of @target, for sender and receiver. Returns 0 on success, -1 on errors. */
+int m_telemetry_address(char const * target, struct sockaddr_storage * address, socklen_t * length);
+
+
+
+
+#endif /* #ifndef H_M_TELEMETRY */
@@ -0,0 +1,64 @@
+#ifndef H_M_TIME
+#define H_M_TIME
+
+
+
+
+/*
+  Helpers for operations on struct timespec.
+
+  struct timespec is a POSIX type, so files including this header
+  need _BSD_SOURCE or _POSIX_C_SOURCE.
+*/
+
+
+
+
+#include <time.h>
+
+#include "m_misc.h"
+
+
+
+
+static inline void m_timespec_add_us(struct timespec * ts, long us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * NSECS_PER_USEC;
+	if (ts->tv_nsec >= NSECS_PER_SEC) {
+		ts->tv_sec++;
+		ts->tv_nsec -= NSECS_PER_SEC;
+	}
+}
+
+
+
+
+static inline int m_timespec_cmp(const struct timespec * a, const struct timespec * b)
+{
+	if (a->tv_sec != b->tv_sec) {
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+	}
+	if (a->tv_nsec != b->tv_nsec) {
+		return a->tv_nsec < b->tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
+
+
+
+
+/*
+  Milliseconds elapsed on CLOCK_MONOTONIC since @begin.
+*/
+static inline long m_timespec_elapsed_ms(const struct timespec * begin)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - begin->tv_sec) * 1000 + (now.tv_nsec - begin->tv_nsec) / (NSECS_PER_SEC / 1000);
+}
+
+
+
+
+#endif /* #ifndef H_M_TIME */
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE /* syscall() */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "m_trace.h"
+#include "m_misc.h"
+
+
+
+
+#define M_TRACE_RING_MASK (M_TRACE_RING_RECORDS - 1)
+
+
+
+
+/* Ring of one thread. Only the owning thread writes records and
+   @head; m_trace_dump() reads them without stopping the thread. */
+struct m_trace_ring {
+	char name[16];
+	uint32_t tid;
+	uint64_t head;           /* Number of records written. */
+	struct m_trace_record records[M_TRACE_RING_RECORDS];
+};
+
+
+
+
+bool m_trace_enabled;
+
+static struct m_trace_ring * trace_rings[M_TRACE_THREADS_MAX];
+static int trace_n_rings;
+
+static __thread struct m_trace_ring * trace_ring;
+static __thread bool trace_no_ring;   /* Allocation failed or too many threads; don't retry. */
+static __thread char trace_name[16];
+
+static const char * const trace_event_names[M_TRACE_EVENTS] = {
+	[M_TRACE_I2C_READ]        = "i2c_read",
+	[M_TRACE_UART_READ]       = "uart_read",
+	[M_TRACE_IMU_PERIOD]      = "imu_period",
+	[M_TRACE_IMU_DECODE]      = "imu_decode",
+	[M_TRACE_IMU_STORE_RAW]   = "imu_store_raw",
+	[M_TRACE_IMU_PUBLISH]     = "imu_publish",
+	[M_TRACE_IMU_SLEEP]       = "imu_sleep",
+	[M_TRACE_IMU_LATE]        = "imu_late",
+	[M_TRACE_PRESSURE_PERIOD] = "pressure_period",
+	[M_TRACE_PRESSURE_DECODE] = "pressure_decode",
+	[M_TRACE_PRESSURE_SLEEP]  = "pressure_sleep",
+	[M_TRACE_FILE_WRITE]      = "file_write",
+	[M_TRACE_TELEMETRY_FLUSH] = "telemetry_flush",
+};
+
+
+
+
+/*
+  Enable tracepoints. Rings are allocated by threads on their first
+  event.
+*/
+void m_trace_start(void)
+{
+	m_trace_enabled = true;
+	fprintf(stderr, "trace: enabled, %d records per thread\n", M_TRACE_RING_RECORDS);
+
+	return;
+}
+
+
+
+
+/*
+  Name of calling thread, shown in the trace. May be called before
+  or after the first event of the thread.
+*/
+void m_trace_thread_name(char const * name)
+{
+	snprintf(trace_name, sizeof (trace_name), "%s", name);
+	if (trace_ring) {
+		memcpy(trace_ring->name, trace_name, sizeof (trace_ring->name));
+	}
+
+	return;
+}
+
+
+
+
+static struct m_trace_ring * m_trace_new_ring(void)
+{
+	const int slot = __atomic_fetch_add(&trace_n_rings, 1, __ATOMIC_RELAXED);
+	if (slot >= M_TRACE_THREADS_MAX) {
+		fprintf(stderr, "%s:%d: too many traced threads, max. %d\n", __FILE__, __LINE__, M_TRACE_THREADS_MAX);
+		trace_no_ring = true;
+		return NULL;
+	}
+
+	struct m_trace_ring * ring = calloc(1, sizeof (struct m_trace_ring));
+	if (!ring) {
+		fprintf(stderr, "%s:%d: failed to allocate trace ring\n", __FILE__, __LINE__);
+		trace_no_ring = true;
+		return NULL;
+	}
+	ring->tid = (uint32_t) syscall(SYS_gettid);
+	if (trace_name[0]) {
+		memcpy(ring->name, trace_name, sizeof (ring->name));
+	} else {
+		snprintf(ring->name, sizeof (ring->name), "%u", ring->tid);
+	}
+
+	/* Dumper sees the ring only when it's initialized. */
+	__atomic_store_n(&trace_rings[slot], ring, __ATOMIC_RELEASE);
+	trace_ring = ring;
+
+	return ring;
+}
+
+
+
+
+void m_trace_record(enum m_trace_event event, enum m_trace_phase phase, uint32_t arg)
+{
+	struct m_trace_ring * ring = trace_ring;
+	if (!ring) {
+		if (trace_no_ring || !(ring = m_trace_new_ring())) {
+			return;
+		}
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	const uint64_t head = ring->head;
+	struct m_trace_record * record = &ring->records[head & M_TRACE_RING_MASK];
+	record->timestamp_ns = (uint64_t) ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+	record->arg = arg;
+	record->event = event;
+	record->phase = phase;
+	record->reserved = 0;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+/*
+  Copy records of @ring that surely weren't overwritten during the
+  copy into @out, oldest first. Returns number of copied records.
+*/
+static uint32_t m_trace_copy_ring(const struct m_trace_ring * ring, struct m_trace_record * out, uint64_t * n_written)
+{
+	const uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	const uint64_t first = head > M_TRACE_RING_RECORDS ? head - M_TRACE_RING_RECORDS : 0;
+	for (uint64_t i = first; i < head; i++) {
+		out[i - first] = ring->records[i & M_TRACE_RING_MASK];
+	}
+
+	/* While copying, the thread may have written more records,
+	   overwriting the oldest ones, and may be in the middle of
+	   writing record @head_after. Records older than that slot
+	   are valid. */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	const uint64_t head_after = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint64_t valid = first;
+	if (head_after + 1 > first + M_TRACE_RING_RECORDS) {
+		valid = head_after + 1 - M_TRACE_RING_RECORDS;
+	}
+	if (valid > head) {
+		valid = head;
+	}
+	if (valid > first) {
+		memmove(out, out + (valid - first), (head - valid) * sizeof (out[0]));
+	}
+
+	*n_written = head;
+	return (uint32_t) (head - valid);
+}
+
+
+
+
+/*
+  Write rings of all threads to file @path. Tracing goes on during
+  and after the dump.
+*/
+int m_trace_dump(char const * path)
+{
+	if (!m_trace_enabled) {
+		return 0;
+	}
+
+	struct m_trace_record * records = malloc(M_TRACE_RING_RECORDS * sizeof (struct m_trace_record));
+	if (!records) {
+		fprintf(stderr, "%s:%d: failed to allocate buffer for trace dump\n", __FILE__, __LINE__);
+		return -1;
+	}
+	FILE * file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "%s:%d: failed to open %s: %s\n", __FILE__, __LINE__, path, strerror(errno));
+		free(records);
+		return -1;
+	}
+
+	int n_rings = __atomic_load_n(&trace_n_rings, __ATOMIC_RELAXED);
+	if (n_rings > M_TRACE_THREADS_MAX) {
+		n_rings = M_TRACE_THREADS_MAX;
+	}
+	struct m_trace_ring * rings[M_TRACE_THREADS_MAX];
+	int n_threads = 0;
+	for (int i = 0; i < n_rings; i++) {
+		struct m_trace_ring * ring = __atomic_load_n(&trace_rings[i], __ATOMIC_ACQUIRE);
+		if (ring) {
+			rings[n_threads++] = ring;
+		}
+	}
+
+	struct timespec realtime;
+	struct timespec monotonic;
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+	struct m_trace_file_header header;
+	memset(&header, 0, sizeof (header));
+	memcpy(header.magic, M_TRACE_MAGIC, sizeof (header.magic));
+	header.version = M_TRACE_VERSION;
+	header.n_events = M_TRACE_EVENTS;
+	header.n_threads = n_threads;
+	header.record_size = sizeof (struct m_trace_record);
+	header.realtime_offset_ns = ((int64_t) realtime.tv_sec - monotonic.tv_sec) * NSECS_PER_SEC + (realtime.tv_nsec - monotonic.tv_nsec);
+	fwrite(&header, sizeof (header), 1, file);
+
+	for (int i = 0; i < M_TRACE_EVENTS; i++) {
+		char name[M_TRACE_NAME_SIZE] = { 0 };
+		snprintf(name, sizeof (name), "%s", trace_event_names[i]);
+		fwrite(name, sizeof (name), 1, file);
+	}
+
+	unsigned long n_total = 0;
+	for (int i = 0; i < n_threads; i++) {
+		struct m_trace_thread_header thread;
+		memset(&thread, 0, sizeof (thread));
+		memcpy(thread.name, rings[i]->name, sizeof (thread.name));
+		thread.name[sizeof (thread.name) - 1] = '\0';
+		thread.tid = rings[i]->tid;
+		thread.n_records = m_trace_copy_ring(rings[i], records, &thread.n_written);
+
+		fwrite(&thread, sizeof (thread), 1, file);
+		fwrite(records, sizeof (records[0]), thread.n_records, file);
+		n_total += thread.n_records;
+	}
+
+	free(records);
+	if (ferror(file) | fclose(file)) {
+		fprintf(stderr, "%s:%d: failed to write %s\n", __FILE__, __LINE__, path);
+		return -1;
+	}
+	fprintf(stderr, "trace: %lu records of %d threads dumped to %s\n", n_total, n_threads, path);
+
+	return 0;
+}
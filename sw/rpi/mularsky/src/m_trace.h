@@ -0,0 +1,145 @@
+#ifndef H_M_TRACE
+#define H_M_TRACE
+
+
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+
+/*
+  Event trace for profiling of hot paths: why was this sample late?
+
+  Tracepoints in reading, decoding, storing and scheduling code write
+  timestamped begin/end records into a ring of the calling thread.
+  Each thread has its own ring, so writing a record takes no lock and
+  no syscall: a clock_gettime() (vDSO), a store of 16 bytes and a
+  release store of the head. When the ring is full the oldest records
+  are overwritten, so the ring always holds the last
+  M_TRACE_RING_RECORDS events of the thread. Until m_trace_start() is
+  called tracepoints cost one load and a branch.
+
+  m_trace_dump() writes rings of all threads to a file; it may be
+  called while threads keep tracing. The dump is converted to Chrome
+  trace-event JSON (chrome://tracing, ui.perfetto.dev) with
+  mularsky_trace2json.
+
+  Dump file: struct m_trace_file_header, then @n_events names of
+  events (M_TRACE_NAME_SIZE bytes each, index = event id), then for
+  each thread struct m_trace_thread_header followed by @n_records
+  records, oldest first. All fields are in host byte order.
+*/
+
+
+
+
+#define M_TRACE_MAGIC         "MLRSKTRC"
+#define M_TRACE_VERSION       1
+#define M_TRACE_RING_RECORDS  (1 << 16)  /* Power of 2; 1 MB per thread, about a minute at 100 Hz. */
+#define M_TRACE_THREADS_MAX   16
+#define M_TRACE_NAME_SIZE     24
+
+
+
+
+enum m_trace_event {
+	M_TRACE_I2C_READ = 0,     /* arg: register | size << 8. */
+	M_TRACE_UART_READ,        /* arg: register | size << 8. */
+	M_TRACE_IMU_PERIOD,       /* One iteration of IMU read loop, without sleep. arg: number of read. */
+	M_TRACE_IMU_DECODE,       /* Decoding and formatting of sample into imu.txt. */
+	M_TRACE_IMU_STORE_RAW,
+	M_TRACE_IMU_PUBLISH,
+	M_TRACE_IMU_SLEEP,        /* Wait for next deadline. */
+	M_TRACE_IMU_LATE,         /* Instant: deadline missed. arg: lateness [us]. */
+	M_TRACE_PRESSURE_PERIOD,
+	M_TRACE_PRESSURE_DECODE,
+	M_TRACE_PRESSURE_SLEEP,
+	M_TRACE_FILE_WRITE,       /* Flush of stdio buffer of output file, with hashing. arg: bytes. */
+	M_TRACE_TELEMETRY_FLUSH,  /* arg: frames. */
+	M_TRACE_EVENTS
+};
+
+
+enum m_trace_phase {
+	M_TRACE_BEGIN = 0,
+	M_TRACE_END,
+	M_TRACE_INSTANT
+};
+
+
+
+
+struct m_trace_record {
+	uint64_t timestamp_ns;   /* CLOCK_MONOTONIC. */
+	uint32_t arg;
+	uint16_t event;          /* enum m_trace_event. */
+	uint8_t phase;           /* enum m_trace_phase. */
+	uint8_t reserved;
+};
+
+
+struct m_trace_file_header {
+	char magic[8];           /* M_TRACE_MAGIC, without terminating NUL. */
+	uint32_t version;
+	uint32_t n_events;
+	uint32_t n_threads;
+	uint32_t record_size;
+	int64_t realtime_offset_ns;  /* CLOCK_REALTIME - CLOCK_MONOTONIC at time of dump. */
+};
+
+
+struct m_trace_thread_header {
+	char name[16];
+	uint32_t tid;
+	uint32_t n_records;
+	uint64_t n_written;      /* Records written since start; older ones have been overwritten. */
+};
+
+
+
+
+extern bool m_trace_enabled;
+
+void m_trace_start(void);
+void m_trace_thread_name(char const * name);
+int m_trace_dump(char const * path);
+
+void m_trace_record(enum m_trace_event event, enum m_trace_phase phase, uint32_t arg);
+
+
+
+
+static inline void m_trace_begin(enum m_trace_event event, uint32_t arg)
+{
+	if (m_trace_enabled) {
+		m_trace_record(event, M_TRACE_BEGIN, arg);
+	}
+}
+
+
+
+
+static inline void m_trace_end(enum m_trace_event event, uint32_t arg)
+{
+	if (m_trace_enabled) {
+		m_trace_record(event, M_TRACE_END, arg);
+	}
+}
+
+
+
+
+static inline void m_trace_instant(enum m_trace_event event, uint32_t arg)
+{
+	if (m_trace_enabled) {
+		m_trace_record(event, M_TRACE_INSTANT, arg);
+	}
+}
+
+
+
+
+#endif /* #ifndef H_M_TRACE */
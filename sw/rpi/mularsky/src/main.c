@@ -10,6 +10,7 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <time.h>
+#include <limits.h>
 
 #include <wiringPi.h>
 
@@ -17,6 +18,12 @@
 #include "m_bno055.h"
 #include "m_i2c.h"
 #include "m_misc.h"
+#include "m_manifest.h"
+#include "m_bus.h"
+#include "m_telemetry.h"
+#include "m_trace.h"
+#include "m_rotate.h"
+#include "m_gps.h"
 
 
 time_t global_time;
@@ -37,22 +44,69 @@ extern int imu_sensor_fd;
 
 static pthread_t pressure_thread;
 static pthread_t imu_thread;
+static pthread_t gps_thread;
 
 static bool run_pressure = true;
 static bool run_imu = true;
+static bool run_gps = false;
 
 
 
 static FILE * button_out_fd;
 static const char * data_filename = "button.txt";
+static FILE * i2c_out_fd;
+static const char * i2c_filename = "i2c.txt";
+static char * dir_path = NULL;
 
+static char const * trace_path = NULL;
+static volatile sig_atomic_t trace_dump_requested;
+static volatile sig_atomic_t exit_requested;
 
+
+/* Threads are stopped and files are closed by main loop, not in
+   signal handler, which could interrupt main thread in the middle
+   of writing a file. */
 void m_sighandler(int sig)
 {
-	fprintf(stderr, "\n");
-	cancel_treads = true;
-	sleep(2);
-	exit(EXIT_SUCCESS);
+	exit_requested = 1;
+}
+
+
+
+
+/* Dump of trace is written by main loop, not in signal handler. */
+void m_sigusr1_handler(int sig)
+{
+	trace_dump_requested = 1;
+}
+
+
+
+
+/*
+  Publish status of collector on live sample bus.
+*/
+static void m_publish_status(int button_state)
+{
+	struct m_bus_status status;
+	memset(&status, 0, sizeof (status));
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	status.timestamp_ns = (uint64_t) ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+	status.global_time = global_time;
+	status.pid = getpid();
+	status.imu_ok = imu_led_time_ms == BLINK_OK;
+	status.pressure_ok = pressure_led_time_ms == BLINK_OK;
+	status.gps_ok = gps_led_time_ms == BLINK_OK;
+	status.button = button_state;
+	if (dir_path) {
+		snprintf(status.dir, sizeof (status.dir), "%s", dir_path);
+	}
+
+	m_bus_publish(M_BUS_STATUS, &status, sizeof (status));
+
+	return;
 }
 
 
@@ -74,6 +128,29 @@ void m_atexit(void)
 
 	sleep(1);
 
+	if (i2c_out_fd) {
+		m_i2c_report(i2c_out_fd, true);
+		if (i2c_out_fd != stderr) {
+			fclose(i2c_out_fd);
+		}
+		i2c_out_fd = NULL;
+	}
+
+	/* Sensor threads have closed their files by now; chunks of
+	   rotated logs may still be closed in background. */
+	m_rotate_finish();
+	if (dir_path) {
+		fprintf(stderr, "writing manifest\n");
+		m_manifest_write(dir_path);
+	}
+
+	m_telemetry_stop();
+	m_bus_destroy();
+
+	if (trace_path) {
+		m_trace_dump(trace_path);
+	}
+
 	digitalWrite(G_GPIO_LED, HIGH);
 
 	return;
@@ -93,26 +170,96 @@ int main(int argc, char ** argv)
 	signal(SIGINT, m_sighandler);
 	signal(SIGTERM, m_sighandler);
 
-	char * dir_path = NULL;
-	if (argc == 2) {
-		fprintf(stderr, "%s: checking path %s\n", argv[0], argv[1]);
-		if (0 != access(argv[1], X_OK | W_OK)) {
+	/* mularsky [-u <imu tty>] [-m ndof|acc|amg] [-r <acc range>] [-b <acc bandwidth>] [-p] [-t <telemetry target>] [-T <trace file>]
+	           [-g <gps tty>] [-I <rotation interval [s]>] [-S <rotation size [MB]>] [<output dir>] */
+	struct m_imu_params imu_params = { .uart_path = NULL, .mode = "ndof", .acc_range = 4, .acc_bandwidth = 500 };
+	struct m_pressure_params pressure_params = { .raw = false };
+	char const * telemetry_target = NULL;
+	char const * gps_path = NULL;
+	bool bad_args = false;
+	struct m_rotate_params rotate_params = { .interval_s = 0, .max_bytes = 0, .simulated_time = false };
+	int opt;
+	while ((opt = getopt(argc, argv, "u:m:r:b:pt:T:g:I:S:")) != -1) {
+		switch (opt) {
+		case 'u':
+			imu_params.uart_path = optarg;
+			break;
+		case 'm':
+			imu_params.mode = optarg;
+			break;
+		case 'r':
+			imu_params.acc_range = atoi(optarg);
+			break;
+		case 'b':
+			imu_params.acc_bandwidth = atoi(optarg);
+			break;
+		case 'p':
+			pressure_params.raw = true;
+			break;
+		case 't':
+			telemetry_target = optarg;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		case 'g':
+			gps_path = optarg;
+			run_gps = true;
+			break;
+		case 'I':
+		case 'S':
+			if (-1 == m_rotate_parse_option(opt, optarg, &rotate_params)) {
+				bad_args = true;
+			}
+			break;
+		default:
+			bad_args = true;
+			break;
+		}
+	}
+	if (bad_args || optind < argc - 1) {
+		fprintf(stderr, "usage: %s [-u <imu tty>] [-m ndof|acc|amg] [-r <acc range [g]>] [-b <acc bandwidth [Hz]>] [-p] [-t udp:<host>:<port>|unix:<path>] [-T <trace file>] [-g <gps tty>] [-I <rotation interval [s]>] [-S <rotation size [MB]>] [<output dir>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (optind == argc - 1) {
+		fprintf(stderr, "%s: checking path %s\n", argv[0], argv[optind]);
+		if (0 != access(argv[optind], X_OK | W_OK)) {
 			exit(EXIT_FAILURE);
 		}
-		dir_path = argv[1];
+		dir_path = argv[optind];
+	}
+
+
+	/* Trace is dumped at exit, and on SIGUSR1 to <trace file>.<n>. */
+	if (trace_path) {
+		m_trace_start();
+		m_trace_thread_name("main");
+		signal(SIGUSR1, m_sigusr1_handler);
+	}
+
+
+	/* Live monitoring is optional, collecting data isn't. */
+	if (-1 == m_bus_create()) {
+		fprintf(stderr, "%s:%d: live sample bus is not available\n", __FILE__, __LINE__);
+	} else if (telemetry_target && -1 == m_telemetry_start(telemetry_target)) {
+		fprintf(stderr, "%s:%d: telemetry is not available\n", __FILE__, __LINE__);
 	}
 
 
 	if (dir_path == NULL) {
 		button_out_fd = stderr;
+		i2c_out_fd = stderr;
 	} else {
-		char buffer[64] = { 0 };
-		snprintf(buffer, sizeof (buffer), "%s/%s", dir_path, data_filename);
-		button_out_fd = fopen(buffer, "w");
+		button_out_fd = m_manifest_fopen(dir_path, data_filename);
+		i2c_out_fd = m_manifest_fopen(dir_path, i2c_filename);
 	}
 
+	/* Logs of sensors are rotated on long deployments, see m_rotate.h. */
+	m_rotate_configure(&rotate_params);
+
 	if (run_pressure) {
-		if (-1 == pressure_prepare(dir_path)) {
+		if (-1 == pressure_prepare(dir_path, &pressure_params)) {
 			exit(EXIT_FAILURE);
 		}
 		errno = 0;
@@ -122,7 +269,7 @@ int main(int argc, char ** argv)
 	}
 
 	if (run_imu) {
-		if (-1 == imu_prepare(dir_path)) {
+		if (-1 == imu_prepare(dir_path, &imu_params)) {
 			exit(EXIT_FAILURE);
 		}
 		errno = 0;
@@ -130,10 +277,32 @@ int main(int argc, char ** argv)
 		fprintf(stderr, "imu thread created: %d / %s\n", rv, strerror(errno));
 	}
 
+	if (run_gps) {
+		if (-1 == gps_prepare(dir_path, gps_path)) {
+			exit(EXIT_FAILURE);
+		}
+		int rv = pthread_create(&gps_thread, NULL, gps_thread_fn, NULL);
+		fprintf(stderr, "gps thread created: %d / %s\n", rv, strerror(rv));
+	}
+
 
 
 	int n_button_pressed = 0;
-	for (;;) {
+	int n_trace_dumps = 0;
+	time_t last_i2c_report = time(NULL);
+	while (!exit_requested) {
+
+		if (i2c_out_fd && time(NULL) - last_i2c_report >= M_I2C_REPORT_PERIOD_S) {
+			m_i2c_report(i2c_out_fd, false);
+			last_i2c_report = time(NULL);
+		}
+
+		if (trace_dump_requested) {
+			trace_dump_requested = 0;
+			char path[PATH_MAX];
+			snprintf(path, sizeof (path), "%s.%d", trace_path, ++n_trace_dumps);
+			m_trace_dump(path);
+		}
 
 		if (global_time > BEGINNING_OF_2017) {
 			gps_led_time_ms = BLINK_OK;
@@ -146,6 +315,7 @@ int main(int argc, char ** argv)
 			n_button_pressed = 0;
 		}
 		button_state = !button_state;
+		m_publish_status(button_state);
 		//fprintf(button_out_fd, "button: state = %d, button counter = %d\n", button_state, n_button_pressed);
 
 		digitalWrite(G_GPIO_LED, button_state * HIGH);
@@ -167,7 +337,8 @@ int main(int argc, char ** argv)
 		usleep(USECS_PER_MSEC * off_led_time_ms);
 	}
 
-
+	fprintf(stderr, "\n");
+	cancel_treads = true;
 
 
 	if (run_pressure) {
@@ -182,6 +353,11 @@ int main(int argc, char ** argv)
 		fprintf(stderr, "imu thread joined: %d / %s\n", rv, strerror(errno));
 	}
 
+	if (run_gps) {
+		int rv = pthread_join(gps_thread, NULL);
+		fprintf(stderr, "gps thread joined: %d / %s\n", rv, strerror(rv));
+	}
+
 
         sleep(1);
 
@@ -0,0 +1,132 @@
+#define _DEFAULT_SOURCE /* usleep() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "m_misc.h"
+#include "m_bus.h"
+
+
+
+
+/*
+  Print live data of running mularsky, read from live sample bus.
+
+  mularsky_monitor [-f]
+
+  Without -f the latest status and samples are printed every second.
+  With -f every IMU sample is printed, and samples lost because the
+  monitor couldn't keep up are counted.
+*/
+
+
+
+
+static void print_latest(const struct m_bus * bus)
+{
+	struct m_bus_status status;
+	struct m_bus_imu_sample imu;
+	struct m_bus_pressure_sample pressure;
+	uint64_t n;
+
+	if (0 == m_bus_read_latest(bus, M_BUS_STATUS, &status, sizeof (status), NULL)) {
+		printf("status: pid %d, time %lld, imu %s, pressure %s, gps %s, button %d, dir '%s'\n",
+		       (int) status.pid, (long long) status.global_time,
+		       status.imu_ok ? "ok" : "nok", status.pressure_ok ? "ok" : "nok", status.gps_ok ? "ok" : "nok",
+		       status.button, status.dir);
+	}
+	if (0 == m_bus_read_latest(bus, M_BUS_IMU, &imu, sizeof (imu), &n)) {
+		printf("imu #%llu: acc=%d,%d,%d qua=%d,%d,%d,%d lia=%d,%d,%d temp=%d calib=0x%x\n",
+		       (unsigned long long) n,
+		       imu.acc[0], imu.acc[1], imu.acc[2],
+		       imu.qua[0], imu.qua[1], imu.qua[2], imu.qua[3],
+		       imu.lia[0], imu.lia[1], imu.lia[2],
+		       imu.temp, imu.calib);
+	}
+	if (0 == m_bus_read_latest(bus, M_BUS_PRESSURE, &pressure, sizeof (pressure), &n)) {
+		if (pressure.compensated) {
+			printf("pressure #%llu: %u Pa, %.2f degC, %.1f %%rH\n", (unsigned long long) n,
+			       pressure.pressure, pressure.temperature / 100.0, pressure.humidity / 1024.0);
+		} else {
+			printf("pressure #%llu: raw %u, %u, %u\n", (unsigned long long) n,
+			       pressure.raw_pressure, pressure.raw_temperature, pressure.raw_humidity);
+		}
+	}
+	fflush(stdout);
+
+	return;
+}
+
+
+
+
+static void follow_imu(const struct m_bus * bus)
+{
+	uint64_t next = m_bus_head(bus, M_BUS_IMU);
+	unsigned long long lost = 0;
+
+	for (;;) {
+		struct m_bus_imu_sample imu;
+		int rv = m_bus_read(bus, M_BUS_IMU, next, &imu, sizeof (imu));
+		if (rv == 1) {
+			usleep(5 * USECS_PER_MSEC);
+			continue;
+		}
+		if (rv == -1) {
+			/* Overwritten; skip to the oldest sample still in ring. */
+			const uint64_t head = m_bus_head(bus, M_BUS_IMU);
+			const uint64_t oldest = head > M_BUS_SLOTS / 2 ? head - M_BUS_SLOTS / 2 : 0;
+			lost += oldest - next;
+			next = oldest;
+			continue;
+		}
+		printf("%llu.%09llu #%llu: acc=%d,%d,%d lia=%d,%d,%d rep=%u lost=%llu\n",
+		       (unsigned long long) (imu.timestamp_ns / NSECS_PER_SEC), (unsigned long long) (imu.timestamp_ns % NSECS_PER_SEC),
+		       (unsigned long long) next,
+		       imu.acc[0], imu.acc[1], imu.acc[2],
+		       imu.lia[0], imu.lia[1], imu.lia[2],
+		       imu.repeats, lost);
+		next++;
+	}
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	bool follow = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "f")) != -1) {
+		switch (opt) {
+		case 'f':
+			follow = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	const struct m_bus * bus = m_bus_attach();
+	if (!bus) {
+		fprintf(stderr, "%s: mularsky is not running (no %s)\n", argv[0], M_BUS_NAME);
+		exit(EXIT_FAILURE);
+	}
+
+	if (follow) {
+		follow_imu(bus);
+	}
+	for (;;) {
+		print_latest(bus);
+		sleep(1);
+	}
+
+	m_bus_detach(bus);
+
+	return 0;
+}
@@ -96,12 +96,13 @@ uint32_t bme280_compensate_pressure_int32(int32_t p, struct m_bme280_compensatio
 		} else {
 			return 0;
 		}
-
-		v_x1_u32 = (((int32_t) c->dig_P9) * ((int32_t) (((v_pressure_u32 >> 03) * (v_pressure_u32 >> 03))))) >> 12;
-		v_x2_u32 = (((int32_t) (v_pressure_u32 >> 02)) * ((int32_t) c->dig_P8)) >> 13;
-		v_pressure_u32 = (uint32_t) ((int32_t)v_pressure_u32 + ((v_x1_u32 + v_x2_u32 + c->dig_P7) >> 04));
 	}
 
+	/* Chapter 8.2: this correction is applied in both cases. */
+	v_x1_u32 = (((int32_t) c->dig_P9) * ((int32_t) (((v_pressure_u32 >> 03) * (v_pressure_u32 >> 03)) >> 13))) >> 12;
+	v_x2_u32 = (((int32_t) (v_pressure_u32 >> 02)) * ((int32_t) c->dig_P8)) >> 13;
+	v_pressure_u32 = (uint32_t) ((int32_t)v_pressure_u32 + ((v_x1_u32 + v_x2_u32 + c->dig_P7) >> 04));
+
 	return v_pressure_u32;
 }
 
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE /* recvmmsg() */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "m_misc.h"
+#include "m_bus.h"
+#include "m_telemetry.h"
+
+
+
+
+/*
+  Reference receiver of telemetry of mularsky (see m_telemetry.h).
+
+  mularsky_receiver [-v] udp:<host>:<port>|unix:<path>
+
+  Every second prints number of samples received per stream, and
+  number of frames and samples missed (dropped by sender or lost in
+  transit). With -v every sample of IMU and pressure is printed.
+*/
+
+
+
+
+#define BATCH 32
+
+
+
+
+static const char * stream_names[M_BUS_STREAMS] = { "imu", "pressure", "status" };
+
+
+
+
+struct stream_stats {
+	bool started;
+	uint64_t next;              /* Expected number of next sample. */
+	unsigned long samples;
+	unsigned long missed;
+};
+
+
+
+
+static void print_sample(int stream, uint64_t number, const unsigned char * data)
+{
+	if (stream == M_BUS_IMU) {
+		struct m_bus_imu_sample s;
+		memcpy(&s, data, sizeof (s));
+		printf("imu #%llu @%llu.%09llu: acc=%d,%d,%d qua=%d,%d,%d,%d lia=%d,%d,%d\n",
+		       (unsigned long long) number,
+		       (unsigned long long) (s.timestamp_ns / NSECS_PER_SEC), (unsigned long long) (s.timestamp_ns % NSECS_PER_SEC),
+		       s.acc[0], s.acc[1], s.acc[2],
+		       s.qua[0], s.qua[1], s.qua[2], s.qua[3],
+		       s.lia[0], s.lia[1], s.lia[2]);
+	} else if (stream == M_BUS_PRESSURE) {
+		struct m_bus_pressure_sample s;
+		memcpy(&s, data, sizeof (s));
+		printf("pressure #%llu @%llu: %u Pa, raw %u, %u, %u\n",
+		       (unsigned long long) number, (unsigned long long) (s.timestamp_ns / NSECS_PER_SEC),
+		       s.pressure, s.raw_pressure, s.raw_temperature, s.raw_humidity);
+	}
+
+	return;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	bool verbose = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-v] udp:<host>:<port>|unix:<path>\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-v] udp:<host>:<port>|unix:<path>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	struct sockaddr_storage address;
+	socklen_t length;
+	if (-1 == m_telemetry_address(argv[optind], &address, &length)) {
+		exit(EXIT_FAILURE);
+	}
+	int fd = socket(address.ss_family, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		fprintf(stderr, "%s:%d: failed to create socket: %s\n", __FILE__, __LINE__, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (address.ss_family == AF_UNIX) {
+		unlink(((struct sockaddr_un *) &address)->sun_path);
+	}
+	if (-1 == bind(fd, (struct sockaddr *) &address, length)) {
+		fprintf(stderr, "%s:%d: failed to bind %s: %s\n", __FILE__, __LINE__, argv[optind], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	static unsigned char frames[BATCH][M_TELEMETRY_FRAME_MAX];
+	struct mmsghdr msgs[BATCH];
+	struct iovec iovs[BATCH];
+	memset(msgs, 0, sizeof (msgs));
+	for (int i = 0; i < BATCH; i++) {
+		iovs[i].iov_base = frames[i];
+		iovs[i].iov_len = sizeof (frames[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	struct stream_stats stats[M_BUS_STREAMS];
+	memset(stats, 0, sizeof (stats));
+	bool have_sequence = false;
+	uint32_t next_sequence = 0;
+	unsigned long frames_missed = 0;
+	unsigned long n_invalid = 0;
+	time_t last_report = time(NULL);
+
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		if (poll(&pfd, 1, 1000) > 0) {
+			int n = recvmmsg(fd, msgs, BATCH, MSG_DONTWAIT, NULL);
+			for (int i = 0; i < n; i++) {
+				const struct m_telemetry_header * header = (const struct m_telemetry_header *) frames[i];
+				if (msgs[i].msg_len < sizeof (struct m_telemetry_header)
+				    || 0 != memcmp(header->magic, M_TELEMETRY_MAGIC, sizeof (header->magic))
+				    || header->version != M_TELEMETRY_VERSION
+				    || header->stream >= M_BUS_STREAMS
+				    || msgs[i].msg_len != sizeof (struct m_telemetry_header) + (size_t) header->n_samples * header->sample_size) {
+					n_invalid++;
+					continue;
+				}
+
+				if (have_sequence && header->sequence != next_sequence) {
+					frames_missed += header->sequence - next_sequence;
+				}
+				next_sequence = header->sequence + 1;
+				have_sequence = true;
+
+				struct stream_stats * s = &stats[header->stream];
+				if (s->started && header->first_number > s->next) {
+					s->missed += header->first_number - s->next;
+				}
+				s->started = true;
+				s->next = header->first_number + header->n_samples;
+				s->samples += header->n_samples;
+
+				if (verbose) {
+					const unsigned char * data = (const unsigned char *) (header + 1);
+					for (int k = 0; k < header->n_samples; k++) {
+						print_sample(header->stream, header->first_number + k, data + k * header->sample_size);
+					}
+				}
+			}
+		}
+
+		time_t now = time(NULL);
+		if (now != last_report) {
+			for (int i = 0; i < M_BUS_STREAMS; i++) {
+				printf("%s: %lu samples (%lu missed); ", stream_names[i], stats[i].samples, stats[i].missed);
+			}
+			printf("frames missed: %lu, invalid: %lu\n", frames_missed, n_invalid);
+			fflush(stdout);
+			last_report = now;
+		}
+	}
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,643 @@
+#define _GNU_SOURCE /* clock_nanosleep(), realpath() */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include "m_bme280.h"
+#include "m_bno055.h"
+#include "m_misc.h"
+#include "m_time.h"
+#include "m_manifest.h"
+#include "m_bus.h"
+#include "m_telemetry.h"
+#include "m_trace.h"
+#include "m_rotate.h"
+
+
+
+
+/*
+  Replay a recorded session through the pipeline of mularsky.
+
+  mularsky_replay [-s <speed>] [-b] [-t <telemetry target>] [-p] [-T <trace file>] [-z <ts_shift>] [-I <seconds>] [-S <MB>] <session dir> <output dir>
+
+  Samples of imu.txt and pressure.txt are converted back into chip
+  registers and go through the same decoding, writing (with manifest)
+  and publishing on live sample bus as samples read from the chips.
+  Lines of nmea.txt are copied, from the first RMC sentence on (time
+  of earlier sentences is unknown). Output files of the replay are
+  written to output dir, so they can be compared with the input.
+
+  Times of NMEA sentences are UTC, while imu.txt and pressure.txt
+  have time of device's clock. ts_shift (hours by which the device's
+  clock is ahead of UTC, as in splitter's config.txt) is read from
+  config.txt in session dir, or given with -z.
+
+  Samples are fed on a simulated clock, taken from their timestamps
+  (samples logged within one second are spread evenly over it).
+  Speed 1 is real time, N is N times faster, 0 (default) is as fast
+  as possible.
+
+  -b publishes samples on live sample bus (-t implies it), so that
+  mularsky_monitor and telemetry see the replay. The bus keeps only
+  M_BUS_SLOTS samples per stream, so at high speeds (more than about
+  that many IMU samples per telemetry period) consumers of the bus
+  lose samples, as they would with a sensor that fast. -p stores
+  only raw pressure values, as mularsky -p does. -T records trace of
+  decoding and writing (see m_trace.h) and dumps it at the end. -I
+  and -S rotate output logs as mularsky does (see m_rotate.h), on
+  the simulated clock. Input session must have plain logs; rotated
+  ones are joined with m_joiner (sw/pc/joiner) first.
+
+  Doesn't need wiringPi or sensors, so it builds and runs on any
+  Linux machine.
+*/
+
+
+
+
+/* Symbols of main.c of mularsky, used by sensor modules. */
+time_t global_time;
+bool cancel_treads;
+int imu_led_time_ms = BLINK_NOK;
+int pressure_led_time_ms = BLINK_NOK;
+
+
+#define LINE_SIZE          512
+#define LINES_PER_SECOND   4096  /* Max. lines of one stream logged within one second. */
+
+enum { STREAM_IMU, STREAM_PRESSURE, STREAM_NMEA, STREAMS };
+
+
+
+
+/*
+  Input file with lines of samples grouped by second of their
+  timestamps.
+*/
+struct stream {
+	const char * name;
+	FILE * in;
+	bool eof;
+
+	char (* lines)[LINE_SIZE];  /* Sample lines of current second. */
+	int n_lines;
+	int next;
+	time_t second;
+
+	char pending[LINE_SIZE];    /* First line of next second. */
+	time_t pending_second;
+	bool have_pending;
+
+	/* For NMEA, whose time of day is in sentences. */
+	time_t day;                 /* Epoch of midnight of day from last RMC, 0 before first RMC. */
+	time_t last_second;
+	int offset;                 /* Seconds by which device's clock is ahead of UTC (ts_shift). */
+
+	unsigned long n_samples;
+	unsigned long n_skipped;    /* Lines that aren't samples. */
+};
+
+
+
+
+static int replay_nmea_field(const char * line, int n, char * out, size_t size)
+{
+	const char * p = line;
+	for (int i = 0; i < n; i++) {
+		p = strchr(p, ',');
+		if (!p) {
+			return -1;
+		}
+		p++;
+	}
+	size_t len = strcspn(p, ",*\r\n");
+	if (len == 0 || len >= size) {
+		return -1;
+	}
+	memcpy(out, p, len);
+	out[len] = '\0';
+
+	return 0;
+}
+
+
+
+
+/*
+  Get second of timestamp of sample line.
+
+  Returns 0 for sample lines, -1 for other lines.
+*/
+static int replay_line_second(struct stream * stream, const char * line, time_t * second)
+{
+	unsigned long ts;
+	if (stream == NULL) {
+		return -1;
+	}
+
+	if (0 == strcmp(stream->name, "imu")) {
+		if (1 == sscanf(line, "imu@%lu:acc=", &ts) && strstr(line, ":acc=")) {
+			*second = ts;
+			return 0;
+		}
+		return -1;
+	}
+	if (0 == strcmp(stream->name, "pressure")) {
+		int n = 0;
+		if (1 == sscanf(line, "pressure@%lu: %*u,%n", &ts, &n) && n > 0) {
+			*second = ts;
+			return 0;
+		}
+		return -1;
+	}
+
+	/* NMEA: RMC has date and time, GGA has time, other sentences
+	   inherit time of previous sentence. Sentences before first
+	   RMC have no known time, and are skipped. Times are UTC,
+	   shifted to device's clock of other logs. */
+	if (line[0] != '$') {
+		return -1;
+	}
+	char field[16];
+	const bool rmc = 0 == strncmp(line + 3, "RMC", 3);
+	const bool gga = 0 == strncmp(line + 3, "GGA", 3);
+	if (rmc && 0 == replay_nmea_field(line, 9, field, sizeof (field)) && strlen(field) == 6) {
+		struct tm tm;
+		memset(&tm, 0, sizeof (tm));
+		tm.tm_mday = (field[0] - '0') * 10 + (field[1] - '0');
+		tm.tm_mon = (field[2] - '0') * 10 + (field[3] - '0') - 1;
+		tm.tm_year = (field[4] - '0') * 10 + (field[5] - '0') + 100;
+		stream->day = timegm(&tm);
+	}
+	if ((rmc || gga) && stream->day && 0 == replay_nmea_field(line, 1, field, sizeof (field)) && strlen(field) >= 6) {
+		const int hh = (field[0] - '0') * 10 + (field[1] - '0');
+		const int mm = (field[2] - '0') * 10 + (field[3] - '0');
+		const int ss = (field[4] - '0') * 10 + (field[5] - '0');
+		stream->last_second = stream->day + hh * 3600 + mm * 60 + ss + stream->offset;
+	}
+	if (!stream->day) {
+		return -1;
+	}
+	*second = stream->last_second;
+
+	return 0;
+}
+
+
+
+
+/*
+  Read lines of next second of stream. Returns number of lines, 0 at
+  end of file.
+*/
+static int replay_fill(struct stream * stream)
+{
+	stream->n_lines = 0;
+	stream->next = 0;
+
+	if (stream->have_pending) {
+		memcpy(stream->lines[stream->n_lines++], stream->pending, LINE_SIZE);
+		stream->second = stream->pending_second;
+		stream->have_pending = false;
+	}
+
+	char line[LINE_SIZE];
+	while (!stream->eof) {
+		if (!fgets(line, sizeof (line), stream->in)) {
+			stream->eof = true;
+			break;
+		}
+		time_t second;
+		if (0 != replay_line_second(stream, line, &second)) {
+			stream->n_skipped++;
+			continue;
+		}
+		if (stream->n_lines == 0) {
+			stream->second = second;
+		} else if (second != stream->second || stream->n_lines == LINES_PER_SECOND) {
+			memcpy(stream->pending, line, LINE_SIZE);
+			stream->pending_second = second;
+			stream->have_pending = true;
+			break;
+		}
+		memcpy(stream->lines[stream->n_lines++], line, LINE_SIZE);
+	}
+
+	return stream->n_lines;
+}
+
+
+
+
+/* Simulated time of next sample of stream [ns], -1 at end. */
+static int64_t replay_next_time(struct stream * stream)
+{
+	if (!stream->in) {
+		return -1;
+	}
+	if (stream->next == stream->n_lines && 0 == replay_fill(stream)) {
+		return -1;
+	}
+	return stream->second * NSECS_PER_SEC + (int64_t) NSECS_PER_SEC * stream->next / stream->n_lines;
+}
+
+
+
+
+static void replay_put_le16(uint8_t * buffer, int value)
+{
+	buffer[0] = value & 0xff;
+	buffer[1] = (value >> 8) & 0xff;
+}
+
+
+
+
+/* Registers of BNO055 from line of imu.txt. */
+static int replay_imu(const char * line)
+{
+	unsigned long ts;
+	int v[23];
+	unsigned int calib;
+	int n = 0;
+	if (25 != sscanf(line, "imu@%lu:acc=%d,%d,%d mag=%d,%d,%d gyr=%d,%d,%d eul=%d,%d,%d qua=%d,%d,%d,%d lia=%d,%d,%d grv=%d,%d,%d temp=%d calib=0x%x%n",
+			 &ts, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8],
+			 &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15],
+			 &v[16], &v[17], &v[18], &v[19], &v[20], &v[21], &v[22], &calib, &n) || n == 0) {
+		return -1;
+	}
+	unsigned int repeats = 0;
+	sscanf(line + n, " rep=%u", &repeats);
+
+	/* Euler angles are logged in degrees, registers are in 1/16 deg. */
+	for (int i = 9; i < 12; i++) {
+		v[i] *= 16;
+	}
+
+	uint8_t buffer[M_IMU_REPLAY_DATA_SIZE];
+	for (int i = 0; i < 22; i++) {
+		replay_put_le16(buffer + 2 * i, v[i]);
+	}
+	buffer[44] = (uint8_t) (int8_t) v[22];
+	buffer[45] = calib;
+
+	imu_replay_sample(buffer, repeats);
+
+	return 0;
+}
+
+
+
+
+/* Registers of BME280 from line of pressure.txt. */
+static int replay_pressure(const char * line)
+{
+	unsigned long ts;
+	unsigned int v[6];
+	int n = 0;
+	unsigned int raw_pressure, raw_temperature, raw_humidity;
+	int r = sscanf(line, "pressure@%lu: %u, %u, %u, %u, %u, %u%n", &ts, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &n);
+	if (r == 7) {
+		raw_pressure = v[0];
+		raw_temperature = v[2];
+		raw_humidity = v[4];
+	} else if (4 == sscanf(line, "pressure@%lu: %u, %u, %u%n", &ts, &v[0], &v[1], &v[2], &n)) {
+		raw_pressure = v[0];
+		raw_temperature = v[1];
+		raw_humidity = v[2];
+	} else {
+		return -1;
+	}
+	unsigned int repeats = 0;
+	sscanf(line + n, " rep=%u", &repeats);
+
+	/* Chapter 4 of datasheet: 20-bit pressure and temperature,
+	   16-bit humidity, MSB first. */
+	uint8_t buffer[M_PRESSURE_REPLAY_DATA_SIZE];
+	buffer[0] = raw_pressure >> 12;
+	buffer[1] = raw_pressure >> 4;
+	buffer[2] = (raw_pressure & 0x0f) << 4;
+	buffer[3] = raw_temperature >> 12;
+	buffer[4] = raw_temperature >> 4;
+	buffer[5] = (raw_temperature & 0x0f) << 4;
+	buffer[6] = raw_humidity >> 8;
+	buffer[7] = raw_humidity;
+
+	pressure_replay_sample(buffer, repeats);
+
+	return 0;
+}
+
+
+
+
+/*
+  Find compensation registers in header of pressure.txt: in
+  "pressure calibration: <hex>" line, or in "compensation data byte"
+  lines of older logs.
+
+  Returns 0 if found.
+*/
+static int replay_find_calibration(FILE * in, uint8_t * calibration)
+{
+	char line[LINE_SIZE];
+	bool found[M_PRESSURE_CALIBRATION_SIZE] = { false };
+	int n_found = 0;
+
+	for (int l = 0; l < 1000 && fgets(line, sizeof (line), in); l++) {
+		if (0 == strncmp(line, "pressure calibration: ", 22)) {
+			const char * hex = line + 22;
+			int i = 0;
+			for (; i < M_PRESSURE_CALIBRATION_SIZE; i++) {
+				unsigned int byte;
+				if (1 != sscanf(hex + 2 * i, "%2x", &byte)) {
+					break;
+				}
+				calibration[i] = byte;
+			}
+			if (i == M_PRESSURE_CALIBRATION_SIZE) {
+				rewind(in);
+				return 0;
+			}
+		}
+
+		int i;
+		unsigned int byte;
+		if (2 == sscanf(line, "compensation data byte %d: 0x%x", &i, &byte) && i >= 0 && i < M_PRESSURE_CALIBRATION_SIZE) {
+			calibration[i] = byte;
+			if (!found[i]) {
+				found[i] = true;
+				n_found++;
+			}
+		}
+	}
+	rewind(in);
+
+	return n_found == M_PRESSURE_CALIBRATION_SIZE ? 0 : -1;
+}
+
+
+
+
+/*
+  Read ts_shift (hours by which device's clock is ahead of GPS's
+  UTC) from config.txt of splitter in session dir, if there is one.
+*/
+static void replay_read_ts_shift(const char * dir, int * ts_shift)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof (path), "%s/config.txt", dir);
+	FILE * in = fopen(path, "r");
+	if (!in) {
+		return;
+	}
+	char line[LINE_SIZE];
+	while (fgets(line, sizeof (line), in)) {
+		int value;
+		if (1 == sscanf(line, "ts_shift,%d", &value)) {
+			*ts_shift = value;
+		}
+	}
+	fclose(in);
+
+	return;
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	double speed = 0.0;
+	bool use_bus = false;
+	char const * telemetry_target = NULL;
+	struct m_pressure_params pressure_params = { .raw = false };
+	char const * trace_path = NULL;
+	struct m_rotate_params rotate_params = { .interval_s = 0, .max_bytes = 0, .simulated_time = true };
+	int ts_shift = 0;
+	bool have_ts_shift = false;
+	bool bad_args = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:bt:pT:z:I:S:")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'b':
+			use_bus = true;
+			break;
+		case 't':
+			telemetry_target = optarg;
+			use_bus = true;
+			break;
+		case 'p':
+			pressure_params.raw = true;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		case 'z':
+			ts_shift = atoi(optarg);
+			have_ts_shift = true;
+			break;
+		case 'I':
+		case 'S':
+			if (-1 == m_rotate_parse_option(opt, optarg, &rotate_params)) {
+				bad_args = true;
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s <speed>] [-b] [-t udp:<host>:<port>|unix:<path>] [-p] [-T <trace file>] [-z <ts_shift>] [-I <seconds>] [-S <MB>] <session dir> <output dir>\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 2 || speed < 0.0 || bad_args) {
+		fprintf(stderr, "usage: %s [-s <speed>] [-b] [-t udp:<host>:<port>|unix:<path>] [-p] [-T <trace file>] [-z <ts_shift>] [-I <seconds>] [-S <MB>] <session dir> <output dir>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	const char * in_dir = argv[optind];
+	const char * out_dir = argv[optind + 1];
+
+	char in_real[PATH_MAX];
+	char out_real[PATH_MAX];
+	if (!realpath(in_dir, in_real) || !realpath(out_dir, out_real)) {
+		fprintf(stderr, "%s:%d: invalid dir: %s\n", __FILE__, __LINE__, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (0 == strcmp(in_real, out_real)) {
+		fprintf(stderr, "%s:%d: output dir must be different from session dir\n", __FILE__, __LINE__);
+		exit(EXIT_FAILURE);
+	}
+
+
+	if (!have_ts_shift) {
+		replay_read_ts_shift(in_dir, &ts_shift);
+	}
+	struct stream streams[STREAMS] = {
+		[STREAM_IMU] = { .name = "imu" },
+		[STREAM_PRESSURE] = { .name = "pressure" },
+		[STREAM_NMEA] = { .name = "nmea", .offset = ts_shift * 3600 },
+	};
+	for (int i = 0; i < STREAMS; i++) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof (path), "%s/%s.txt", in_dir, streams[i].name);
+		streams[i].in = fopen(path, "r");
+		if (!streams[i].in) {
+			fprintf(stderr, "replay: no %s, skipping\n", path);
+			continue;
+		}
+		streams[i].lines = malloc(LINES_PER_SECOND * sizeof (streams[i].lines[0]));
+		if (!streams[i].lines) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!streams[STREAM_IMU].in && !streams[STREAM_PRESSURE].in && !streams[STREAM_NMEA].in) {
+		fprintf(stderr, "%s:%d: no logs in %s\n", __FILE__, __LINE__, in_dir);
+		exit(EXIT_FAILURE);
+	}
+
+
+	if (trace_path) {
+		m_trace_start();
+		m_trace_thread_name("replay");
+	}
+
+	/* Same stages as in mularsky. */
+	m_rotate_configure(&rotate_params);
+	if (use_bus) {
+		if (-1 == m_bus_create()) {
+			exit(EXIT_FAILURE);
+		}
+		if (telemetry_target && -1 == m_telemetry_start(telemetry_target)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (streams[STREAM_IMU].in && -1 == imu_replay_prepare(out_dir)) {
+		exit(EXIT_FAILURE);
+	}
+	if (streams[STREAM_PRESSURE].in) {
+		uint8_t calibration[M_PRESSURE_CALIBRATION_SIZE];
+		const bool have_calibration = 0 == replay_find_calibration(streams[STREAM_PRESSURE].in, calibration);
+		if (!have_calibration && !pressure_params.raw) {
+			fprintf(stderr, "replay: no calibration of pressure sensor, storing raw values\n");
+		}
+		if (-1 == pressure_replay_prepare(out_dir, &pressure_params, have_calibration ? calibration : NULL)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	FILE * nmea_out = NULL;
+	struct m_rotate_log * nmea_log = NULL;
+	if (streams[STREAM_NMEA].in) {
+		nmea_log = m_rotate_open(out_dir, "nmea.txt", &nmea_out);
+		if (!nmea_log) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	imu_led_time_ms = BLINK_OK;
+	pressure_led_time_ms = BLINK_OK;
+
+
+	/* Merge streams in order of simulated time. */
+	struct timespec wall_start;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	int64_t sim_start = -1;
+	int64_t sim_end = 0;
+	int64_t max_lag_ns = 0;
+	unsigned long n_bad = 0;
+
+	for (;;) {
+		int s = -1;
+		int64_t t = -1;
+		for (int i = 0; i < STREAMS; i++) {
+			int64_t ti = replay_next_time(&streams[i]);
+			if (ti != -1 && (s == -1 || ti < t)) {
+				s = i;
+				t = ti;
+			}
+		}
+		if (s == -1) {
+			break;
+		}
+		if (sim_start == -1) {
+			sim_start = t;
+		}
+		sim_end = t;
+
+		if (speed > 0.0) {
+			struct timespec deadline = wall_start;
+			m_timespec_add_us(&deadline, (long) ((t - sim_start) / speed / NSECS_PER_USEC));
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (m_timespec_cmp(&now, &deadline) > 0) {
+				const int64_t lag = (now.tv_sec - deadline.tv_sec) * NSECS_PER_SEC + (now.tv_nsec - deadline.tv_nsec);
+				if (lag > max_lag_ns) {
+					max_lag_ns = lag;
+				}
+			} else {
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+			}
+		}
+
+		struct stream * stream = &streams[s];
+		const char * line = stream->lines[stream->next++];
+		global_time = t / NSECS_PER_SEC;
+
+		int rv = 0;
+		if (s == STREAM_IMU) {
+			rv = replay_imu(line);
+		} else if (s == STREAM_PRESSURE) {
+			rv = replay_pressure(line);
+		} else {
+			rv = EOF == fputs(line, nmea_out) ? -1 : 0;
+			m_rotate_check(nmea_log, &nmea_out);
+		}
+		if (rv == 0) {
+			stream->n_samples++;
+		} else {
+			n_bad++;
+		}
+	}
+
+	struct timespec wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+
+	imu_replay_finish();
+	pressure_replay_finish();
+	m_rotate_close(nmea_log, &nmea_out);
+	m_rotate_finish();
+	m_manifest_write(out_dir);
+	m_telemetry_stop();
+	m_bus_destroy();
+	if (trace_path) {
+		m_trace_dump(trace_path);
+	}
+
+	const double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	const double sim = sim_start == -1 ? 0.0 : (sim_end - sim_start) / 1e9;
+	unsigned long total = 0;
+	for (int i = 0; i < STREAMS; i++) {
+		if (streams[i].in) {
+			fprintf(stderr, "replay: %s: %lu samples, %lu other lines\n", streams[i].name, streams[i].n_samples, streams[i].n_skipped);
+			fclose(streams[i].in);
+		}
+		total += streams[i].n_samples;
+		free(streams[i].lines);
+	}
+	fprintf(stderr, "replay: %.1f s of session in %.3f s (%.1fx real time), %.0f samples/s, %lu bad lines\n",
+		sim, wall, wall > 0 ? sim / wall : 0.0, wall > 0 ? total / wall : 0.0, n_bad);
+	if (speed > 0.0) {
+		fprintf(stderr, "replay: max. lag behind simulated clock: %.3f ms\n", max_lag_ns / 1e6);
+	}
+
+	return n_bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
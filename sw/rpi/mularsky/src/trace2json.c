@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "m_trace.h"
+
+
+
+
+/*
+  Convert dump of trace of mularsky (see m_trace.h) to Chrome
+  trace-event JSON, for chrome://tracing or ui.perfetto.dev.
+
+  mularsky_trace2json <trace file> [<json file>]
+
+  JSON goes to stdout if no json file is given. Summary of durations
+  of events, per thread, is printed to stderr.
+
+  Timestamps are in microseconds since the first record of the dump.
+  Rings of threads are overwritten from the oldest records, so ends
+  of events whose begin is no longer in the dump are skipped.
+*/
+
+
+
+
+struct event_stats {
+	unsigned long count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t begin_ns;       /* Of currently open event. */
+	bool open;
+	bool instant;
+};
+
+
+
+
+static int read_exact(FILE * file, void * buffer, size_t size, char const * path)
+{
+	if (1 != fread(buffer, size, 1, file)) {
+		fprintf(stderr, "%s:%d: %s is truncated\n", __FILE__, __LINE__, path);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+static void print_json_string(FILE * out, const char * s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', out);
+			fputc(*s, out);
+		} else if ((unsigned char) *s < 0x20) {
+			fprintf(out, "\\u%04x", (unsigned char) *s);
+		} else {
+			fputc(*s, out);
+		}
+	}
+	fputc('"', out);
+}
+
+
+
+
+int main(int argc, char ** argv)
+{
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: %s <trace file> [<json file>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	char const * path = argv[1];
+
+	FILE * in = fopen(path, "r");
+	if (!in) {
+		fprintf(stderr, "%s:%d: failed to open %s: %s\n", __FILE__, __LINE__, path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	FILE * out = stdout;
+	if (argc == 3) {
+		out = fopen(argv[2], "w");
+		if (!out) {
+			fprintf(stderr, "%s:%d: failed to open %s: %s\n", __FILE__, __LINE__, argv[2], strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct m_trace_file_header header;
+	if (-1 == read_exact(in, &header, sizeof (header), path)) {
+		exit(EXIT_FAILURE);
+	}
+	if (0 != memcmp(header.magic, M_TRACE_MAGIC, sizeof (header.magic))
+	    || header.version != M_TRACE_VERSION
+	    || header.record_size != sizeof (struct m_trace_record)
+	    || header.n_events == 0 || header.n_events > 1024) {
+		fprintf(stderr, "%s:%d: %s is not a trace of this version of mularsky\n", __FILE__, __LINE__, path);
+		exit(EXIT_FAILURE);
+	}
+
+	char (* names)[M_TRACE_NAME_SIZE] = calloc(header.n_events, M_TRACE_NAME_SIZE);
+	struct event_stats * stats = calloc(header.n_events, sizeof (struct event_stats));
+	if (!names || !stats) {
+		exit(EXIT_FAILURE);
+	}
+	for (uint32_t i = 0; i < header.n_events; i++) {
+		if (-1 == read_exact(in, names[i], M_TRACE_NAME_SIZE, path)) {
+			exit(EXIT_FAILURE);
+		}
+		names[i][M_TRACE_NAME_SIZE - 1] = '\0';
+	}
+
+	/* Read all threads first: timestamps are relative to the
+	   oldest record of all threads. */
+	struct m_trace_thread_header * threads = calloc(header.n_threads ? header.n_threads : 1, sizeof (struct m_trace_thread_header));
+	struct m_trace_record ** records = calloc(header.n_threads ? header.n_threads : 1, sizeof (struct m_trace_record *));
+	if (!threads || !records) {
+		exit(EXIT_FAILURE);
+	}
+	uint64_t start_ns = UINT64_MAX;
+	for (uint32_t t = 0; t < header.n_threads; t++) {
+		if (-1 == read_exact(in, &threads[t], sizeof (threads[t]), path)) {
+			exit(EXIT_FAILURE);
+		}
+		threads[t].name[sizeof (threads[t].name) - 1] = '\0';
+		if (threads[t].n_records > M_TRACE_RING_RECORDS) {
+			fprintf(stderr, "%s:%d: invalid number of records in %s\n", __FILE__, __LINE__, path);
+			exit(EXIT_FAILURE);
+		}
+		records[t] = malloc((threads[t].n_records ? threads[t].n_records : 1) * sizeof (struct m_trace_record));
+		if (!records[t]) {
+			exit(EXIT_FAILURE);
+		}
+		if (threads[t].n_records && -1 == read_exact(in, records[t], threads[t].n_records * sizeof (struct m_trace_record), path)) {
+			exit(EXIT_FAILURE);
+		}
+		if (threads[t].n_records && records[t][0].timestamp_ns < start_ns) {
+			start_ns = records[t][0].timestamp_ns;
+		}
+	}
+	fclose(in);
+	if (start_ns == UINT64_MAX) {
+		start_ns = 0;
+	}
+
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"realtime_start_ns\":\"%lld\"},\"traceEvents\":[\n",
+		(long long) (start_ns + header.realtime_offset_ns));
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"mularsky\"}}");
+
+	for (uint32_t t = 0; t < header.n_threads; t++) {
+		const uint32_t tid = threads[t].tid;
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", tid);
+		print_json_string(out, threads[t].name);
+		fprintf(out, "}}");
+
+		memset(stats, 0, header.n_events * sizeof (struct event_stats));
+		unsigned long n_orphans = 0;
+
+		for (uint32_t r = 0; r < threads[t].n_records; r++) {
+			const struct m_trace_record * record = &records[t][r];
+			if (record->event >= header.n_events || record->phase > M_TRACE_INSTANT) {
+				n_orphans++;
+				continue;
+			}
+			struct event_stats * s = &stats[record->event];
+			char phase = 'i';
+			if (record->phase == M_TRACE_BEGIN) {
+				phase = 'B';
+				s->begin_ns = record->timestamp_ns;
+				s->open = true;
+			} else if (record->phase == M_TRACE_END) {
+				if (!s->open) {
+					/* Begin has been overwritten. */
+					n_orphans++;
+					continue;
+				}
+				phase = 'E';
+				const uint64_t duration = record->timestamp_ns - s->begin_ns;
+				s->count++;
+				s->total_ns += duration;
+				if (duration > s->max_ns) {
+					s->max_ns = duration;
+				}
+				s->open = false;
+			} else {
+				s->count++;
+				s->instant = true;
+			}
+
+			const uint64_t ts_ns = record->timestamp_ns - start_ns;
+			fprintf(out, ",\n{\"name\":");
+			print_json_string(out, names[record->event]);
+			fprintf(out, ",\"cat\":\"mularsky\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%u",
+				phase, (unsigned long long) (ts_ns / 1000), (unsigned long long) (ts_ns % 1000), tid);
+			if (phase == 'i') {
+				fprintf(out, ",\"s\":\"t\"");
+			}
+			fprintf(out, ",\"args\":{\"arg\":%u}}", record->arg);
+		}
+
+		fprintf(stderr, "thread %s (%u): %u records, %llu overwritten, %lu without begin\n",
+			threads[t].name, tid, threads[t].n_records,
+			(unsigned long long) (threads[t].n_written - threads[t].n_records), n_orphans);
+		for (uint32_t e = 0; e < header.n_events; e++) {
+			if (stats[e].count == 0) {
+				continue;
+			}
+			if (stats[e].instant) {
+				fprintf(stderr, "  %-20s %8lu\n", names[e], stats[e].count);
+			} else {
+				fprintf(stderr, "  %-20s %8lu  mean %10.3f us  max %10.3f us  total %10.3f ms\n",
+					names[e], stats[e].count,
+					stats[e].total_ns / 1e3 / stats[e].count, stats[e].max_ns / 1e3, stats[e].total_ns / 1e6);
+			}
+		}
+		free(records[t]);
+	}
+
+	fprintf(out, "\n]}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	free(records);
+	free(threads);
+	free(stats);
+	free(names);
+
+	return 0;
+}
@@ -54,6 +54,7 @@ mkdir $DIR_NAME
 chmod 0777 $DIR_NAME
 
 stty -F /dev/ttyAMA0 raw 9600 cs8 clocal -cstopb
-cat /dev/ttyAMA0 > $DIR_NAME/nmea.txt &
+# mularsky logs nmea.txt itself (-g), so it's rotated and hashed
+# with other logs; add e.g. "-I 3600" for hourly chunks.
 # tail -f /var/log/auth.log &
-/home/pi/sw/mularsky/mularsky $DIR_NAME &
+/home/pi/sw/mularsky/mularsky -g /dev/ttyAMA0 $DIR_NAME &
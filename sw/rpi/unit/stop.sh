@@ -1,8 +1,6 @@
 #!/bin/sh
 echo "Stopping mularsky service"
 
-sync
-killall -9 cat
 sync
 sleep 1
 /etc/init.d/ntp stop
@@ -12,3 +10,17 @@ sleep 3
 killall -INT mularsky
 sync
 sleep 3
+
+# mularsky writes manifest of its files (nmea.txt included) at exit.
+# Don't wait for a hung one forever, shutdown waits for this script.
+WAIT_S=60
+while pidof mularsky > /dev/null; do
+	if [ $WAIT_S -eq 0 ]; then
+		echo "mularsky didn't exit, killing it"
+		killall -9 mularsky
+		break
+	fi
+	WAIT_S=$((WAIT_S - 1))
+	sleep 1
+done
+sync